@@ -37,12 +37,12 @@ workspace "librw"
 	configurations { "Release", "Debug" }
 	filter { "system:windows" }
 		configurations { "ReleaseStatic" }
-		platforms { "win-x86-null", "win-x86-gl3", "win-x86-d3d9",
-			"win-amd64-null", "win-amd64-gl3", "win-amd64-d3d9" }
+		platforms { "win-x86-null", "win-x86-gl3", "win-x86-d3d9", "win-x86-soft",
+			"win-amd64-null", "win-amd64-gl3", "win-amd64-d3d9", "win-amd64-soft" }
 	filter { "system:linux" }
-		platforms { "linux-x86-null", "linux-x86-gl3",
-		"linux-amd64-null", "linux-amd64-gl3",
-		"linux-arm-null", "linux-arm-gl3",
+		platforms { "linux-x86-null", "linux-x86-gl3", "linux-x86-soft",
+		"linux-amd64-null", "linux-amd64-gl3", "linux-amd64-soft",
+		"linux-arm-null", "linux-arm-gl3", "linux-arm-soft",
 		"ps2" }
 		if _OPTIONS["gfxlib"] == "sdl2" then
 			includedirs { "/usr/include/SDL2" }
@@ -67,6 +67,8 @@ workspace "librw"
 		end
 	filter { "platforms:*d3d9" }
 		defines { "RW_D3D9" }
+	filter { "platforms:*soft" }
+		defines { "RW_SOFT" }
 	filter { "platforms:ps2" }
 		defines { "RW_PS2" }
 		toolset "gcc"
@@ -126,6 +128,15 @@ project "dumprwtree"
 	libdirs { Libdir }
 	links { "librw" }
 
+project "librw_bench"
+	kind "ConsoleApp"
+	targetdir (Bindir)
+	removeplatforms { "*gl3", "*d3d9", "ps2" }
+	files { "tools/bench/*.cpp" }
+	includedirs { "." }
+	libdirs { Libdir }
+	links { "librw" }
+
 function findlibs()
 	filter { "platforms:linux*gl3" }
 		links { "GL" }
@@ -190,7 +201,7 @@ project "playground"
 	characterset ("MBCS")
 	skeltool("playground")
 	entrypoint("WinMainCRTStartup")
-	removeplatforms { "*null" }
+	removeplatforms { "*null", "*soft" }
 	removeplatforms { "ps2" } -- for now
 
 project "imguitest"
@@ -198,7 +209,7 @@ project "imguitest"
 	characterset ("MBCS")
 	skeltool("imguitest")
 	entrypoint("WinMainCRTStartup")
-	removeplatforms { "*null" }
+	removeplatforms { "*null", "*soft" }
 	removeplatforms { "ps2" }
 
 project "lights"
@@ -206,7 +217,7 @@ project "lights"
 	characterset ("MBCS")
 	skeltool("lights")
 	entrypoint("WinMainCRTStartup")
-	removeplatforms { "*null" }
+	removeplatforms { "*null", "*soft" }
 	removeplatforms { "ps2" }
 
 project "subrast"
@@ -214,7 +225,7 @@ project "subrast"
 	characterset ("MBCS")
 	skeltool("subrast")
 	entrypoint("WinMainCRTStartup")
-	removeplatforms { "*null" }
+	removeplatforms { "*null", "*soft" }
 	removeplatforms { "ps2" }
 
 project "camera"
@@ -222,7 +233,7 @@ project "camera"
 	characterset ("MBCS")
 	skeltool("camera")
 	entrypoint("WinMainCRTStartup")
-	removeplatforms { "*null" }
+	removeplatforms { "*null", "*soft" }
 	removeplatforms { "ps2" }
 
 project "im2d"
@@ -230,7 +241,7 @@ project "im2d"
 	characterset ("MBCS")
 	skeltool("im2d")
 	entrypoint("WinMainCRTStartup")
-	removeplatforms { "*null" }
+	removeplatforms { "*null", "*soft" }
 	removeplatforms { "ps2" }
 
 project "im3d"
@@ -238,7 +249,7 @@ project "im3d"
 	characterset ("MBCS")
 	skeltool("im3d")
 	entrypoint("WinMainCRTStartup")
-	removeplatforms { "*null" }
+	removeplatforms { "*null", "*soft" }
 	removeplatforms { "ps2" }
 
 project "ska2anm"
@@ -281,6 +292,6 @@ project "hopalong"
 	characterset ("MBCS")
 	skeltool("hopalong")
 	entrypoint("WinMainCRTStartup")
-	removeplatforms { "*null" }
+	removeplatforms { "*null", "*soft" }
 	removeplatforms { "ps2" }
 
@@ -23,3 +23,5 @@
 #include "src/gl/rwgl3.h"
 #include "src/gl/rwgl3shader.h"
 #include "src/gl/rwgl3plg.h"
+#include "src/soft/rwsoft.h"
+#include "src/soft/rwsoftplg.h"
@@ -5,9 +5,11 @@
 #include "rwbase.h"
 #include "rwerror.h"
 #include "rwplg.h"
+#include "rwrender.h"
 #include "rwpipeline.h"
 #include "rwobjects.h"
 #include "rwengine.h"
+#include "rwsimd.h"
 
 #define PLUGIN_ID ID_CAMERA
 
@@ -22,12 +24,14 @@ defaultBeginUpdateCB(Camera *cam)
 {
 	engine->currentCamera = cam;
 	Frame::syncDirty();
+	FlushImmediate();
 	engine->device.beginUpdate(cam);
 }
 
 void
 defaultEndUpdateCB(Camera *cam)
 {
+	FlushImmediate();
 	engine->device.endUpdate(cam);
 }
 
@@ -259,6 +263,8 @@ worldBeginUpdateCB(Camera *cam)
 {
 	engine->currentWorld = cam->world;
 	cam->originalBeginUpdate(cam);
+	if(cam->world)
+		cam->world->clusterLights(cam);
 }
 
 void
@@ -296,6 +302,7 @@ Camera::create(void)
 
 	cam->frameBuffer = nil;
 	cam->zBuffer = nil;
+	cam->occlusion = nil;
 
 	// clump extension
 	cam->clump = nil;
@@ -331,6 +338,8 @@ Camera::clone(void)
 
 	cam->frameBuffer = this->frameBuffer;
 	cam->zBuffer = this->zBuffer;
+	if(this->occlusion)
+		cam->setOcclusion(this->occlusion->width, this->occlusion->height);
 
 	if(this->world)
 		this->world->addCamera(cam);
@@ -346,13 +355,31 @@ Camera::destroy(void)
 	assert(this->clump == nil);
 	assert(this->world == nil);
 	this->setFrame(nil);
+	if(this->occlusion)
+		this->occlusion->destroy();
 	rwFree(this);
 	numAllocated--;
 }
 
+// Occlusion culling with a width x height depth buffer, 0 turns it off
+void
+Camera::setOcclusion(int32 width, int32 height)
+{
+	if(this->occlusion){
+		if(this->occlusion->width == ((width+3) & ~3) &&
+		   this->occlusion->height == height)
+			return;
+		this->occlusion->destroy();
+		this->occlusion = nil;
+	}
+	if(width > 0 && height > 0)
+		this->occlusion = OcclusionBuffer::create(width, height);
+}
+
 void
 Camera::clear(RGBA *col, uint32 mode)
 {
+	FlushImmediate();
 	engine->device.clearCamera(this, col, mode);
 }
 
@@ -360,6 +387,7 @@ void
 Camera::showRaster(uint32 flags)
 {
 	this->frameBuffer->show(flags);
+	Metrics::endFrame();
 }
 
 void
@@ -439,6 +467,86 @@ Camera::frustumTestSphere(const Sphere *s) const
 	return res;
 }
 
+int32
+Camera::frustumTestBBox(const BBox *box) const
+{
+	V3d c;
+	int32 res = BOXINSIDE;
+	const FrustumPlane *p = this->frustumPlanes;
+	for(int32 i = 0; i < 6; i++){
+		// corner furthest behind the plane
+		c.x = p->closestX ? box->inf.x : box->sup.x;
+		c.y = p->closestY ? box->inf.y : box->sup.y;
+		c.z = p->closestZ ? box->inf.z : box->sup.z;
+		if(dot(p->plane.normal, c) > p->plane.distance)
+			return BOXOUTSIDE;
+		// corner furthest in front of it
+		c.x = p->closestX ? box->sup.x : box->inf.x;
+		c.y = p->closestY ? box->sup.y : box->inf.y;
+		c.z = p->closestZ ? box->sup.z : box->inf.z;
+		if(dot(p->plane.normal, c) > p->plane.distance)
+			res = BOXBOUNDARY;
+		p++;
+	}
+	return res;
+}
+
+// Test n spheres given as separate coordinate arrays.
+// visible[i] is set to 1 if sphere i is not outside the frustum.
+// Returns the number of visible spheres.
+int32
+Camera::frustumTestSpheres(const float32 *x, const float32 *y, const float32 *z,
+	const float32 *radius, uint8 *visible, int32 n) const
+{
+	int32 i, j, numVisible = 0;
+	const FrustumPlane *p;
+#ifdef RW_SSE2
+	__m128 nx[6], ny[6], nz[6], d[6];
+	p = this->frustumPlanes;
+	for(j = 0; j < 6; j++){
+		nx[j] = _mm_set1_ps(p[j].plane.normal.x);
+		ny[j] = _mm_set1_ps(p[j].plane.normal.y);
+		nz[j] = _mm_set1_ps(p[j].plane.normal.z);
+		d[j] = _mm_set1_ps(p[j].plane.distance);
+	}
+	for(i = 0; i+4 <= n; i += 4){
+		__m128 sx = _mm_loadu_ps(&x[i]);
+		__m128 sy = _mm_loadu_ps(&y[i]);
+		__m128 sz = _mm_loadu_ps(&z[i]);
+		__m128 sr = _mm_loadu_ps(&radius[i]);
+		__m128 outside = _mm_setzero_ps();
+		for(j = 0; j < 6; j++){
+			__m128 dist = _mm_mul_ps(nx[j], sx);
+			dist = _mm_add_ps(dist, _mm_mul_ps(ny[j], sy));
+			dist = _mm_add_ps(dist, _mm_mul_ps(nz[j], sz));
+			dist = _mm_sub_ps(dist, d[j]);
+			outside = _mm_or_ps(outside, _mm_cmplt_ps(sr, dist));
+		}
+		int32 mask = _mm_movemask_ps(outside);
+		for(j = 0; j < 4; j++){
+			visible[i+j] = !(mask & (1<<j));
+			numVisible += visible[i+j];
+		}
+	}
+#else
+	i = 0;
+#endif
+	for(; i < n; i++){
+		visible[i] = 1;
+		p = this->frustumPlanes;
+		for(j = 0; j < 6; j++){
+			float32 dist = p[j].plane.normal.x*x[i] + p[j].plane.normal.y*y[i] +
+				p[j].plane.normal.z*z[i] - p[j].plane.distance;
+			if(radius[i] < dist){
+				visible[i] = 0;
+				break;
+			}
+		}
+		numVisible += visible[i];
+	}
+	return numVisible;
+}
+
 struct CameraChunkData
 {
 	V2d viewWindow;
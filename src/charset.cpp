@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 
 #include "rwbase.h"
 #include "rwerror.h"
@@ -12,6 +13,7 @@
 #include "ps2/rwps2.h"
 #include "d3d/rwd3d.h"
 #include "gl/rwgl3.h"
+#include "soft/rwsoft.h"
 
 
 #define PLUGIN_ID 1000	// TODO: find a better ID
@@ -30,35 +32,106 @@ const uint8 fontbits[256*256] = {
 #include "vgafont.inc"
 };
 
-#define NUMCHARS 100
+// Glyphs are collected per raster and drawn by flushBuffer in chunks
+// that fit into one Im2D batch.
+#define DRAWCHARS 1024
+
+struct GlyphBatch
+{
+	Raster *raster;
+	RWDEVICE::Im2DVertex *vertices;
+	int32 numChars;
+	int32 maxChars;
+};
+
+// Vertices of a printed string, kept across frames.
+// The cache is looked up by string, charset, position and hideSpaces.
+struct TextLayout
+{
+	LLLink inLRU;
+	TextLayout *hashNext;
+	uint32 hash;
+	Charset *charset;
+	int32 x, y;
+	bool32 hideSpaces;
+	float32 nearPlane;	// vertices depend on the camera
+	char *str;
+	int32 numChars;
+	RWDEVICE::Im2DVertex *vertices;
+};
+
+#define LAYOUTBUCKETS 4096
+#define MAXLAYOUTS 8192
+
 static uint16 *indices;
-static RWDEVICE::Im2DVertex *vertices;
-static int32 numChars;
-static Raster *lastRaster;
+static GlyphBatch *batches;
+static int32 numBatches, maxBatches;
+static int32 numPending;
+static TextLayout **layoutBuckets;
+static LinkList layoutLRU;	// most recently used first
+static int32 numLayouts;
 
 bool32
 Charset::open(void)
 {
-	if(indices || vertices)
+	int32 i;
+
+	if(indices)
 		return 0;
-	numChars = 0;
-	lastRaster = nil;
-	indices = rwNewT(uint16, NUMCHARS*6, MEMDUR_EVENT);
-	vertices = rwNewT(RWDEVICE::Im2DVertex, NUMCHARS*4, MEMDUR_EVENT);
-	if(indices == nil || vertices == nil){
+	indices = rwNewT(uint16, DRAWCHARS*6, MEMDUR_EVENT);
+	layoutBuckets = rwNewT(TextLayout*, LAYOUTBUCKETS, MEMDUR_EVENT);
+	if(indices == nil || layoutBuckets == nil){
 		close();
 		return 0;
 	}
+	// same quads every time
+	for(i = 0; i < DRAWCHARS; i++){
+		indices[i*6+0] = i*4;
+		indices[i*6+1] = i*4+1;
+		indices[i*6+2] = i*4+2;
+		indices[i*6+3] = i*4+2;
+		indices[i*6+4] = i*4+1;
+		indices[i*6+5] = i*4+3;
+	}
+	memset(layoutBuckets, 0, LAYOUTBUCKETS*sizeof(TextLayout*));
+	layoutLRU.init();
+	numLayouts = 0;
+	batches = nil;
+	numBatches = maxBatches = 0;
+	numPending = 0;
 	return 1;
 }
 
+static void
+removeLayout(TextLayout *l)
+{
+	TextLayout **pp = &layoutBuckets[l->hash % LAYOUTBUCKETS];
+	while(*pp != l)
+		pp = &(*pp)->hashNext;
+	*pp = l->hashNext;
+	l->inLRU.remove();
+	numLayouts--;
+	rwFree(l);
+}
+
 void
 Charset::close(void)
 {
+	int32 i;
+
+	if(layoutBuckets)
+		FORLIST(lnk, layoutLRU)
+			removeLayout(LLLinkGetData(lnk, TextLayout, inLRU));
+	for(i = 0; i < numBatches; i++)
+		rwFree(batches[i].vertices);
+	rwFree(batches);
+	batches = nil;
+	numBatches = maxBatches = 0;
+	numPending = 0;
+	rwFree(layoutBuckets);
+	layoutBuckets = nil;
 	rwFree(indices);
 	indices = nil;
-	rwFree(vertices);
-	vertices = nil;
 }
 
 Charset*
@@ -87,8 +160,16 @@ Charset::create(const RGBA *foreground, const RGBA *background)
 void
 Charset::destroy(void)
 {
-	if(raster)
+	if(raster){
+		flushBuffer();
 		raster->destroy();
+	}
+	if(layoutBuckets)
+		FORLIST(lnk, layoutLRU){
+			TextLayout *l = LLLinkGetData(lnk, TextLayout, inLRU);
+			if(l->charset == this)
+				removeLayout(l);
+		}
 	rwFree(this);
 }
 
@@ -114,62 +195,109 @@ Charset::setColors(const RGBA *foreground, const RGBA *background)
 	img->destroy();
 	if(newRaster == nil)
 		return nil;
-	if(this->raster)
+	if(this->raster){
+		flushBuffer();
 		this->raster->destroy();
+	}
 	this->raster = newRaster;
 	return this;
 }
 
+// Draws everything printed since the last flush,
+// render state is only changed and restored once.
 void
 Charset::flushBuffer(void)
 {
-	if(numChars){
-		rw::SetRenderStatePtr(rw::TEXTURERASTER, lastRaster);
-		rw::SetRenderState(rw::TEXTUREADDRESS, rw::Texture::WRAP);
-		rw::SetRenderState(rw::TEXTUREFILTER, rw::Texture::NEAREST);
-
-		uint32 cull = rw::GetRenderState(rw::CULLMODE);
-		uint32 ztest = rw::GetRenderState(rw::ZTESTENABLE);
-		rw::SetRenderState(rw::CULLMODE, rw::CULLNONE);
-		rw::SetRenderState(rw::ZTESTENABLE, 0);
+	GlyphBatch *b;
+	int32 i, j, n;
 
-		im2d::RenderIndexedPrimitive(rw::PRIMTYPETRILIST,
-			vertices, numChars*4, indices, numChars*6);
+	if(numPending == 0)
+		return;
 
-		rw::SetRenderState(rw::CULLMODE, cull);
-		rw::SetRenderState(rw::ZTESTENABLE, ztest);
+	rw::SetRenderState(rw::TEXTUREADDRESS, rw::Texture::WRAP);
+	rw::SetRenderState(rw::TEXTUREFILTER, rw::Texture::NEAREST);
+	uint32 cull = rw::GetRenderState(rw::CULLMODE);
+	uint32 ztest = rw::GetRenderState(rw::ZTESTENABLE);
+	rw::SetRenderState(rw::CULLMODE, rw::CULLNONE);
+	rw::SetRenderState(rw::ZTESTENABLE, 0);
+
+	for(i = 0; i < numBatches; i++){
+		b = &batches[i];
+		if(b->numChars == 0)
+			continue;
+		rw::SetRenderStatePtr(rw::TEXTURERASTER, b->raster);
+		for(j = 0; j < b->numChars; j += DRAWCHARS){
+			n = b->numChars - j;
+			if(n > DRAWCHARS)
+				n = DRAWCHARS;
+			im2d::RenderIndexedPrimitive(rw::PRIMTYPETRILIST,
+				&b->vertices[j*4], n*4, indices, n*6);
+		}
+		b->numChars = 0;
 	}
 
-	numChars = 0;
-	lastRaster = nil;
+	rw::SetRenderState(rw::CULLMODE, cull);
+	rw::SetRenderState(rw::ZTESTENABLE, ztest);
+	numPending = 0;
+}
+
+// Space for n more glyphs with this raster
+static RWDEVICE::Im2DVertex*
+reserveGlyphs(Raster *raster, int32 n)
+{
+	GlyphBatch *b;
+	int32 i;
+
+	for(i = 0; i < numBatches; i++)
+		if(batches[i].raster == raster)
+			break;
+	if(i == numBatches){
+		// reuse one that has nothing pending
+		for(i = 0; i < numBatches; i++)
+			if(batches[i].numChars == 0)
+				break;
+		if(i == numBatches){
+			if(numBatches >= maxBatches){
+				maxBatches = maxBatches ? maxBatches*2 : 4;
+				batches = rwResizeT(GlyphBatch, batches, maxBatches, MEMDUR_EVENT);
+			}
+			b = &batches[numBatches++];
+			b->vertices = nil;
+			b->maxChars = 0;
+		}
+		b = &batches[i];
+		b->raster = raster;
+		b->numChars = 0;
+	}
+	b = &batches[i];
+	if(b->numChars + n > b->maxChars){
+		b->maxChars = b->maxChars ? b->maxChars*2 : 256;
+		if(b->maxChars < b->numChars + n)
+			b->maxChars = b->numChars + n;
+		b->vertices = rwResizeT(RWDEVICE::Im2DVertex, b->vertices, b->maxChars*4, MEMDUR_EVENT);
+	}
+	RWDEVICE::Im2DVertex *vert = &b->vertices[b->numChars*4];
+	b->numChars += n;
+	numPending += n;
+	return vert;
 }
 
+// The four vertices of a glyph quad
 void
-Charset::printChar(int32 c, int32 x, int32 y)
+Charset::buildChar(void *dst, int32 c, int32 x, int32 y)
 {
 	Camera *cam;
 	float recipZ;
 	float u, v, du, dv;
-	RWDEVICE::Im2DVertex *vert;
-	uint16 *ix;
-
-	if(c >= this->desc.count)
-		return;
-
-	if(this->raster != lastRaster || numChars >= NUMCHARS)
-		flushBuffer();
-	lastRaster = this->raster;
+	RWDEVICE::Im2DVertex *vert = (RWDEVICE::Im2DVertex*)dst;
 
 	cam = (Camera*)engine->currentCamera;
-	vert = &vertices[numChars*4];
-	ix = &indices[numChars*6];
 	recipZ = 1.0f/cam->nearPlane;
 
 	u = ((c % this->desc.tileWidth)*this->desc.width_internal + HALFPX) / (float32)this->raster->width;
 	v = ((c / this->desc.tileWidth)*this->desc.height_internal + HALFPX) / (float32)this->raster->height;
 	du = this->desc.width_internal/(float32)this->raster->width;
 	dv = this->desc.height_internal/(float32)this->raster->height;
-
 	vert->setScreenX((float)x);
 	vert->setScreenY((float)y);
 	vert->setScreenZ(rw::im2d::GetNearZ());
@@ -210,14 +338,6 @@ Charset::printChar(int32 c, int32 x, int32 y)
 	vert->setV(v+dv, recipZ);
 	vert++;
 
-	*ix++ = numChars*4;
-	*ix++ = numChars*4+1;
-	*ix++ = numChars*4+2;
-	*ix++ = numChars*4+2;
-	*ix++ = numChars*4+1;
-	*ix++ = numChars*4+3;
-
-	numChars++;
 }
 
 void
@@ -227,18 +347,101 @@ Charset::print(const char *str, int32 x, int32 y, bool32 hideSpaces)
 	flushBuffer();
 }
 
+static uint32
+hashLayout(const char *str, Charset *charset, int32 x, int32 y, bool32 hideSpaces)
+{
+	// FNV-1a
+	uint32 h = 2166136261u;
+	while(*str)
+		h = (h ^ (uint8)*str++) * 16777619u;
+	h = (h ^ (uint32)(uintptr)charset) * 16777619u;
+	h = (h ^ (uint32)x) * 16777619u;
+	h = (h ^ (uint32)y) * 16777619u;
+	h = (h ^ (uint32)hideSpaces) * 16777619u;
+	return h;
+}
+
+static TextLayout*
+findLayout(uint32 hash, const char *str, Charset *charset, int32 x, int32 y, bool32 hideSpaces)
+{
+	TextLayout *l;
+	for(l = layoutBuckets[hash % LAYOUTBUCKETS]; l; l = l->hashNext)
+		if(l->hash == hash && l->charset == charset &&
+		   l->x == x && l->y == y && l->hideSpaces == hideSpaces &&
+		   strcmp(l->str, str) == 0)
+			return l;
+	return nil;
+}
+
+// Build the glyphs of a string once, later prints of the same
+// string at the same place just copy the vertices.
+TextLayout*
+Charset::makeLayout(uint32 hash, const char *str, int32 x, int32 y, bool32 hideSpaces)
+{
+	TextLayout *l;
+	const char *s;
+	int32 len, n;
+
+	len = strlen(str);
+	n = 0;
+	for(s = str; *s; s++)
+		if((!hideSpaces || *s != ' ') && (uint8)*s < this->desc.count)
+			n++;
+	if(numLayouts >= MAXLAYOUTS)
+		removeLayout(LLLinkGetData(layoutLRU.link.prev, TextLayout, inLRU));
+
+	uint32 sz = sizeof(TextLayout) + n*4*sizeof(RWDEVICE::Im2DVertex) + len+1;
+	l = (TextLayout*)rwMalloc(sz, MEMDUR_EVENT);
+	l->vertices = (RWDEVICE::Im2DVertex*)(l+1);
+	l->str = (char*)&l->vertices[n*4];
+	memcpy(l->str, str, len+1);
+	l->hash = hash;
+	l->charset = this;
+	l->x = x;
+	l->y = y;
+	l->hideSpaces = hideSpaces;
+	l->nearPlane = engine->currentCamera->nearPlane;
+	l->numChars = n;
+	n = 0;
+	for(s = str; *s; s++){
+		if((!hideSpaces || *s != ' ') && (uint8)*s < this->desc.count)
+			this->buildChar(&l->vertices[4*n++], (uint8)*s, x, y);
+		x += this->desc.width;
+	}
+
+	l->hashNext = layoutBuckets[hash % LAYOUTBUCKETS];
+	layoutBuckets[hash % LAYOUTBUCKETS] = l;
+	layoutLRU.add(&l->inLRU);
+	numLayouts++;
+	return l;
+}
+
 void
 Charset::printBuffered(const char *str, int32 x, int32 y, bool32 hideSpaces)
 {
-	while(*str){
-		if(!hideSpaces || *str != ' ')
-			printChar((uint8)*str, x, y);
-		x += this->desc.width;
-		str++;
+	TextLayout *l;
+	uint32 hash;
+
+	// without open() there is nowhere to keep layouts
+	if(layoutBuckets == nil)
+		return;
+	hash = hashLayout(str, this, x, y, hideSpaces);
+	l = findLayout(hash, str, this, x, y, hideSpaces);
+	if(l && l->nearPlane != engine->currentCamera->nearPlane){
+		removeLayout(l);
+		l = nil;
 	}
+	if(l == nil)
+		l = this->makeLayout(hash, str, x, y, hideSpaces);
+	else{
+		l->inLRU.remove();
+		layoutLRU.add(&l->inLRU);
+	}
+	if(l->numChars)
+		memcpy(reserveGlyphs(this->raster, l->numChars), l->vertices,
+			l->numChars*4*sizeof(RWDEVICE::Im2DVertex));
 }
 
 }
 
 #endif
-
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 #include "rwbase.h"
 #include "rwerror.h"
@@ -16,6 +17,7 @@ namespace rw {
 
 int32 Clump::numAllocated;
 int32 Atomic::numAllocated;
+FreeList *Atomic::freeList;
 
 PluginList Clump::s_plglist(sizeof(Clump));
 PluginList Atomic::s_plglist(sizeof(Atomic));
@@ -52,12 +54,14 @@ Clump::clone(void)
 	Clump *clump = Clump::create();
 	Frame *root = this->getFrame()->cloneAndLink();
 	clump->setFrame(root);
+	Atomic::freeList->beginBulk(this->countAtomics());
 	FORLIST(lnk, this->atomics){
 		Atomic *a = Atomic::fromClump(lnk);
 		Atomic *atomic = a->clone();
 		atomic->setFrame(a->getFrame()->root);
 		clump->addAtomic(atomic);
 	}
+	Atomic::freeList->endBulk();
 	this->getFrame()->purgeClone();
 
 	// World extension
@@ -91,7 +95,10 @@ Clump::destroy(void)
 	if(f = this->getFrame(), f)
 		f->destroyHierarchy();
 	assert(this->world == nil);
-	rwFree(this);
+	if(this->object.privateFlags & Object::INSTANCEBLOCK)
+		ClumpPrototype::release(this);
+	else
+		rwFree(this);
 	numAllocated--;
 }
 
@@ -152,6 +159,7 @@ Clump::streamRead(Stream *stream)
 	Clump *clump;
 	int32 numGeometries;
 	Geometry **geometryList;
+	RWTIMER("load clump");
 
 	if(!findChunk(stream, ID_STRUCT, &length, &version)){
 		RWERROR((ERR_CHUNK, "STRUCT"));
@@ -382,22 +390,43 @@ void
 Clump::render(void)
 {
 	Atomic *a;
+	Atomic *batch[Atomic::CULLBATCH];
+	int32 n;
+	Camera *cam = engine->currentCamera;
+
+	if(cam == nil){
+		FORLIST(lnk, this->atomics){
+			a = Atomic::fromClump(lnk);
+			if(a->object.object.flags & Atomic::RENDER)
+				a->render();
+		}
+		return;
+	}
+
+	n = 0;
 	FORLIST(lnk, this->atomics){
-		a = Atomic::fromClump(lnk);
-		if(a->object.object.flags & Atomic::RENDER)
-			a->render();
+		batch[n++] = Atomic::fromClump(lnk);
+		if(n == Atomic::CULLBATCH){
+			Atomic::renderCulled(batch, n, cam, nil);
+			n = 0;
+		}
 	}
+	if(n)
+		Atomic::renderCulled(batch, n, cam, nil);
 }
 
 //
 // Atomic
 //
 
+// The LTM is valid when this is called from Frame::syncDirty,
+// so update the world bounds of all moved atomics right here.
 static void
 atomicSync(ObjectWithFrame *obj)
 {
 	// TODO: interpolate
-	obj->object.privateFlags |= Atomic::WORLDBOUNDDIRTY;
+	Atomic *atomic = (Atomic*)obj;
+	atomic->calculateWorldBounds(&atomic->getFrame()->ltm);
 }
 
 
@@ -406,12 +435,14 @@ worldAtomicSync(ObjectWithFrame *obj)
 {
 	Atomic *atomic = (Atomic*)obj;
 	atomic->originalSync(obj);
+	if(atomic->world)
+		atomic->world->atomicMoved(atomic);
 }
 
 Atomic*
 Atomic::create(void)
 {
-	Atomic *atomic = (Atomic*)rwMalloc(s_plglist.size, MEMDUR_EVENT | ID_ATOMIC);
+	Atomic *atomic = (Atomic*)freeList->alloc();
 	if(atomic == nil){
 		RWERROR((ERR_ALLOC, s_plglist.size));
 		return nil;
@@ -424,6 +455,11 @@ Atomic::create(void)
 	atomic->boundingSphere.radius = 0.0f;
 	atomic->worldBoundingSphere.center.set(0.0f, 0.0f, 0.0f);
 	atomic->worldBoundingSphere.radius = 0.0f;
+	// empty until there is a geometry, world box then comes from the sphere
+	atomic->boundingBox.inf.set(0.0f, 0.0f, 0.0f);
+	atomic->boundingBox.sup.set(-1.0f, -1.0f, -1.0f);
+	atomic->worldBoundingBox.inf.set(0.0f, 0.0f, 0.0f);
+	atomic->worldBoundingBox.sup.set(0.0f, 0.0f, 0.0f);
 	atomic->setFrame(nil);
 	atomic->object.object.privateFlags |= WORLDBOUNDDIRTY;
 	atomic->clump = nil;
@@ -437,6 +473,8 @@ Atomic::create(void)
 	atomic->world = nil;
 	atomic->originalSync = atomic->object.syncCB;
 	atomic->object.syncCB = worldAtomicSync;
+	atomic->sector = nil;
+	atomic->inSector.init();
 
 	s_plglist.construct(atomic);
 	return atomic;
@@ -470,7 +508,10 @@ Atomic::destroy(void)
 	assert(this->clump == nil);
 	assert(this->world == nil);
 	this->setFrame(nil);
-	rwFree(this);
+	if(this->object.object.privateFlags & Object::INSTANCEBLOCK)
+		ClumpPrototype::release(this);
+	else
+		freeList->free(this);
 	numAllocated--;
 }
 
@@ -486,25 +527,125 @@ Atomic::setGeometry(Geometry *geo, uint32 flags)
 		return;
 	if(geo){
 		this->boundingSphere = geo->morphTargets[0].boundingSphere;
+		this->boundingBox = geo->morphTargets[0].boundingBox;
+		this->object.object.privateFlags |= WORLDBOUNDDIRTY;
 		if(this->getFrame())	// TODO: && getWorld???
 			this->getFrame()->updateObjects();
 	}
 }
 
-Sphere*
-Atomic::getWorldBoundingSphere(void)
+// Transform the local bounds by an LTM.
+// The sphere radius is scaled by the longest axis so non-uniform
+// scaling still gives a conservative sphere.
+void
+Atomic::calculateWorldBounds(const Matrix *ltm)
 {
 	Sphere *s = &this->worldBoundingSphere;
-	// TODO: if we ever support morphing, check interpolation
-	if(!this->getFrame()->dirty() &&
-	   (this->object.object.privateFlags & WORLDBOUNDDIRTY) == 0)
-		return s;
-	Matrix *ltm = this->getFrame()->getLTM();
-	// TODO: support scaling
+	BBox *b = &this->worldBoundingBox;
+	float32 sx, sy, sz, smax;
+	V3d c, e, wc, we;
+
 	V3d::transformPoints(&s->center, &this->boundingSphere.center, 1, ltm);
-	s->radius = this->boundingSphere.radius;
+	sx = dot(ltm->right, ltm->right);
+	sy = dot(ltm->up, ltm->up);
+	sz = dot(ltm->at, ltm->at);
+	smax = sx > sy ? sx : sy;
+	smax = smax > sz ? smax : sz;
+	s->radius = this->boundingSphere.radius*sqrtf(smax);
+
+	if(this->boundingBox.inf.x > this->boundingBox.sup.x){
+		we.x = we.y = we.z = s->radius;
+		b->inf = sub(s->center, we);
+		b->sup = add(s->center, we);
+		this->object.object.privateFlags &= ~WORLDBOUNDDIRTY;
+		return;
+	}
+
+	// box is centre and extent, extent goes through abs of the matrix
+	c = scale(add(this->boundingBox.inf, this->boundingBox.sup), 0.5f);
+	e = scale(sub(this->boundingBox.sup, this->boundingBox.inf), 0.5f);
+	V3d::transformPoints(&wc, &c, 1, ltm);
+	we.x = fabsf(ltm->right.x)*e.x + fabsf(ltm->up.x)*e.y + fabsf(ltm->at.x)*e.z;
+	we.y = fabsf(ltm->right.y)*e.x + fabsf(ltm->up.y)*e.y + fabsf(ltm->at.y)*e.z;
+	we.z = fabsf(ltm->right.z)*e.x + fabsf(ltm->up.z)*e.y + fabsf(ltm->at.z)*e.z;
+	b->inf = sub(wc, we);
+	b->sup = add(wc, we);
+
 	this->object.object.privateFlags &= ~WORLDBOUNDDIRTY;
-	return s;
+}
+
+Sphere*
+Atomic::getWorldBoundingSphere(void)
+{
+	// TODO: if we ever support morphing, check interpolation
+	if(this->getFrame()->dirty() ||
+	   this->object.object.privateFlags & WORLDBOUNDDIRTY)
+		this->calculateWorldBounds(this->getFrame()->getLTM());
+	return &this->worldBoundingSphere;
+}
+
+BBox*
+Atomic::getWorldBoundingBox(void)
+{
+	if(this->getFrame()->dirty() ||
+	   this->object.object.privateFlags & WORLDBOUNDDIRTY)
+		this->calculateWorldBounds(this->getFrame()->getLTM());
+	return &this->worldBoundingBox;
+}
+
+// Bounding spheres are gathered into separate arrays so
+// the camera can test several of them at once.
+// Atomics without a frame can't be culled and are kept.
+int32
+Atomic::frustumCull(Atomic **atomics, int32 n, Camera *cam, CullStats *stats)
+{
+	float32 x[CULLBATCH], y[CULLBATCH], z[CULLBATCH], r[CULLBATCH];
+	uint8 visible[CULLBATCH];
+	Atomic *batch[CULLBATCH];
+	int32 i, j, nb, numVisible, numOut;
+	Atomic *a;
+	Sphere *s;
+
+	i = 0;
+	numOut = 0;
+	while(i < n){
+		nb = 0;
+		for(; i < n && nb < CULLBATCH; i++){
+			a = atomics[i];
+			if((a->object.object.flags & RENDER) == 0)
+				continue;
+			if(a->getFrame() == nil){
+				atomics[numOut++] = a;
+				continue;
+			}
+			s = a->getWorldBoundingSphere();
+			x[nb] = s->center.x;
+			y[nb] = s->center.y;
+			z[nb] = s->center.z;
+			r[nb] = s->radius;
+			batch[nb++] = a;
+		}
+		if(nb == 0)
+			continue;
+		numVisible = cam->frustumTestSpheres(x, y, z, r, visible, nb);
+		if(stats){
+			stats->atomicsTested += nb;
+			stats->atomicsCulled += nb - numVisible;
+		}
+		// numOut never overtakes i, so this doesn't clobber unread entries
+		for(j = 0; j < nb; j++)
+			if(visible[j])
+				atomics[numOut++] = batch[j];
+	}
+	return numOut;
+}
+
+void
+Atomic::renderCulled(Atomic **atomics, int32 n, Camera *cam, CullStats *stats)
+{
+	n = frustumCull(atomics, n, cam, stats);
+	for(int32 i = 0; i < n; i++)
+		atomics[i]->render();
 }
 
 static uint32 atomicRights[2];
@@ -627,6 +768,234 @@ Atomic::defaultRenderCB(Atomic *atomic)
 	atomic->getPipeline()->render(atomic);
 }
 
+//
+// ClumpPrototype
+//
+
+// Every object in an instance block is preceded by a pointer to the block,
+// the block starts with the number of objects still alive in it.
+#define INSTANCEHEADER 16
+
+static int32
+instanceStride(int32 size)
+{
+	return (INSTANCEHEADER + size + 0xF) & ~0xF;
+}
+
+static uint8**
+instanceBlock(void *object)
+{
+	return (uint8**)((uint8*)object - INSTANCEHEADER);
+}
+
+static Frame*
+instanceFrame(ClumpPrototype *proto, uint8 *block, int32 i)
+{
+	return (Frame*)(block + proto->frameOffset + i*proto->frameStride + INSTANCEHEADER);
+}
+
+static Atomic*
+instanceAtomic(ClumpPrototype *proto, uint8 *block, int32 i)
+{
+	return (Atomic*)(block + proto->atomicOffset + i*proto->atomicStride + INSTANCEHEADER);
+}
+
+static Clump*
+instanceClump(uint8 *block)
+{
+	return (Clump*)(block + INSTANCEHEADER + INSTANCEHEADER);
+}
+
+// Number frames in the order cloneRecurse creates them.
+// Children are prepended there so their order is reversed.
+static int32
+collectFrames(ClumpPrototype *proto, Frame *f, int32 parent, int32 n)
+{
+	int32 i = n++;
+	int32 c, prev = -1;
+	proto->frames[i] = f;
+	proto->frameLinks[i*3+0] = parent;
+	proto->frameLinks[i*3+1] = -1;
+	proto->frameLinks[i*3+2] = -1;
+	for(Frame *child = f->child; child; child = child->next){
+		c = n;
+		n = collectFrames(proto, child, i, n);
+		proto->frameLinks[c*3+2] = prev;
+		proto->frameLinks[i*3+1] = c;
+		prev = c;
+	}
+	return n;
+}
+
+ClumpPrototype*
+ClumpPrototype::create(Clump *clump)
+{
+	ClumpPrototype *proto;
+	Frame *root = clump->getFrame();
+	uint8 *img;
+	int32 i, j;
+
+	if(root == nil){
+		RWERROR((ERR_GENERAL, "clump has no frame"));
+		return nil;
+	}
+	proto = rwNewT(ClumpPrototype, 1, MEMDUR_EVENT | ID_CLUMP);
+	proto->clump = clump;
+	proto->numFrames = root->count();
+	proto->numAtomics = clump->countAtomics();
+	proto->frames = rwNewT(Frame*, proto->numFrames, MEMDUR_EVENT | ID_CLUMP);
+	proto->frameLinks = rwNewT(int32, proto->numFrames*3, MEMDUR_EVENT | ID_CLUMP);
+	proto->atomics = rwNewT(Atomic*, proto->numAtomics, MEMDUR_EVENT | ID_CLUMP);
+	proto->atomicFrames = rwNewT(int32, proto->numAtomics, MEMDUR_EVENT | ID_CLUMP);
+	proto->image = nil;
+	collectFrames(proto, root, -1, 0);
+	i = 0;
+	FORLIST(lnk, clump->atomics){
+		Atomic *a = Atomic::fromClump(lnk);
+		proto->atomics[i] = a;
+		proto->atomicFrames[i] = -1;
+		for(j = 0; j < proto->numFrames; j++)
+			if(proto->frames[j] == a->getFrame())
+				proto->atomicFrames[i] = j;
+		if(proto->atomicFrames[i] < 0){
+			RWERROR((ERR_GENERAL, "atomic frame not in clump hierarchy"));
+			proto->destroy();
+			return nil;
+		}
+		i++;
+	}
+
+	proto->frameStride = instanceStride(Frame::s_plglist.size);
+	proto->atomicStride = instanceStride(Atomic::s_plglist.size);
+	proto->frameOffset = INSTANCEHEADER + instanceStride(Clump::s_plglist.size);
+	proto->atomicOffset = proto->frameOffset + proto->numFrames*proto->frameStride;
+	proto->size = proto->atomicOffset + proto->numAtomics*proto->atomicStride;
+
+	// Fill in what is the same for all instances,
+	// links between the objects are made by instance()
+	img = rwNewT(uint8, proto->size, MEMDUR_EVENT | ID_CLUMP);
+	memset(img, 0, proto->size);
+	proto->image = img;
+	*(int32*)img = 1 + proto->numFrames + proto->numAtomics;
+
+	Clump *c = instanceClump(img);
+	c->object.init(Clump::ID, 0);
+	c->object.privateFlags |= Object::INSTANCEBLOCK;
+
+	for(i = 0; i < proto->numFrames; i++){
+		Frame *src = proto->frames[i];
+		Frame *f = instanceFrame(proto, img, i);
+		f->object.copy(&src->object);
+		f->object.privateFlags |= Object::INSTANCEBLOCK;
+		f->matrix = src->matrix;
+		f->ltm.setIdentity();
+	}
+
+	for(i = 0; i < proto->numAtomics; i++){
+		Atomic *src = proto->atomics[i];
+		Atomic *a = instanceAtomic(proto, img, i);
+		a->object.object.copy(&src->object.object);
+		a->object.object.privateFlags |= Atomic::WORLDBOUNDDIRTY | Object::INSTANCEBLOCK;
+		a->object.syncCB = worldAtomicSync;
+		a->originalSync = atomicSync;
+		a->geometry = src->geometry;
+		if(src->geometry){
+			a->boundingSphere = src->geometry->morphTargets[0].boundingSphere;
+			a->boundingBox = src->geometry->morphTargets[0].boundingBox;
+		}else{
+			a->boundingBox.inf.set(0.0f, 0.0f, 0.0f);
+			a->boundingBox.sup.set(-1.0f, -1.0f, -1.0f);
+		}
+		a->renderCB = src->renderCB;
+		a->pipeline = src->pipeline;
+	}
+	return proto;
+}
+
+void
+ClumpPrototype::destroy(void)
+{
+	rwFree(this->frames);
+	rwFree(this->frameLinks);
+	rwFree(this->atomics);
+	rwFree(this->atomicFrames);
+	rwFree(this->image);
+	rwFree(this);
+}
+
+// Same result as clump->clone()
+Clump*
+ClumpPrototype::instance(void)
+{
+	uint8 *block;
+	Clump *clump;
+	Frame *f, *root;
+	Atomic *a;
+	int32 i, *l;
+
+	block = (uint8*)rwMalloc(this->size, MEMDUR_EVENT | ID_CLUMP);
+	if(block == nil){
+		RWERROR((ERR_ALLOC, this->size));
+		return nil;
+	}
+	memcpy(block, this->image, this->size);
+
+	root = instanceFrame(this, block, 0);
+	l = this->frameLinks;
+	for(i = 0; i < this->numFrames; i++, l += 3){
+		f = instanceFrame(this, block, i);
+		*instanceBlock(f) = block;
+		f->objectList.init();
+		f->object.parent = l[0] < 0 ? nil : instanceFrame(this, block, l[0]);
+		f->child = l[1] < 0 ? nil : instanceFrame(this, block, l[1]);
+		f->next = l[2] < 0 ? nil : instanceFrame(this, block, l[2]);
+		f->root = root;
+		Frame::s_plglist.construct(f);
+		Frame::s_plglist.copy(f, this->frames[i]);
+	}
+	Frame::numAllocated += this->numFrames;
+	// frame is not in dirty list so important to get this flag right
+	root->object.privateFlags &= ~Frame::HIERARCHYSYNC;
+	root->updateObjects();
+
+	clump = instanceClump(block);
+	*instanceBlock(clump) = block;
+	clump->atomics.init();
+	clump->lights.init();
+	clump->cameras.init();
+	clump->inWorld.init();
+	clump->setFrame(root);
+	Clump::s_plglist.construct(clump);
+	Clump::numAllocated++;
+
+	for(i = 0; i < this->numAtomics; i++){
+		a = instanceAtomic(this, block, i);
+		*instanceBlock(a) = block;
+		if(a->geometry)
+			a->geometry->addRef();
+		a->inSector.init();
+		Atomic::s_plglist.construct(a);
+		Atomic::s_plglist.copy(a, this->atomics[i]);
+		a->setFrame(instanceFrame(this, block, this->atomicFrames[i]));
+		clump->addAtomic(a);
+	}
+	Atomic::numAllocated += this->numAtomics;
+
+	if(this->clump->world)
+		this->clump->world->addClump(clump);
+
+	Clump::s_plglist.copy(clump, this->clump);
+	return clump;
+}
+
+void
+ClumpPrototype::release(void *object)
+{
+	uint8 *block = *instanceBlock(object);
+	if(--*(int32*)block == 0)
+		rwFree(block);
+}
+
 // Atomic Rights plugin
 
 static Stream*
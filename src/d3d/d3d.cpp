@@ -722,13 +722,48 @@ imageFindRasterFormat(Image *img, int32 type,
 	return 1;
 }
 
+// Compress image into a DXT raster
+static bool32
+rasterFromImageDXT(Raster *raster, Image *image)
+{
+	D3dRaster *natras = GETD3DRASTEREXT(raster);
+	int32 dxt;
+	switch(natras->format){
+	case D3DFMT_DXT1: dxt = 1; break;
+	case D3DFMT_DXT3: dxt = 3; break;
+	case D3DFMT_DXT5: dxt = 5; break;
+	default:
+		RWERROR((ERR_INVRASTER));
+		return 0;
+	}
+
+	bool unlock = false;
+	if(raster->pixels == nil){
+		raster->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+		unlock = true;
+	}
+
+	assert(raster->pixels);
+	assert(image->width == raster->width);
+	assert(image->height == raster->height);
+	image->getPixelsDXT(dxt, raster->pixels, dxtQuality);
+
+	if(unlock)
+		raster->unlock(0);
+
+	return 1;
+}
+
 bool32
 rasterFromImage(Raster *raster, Image *image)
 {
 	if((raster->type&0xF) != Raster::TEXTURE)
 		return 0;
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
+	if(GETD3DRASTEREXT(raster)->customFormat)
+		return rasterFromImageDXT(raster, image);
+
+	int32 srcFormat, dstFormat;
 
 	// Unpalettize image if necessary but don't change original
 	Image *truecolimg = nil;
@@ -745,37 +780,39 @@ rasterFromImage(Raster *raster, Image *image)
 	int32 format = raster->format&(Raster::PAL8 | Raster::PAL4 | 0xF00);
 	switch(image->depth){
 	case 32:
-		if(format == Raster::C8888)
-			conv = conv_BGRA8888_from_RGBA8888;
-		else if(format == Raster::C888)
-			conv = conv_BGR888_from_RGB888;
+		srcFormat = PIXFMT_RGBA8888;
+		// C888 is X8R8G8B8
+		if(format == Raster::C8888 || format == Raster::C888)
+			dstFormat = PIXFMT_BGRA8888;
 		else
 			goto err;
 		break;
 	case 24:
-		if(format == Raster::C8888)
-			conv = conv_BGRA8888_from_RGB888;
-		else if(format == Raster::C888)
-			conv = conv_BGR888_from_RGB888;
+		srcFormat = PIXFMT_RGB888;
+		if(format == Raster::C8888 || format == Raster::C888)
+			dstFormat = PIXFMT_BGRA8888;
 		else
 			goto err;
 		break;
 	case 16:
+		srcFormat = PIXFMT_ARGB1555;
 		if(format == Raster::C1555)
-			conv = conv_ARGB1555_from_ARGB1555;
+			dstFormat = PIXFMT_ARGB1555;
 		else
 			goto err;
 		break;
 	case 8:
+		srcFormat = PIXFMT_8;
 		if(format == (Raster::PAL8 | Raster::C8888))
-			conv = conv_8_from_8;
+			dstFormat = PIXFMT_8;
 		else
 			goto err;
 		break;
 	case 4:
+		srcFormat = PIXFMT_8;
 		if(format == (Raster::PAL4 | Raster::C8888) ||
 		   format == (Raster::PAL8 | Raster::C8888))
-			conv = conv_8_from_8;
+			dstFormat = PIXFMT_8;
 		else
 			goto err;
 		break;
@@ -808,24 +845,11 @@ fprintf(stderr, "%d %x\n", image->depth, format); fflush(stdout);
 		unlock = true;
 	}
 
-	uint8 *pixels = raster->pixels;
-	assert(pixels);
-	uint8 *imgpixels = image->pixels;
-
-	int x, y;
+	assert(raster->pixels);
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
-	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(rasrow, imgrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
-		imgpixels += image->stride;
-		pixels += raster->stride;
-	}
+	convertPixels(raster->pixels, raster->stride, dstFormat,
+		image->pixels, image->stride, srcFormat, image->width, image->height);
 	if(unlock)
 		raster->unlock(0);
 
@@ -884,23 +908,27 @@ rasterToImage(Raster *raster)
 		return image;
 	}
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
+	int32 srcFormat, dstFormat;
 	switch(raster->format & 0xF00){
 	case Raster::C1555:
 		depth = 16;
-		conv = conv_ARGB1555_from_ARGB1555;
+		srcFormat = PIXFMT_ARGB1555;
+		dstFormat = PIXFMT_ARGB1555;
 		break;
 	case Raster::C8888:
 		depth = 32;
-		conv = conv_RGBA8888_from_BGRA8888;
+		srcFormat = PIXFMT_BGRA8888;
+		dstFormat = PIXFMT_RGBA8888;
 		break;
 	case Raster::C888:
 		depth = 24;
-		conv = conv_RGB888_from_BGR888;
+		srcFormat = PIXFMT_BGRA8888;
+		dstFormat = PIXFMT_RGB888;
 		break;
 	case Raster::C555:
 		depth = 16;
-		conv = conv_ARGB1555_from_RGB555;
+		srcFormat = PIXFMT_RGB555;
+		dstFormat = PIXFMT_ARGB1555;
 		break;
 
 	default:
@@ -918,6 +946,10 @@ rasterToImage(Raster *raster)
 		depth = 8;
 		pallength = 256;
 	}
+	if(pallength){
+		srcFormat = PIXFMT_8;
+		dstFormat = PIXFMT_8;
+	}
 
 	uint8 *in, *out;
 	image = Image::create(raster->width, raster->height, depth);
@@ -933,23 +965,10 @@ rasterToImage(Raster *raster)
 		}
 	}
 
-	uint8 *imgpixels = image->pixels;
-	uint8 *pixels = raster->pixels;
-
-	int x, y;
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
-	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(imgrow, rasrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
-		imgpixels += image->stride;
-		pixels += raster->stride;
-	}
+	convertPixels(image->pixels, image->stride, dstFormat,
+		raster->pixels, raster->stride, srcFormat, image->width, image->height);
 	image->compressPalette();
 
 	if(unlock)
@@ -358,6 +358,7 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 	header->inst = rwNewT(InstanceData, header->numMeshes, MEMDUR_EVENT | ID_GEOMETRY);
 
 	header->indexBuffer = createIndexBuffer(header->totalNumIndex*2, false);
+	RWMETRIC(numInstanceBytes, header->totalNumIndex*2);
 
 	uint16 *indices = lockIndices(header->indexBuffer, 0, 0, 0);
 	InstanceData *inst = header->inst;
@@ -583,6 +584,7 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 		getDeclaration(header->vertexDeclaration, dcl);
 
 	uint8 *verts = lockVertices(s->vertexBuffer, 0, 0, D3DLOCK_NOSYSLOCK);
+	RWMETRIC(numInstanceBytes, header->totalNumVertex*s->stride);
 
 	// Instance vertices
 	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES){
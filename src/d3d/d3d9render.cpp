@@ -67,6 +67,7 @@ drawInst_GSemu(d3d9::InstanceDataHeader *header, InstanceData *inst)
 void
 drawInst(d3d9::InstanceDataHeader *header, d3d9::InstanceData *inst)
 {
+	RWMETRIC(numMeshes, 1);
 	if(rw::GetRenderState(rw::GSALPHATEST))
 		drawInst_GSemu(header, inst);
 	else
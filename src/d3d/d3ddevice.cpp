@@ -463,6 +463,7 @@ setRasterStage(uint32 stage, Raster *raster)
 	D3dRaster *d3draster = nil;
 	if(raster != rwStateCache.texstage[stage].raster){
 		rwStateCache.texstage[stage].raster = raster;
+		RWMETRIC(numTextureBinds, 1);
 		if(raster){
 			assert(raster->platform == PLATFORM_D3D8 ||
 				raster->platform == PLATFORM_D3D9);
@@ -2016,6 +2017,8 @@ Device renderdevice = {
 	d3d::im3DRenderIndexedPrimitive,
 	d3d::im3DEnd,
 	d3d::deviceSystem,
+	sizeof(d3d::Im2DVertex),
+	sizeof(d3d::Im3DVertex)
 };
 
 #endif
@@ -842,9 +842,11 @@ createNativeRaster(void *object, int32 offset, int32)
 }
 
 static void*
-destroyNativeRaster(void *object, int32, int32)
+destroyNativeRaster(void *object, int32 offset, int32)
 {
-	// TODO:
+	XboxRaster *raster = PLUGINOFFSET(XboxRaster, object, offset);
+	rwFree(raster->texture);
+	rwFree(raster->palette);
 	return object;
 }
 
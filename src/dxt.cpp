@@ -0,0 +1,631 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwsimd.h"
+
+#define PLUGIN_ID ID_IMAGE
+
+// DXT (S3TC) block compression and decompression.
+// Colour blocks are two 565 endpoints followed by 16 2-bit indices,
+// DXT3 alpha is 16 4-bit values, DXT5 alpha is two 8-bit endpoints
+// followed by 16 3-bit indices. All little endian.
+
+namespace rw {
+
+int32 dxtQuality = DXT_FAST;
+
+#define R565(c) (((c)>>11) & 0x1F)
+#define G565(c) (((c)>> 5) & 0x3F)
+#define B565(c) ( (c)      & 0x1F)
+
+/*
+ * Decompression
+ */
+
+static void
+makeColorPalette(uint8 (*c)[4], uint32 col0, uint32 col1, bool32 fourColor)
+{
+	c[0][0] = R565(col0)*0xFF/0x1F;
+	c[0][1] = G565(col0)*0xFF/0x3F;
+	c[0][2] = B565(col0)*0xFF/0x1F;
+	c[0][3] = 0xFF;
+
+	c[1][0] = R565(col1)*0xFF/0x1F;
+	c[1][1] = G565(col1)*0xFF/0x3F;
+	c[1][2] = B565(col1)*0xFF/0x1F;
+	c[1][3] = 0xFF;
+	if(fourColor){
+		c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
+		c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
+		c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
+		c[2][3] = 0xFF;
+
+		c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
+		c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
+		c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
+		c[3][3] = 0xFF;
+	}else{
+		c[2][0] = (c[0][0] + c[1][0])/2;
+		c[2][1] = (c[0][1] + c[1][1])/2;
+		c[2][2] = (c[0][2] + c[1][2])/2;
+		c[2][3] = 0xFF;
+
+		c[3][0] = 0x00;
+		c[3][1] = 0x00;
+		c[3][2] = 0x00;
+		c[3][3] = 0x00;
+	}
+}
+
+#ifdef RW_SSE2
+// Same as makeColorPalette but for two blocks at once,
+// 16 bit lanes: block 0 in the low, block 1 in the high half.
+static void
+makeColorPalettes2(uint8 (*c)[4][4], uint32 *col0, uint32 *col1, bool32 *fourColor)
+{
+	__m128i c0 = _mm_setr_epi16(
+		R565(col0[0])*0xFF/0x1F, G565(col0[0])*0xFF/0x3F, B565(col0[0])*0xFF/0x1F, 0xFF,
+		R565(col0[1])*0xFF/0x1F, G565(col0[1])*0xFF/0x3F, B565(col0[1])*0xFF/0x1F, 0xFF);
+	__m128i c1 = _mm_setr_epi16(
+		R565(col1[0])*0xFF/0x1F, G565(col1[0])*0xFF/0x3F, B565(col1[0])*0xFF/0x1F, 0xFF,
+		R565(col1[1])*0xFF/0x1F, G565(col1[1])*0xFF/0x3F, B565(col1[1])*0xFF/0x1F, 0xFF);
+	int16 m0 = fourColor[0] ? -1 : 0;
+	int16 m1 = fourColor[1] ? -1 : 0;
+	__m128i four = _mm_setr_epi16(m0, m0, m0, m0, m1, m1, m1, m1);
+	// x/3 == x*21846 >> 16 for all x we can get here
+	__m128i third = _mm_set1_epi16(21846);
+	__m128i c2 = _mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(c0, c0), c1), third);
+	__m128i c3 = _mm_mulhi_epu16(_mm_add_epi16(_mm_add_epi16(c1, c1), c0), third);
+	__m128i half = _mm_srli_epi16(_mm_add_epi16(c0, c1), 1);
+	c2 = _mm_or_si128(_mm_and_si128(four, c2), _mm_andnot_si128(four, half));
+	c3 = _mm_and_si128(four, c3);
+
+	uint8 p[2][16];
+	_mm_storeu_si128((__m128i*)p[0], _mm_packus_epi16(c0, c1));
+	_mm_storeu_si128((__m128i*)p[1], _mm_packus_epi16(c2, c3));
+	memcpy(c[0][0], &p[0][0], 4);
+	memcpy(c[1][0], &p[0][4], 4);
+	memcpy(c[0][1], &p[0][8], 4);
+	memcpy(c[1][1], &p[0][12], 4);
+	memcpy(c[0][2], &p[1][0], 4);
+	memcpy(c[1][2], &p[1][4], 4);
+	memcpy(c[0][3], &p[1][8], 4);
+	memcpy(c[1][3], &p[1][12], 4);
+}
+#endif
+
+static void
+makeAlphaPalette(uint32 *a, uint32 a0, uint32 a1)
+{
+	a[0] = a0;
+	a[1] = a1;
+	if(a[0] > a[1]){
+		a[2] = (6*a[0] + 1*a[1])/7;
+		a[3] = (5*a[0] + 2*a[1])/7;
+		a[4] = (4*a[0] + 3*a[1])/7;
+		a[5] = (3*a[0] + 4*a[1])/7;
+		a[6] = (2*a[0] + 5*a[1])/7;
+		a[7] = (1*a[0] + 6*a[1])/7;
+	}else{
+		a[2] = (4*a[0] + 1*a[1])/5;
+		a[3] = (3*a[0] + 2*a[1])/5;
+		a[4] = (2*a[0] + 3*a[1])/5;
+		a[5] = (1*a[0] + 4*a[1])/5;
+		a[6] = 0;
+		a[7] = 0xFF;
+	}
+}
+
+static void
+writeColorBlock(uint8 (*dst)[4], int32 w, uint8 (*c)[4], uint32 indices)
+{
+	for(int32 l = 0; l < 4; l++){
+		for(int32 k = 0; k < 4; k++){
+			memcpy(dst[k], c[indices & 3], 4);
+			indices >>= 2;
+		}
+		dst += w;
+	}
+}
+
+static void
+writeAlphaBlock3(uint8 (*dst)[4], int32 w, uint8 *src)
+{
+	uint64 alphas = *((uint64*)src);
+	for(int32 l = 0; l < 4; l++){
+		for(int32 k = 0; k < 4; k++){
+			dst[k][3] = (alphas & 0xF)*17;
+			alphas >>= 4;
+		}
+		dst += w;
+	}
+}
+
+static void
+writeAlphaBlock5(uint8 (*dst)[4], int32 w, uint8 *src)
+{
+	uint32 a[8];
+	makeAlphaPalette(a, src[0], src[1]);
+	// only 6 bytes of indices
+	uint64 alphas = *((uint64*)&src[0]) >> 16;
+	for(int32 l = 0; l < 4; l++){
+		for(int32 k = 0; k < 4; k++){
+			dst[k][3] = a[alphas & 0x7];
+			alphas >>= 3;
+		}
+		dst += w;
+	}
+}
+
+// Decompress w*h texels to 32 bit RGBA.
+// Blocks are decoded in pairs, the palettes of both are
+// computed together if we have SIMD.
+void
+decompressDXT(int32 type, uint8 *adst, int32 w, int32 h, uint8 *src)
+{
+	uint8 (*dst)[4] = (uint8(*)[4])adst;
+	int32 blockSize = type == 1 ? 8 : 16;
+	int32 colorOffset = type == 1 ? 0 : 8;
+	int32 x, y, i, n;
+	uint8 *blk[2];
+	uint32 col0[2], col1[2];
+	bool32 fourColor[2];
+	uint8 c[2][4][4];
+
+	for(y = 0; y < h; y += 4)
+		for(x = 0; x < w; x += 8){
+			n = x+4 < w ? 2 : 1;
+			for(i = 0; i < n; i++){
+				blk[i] = src + i*blockSize;
+				col0[i] = *((uint16*)&blk[i][colorOffset+0]);
+				col1[i] = *((uint16*)&blk[i][colorOffset+2]);
+				// DXT3 is always four colour
+				fourColor[i] = type == 3 || col0[i] > col1[i];
+			}
+#ifdef RW_SSE2
+			if(n == 2)
+				makeColorPalettes2(c, col0, col1, fourColor);
+			else
+#endif
+			for(i = 0; i < n; i++)
+				makeColorPalette(c[i], col0[i], col1[i], fourColor[i]);
+
+			for(i = 0; i < n; i++){
+				uint8 (*bdst)[4] = &dst[y*w + x+i*4];
+				writeColorBlock(bdst, w, c[i], *((uint32*)&blk[i][colorOffset+4]));
+				if(type == 3)
+					writeAlphaBlock3(bdst, w, blk[i]);
+				else if(type == 5)
+					writeAlphaBlock5(bdst, w, blk[i]);
+			}
+			src += n*blockSize;
+		}
+}
+
+/*
+ * Compression
+ */
+
+// Get a 4x4 block of RGBA texels, clamping at the image edges
+static void
+fetchBlock(uint8 (*px)[4], uint8 *src, int32 stride, int32 x, int32 y, int32 w, int32 h)
+{
+	int32 k, l, sx, sy;
+	for(l = 0; l < 4; l++){
+		sy = y+l < h ? y+l : h-1;
+		for(k = 0; k < 4; k++){
+			sx = x+k < w ? x+k : w-1;
+			memcpy(px[l*4+k], &src[sy*stride + sx*4], 4);
+		}
+	}
+}
+
+static int32
+colorDist(uint8 *a, uint8 *b)
+{
+	int32 dr = a[0] - b[0];
+	int32 dg = a[1] - b[1];
+	int32 db = a[2] - b[2];
+	return dr*dr + dg*dg + db*db;
+}
+
+static uint32
+pack565(float32 *c)
+{
+	int32 r = (int32)(c[0]*31.0f/255.0f + 0.5f);
+	int32 g = (int32)(c[1]*63.0f/255.0f + 0.5f);
+	int32 b = (int32)(c[2]*31.0f/255.0f + 0.5f);
+	r = r < 0 ? 0 : r > 31 ? 31 : r;
+	g = g < 0 ? 0 : g > 63 ? 63 : g;
+	b = b < 0 ? 0 : b > 31 ? 31 : b;
+	return r<<11 | g<<5 | b;
+}
+
+// Round a colour to what it will be after 565 quantization
+static void
+snap565(float32 *c)
+{
+	uint32 col = pack565(c);
+	c[0] = (float32)(R565(col)*0xFF/0x1F);
+	c[1] = (float32)(G565(col)*0xFF/0x3F);
+	c[2] = (float32)(B565(col)*0xFF/0x1F);
+}
+
+// Pick the best indices for texels in mask given the endpoints,
+// texels not in mask get index 3 (transparent in three colour mode).
+// Returns the squared error.
+static int32
+fitIndices(uint8 (*px)[4], uint32 mask, uint32 col0, uint32 col1, bool32 fourColor, uint32 *pIndices)
+{
+	uint8 c[4][4];
+	int32 i, j, d, best, bestd;
+	int32 numColors = fourColor ? 4 : 3;
+	int32 err = 0;
+	uint32 indices = 0;
+
+	makeColorPalette(c, col0, col1, fourColor);
+	for(i = 15; i >= 0; i--){
+		if((mask & (1<<i)) == 0){
+			best = 3;
+			bestd = 0;
+		}else{
+			best = 0;
+			bestd = colorDist(px[i], c[0]);
+			for(j = 1; j < numColors; j++){
+				d = colorDist(px[i], c[j]);
+				if(d < bestd){
+					bestd = d;
+					best = j;
+				}
+			}
+		}
+		err += bestd;
+		indices = indices<<2 | best;
+	}
+	*pIndices = indices;
+	return err;
+}
+
+// Mean and direction of greatest variance of the texels in mask
+static void
+principalAxis(float32 *mean, float32 *axis, uint8 (*px)[4], uint32 mask)
+{
+	float32 cov[6];
+	float32 d[3], v[3];
+	int32 i, n;
+
+	n = 0;
+	mean[0] = mean[1] = mean[2] = 0.0f;
+	for(i = 0; i < 16; i++)
+		if(mask & (1<<i)){
+			mean[0] += px[i][0];
+			mean[1] += px[i][1];
+			mean[2] += px[i][2];
+			n++;
+		}
+	mean[0] /= n;
+	mean[1] /= n;
+	mean[2] /= n;
+
+	memset(cov, 0, sizeof(cov));
+	for(i = 0; i < 16; i++)
+		if(mask & (1<<i)){
+			d[0] = px[i][0] - mean[0];
+			d[1] = px[i][1] - mean[1];
+			d[2] = px[i][2] - mean[2];
+			cov[0] += d[0]*d[0];
+			cov[1] += d[0]*d[1];
+			cov[2] += d[0]*d[2];
+			cov[3] += d[1]*d[1];
+			cov[4] += d[1]*d[2];
+			cov[5] += d[2]*d[2];
+		}
+
+	// power iteration, start with the row of the largest variance
+	axis[0] = axis[1] = axis[2] = 1.0f;
+	if(cov[0] >= cov[3] && cov[0] >= cov[5] && cov[0] > 0.0f){
+		axis[0] = cov[0]; axis[1] = cov[1]; axis[2] = cov[2];
+	}else if(cov[3] >= cov[5] && cov[3] > 0.0f){
+		axis[0] = cov[1]; axis[1] = cov[3]; axis[2] = cov[4];
+	}else if(cov[5] > 0.0f){
+		axis[0] = cov[2]; axis[1] = cov[4]; axis[2] = cov[5];
+	}
+	for(i = 0; i < 8; i++){
+		v[0] = cov[0]*axis[0] + cov[1]*axis[1] + cov[2]*axis[2];
+		v[1] = cov[1]*axis[0] + cov[3]*axis[1] + cov[4]*axis[2];
+		v[2] = cov[2]*axis[0] + cov[4]*axis[1] + cov[5]*axis[2];
+		float32 m = v[0];
+		if(v[1] > m) m = v[1];
+		if(v[2] > m) m = v[2];
+		if(-v[0] > m) m = -v[0];
+		if(-v[1] > m) m = -v[1];
+		if(-v[2] > m) m = -v[2];
+		if(m < 1.0e-6f)
+			break;
+		axis[0] = v[0]/m;
+		axis[1] = v[1]/m;
+		axis[2] = v[2]/m;
+	}
+}
+
+// Fast: endpoints are the extremes of the texels projected onto the principal axis
+static void
+rangeFit(float32 *a, float32 *b, uint8 (*px)[4], uint32 mask)
+{
+	float32 mean[3], axis[3];
+	float32 t, tmin, tmax;
+	int32 i;
+
+	principalAxis(mean, axis, px, mask);
+	float32 len2 = axis[0]*axis[0] + axis[1]*axis[1] + axis[2]*axis[2];
+	tmin = tmax = 0.0f;
+	for(i = 0; i < 16; i++)
+		if(mask & (1<<i)){
+			t = ((px[i][0]-mean[0])*axis[0] +
+			     (px[i][1]-mean[1])*axis[1] +
+			     (px[i][2]-mean[2])*axis[2]) / len2;
+			if(t < tmin) tmin = t;
+			if(t > tmax) tmax = t;
+		}
+	for(i = 0; i < 3; i++){
+		a[i] = mean[i] + axis[i]*tmax;
+		b[i] = mean[i] + axis[i]*tmin;
+	}
+}
+
+// High quality: order the texels along the principal axis and try every
+// split into four consecutive clusters, solving for the least squares
+// endpoints of each. Only used for four colour blocks.
+static void
+clusterFit(float32 *a, float32 *b, uint8 (*px)[4])
+{
+	float32 mean[3], axis[3];
+	float32 dot[16];
+	int32 order[16];
+	float32 sum[17][3];	// prefix sums of ordered texels
+	int32 i, j, k, l, c;
+
+	principalAxis(mean, axis, px, 0xFFFF);
+	for(i = 0; i < 16; i++){
+		dot[i] = px[i][0]*axis[0] + px[i][1]*axis[1] + px[i][2]*axis[2];
+		// insertion sort
+		for(j = i; j > 0 && dot[order[j-1]] > dot[i]; j--)
+			order[j] = order[j-1];
+		order[j] = i;
+	}
+	sum[0][0] = sum[0][1] = sum[0][2] = 0.0f;
+	for(i = 0; i < 16; i++)
+		for(c = 0; c < 3; c++)
+			sum[i+1][c] = sum[i][c] + px[order[i]][c];
+
+	float32 besterr = 3.4e38f;
+	float32 ca[3], cb[3];
+	float32 ax[3], bx[3];
+	// some split always has det > 0 (e.g. i == k == 8), so a and b are always set
+	// texels [0,i) get b, [i,j) 2/3 b, [j,k) 2/3 a, [k,16) a
+	for(i = 0; i <= 16; i++)
+	for(j = i; j <= 16; j++)
+	for(k = j; k <= 16; k++){
+		float32 n0 = (float32)i;
+		float32 n1 = (float32)(j-i);
+		float32 n2 = (float32)(k-j);
+		float32 n3 = (float32)(16-k);
+		float32 aa = n3 + n2*(4.0f/9.0f) + n1*(1.0f/9.0f);
+		float32 bb = n0 + n1*(4.0f/9.0f) + n2*(1.0f/9.0f);
+		float32 ab = (n1 + n2)*(2.0f/9.0f);
+		float32 det = aa*bb - ab*ab;
+		if(det < 1.0e-6f)
+			continue;
+		for(c = 0; c < 3; c++){
+			float32 s0 = sum[i][c];
+			float32 s1 = sum[j][c] - sum[i][c];
+			float32 s2 = sum[k][c] - sum[j][c];
+			float32 s3 = sum[16][c] - sum[k][c];
+			ax[c] = s3 + s2*(2.0f/3.0f) + s1*(1.0f/3.0f);
+			bx[c] = s0 + s1*(2.0f/3.0f) + s2*(1.0f/3.0f);
+			ca[c] = (bb*ax[c] - ab*bx[c])/det;
+			cb[c] = (aa*bx[c] - ab*ax[c])/det;
+			ca[c] = ca[c] < 0.0f ? 0.0f : ca[c] > 255.0f ? 255.0f : ca[c];
+			cb[c] = cb[c] < 0.0f ? 0.0f : cb[c] > 255.0f ? 255.0f : cb[c];
+		}
+		snap565(ca);
+		snap565(cb);
+		// error minus the constant sum of x*x
+		float32 err = 0.0f;
+		for(l = 0; l < 3; l++)
+			err += aa*ca[l]*ca[l] + bb*cb[l]*cb[l] + 2.0f*ab*ca[l]*cb[l]
+				- 2.0f*ca[l]*ax[l] - 2.0f*cb[l]*bx[l];
+		if(err < besterr){
+			besterr = err;
+			memcpy(a, ca, sizeof(ca));
+			memcpy(b, cb, sizeof(cb));
+		}
+	}
+}
+
+static void
+compressColorBlock(uint8 *dst, uint8 (*px)[4], bool32 dxt1, int32 quality)
+{
+	uint32 mask = 0xFFFF;
+	uint32 col0, col1, tmp;
+	uint32 indices, indices2;
+	float32 a[3], b[3];
+	int32 i;
+	int32 err = 0;
+
+	// DXT1 has 1 bit alpha through three colour mode
+	if(dxt1)
+		for(i = 0; i < 16; i++)
+			if(px[i][3] < 128)
+				mask &= ~(1<<i);
+	if(mask == 0){
+		col0 = col1 = 0;
+		indices = 0xFFFFFFFF;
+	}else if(mask != 0xFFFF){
+		rangeFit(a, b, px, mask);
+		col0 = pack565(a);
+		col1 = pack565(b);
+		if(col0 > col1){
+			tmp = col0;
+			col0 = col1;
+			col1 = tmp;
+		}
+		fitIndices(px, mask, col0, col1, 0, &indices);
+	}else{
+		rangeFit(a, b, px, mask);
+		col0 = pack565(a);
+		col1 = pack565(b);
+		if(col0 < col1){
+			tmp = col0;
+			col0 = col1;
+			col1 = tmp;
+		}
+		// with equal endpoints the decoder picks three colour mode
+		if(col0 == col1)
+			indices = 0;
+		else
+			err = fitIndices(px, mask, col0, col1, 1, &indices);
+
+		if(quality >= DXT_HIGH && col0 != col1){
+			uint32 c0, c1;
+			clusterFit(a, b, px);
+			c0 = pack565(a);
+			c1 = pack565(b);
+			if(c0 < c1){
+				tmp = c0;
+				c0 = c1;
+				c1 = tmp;
+			}
+			if(c0 != c1 && fitIndices(px, mask, c0, c1, 1, &indices2) < err){
+				col0 = c0;
+				col1 = c1;
+				indices = indices2;
+			}
+		}
+	}
+	dst[0] = col0;
+	dst[1] = col0>>8;
+	dst[2] = col1;
+	dst[3] = col1>>8;
+	dst[4] = indices;
+	dst[5] = indices>>8;
+	dst[6] = indices>>16;
+	dst[7] = indices>>24;
+}
+
+static void
+compressAlphaBlock3(uint8 *dst, uint8 (*px)[4])
+{
+	int32 i;
+	for(i = 0; i < 8; i++)
+		dst[i] = (px[2*i][3]+8)/17 | ((px[2*i+1][3]+8)/17)<<4;
+}
+
+static uint32
+fitAlphaIndices(uint8 (*px)[4], uint32 a0, uint32 a1, uint64 *pIndices)
+{
+	uint32 a[8];
+	int32 i, j, d, best, bestd;
+	uint32 err = 0;
+	uint64 indices = 0;
+
+	makeAlphaPalette(a, a0, a1);
+	for(i = 15; i >= 0; i--){
+		best = 0;
+		bestd = 0x10000;
+		for(j = 0; j < 8; j++){
+			d = px[i][3] - (int32)a[j];
+			d *= d;
+			if(d < bestd){
+				bestd = d;
+				best = j;
+			}
+		}
+		err += bestd;
+		indices = indices<<3 | best;
+	}
+	*pIndices = indices;
+	return err;
+}
+
+static void
+compressAlphaBlock5(uint8 *dst, uint8 (*px)[4], int32 quality)
+{
+	uint32 amin, amax, a0, a1;
+	uint64 indices, indices2;
+	int32 i;
+
+	// eight alpha mode over the full range
+	amin = amax = px[0][3];
+	for(i = 1; i < 16; i++){
+		if(px[i][3] < amin) amin = px[i][3];
+		if(px[i][3] > amax) amax = px[i][3];
+	}
+	a0 = amax;
+	a1 = amin;
+	uint32 err = fitAlphaIndices(px, a0, a1, &indices);
+
+	// six alpha mode has 0 and 0xFF for free
+	if(quality >= DXT_HIGH && err != 0){
+		uint32 min6 = 0xFF, max6 = 0;
+		for(i = 0; i < 16; i++){
+			if(px[i][3] == 0 || px[i][3] == 0xFF)
+				continue;
+			if(px[i][3] < min6) min6 = px[i][3];
+			if(px[i][3] > max6) max6 = px[i][3];
+		}
+		if(min6 > max6)
+			min6 = max6 = 0;
+		if(fitAlphaIndices(px, min6, max6, &indices2) < err){
+			a0 = min6;
+			a1 = max6;
+			indices = indices2;
+		}
+	}
+	dst[0] = a0;
+	dst[1] = a1;
+	for(i = 0; i < 6; i++)
+		dst[2+i] = indices >> i*8;
+}
+
+// Compress a w*h 32 bit RGBA image to DXT1, 3 or 5.
+void
+compressDXT(int32 type, uint8 *dst, int32 w, int32 h, uint8 *src, int32 stride, int32 quality)
+{
+	uint8 px[16][4];
+	int32 x, y;
+
+	for(y = 0; y < h; y += 4)
+		for(x = 0; x < w; x += 4){
+			fetchBlock(px, src, stride, x, y, w, h);
+			switch(type){
+			case 1:
+				compressColorBlock(dst, px, 1, quality);
+				dst += 8;
+				break;
+			case 3:
+				compressAlphaBlock3(dst, px);
+				compressColorBlock(dst+8, px, 0, quality);
+				dst += 16;
+				break;
+			case 5:
+				compressAlphaBlock5(dst, px, quality);
+				compressColorBlock(dst+8, px, 0, quality);
+				dst += 16;
+				break;
+			default:
+				assert(0 && "invalid DXT format");
+				return;
+			}
+		}
+}
+
+}
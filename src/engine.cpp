@@ -16,6 +16,7 @@
 #include "d3d/rwd3d8.h"
 #include "d3d/rwd3d9.h"
 #include "gl/rwgl3.h"
+#include "soft/rwsoft.h"
 #include "gl/rwwdgl.h"
 
 #define PLUGIN_ID 0
@@ -166,6 +167,122 @@ char *strdup_LOC(const char *s, uint32 hint, const char *here) {
 	return t;
 }
 
+//
+// FreeList
+//
+
+// block header, keeps entries 16 byte aligned
+#define FREELISTHEADER 16
+
+FreeList*
+FreeList::create(int32 entrySize, int32 entriesPerBlock, uint32 hint)
+{
+	FreeList *fl = rwNewT(FreeList, 1, MEMDUR_GLOBAL);
+	// room for the free link and keep entries aligned
+	fl->entrySize = (entrySize + 0xF) & ~0xF;
+	fl->entriesPerBlock = entriesPerBlock;
+	fl->hint = hint;
+	fl->blocks = nil;
+	fl->freeEntries = nil;
+	fl->numFree = 0;
+	fl->next = fl->end = nil;
+	fl->bulkNext = fl->bulkEnd = nil;
+	fl->numUsed = 0;
+	return fl;
+}
+
+void
+FreeList::destroy(void)
+{
+	uint8 *b, *next;
+	for(b = this->blocks; b; b = next){
+		next = *(uint8**)b;
+		rwFree(b);
+	}
+	rwFree(this);
+}
+
+static uint8*
+newBlock(FreeList *fl, int32 n)
+{
+	uint8 *b = (uint8*)rwNew(FREELISTHEADER + n*fl->entrySize, fl->hint);
+	*(uint8**)b = fl->blocks;
+	fl->blocks = b;
+	return b + FREELISTHEADER;
+}
+
+void*
+FreeList::alloc(void)
+{
+	uint8 *e;
+	if(this->bulkNext < this->bulkEnd){
+		e = this->bulkNext;
+		this->bulkNext += this->entrySize;
+	}else if(this->freeEntries){
+		e = this->freeEntries;
+		this->freeEntries = *(uint8**)e;
+		this->numFree--;
+	}else{
+		if(this->next >= this->end){
+			this->next = newBlock(this, this->entriesPerBlock);
+			this->end = this->next + this->entriesPerBlock*this->entrySize;
+		}
+		e = this->next;
+		this->next += this->entrySize;
+	}
+	this->numUsed++;
+	return e;
+}
+
+void
+FreeList::free(void *entry)
+{
+	*(uint8**)entry = this->freeEntries;
+	this->freeEntries = (uint8*)entry;
+	this->numFree++;
+	this->numUsed--;
+}
+
+static void
+freeRange(FreeList *fl, uint8 *start, uint8 *end)
+{
+	for(; start < end; start += fl->entrySize){
+		*(uint8**)start = fl->freeEntries;
+		fl->freeEntries = start;
+		fl->numFree++;
+	}
+}
+
+void
+FreeList::beginBulk(int32 n)
+{
+	int32 sz = n*this->entrySize;
+	this->endBulk();
+	// don't grow when freed entries can be reused
+	if(this->numFree >= n)
+		return;
+	if(this->end - this->next >= sz){
+		this->bulkNext = this->next;
+		this->next += sz;
+	}else{
+		// what's left of the old block can still be used
+		freeRange(this, this->next, this->end);
+		n = n > this->entriesPerBlock ? n : this->entriesPerBlock;
+		this->bulkNext = newBlock(this, n);
+		this->next = this->bulkNext + sz;
+		this->end = this->bulkNext + n*this->entrySize;
+	}
+	this->bulkEnd = this->bulkNext + sz;
+}
+
+// entries that weren't taken go to the free list
+void
+FreeList::endBulk(void)
+{
+	freeRange(this, this->bulkNext, this->bulkEnd);
+	this->bulkNext = this->bulkEnd = nil;
+}
+
 MemoryFunctions defaultMemfuncs = {
 	malloc_h,
 	realloc_h,
@@ -214,6 +331,7 @@ Engine::init(MemoryFunctions *memfuncs)
 	Image::registerModule();
 	Raster::registerModule();
 	Texture::registerModule();
+	Metrics::registerModule();
 
 	// TODO: reset all allocation counts here. or maybe do that in modules?
 	Frame::numAllocated = 0;
@@ -236,6 +354,7 @@ Engine::init(MemoryFunctions *memfuncs)
 	d3d9::registerPlatformPlugins();
 	wdgl::registerPlatformPlugins();
 	gl3::registerPlatformPlugins();
+	soft::registerPlatformPlugins();
 
 	Engine::state = Initialized;
 	return 1;
@@ -270,12 +389,20 @@ Engine::open(EngineOpenParams *p)
 	engine->device = gl3::renderdevice;
 #elif RW_D3D9
 	engine->device = d3d::renderdevice;
+#elif RW_SOFT
+	engine->device = soft::renderdevice;
 #else
 	engine->device = null::renderdevice;
 #endif
 
 	engine->device.system(DEVICEOPEN, (void*)p, 0);
 
+	// plugins are all registered now so we know the sizes
+	Frame::freeList = FreeList::create(Frame::s_plglist.size, 64, MEMDUR_EVENT | ID_FRAMELIST);
+	Atomic::freeList = FreeList::create(Atomic::s_plglist.size, 64, MEMDUR_EVENT | ID_ATOMIC);
+	Material::freeList = FreeList::create(Material::s_plglist.size, 64, MEMDUR_EVENT | ID_MATERIAL);
+	Texture::freeList = FreeList::create(Texture::s_plglist.size, 64, MEMDUR_EVENT | ID_TEXTURE);
+
 	engine->dummyDefaultPipeline = ObjPipeline::create();
 	for(uint i = 0; i < NUM_PLATFORMS; i++){
 		rw::engine->driver[i] = (Driver*)rwNew(Driver::s_plglist[i].size,
@@ -354,6 +481,14 @@ Engine::close(void)
 	for(uint i = 0; i < NUM_PLATFORMS; i++)
 		rwFree(rw::engine->driver[i]);
 	engine->dummyDefaultPipeline->destroy();
+	Frame::freeList->destroy();
+	Atomic::freeList->destroy();
+	Material::freeList->destroy();
+	Texture::freeList->destroy();
+	Frame::freeList = nil;
+	Atomic::freeList = nil;
+	Material::freeList = nil;
+	Texture::freeList = nil;
 	rwFree(engine);
 	engine = nil;
 	Engine::state = Initialized;
@@ -566,7 +701,8 @@ Device renderdevice = {
 	null::im3DRenderPrimitive,
 	null::im3DRenderIndexedPrimitive,
 	null::im3DEnd,
-	null::deviceSystem
+	null::deviceSystem,
+	0, 0
 };
 
 }
@@ -14,6 +14,7 @@
 namespace rw {
 
 int32 Frame::numAllocated;
+FreeList *Frame::freeList;
 
 PluginList Frame::s_plglist(sizeof(Frame));
 static void *frameOpen(void *object, int32 offset, int32 size) { engine->frameDirtyList.init(); return object; }
@@ -28,7 +29,7 @@ Frame::registerModule(void)
 Frame*
 Frame::create(void)
 {
-	Frame *f = (Frame*)rwMalloc(s_plglist.size, MEMDUR_EVENT | ID_FRAMELIST);
+	Frame *f = (Frame*)freeList->alloc();
 	if(f == nil){
 		RWERROR((ERR_ALLOC, s_plglist.size));
 		return nil;
@@ -64,7 +65,10 @@ Frame::destroy(void)
 		this->inDirtyList.remove();
 	for(Frame *f = this->child; f; f = f->next)
 		f->object.parent = nil;
-	rwFree(this);
+	if(this->object.privateFlags & Object::INSTANCEBLOCK)
+		ClumpPrototype::release(this);
+	else
+		freeList->free(this);
 	numAllocated--;
 }
 
@@ -80,7 +84,11 @@ Frame::destroyHierarchy(void)
 	s_plglist.destruct(this);
 	if(this->object.privateFlags & Frame::HIERARCHYSYNC)
 		this->inDirtyList.remove();
-	rwFree(this);
+	if(this->object.privateFlags & Object::INSTANCEBLOCK)
+		ClumpPrototype::release(this);
+	else
+		freeList->free(this);
+	numAllocated--;
 }
 
 Frame*
@@ -207,9 +215,11 @@ syncRecurse(Frame *frame, uint8 hierarchyFlags)
 	for(; frame; frame = frame->next){
 		// If frame is dirty or any parent was dirty, update LTM
 		hierarchyFlags |= frame->object.privateFlags;
-		if(hierarchyFlags & Frame::SUBTREESYNCLTM)
+		if(hierarchyFlags & Frame::SUBTREESYNCLTM){
 			Matrix::mult(&frame->ltm, &frame->matrix,
 			             &frame->getParent()->ltm);
+			RWMETRIC(numFramesSynced, 1);
+		}
 		// Synch attached objects
 		FORLIST(lnk, frame->objectList)
 			ObjectWithFrame::fromFrame(lnk)->sync();
@@ -245,12 +255,15 @@ void
 Frame::syncDirty(void)
 {
 	Frame *frame;
+	RWTIMER("sync");
 	FORLIST(lnk, engine->frameDirtyList){
 		frame = LLLinkGetData(lnk, Frame, inDirtyList);
 		if(frame->object.privateFlags & Frame::HIERARCHYSYNCLTM){
 			// Sync root's LTM
-			if(frame->object.privateFlags & Frame::SUBTREESYNCLTM)
+			if(frame->object.privateFlags & Frame::SUBTREESYNCLTM){
 				frame->ltm = frame->matrix;
+				RWMETRIC(numFramesSynced, 1);
+			}
 			// Synch attached objects
 			FORLIST(lnk, frame->objectList)
 				ObjectWithFrame::fromFrame(lnk)->sync();
@@ -339,7 +352,10 @@ cloneRecurse(Frame *old, Frame *newroot)
 Frame*
 Frame::cloneAndLink(void)
 {
+	// get all frames from one contiguous run
+	freeList->beginBulk(this->count());
 	Frame *newhier = cloneRecurse(this, nil);
+	freeList->endBulk();
 	if(newhier){
 		// frame is not in dirty list so important to get this flag right
 		newhier->object.privateFlags &= ~HIERARCHYSYNC;
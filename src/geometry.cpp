@@ -17,6 +17,7 @@ namespace rw {
 
 int32 Geometry::numAllocated;
 int32 Material::numAllocated;
+FreeList *Material::freeList;
 
 PluginList Geometry::s_plglist(sizeof(Geometry));
 PluginList Material::s_plglist(sizeof(Material));
@@ -177,6 +178,11 @@ Geometry::streamRead(Stream *stream)
 			stream->read32(m->vertices, 3*geo->numVertices*4);
 		if(hasNormals)
 			stream->read32(m->normals, 3*geo->numVertices*4);
+		// keep the sphere from the file, only the box is new
+		if(hasVertices && geo->numVertices)
+			m->boundingBox.calculate(m->vertices, geo->numVertices);
+		else
+			m->boxFromSphere();
 	}
 
 	if(!findChunk(stream, ID_MATLIST, nil, nil)){
@@ -335,6 +341,7 @@ Geometry::addMorphTargets(int32 n)
 			mts->boundingSphere.center.y = 0.0f;
 			mts->boundingSphere.center.z = 0.0f;
 			mts->boundingSphere.radius = 0.0f;
+			mts->boxFromSphere();
 		}
 		if(!(this->flags & NATIVE) && this->numVertices){
 			mts->vertices = data;
@@ -354,7 +361,7 @@ Geometry::calculateBoundingSphere(void)
 {
 	for(int32 i = 0; i < this->numMorphTargets; i++){
 		MorphTarget *m = &this->morphTargets[i];
-		m->boundingSphere = m->calculateBoundingSphere();
+		m->calculateBounds();
 	}
 }
 
@@ -381,6 +388,11 @@ Geometry::allocateData(void)
 		sz += this->numVertices*sizeof(RGBA);
 	sz += this->numTexCoordSets*this->numVertices*sizeof(TexCoords);
 
+	// replaces whatever was kept after instancing
+	rwFree(this->triangles);
+	this->colors = nil;
+	for(int32 i = 0; i < 8; i++)
+		this->texCoords[i] = nil;
 	uint8 *data = (uint8*)rwNew(sz, MEMDUR_EVENT | ID_GEOMETRY);
 	this->triangles = (Triangle*)data;
 	data += this->numTriangles*sizeof(Triangle);
@@ -705,6 +717,28 @@ MorphTarget::calculateBoundingSphere(void) const
 	return sphere;
 }
 
+// Calculate box and sphere in one pass over the vertices
+void
+MorphTarget::calculateBounds(void)
+{
+	if(this->vertices == nil || this->parent->numVertices == 0){
+		this->boxFromSphere();
+		return;
+	}
+	this->boundingBox.calculate(this->vertices, this->parent->numVertices);
+	this->boundingSphere.center = scale(add(this->boundingBox.inf, this->boundingBox.sup), 1/2.0f);
+	this->boundingSphere.radius = length(sub(this->boundingBox.sup, this->boundingSphere.center));
+}
+
+// For morph targets without vertices
+void
+MorphTarget::boxFromSphere(void)
+{
+	V3d r = { this->boundingSphere.radius, this->boundingSphere.radius, this->boundingSphere.radius };
+	this->boundingBox.inf = sub(this->boundingSphere.center, r);
+	this->boundingBox.sup = add(this->boundingSphere.center, r);
+}
+
 
 //
 // MaterialList
@@ -857,7 +891,7 @@ MaterialList::streamGetSize(void)
 Material*
 Material::create(void)
 {
-	Material *mat = (Material*)rwMalloc(s_plglist.size, MEMDUR_EVENT | ID_MATERIAL);
+	Material *mat = (Material*)freeList->alloc();
 	if(mat == nil){
 		RWERROR((ERR_ALLOC, s_plglist.size));
 		return nil;
@@ -897,7 +931,7 @@ Material::destroy(void)
 		s_plglist.destruct(this);
 		if(this->texture)
 			this->texture->destroy();
-		rwFree(this);
+		freeList->free(this);
 		numAllocated--;
 	}
 }
@@ -107,7 +107,13 @@ const char *shaderDecl;
 
 static GLuint vao;
 #ifdef RW_GL_USE_UBOS
-static GLuint ubo_state, ubo_scene, ubo_object;
+// All uniform blocks are sub-allocated from one streaming buffer
+// and bound with glBindBufferRange. It's orphaned when full.
+#define UBORINGSIZE (256*1024)
+static GLuint ubo_ring;
+static uint32 uboRingOffset;
+static GLint uboAlignment;
+static int32 block_state, block_scene, block_object;
 #endif
 static GLuint whitetex;
 static UniformState uniformState;
@@ -136,18 +142,24 @@ int32 u_lightColor;
 int32 u_matColor;
 int32 u_surfProps;
 
+ShaderPermutations *defaultShaders;
 Shader *defaultShader, *defaultShader_noAT;
 Shader *defaultShader_fullLight, *defaultShader_fullLight_noAT;
 
 static bool32 stateDirty = 1;
 static bool32 sceneDirty = 1;
 static bool32 objectDirty = 1;
+static bool32 glStateDirty = 1;
+// what the last flushCache sent, to skip draws that change nothing
+static Shader *flushedShader;
+static uint32 flushedUniformSerial = ~0;
 
 struct RwRasterStateCache {
 	Raster *raster;
 	Texture::Addressing addressingU;
 	Texture::Addressing addressingV;
 	Texture::FilterMode filter;
+	int32 maxAnisotropy;
 };
 
 #define MAXNUMSTAGES 8
@@ -312,6 +324,7 @@ setGlRenderState(uint32 state, uint32 value)
 	case RWGL_STENCILMASK: curGlState.stencilMask = value; break;
 	case RWGL_STENCILWRITEMASK: curGlState.stencilWriteMask = value; break;
 	}
+	glStateDirty = 1;
 }
 
 void
@@ -375,6 +388,7 @@ flushGlRenderState(void)
 		oldGlState.cullFace = curGlState.cullFace;
 		glCullFace(oldGlState.cullFace);
 	}
+	glStateDirty = 0;
 }
 
 
@@ -514,9 +528,91 @@ static GLint addressConvMap[] = {
 	GL_CLAMP_TO_EDGE, GL_CLAMP_TO_BORDER
 };
 
+// With sampler objects the texture parameters are never touched,
+// each stage just binds the sampler for its (filter, address, aniso).
+#define MAXSAMPLERANISO 16
+static bool32 useSamplers;
+static GLuint samplers[2][nelem(filterConvMap_MIP)][nelem(addressConvMap)][nelem(addressConvMap)][MAXSAMPLERANISO];
+static GLuint boundSampler[MAXNUMSTAGES];
+static uint32 samplersDirty;
+
+static GLuint
+getSampler(bool32 mip, int32 filter, int32 addrU, int32 addrV, int32 aniso)
+{
+	if(filter <= 0 || filter >= (int32)nelem(filterConvMap_MIP))
+		filter = Texture::NEAREST;
+	if(addrU <= 0 || addrU >= (int32)nelem(addressConvMap))
+		addrU = Texture::WRAP;
+	if(addrV <= 0 || addrV >= (int32)nelem(addressConvMap))
+		addrV = Texture::WRAP;
+	if(aniso < 1)
+		aniso = 1;
+	if(aniso > MAXSAMPLERANISO)
+		aniso = MAXSAMPLERANISO;
+
+	GLuint *s = &samplers[!!mip][filter][addrU][addrV][aniso-1];
+	if(*s == 0){
+		glGenSamplers(1, s);
+		glSamplerParameteri(*s, GL_TEXTURE_MIN_FILTER, mip ? filterConvMap_MIP[filter] : filterConvMap_NoMIP[filter]);
+		glSamplerParameteri(*s, GL_TEXTURE_MAG_FILTER, filterConvMap_NoMIP[filter]);
+		glSamplerParameteri(*s, GL_TEXTURE_WRAP_S, addressConvMap[addrU]);
+		glSamplerParameteri(*s, GL_TEXTURE_WRAP_T, addressConvMap[addrV]);
+		if(aniso > 1 && maxAnisotropy > 1.0f)
+			glSamplerParameterf(*s, GL_TEXTURE_MAX_ANISOTROPY_EXT, aniso < maxAnisotropy ? (float)aniso : maxAnisotropy);
+	}
+	return *s;
+}
+
+static void
+flushSamplers(void)
+{
+	int i;
+	GLuint s;
+	RwRasterStateCache *ts;
+
+	for(i = 0; samplersDirty; i++, samplersDirty >>= 1){
+		if((samplersDirty & 1) == 0)
+			continue;
+		ts = &rwStateCache.texstage[i];
+		if(ts->raster){
+			Gl3Raster *natras = PLUGINOFFSET(Gl3Raster, ts->raster, nativeRasterOffset);
+			s = getSampler(natras->autogenMipmap || natras->numLevels > 1,
+				ts->filter, ts->addressingU, ts->addressingV, ts->maxAnisotropy);
+		}else
+			s = 0;	// white texture uses its own parameters
+		if(boundSampler[i] != s){
+			glBindSampler(i, s);
+			boundSampler[i] = s;
+		}
+	}
+}
+
+static void
+destroySamplers(void)
+{
+	GLuint *s = &samplers[0][0][0][0][0];
+	int32 i, n = sizeof(samplers)/sizeof(GLuint);
+	for(i = 0; i < n; i++)
+		if(s[i]){
+			glDeleteSamplers(1, &s[i]);
+			s[i] = 0;
+		}
+	for(i = 0; i < MAXNUMSTAGES; i++)
+		boundSampler[i] = 0;
+}
+
 static void
 setFilterMode(uint32 stage, int32 filter, int32 maxAniso = 1)
 {
+	if(useSamplers){
+		RwRasterStateCache *ts = &rwStateCache.texstage[stage];
+		if(ts->filter != (Texture::FilterMode)filter || ts->maxAnisotropy != maxAniso){
+			ts->filter = (Texture::FilterMode)filter;
+			ts->maxAnisotropy = maxAniso;
+			samplersDirty |= 1<<stage;
+		}
+		return;
+	}
 	if(rwStateCache.texstage[stage].filter != (Texture::FilterMode)filter){
 		rwStateCache.texstage[stage].filter = (Texture::FilterMode)filter;
 		Raster *raster = rwStateCache.texstage[stage].raster;
@@ -547,10 +643,14 @@ setAddressU(uint32 stage, int32 addressing)
 {
 	if(rwStateCache.texstage[stage].addressingU != (Texture::Addressing)addressing){
 		rwStateCache.texstage[stage].addressingU = (Texture::Addressing)addressing;
+		if(useSamplers){
+			samplersDirty |= 1<<stage;
+			return;
+		}
 		Raster *raster = rwStateCache.texstage[stage].raster;
 		if(raster){
 			Gl3Raster *natras = PLUGINOFFSET(Gl3Raster, raster, nativeRasterOffset);
-			if(natras->addressU == addressing){
+			if(natras->addressU != addressing){
 				setActiveTexture(stage);
 				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, addressConvMap[addressing]);
 				natras->addressU = addressing;
@@ -564,10 +664,14 @@ setAddressV(uint32 stage, int32 addressing)
 {
 	if(rwStateCache.texstage[stage].addressingV != (Texture::Addressing)addressing){
 		rwStateCache.texstage[stage].addressingV = (Texture::Addressing)addressing;
+		if(useSamplers){
+			samplersDirty |= 1<<stage;
+			return;
+		}
 		Raster *raster = rwStateCache.texstage[stage].raster;
 		if(raster){
 			Gl3Raster *natras = PLUGINOFFSET(Gl3Raster, rwStateCache.texstage[stage].raster, nativeRasterOffset);
-			if(natras->addressV == addressing){
+			if(natras->addressV != addressing){
 				setActiveTexture(stage);
 				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, addressConvMap[addressing]);
 				natras->addressV = addressing;
@@ -582,6 +686,7 @@ setRasterStageOnly(uint32 stage, Raster *raster)
 	bool32 alpha;
 	if(raster != rwStateCache.texstage[stage].raster){
 		rwStateCache.texstage[stage].raster = raster;
+		RWMETRIC(numTextureBinds, 1);
 		setActiveTexture(stage);
 		if(raster){
 			assert(raster->platform == PLATFORM_GL3);
@@ -591,12 +696,15 @@ setRasterStageOnly(uint32 stage, Raster *raster)
 			rwStateCache.texstage[stage].filter = (rw::Texture::FilterMode)natras->filterMode;
 			rwStateCache.texstage[stage].addressingU = (rw::Texture::Addressing)natras->addressU;
 			rwStateCache.texstage[stage].addressingV = (rw::Texture::Addressing)natras->addressV;
+			rwStateCache.texstage[stage].maxAnisotropy = natras->maxAnisotropy;
 
 			alpha = natras->hasAlpha;
 		}else{
 			bindTexture(whitetex);
 			alpha = 0;
 		}
+		if(useSamplers)
+			samplersDirty |= 1<<stage;
 
 		if(stage == 0){
 			if(alpha != rwStateCache.textureAlpha){
@@ -616,6 +724,7 @@ setRasterStage(uint32 stage, Raster *raster)
 	bool32 alpha;
 	if(raster != rwStateCache.texstage[stage].raster){
 		rwStateCache.texstage[stage].raster = raster;
+		RWMETRIC(numTextureBinds, 1);
 		setActiveTexture(stage);
 		if(raster){
 			assert(raster->platform == PLATFORM_GL3);
@@ -624,29 +733,34 @@ setRasterStage(uint32 stage, Raster *raster)
 			uint32 filter = rwStateCache.texstage[stage].filter;
 			uint32 addrU = rwStateCache.texstage[stage].addressingU;
 			uint32 addrV = rwStateCache.texstage[stage].addressingV;
-			if(natras->filterMode != filter){
-				if(natras->autogenMipmap || natras->numLevels > 1){
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filterConvMap_MIP[filter]);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filterConvMap_NoMIP[filter]);
-				}else{
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filterConvMap_NoMIP[filter]);
-					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filterConvMap_NoMIP[filter]);
+			// with samplers the parameters are set at flush time
+			if(!useSamplers){
+				if(natras->filterMode != filter){
+					if(natras->autogenMipmap || natras->numLevels > 1){
+						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filterConvMap_MIP[filter]);
+						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filterConvMap_NoMIP[filter]);
+					}else{
+						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, filterConvMap_NoMIP[filter]);
+						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, filterConvMap_NoMIP[filter]);
+					}
+					natras->filterMode = filter;
+				}
+				if(natras->addressU != addrU){
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, addressConvMap[addrU]);
+					natras->addressU = addrU;
+				}
+				if(natras->addressV != addrV){
+					glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, addressConvMap[addrV]);
+					natras->addressV = addrV;
 				}
-				natras->filterMode = filter;
-			}
-			if(natras->addressU != addrU){
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, addressConvMap[addrU]);
-				natras->addressU = addrU;
-			}
-			if(natras->addressV != addrV){
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, addressConvMap[addrV]);
-				natras->addressV = addrV;
 			}
 			alpha = natras->hasAlpha;
 		}else{
 			bindTexture(whitetex);
 			alpha = 0;
 		}
+		if(useSamplers)
+			samplersDirty |= 1<<stage;
 
 		if(stage == 0){
 			if(alpha != rwStateCache.textureAlpha){
@@ -938,6 +1052,7 @@ resetRenderState(void)
 	rwStateCache.alphaTestEnable = 0;
 
 	memset(&oldGlState, 0xFE, sizeof(oldGlState));
+	glStateDirty = 1;
 
 	rwStateCache.blendEnable = 0;
 	setGlRenderState(RWGL_BLEND, false);
@@ -978,15 +1093,24 @@ resetRenderState(void)
 	for(int i = 0; i < MAXNUMSTAGES; i++){
 		setActiveTexture(i);
 		bindTexture(whitetex);
+		if(useSamplers){
+			glBindSampler(i, 0);
+			boundSampler[i] = 0;
+		}
 	}
 	setActiveTexture(0);
+	if(useSamplers)
+		samplersDirty = (1<<MAXNUMSTAGES)-1;
+	flushedShader = nil;
 }
 
 void
 setWorldMatrix(Matrix *mat)
 {
 	convMatrix(&uniformObject.world, mat);
+#ifndef RW_GL_USE_UBOS
 	setUniform(u_world, &uniformObject.world);
+#endif
 	objectDirty = 1;
 }
 
@@ -1053,11 +1177,13 @@ setLights(WorldLights *lightData)
 
 	uniformObject.lightParams[n].type = 0.0f;
 
+#ifndef RW_GL_USE_UBOS
 	setUniform(u_ambLight, &uniformObject.ambLight);
 	setUniform(u_lightParams, uniformObject.lightParams);
 	setUniform(u_lightPosition, uniformObject.lightPosition);
 	setUniform(u_lightDirection, uniformObject.lightDirection);
 	setUniform(u_lightColor, uniformObject.lightColor);
+#endif
 out:
 	objectDirty = 1;
 	return bits;
@@ -1067,7 +1193,9 @@ void
 setProjectionMatrix(float32 *mat)
 {
 	memcpy(&uniformScene.proj, mat, 64);
+#ifndef RW_GL_USE_UBOS
 	setUniform(u_proj, uniformScene.proj);
+#endif
 	sceneDirty = 1;
 }
 
@@ -1075,7 +1203,9 @@ void
 setViewMatrix(float32 *mat)
 {
 	memcpy(&uniformScene.view, mat, 64);
+#ifndef RW_GL_USE_UBOS
 	setUniform(u_view, uniformScene.view);
+#endif
 	sceneDirty = 1;
 }
 
@@ -1096,10 +1226,45 @@ setMaterial(const RGBA &color, const SurfaceProperties &surfaceprops, float extr
 	setUniform(u_surfProps, surfProps);
 }
 
+#ifdef RW_GL_USE_UBOS
+static uint32
+uboAlign(uint32 size)
+{
+	return (size + uboAlignment-1) & ~(uboAlignment-1);
+}
+
+// Caller has to make sure the block fits, see flushCache
+static void
+uploadBlock(int32 block, void *data, uint32 size)
+{
+	uint32 offset = uboAlign(uboRingOffset);
+	GLbitfield access = GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT;
+	assert(offset + size <= UBORINGSIZE);
+	void *dst = glMapBufferRange(GL_UNIFORM_BUFFER, offset, size, access);
+	if(dst){
+		memcpy(dst, data, size);
+		glUnmapBuffer(GL_UNIFORM_BUFFER);
+	}else
+		glBufferSubData(GL_UNIFORM_BUFFER, offset, size, data);
+	glBindBufferRange(GL_UNIFORM_BUFFER, block, ubo_ring, offset, size);
+	uboRingOffset = offset + size;
+}
+#endif
+
 void
 flushCache(void)
 {
-	flushGlRenderState();
+	// nothing changed since the last draw
+	if(!glStateDirty && !(useSamplers && samplersDirty) &&
+	   !stateDirty && !sceneDirty && !objectDirty &&
+	   currentShader == flushedShader &&
+	   uniformRegistry.serialNum == flushedUniformSerial)
+		return;
+
+	if(glStateDirty)
+		flushGlRenderState();
+	if(useSamplers && samplersDirty)
+		flushSamplers();
 
 #ifndef RW_GL_USE_UBOS
 
@@ -1151,17 +1316,34 @@ flushCache(void)
 		uniformStateDirty[RWGL_FOGCOLOR] = false;
 	}
 
+	// only used to skip flushes here, the uniforms track themselves
+	stateDirty = 0;
+	sceneDirty = 0;
+	objectDirty = 0;
 #else
+	if(objectDirty || sceneDirty || stateDirty){
+		glBindBuffer(GL_UNIFORM_BUFFER, ubo_ring);
+		// Orphaning leaves the ranges that are still bound pointing
+		// into the old storage, so when the dirty blocks don't fit
+		// orphan first and upload all blocks again.
+		uint32 size = 0;
+		if(objectDirty) size += uboAlign(sizeof(UniformObject));
+		if(sceneDirty) size += uboAlign(sizeof(UniformScene));
+		if(stateDirty) size += uboAlign(sizeof(UniformState));
+		if(uboAlign(uboRingOffset) + size > UBORINGSIZE){
+			glBufferData(GL_UNIFORM_BUFFER, UBORINGSIZE, nil, GL_STREAM_DRAW);
+			uboRingOffset = 0;
+			objectDirty = 1;
+			sceneDirty = 1;
+			stateDirty = 1;
+		}
+	}
 	if(objectDirty){
-		glBindBuffer(GL_UNIFORM_BUFFER, ubo_object);
-		glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformObject), nil, GL_STREAM_DRAW);
-		glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformObject), &uniformObject, GL_STREAM_DRAW);
+		uploadBlock(block_object, &uniformObject, sizeof(UniformObject));
 		objectDirty = 0;
 	}
 	if(sceneDirty){
-		glBindBuffer(GL_UNIFORM_BUFFER, ubo_scene);
-		glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformScene), nil, GL_STREAM_DRAW);
-		glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformScene), &uniformScene, GL_STREAM_DRAW);
+		uploadBlock(block_scene, &uniformScene, sizeof(UniformScene));
 		sceneDirty = 0;
 	}
 	if(stateDirty){
@@ -1184,13 +1366,13 @@ flushCache(void)
 		uniformState.fogStart = rwStateCache.fogStart;
 		uniformState.fogEnd = rwStateCache.fogEnd;
 		uniformState.fogRange = 1.0f/(rwStateCache.fogStart - rwStateCache.fogEnd);
-		glBindBuffer(GL_UNIFORM_BUFFER, ubo_state);
-		glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformState), nil, GL_STREAM_DRAW);
-		glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformState), &uniformState, GL_STREAM_DRAW);
+		uploadBlock(block_state, &uniformState, sizeof(UniformState));
 		stateDirty = 0;
 	}
 #endif
 	flushUniforms();
+	flushedShader = currentShader;
+	flushedUniformSerial = uniformRegistry.serialNum;
 }
 
 static void
@@ -1504,6 +1686,7 @@ openSDL2(EngineOpenParams *openparams)
 	glGlobals.winHeight = openparams->height;
 	glGlobals.winTitle = openparams->windowtitle;
 	glGlobals.pWindow = openparams->window;
+	shaderCachePath = openparams->shaderCachePath;
 
 	memset(&gl3Caps, 0, sizeof(gl3Caps));
 
@@ -1659,6 +1842,7 @@ openGLFW(EngineOpenParams *openparams)
 	glGlobals.winHeight = openparams->height;
 	glGlobals.winTitle = openparams->windowtitle;
 	glGlobals.pWindow = openparams->window;
+	shaderCachePath = openparams->shaderCachePath;
 
 	memset(&gl3Caps, 0, sizeof(gl3Caps));
 
@@ -1790,6 +1974,15 @@ initOpenGL(void)
 
 	glGetFloatv(GL_MAX_TEXTURE_MAX_ANISOTROPY_EXT, &gl3Caps.maxAnisotropy);
 
+	// glversion is what we asked for, not what we got, so check the extension.
+	// glad only loads the entry points for GLES 3 or the ARB extension.
+	if((gl3Caps.gles ? gl3Caps.glversion >= 30 : GLAD_GL_ARB_get_program_binary) &&
+	   glGetProgramBinary && glProgramBinary && glProgramParameteri){
+		GLint numFormats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &numFormats);
+		gl3Caps.programBinary = numFormats > 0;
+	}
+
 	if(gl3Caps.gles){
 		if(gl3Caps.glversion >= 30)
 			shaderDecl = shaderDecl310es;
@@ -1816,9 +2009,9 @@ initOpenGL(void)
 	u_lightColor = registerUniform("u_lightColor", UNIFORM_VEC4, MAX_LIGHTS);
 	lastShaderUploaded = nil;
 #else
-	registerBlock("Scene");
-	registerBlock("Object");
-	registerBlock("State");
+	block_scene = registerBlock("Scene");
+	block_object = registerBlock("Object");
+	block_state = registerBlock("State");
 #endif
 	u_matColor = registerUniform("u_matColor", UNIFORM_VEC4);
 	u_surfProps = registerUniform("u_surfProps", UNIFORM_VEC4);
@@ -1828,6 +2021,11 @@ initOpenGL(void)
 
 	glClearColor(0.25, 0.25, 0.25, 1.0);
 
+	if(gl3Caps.gles)
+		useSamplers = gl3Caps.glversion >= 30;
+	else
+		useSamplers = gl3Caps.glversion >= 33;
+
 	byte whitepixel[4] = {0xFF, 0xFF, 0xFF, 0xFF};
 	glGenTextures(1, &whitetex);
 	glBindTexture(GL_TEXTURE_2D, whitetex);
@@ -1848,44 +2046,29 @@ initOpenGL(void)
 	}
 
 #ifdef RW_GL_USE_UBOS
-	glGenBuffers(1, &ubo_state);
-	glBindBuffer(GL_UNIFORM_BUFFER, ubo_state);
-	glBindBufferBase(GL_UNIFORM_BUFFER, gl3::findBlock("State"), ubo_state);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformState), &uniformState,
-	             GL_STREAM_DRAW);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-	glGenBuffers(1, &ubo_scene);
-	glBindBuffer(GL_UNIFORM_BUFFER, ubo_scene);
-	glBindBufferBase(GL_UNIFORM_BUFFER, gl3::findBlock("Scene"), ubo_scene);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformScene), &uniformScene,
-	             GL_STREAM_DRAW);
-	glBindBuffer(GL_UNIFORM_BUFFER, 0);
-
-	glGenBuffers(1, &ubo_object);
-	glBindBuffer(GL_UNIFORM_BUFFER, ubo_object);
-	glBindBufferBase(GL_UNIFORM_BUFFER, gl3::findBlock("Object"), ubo_object);
-	glBufferData(GL_UNIFORM_BUFFER, sizeof(UniformObject), &uniformObject,
-	             GL_STREAM_DRAW);
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &uboAlignment);
+	if(uboAlignment < 1)
+		uboAlignment = 256;
+	glGenBuffers(1, &ubo_ring);
+	glBindBuffer(GL_UNIFORM_BUFFER, ubo_ring);
+	glBufferData(GL_UNIFORM_BUFFER, UBORINGSIZE, nil, GL_STREAM_DRAW);
+	uboRingOffset = 0;
+	uploadBlock(block_state, &uniformState, sizeof(UniformState));
+	uploadBlock(block_scene, &uniformScene, sizeof(UniformScene));
+	uploadBlock(block_object, &uniformObject, sizeof(UniformObject));
 	glBindBuffer(GL_UNIFORM_BUFFER, 0);
 #endif
 
 #include "shaders/default_vs_gl.inc"
 #include "shaders/simple_fs_gl.inc"
-	const char *vs[] = { shaderDecl, header_vert_src, default_vert_src, nil };
-	const char *vs_fullLight[] = { shaderDecl, "#define DIRECTIONALS\n#define POINTLIGHTS\n#define SPOTLIGHTS\n", header_vert_src, default_vert_src, nil };
-	const char *fs[] = { shaderDecl, header_frag_src, simple_frag_src, nil };
-	const char *fs_noAT[] = { shaderDecl, "#define NO_ALPHATEST\n", header_frag_src, simple_frag_src, nil };
+	const char *vs[] = { header_vert_src, default_vert_src, nil };
+	const char *fs[] = { header_frag_src, simple_frag_src, nil };
 
-	defaultShader = Shader::create(vs, fs);
-	assert(defaultShader);
-	defaultShader_noAT = Shader::create(vs, fs_noAT);
-	assert(defaultShader_noAT);
-
-	defaultShader_fullLight = Shader::create(vs_fullLight, fs);
-	assert(defaultShader_fullLight);
-	defaultShader_fullLight_noAT = Shader::create(vs_fullLight, fs_noAT);
-	assert(defaultShader_fullLight_noAT);
+	defaultShaders = ShaderPermutations::create(vs, fs);
+	defaultShader = defaultShaders->get(0, true);
+	defaultShader_noAT = defaultShaders->get(0, false);
+	defaultShader_fullLight = defaultShaders->get(VSLIGHT_MASK, true);
+	defaultShader_fullLight_noAT = defaultShaders->get(VSLIGHT_MASK, false);
 
 	openIm2D();
 	openIm3D();
@@ -1899,18 +2082,23 @@ termOpenGL(void)
 	closeIm3D();
 	closeIm2D();
 
-	defaultShader->destroy();
+	defaultShaders->destroy();
+	defaultShaders = nil;
 	defaultShader = nil;
-	defaultShader_noAT->destroy();
 	defaultShader_noAT = nil;
-	defaultShader_fullLight->destroy();
 	defaultShader_fullLight = nil;
-	defaultShader_fullLight_noAT->destroy();
 	defaultShader_fullLight_noAT = nil;
 
 	glDeleteTextures(1, &whitetex);
 	whitetex = 0;
 
+	if(useSamplers)
+		destroySamplers();
+#ifdef RW_GL_USE_UBOS
+	glDeleteBuffers(1, &ubo_ring);
+	ubo_ring = 0;
+#endif
+
 	return 1;
 }
 
@@ -2091,10 +2279,12 @@ Device renderdevice = {
 	gl3::im3DRenderIndexedPrimitive,
 	gl3::im3DEnd,
 #ifdef LIBRW_SDL2
-	gl3::deviceSystemSDL2
+	gl3::deviceSystemSDL2,
 #else
-	gl3::deviceSystemGLFW
+	gl3::deviceSystemGLFW,
 #endif
+	sizeof(gl3::Im2DVertex),
+	sizeof(gl3::Im3DVertex)
 };
 
 }
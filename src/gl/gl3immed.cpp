@@ -23,12 +23,143 @@ uint32 im2DVbo, im2DIbo;
 uint32 im2DVao;
 #endif
 
-Shader *im2dOverrideShader;
+static Shader *im2dOverrideShader;
+
+// Batched Im2D is only drawn at the next flush, with whatever shader
+// is set then. So draw what's pending and don't batch at all while an
+// override is set, its uniforms may change between primitives.
+void
+setIm2DOverrideShader(Shader *shader)
+{
+	if(shader == im2dOverrideShader)
+		return;
+	FlushImmediate();
+	im2dOverrideShader = shader;
+	engine->device.im2DVertexSize = shader ? 0 : sizeof(Im2DVertex);
+}
+
+Shader*
+getIm2DOverrideShader(void)
+{
+	return im2dOverrideShader;
+}
 
 static int32 u_xform;
 
-#define STARTINDICES 10000
-#define STARTVERTICES 10000
+// Vertices and indices are appended to ring buffers that are only
+// orphaned when they wrap around, vertex rings hold 64k vertices
+// so indices can be rebased to where the vertices ended up.
+#define RINGVERTICES 0x10000
+#define RINGINDICES (3*0x10000)
+
+struct ImRing
+{
+	uint32 buffer;
+	GLenum target;
+	uint32 size;
+	uint32 offset;
+};
+
+static uint8 *ringScratch;	// when buffers can't be mapped
+static uint32 ringScratchSize;
+
+static void
+ringCreate(ImRing *ring, GLenum target, uint32 size)
+{
+	glGenBuffers(1, &ring->buffer);
+	glBindBuffer(target, ring->buffer);
+	glBufferData(target, size, nil, GL_STREAM_DRAW);
+	ring->target = target;
+	ring->size = size;
+	ring->offset = 0;
+}
+
+// Start over with fresh storage, the buffer is bound afterwards.
+static void
+ringOrphan(ImRing *ring)
+{
+	glBindBuffer(ring->target, ring->buffer);
+	glBufferData(ring->target, ring->size, nil, GL_STREAM_DRAW);
+	ring->offset = 0;
+}
+
+// Get space for size bytes at an offset aligned to align,
+// the buffer is bound afterwards.
+static uint8*
+ringMap(ImRing *ring, uint32 size, uint32 align, uint32 *offset)
+{
+	uint32 off = (ring->offset + align-1)/align*align;
+	glBindBuffer(ring->target, ring->buffer);
+	if(off + size > ring->size){
+		if(size > ring->size)
+			ring->size = size;
+		ringOrphan(ring);
+		off = 0;
+	}
+	ring->offset = off + size;
+	*offset = off;
+	if(gl3Caps.glversion >= 30)
+		return (uint8*)glMapBufferRange(ring->target, off, size,
+			GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if(size > ringScratchSize){
+		ringScratchSize = size;
+		ringScratch = rwResizeT(uint8, ringScratch, size, MEMDUR_EVENT | ID_DRIVER);
+	}
+	return ringScratch;
+}
+
+static void
+ringUnmap(ImRing *ring, uint32 offset, uint32 size)
+{
+	if(gl3Caps.glversion >= 30)
+		glUnmapBuffer(ring->target);
+	else
+		glBufferSubData(ring->target, offset, size, ringScratch);
+}
+
+static uint32
+ringUpload(ImRing *ring, void *data, uint32 size, uint32 align)
+{
+	uint32 offset;
+	memcpy(ringMap(ring, size, align, &offset), data, size);
+	ringUnmap(ring, offset, size);
+	return offset;
+}
+
+// Returns the index of the first vertex. Vertices never end up past
+// 64k unless there are that many, so rebased 16 bit indices don't
+// wrap, even after an oversized upload has grown the ring.
+static uint32
+ringUploadVertices(ImRing *ring, void *vertices, int32 numVertices, uint32 stride)
+{
+	uint32 first = (ring->offset + stride-1)/stride;
+	if(first + numVertices > RINGVERTICES)
+		ringOrphan(ring);
+	return ringUpload(ring, vertices, numVertices*stride, stride) / stride;
+}
+
+// Indices rebased to the first vertex, returns byte offset
+static uint32
+ringUploadIndices(ImRing *ring, void *indices, int32 numIndices, uint32 first)
+{
+	uint32 offset;
+	uint32 size = numIndices*2;
+	uint16 *src = (uint16*)indices;
+	uint16 *dst = (uint16*)ringMap(ring, size, 2, &offset);
+	for(int32 i = 0; i < numIndices; i++)
+		dst[i] = src[i] + first;
+	ringUnmap(ring, offset, size);
+	return offset;
+}
+
+static void
+ringDestroy(ImRing *ring)
+{
+	glDeleteBuffers(1, &ring->buffer);
+	ring->buffer = 0;
+}
+
+static ImRing im2DVertRing, im2DIndexRing;
 
 static Shader *im2dShader;
 static AttribDesc im2dattribDesc[3] = {
@@ -63,13 +194,10 @@ openIm2D(void)
 	im2dShader = Shader::create(vs, fs);
 	assert(im2dShader);
 
-	glGenBuffers(1, &im2DIbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, im2DIbo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, STARTINDICES*2, nil, GL_STREAM_DRAW);
-
-	glGenBuffers(1, &im2DVbo);
-	glBindBuffer(GL_ARRAY_BUFFER, im2DVbo);
-	glBufferData(GL_ARRAY_BUFFER, STARTVERTICES*sizeof(Im2DVertex), nil, GL_STREAM_DRAW);
+	ringCreate(&im2DIndexRing, GL_ELEMENT_ARRAY_BUFFER, RINGINDICES*2);
+	ringCreate(&im2DVertRing, GL_ARRAY_BUFFER, RINGVERTICES*sizeof(Im2DVertex));
+	im2DIbo = im2DIndexRing.buffer;
+	im2DVbo = im2DVertRing.buffer;
 
 #ifdef RW_GL_USE_VAOS
 	glGenVertexArrays(1, &im2DVao);
@@ -81,11 +209,15 @@ openIm2D(void)
 void
 closeIm2D(void)
 {
-	glDeleteBuffers(1, &im2DIbo);
-	glDeleteBuffers(1, &im2DVbo);
+	ringDestroy(&im2DIndexRing);
+	ringDestroy(&im2DVertRing);
+	im2DIbo = im2DVbo = 0;
 #ifdef RW_GL_USE_VAOS
 	glDeleteVertexArrays(1, &im2DVao);
 #endif
+	rwFree(ringScratch);
+	ringScratch = nil;
+	ringScratchSize = 0;
 	im2dShader->destroy();
 	im2dShader = nil;
 }
@@ -128,13 +260,12 @@ im2DSetXform(void)
 void
 im2DRenderPrimitive(PrimitiveType primType, void *vertices, int32 numVertices)
 {
+	uint32 first;
 #ifdef RW_GL_USE_VAOS
 	glBindVertexArray(im2DVao);
 #endif
 
-	glBindBuffer(GL_ARRAY_BUFFER, im2DVbo);
-	glBufferData(GL_ARRAY_BUFFER, STARTVERTICES*sizeof(Im2DVertex), nil, GL_STREAM_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, numVertices*sizeof(Im2DVertex), vertices);
+	first = ringUploadVertices(&im2DVertRing, vertices, numVertices, sizeof(Im2DVertex));
 
 	if(im2dOverrideShader)
 		im2dOverrideShader->use();
@@ -147,7 +278,7 @@ im2DRenderPrimitive(PrimitiveType primType, void *vertices, int32 numVertices)
 	im2DSetXform();
 
 	flushCache();
-	glDrawArrays(primTypeMap[primType], 0, numVertices);
+	glDrawArrays(primTypeMap[primType], first, numVertices);
 #ifndef RW_GL_USE_VAOS
 	disableAttribPointers(im2dattribDesc, 3);
 #endif
@@ -158,17 +289,13 @@ im2DRenderIndexedPrimitive(PrimitiveType primType,
 	void *vertices, int32 numVertices,
 	void *indices, int32 numIndices)
 {
+	uint32 first, offset;
 #ifdef RW_GL_USE_VAOS
 	glBindVertexArray(im2DVao);
 #endif
 
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, im2DIbo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, STARTINDICES*2, nil, GL_STREAM_DRAW);
-	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, numIndices*2, indices);
-
-	glBindBuffer(GL_ARRAY_BUFFER, im2DVbo);
-	glBufferData(GL_ARRAY_BUFFER, STARTVERTICES*sizeof(Im2DVertex), nil, GL_STREAM_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, numVertices*sizeof(Im2DVertex), vertices);
+	first = ringUploadVertices(&im2DVertRing, vertices, numVertices, sizeof(Im2DVertex));
+	offset = ringUploadIndices(&im2DIndexRing, indices, numIndices, first);
 
 	if(im2dOverrideShader)
 		im2dOverrideShader->use();
@@ -182,7 +309,7 @@ im2DRenderIndexedPrimitive(PrimitiveType primType,
 
 	flushCache();
 	glDrawElements(primTypeMap[primType], numIndices,
-	               GL_UNSIGNED_SHORT, nil);
+	               GL_UNSIGNED_SHORT, (void*)(uintptr)offset);
 #ifndef RW_GL_USE_VAOS
 	disableAttribPointers(im2dattribDesc, 3);
 #endif
@@ -205,7 +332,9 @@ static uint32 im3DVbo, im3DIbo;
 #ifdef RW_GL_USE_VAOS
 static uint32 im3DVao;
 #endif
-static int32 num3DVertices;	// not actually needed here
+static ImRing im3DVertRing, im3DIndexRing;
+static int32 num3DVertices;
+static uint32 first3DVertex;
 
 void
 openIm3D(void)
@@ -217,13 +346,10 @@ openIm3D(void)
 	im3dShader = Shader::create(vs, fs);
 	assert(im3dShader);
 
-	glGenBuffers(1, &im3DIbo);
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, im3DIbo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, STARTINDICES*2, nil, GL_STREAM_DRAW);
-
-	glGenBuffers(1, &im3DVbo);
-	glBindBuffer(GL_ARRAY_BUFFER, im3DVbo);
-	glBufferData(GL_ARRAY_BUFFER, STARTVERTICES*sizeof(Im3DVertex), nil, GL_STREAM_DRAW);
+	ringCreate(&im3DIndexRing, GL_ELEMENT_ARRAY_BUFFER, RINGINDICES*2);
+	ringCreate(&im3DVertRing, GL_ARRAY_BUFFER, RINGVERTICES*sizeof(Im3DVertex));
+	im3DIbo = im3DIndexRing.buffer;
+	im3DVbo = im3DVertRing.buffer;
 
 #ifdef RW_GL_USE_VAOS
 	glGenVertexArrays(1, &im3DVao);
@@ -235,8 +361,9 @@ openIm3D(void)
 void
 closeIm3D(void)
 {
-	glDeleteBuffers(1, &im3DIbo);
-	glDeleteBuffers(1, &im3DVbo);
+	ringDestroy(&im3DIndexRing);
+	ringDestroy(&im3DVertRing);
+	im3DIbo = im3DVbo = 0;
 #ifdef RW_GL_USE_VAOS
 	glDeleteVertexArrays(1, &im3DVao);
 #endif
@@ -262,9 +389,7 @@ im3DTransform(void *vertices, int32 numVertices, Matrix *world, uint32 flags)
 	glBindVertexArray(im2DVao);
 #endif
 
-	glBindBuffer(GL_ARRAY_BUFFER, im3DVbo);
-	glBufferData(GL_ARRAY_BUFFER, STARTVERTICES*sizeof(Im3DVertex), nil, GL_STREAM_DRAW);
-	glBufferSubData(GL_ARRAY_BUFFER, 0, numVertices*sizeof(Im3DVertex), vertices);
+	first3DVertex = ringUploadVertices(&im3DVertRing, vertices, numVertices, sizeof(Im3DVertex));
 #ifndef RW_GL_USE_VAOS
 	setAttribPointers(im3dattribDesc, 3);
 #endif
@@ -277,19 +402,17 @@ im3DRenderPrimitive(PrimitiveType primType)
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, im3DIbo);
 
 	flushCache();
-	glDrawArrays(primTypeMap[primType], 0, num3DVertices);
+	glDrawArrays(primTypeMap[primType], first3DVertex, num3DVertices);
 }
 
 void
 im3DRenderIndexedPrimitive(PrimitiveType primType, void *indices, int32 numIndices)
 {
-	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, im3DIbo);
-	glBufferData(GL_ELEMENT_ARRAY_BUFFER, STARTINDICES*2, nil, GL_STREAM_DRAW);
-	glBufferSubData(GL_ELEMENT_ARRAY_BUFFER, 0, numIndices*2, indices);
+	uint32 offset = ringUploadIndices(&im3DIndexRing, indices, numIndices, first3DVertex);
 
 	flushCache();
 	glDrawElements(primTypeMap[primType], numIndices,
-	               GL_UNSIGNED_SHORT, nil);
+	               GL_UNSIGNED_SHORT, (void*)(uintptr)offset);
 }
 
 void
@@ -24,8 +24,7 @@ namespace gl3 {
 
 #ifdef RW_OPENGL
 
-static Shader *envShader, *envShader_noAT;
-static Shader *envShader_fullLight, *envShader_fullLight_noAT;
+static ShaderPermutations *envShaders;
 static int32 u_texMatrix;
 static int32 u_fxparams;
 static int32 u_colorClamp;
@@ -43,17 +42,7 @@ matfxDefaultRender(InstanceDataHeader *header, InstanceData *inst, int32 vsBits,
 
 	rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
 
-	if((vsBits & VSLIGHT_MASK) == 0){
-		if(getAlphaTest())
-			defaultShader->use();
-		else
-			defaultShader_noAT->use();
-	}else{
-		if(getAlphaTest())
-			defaultShader_fullLight->use();
-		else
-			defaultShader_fullLight_noAT->use();
-	}
+	defaultShaders->get(vsBits, getAlphaTest())->use();
 
 	drawInst(header, inst);
 }
@@ -132,17 +121,7 @@ matfxEnvRender(InstanceDataHeader *header, InstanceData *inst, int32 vsBits, uin
 	rw::SetRenderState(VERTEXALPHA, 1);
 	rw::SetRenderState(SRCBLEND, BLENDONE);
 
-	if((vsBits & VSLIGHT_MASK) == 0){
-		if(getAlphaTest())
-			envShader->use();
-		else
-			envShader_noAT->use();
-	}else{
-		if(getAlphaTest())
-			envShader_fullLight->use();
-		else
-			envShader_fullLight_noAT->use();
-	}
+	envShaders->get(vsBits, getAlphaTest())->use();
 
 	drawInst(header, inst);
 
@@ -199,20 +178,10 @@ matfxOpen(void *o, int32, int32)
 	matFXGlobals.pipelines[PLATFORM_GL3] = makeMatFXPipeline();
 
 #include "shaders/matfx_gl.inc"
-	const char *vs[] = { shaderDecl, header_vert_src, matfx_env_vert_src, nil };
-	const char *vs_fullLight[] = { shaderDecl, "#define DIRECTIONALS\n#define POINTLIGHTS\n#define SPOTLIGHTS\n", header_vert_src, matfx_env_vert_src, nil };
-	const char *fs[] = { shaderDecl, header_frag_src, matfx_env_frag_src, nil };
-	const char *fs_noAT[] = { shaderDecl, "#define NO_ALPHATEST\n", header_frag_src, matfx_env_frag_src, nil };
-
-	envShader = Shader::create(vs, fs);
-	assert(envShader);
-	envShader_noAT = Shader::create(vs, fs_noAT);
-	assert(envShader_noAT);
+	const char *vs[] = { header_vert_src, matfx_env_vert_src, nil };
+	const char *fs[] = { header_frag_src, matfx_env_frag_src, nil };
 
-	envShader_fullLight = Shader::create(vs_fullLight, fs);
-	assert(envShader_fullLight);
-	envShader_fullLight_noAT = Shader::create(vs_fullLight, fs_noAT);
-	assert(envShader_fullLight_noAT);
+	envShaders = ShaderPermutations::create(vs, fs);
 
 	return o;
 }
@@ -223,14 +192,8 @@ matfxClose(void *o, int32, int32)
 	((ObjPipeline*)matFXGlobals.pipelines[PLATFORM_GL3])->destroy();
 	matFXGlobals.pipelines[PLATFORM_GL3] = nil;
 
-	envShader->destroy();
-	envShader = nil;
-	envShader_noAT->destroy();
-	envShader_noAT = nil;
-	envShader_fullLight->destroy();
-	envShader_fullLight = nil;
-	envShader_fullLight_noAT->destroy();
-	envShader_fullLight_noAT = nil;
+	envShaders->destroy();
+	envShaders = nil;
 
 	return o;
 }
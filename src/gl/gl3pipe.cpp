@@ -96,6 +96,7 @@ instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
 	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, header->ibo);
 	glBufferData(GL_ELEMENT_ARRAY_BUFFER, header->totalNumIndex*2,
 			header->indexBuffer, GL_STATIC_DRAW);
+	RWMETRIC(numInstanceBytes, header->totalNumIndex*2);
 
 	return header;
 }
@@ -303,6 +304,7 @@ defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
 	glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*attribs[0].stride,
 	             header->vertexBuffer, GL_STATIC_DRAW);
+	RWMETRIC(numInstanceBytes, header->totalNumVertex*attribs[0].stride);
 #ifdef RW_GL_USE_VAOS
 	setAttribPointers(header->attribDesc, header->numAttribs);
 	glBindVertexArray(0);
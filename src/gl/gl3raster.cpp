@@ -635,13 +635,65 @@ imageFindRasterFormat(Image *img, int32 type,
 	return 1;
 }
 
+// Compress image into a DXT raster
+static bool32
+rasterFromImageDXT(Raster *raster, Image *image)
+{
+	Gl3Raster *natras = GETGL3RASTEREXT(raster);
+	int32 dxt, blockSize;
+	switch(natras->internalFormat){
+#ifdef RW_OPENGL
+	case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+	case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+		dxt = 1;
+		blockSize = 8;
+		break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+		dxt = 3;
+		blockSize = 16;
+		break;
+	case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+		dxt = 5;
+		blockSize = 16;
+		break;
+#endif
+	default:
+		RWERROR((ERR_INVRASTER));
+		return 0;
+	}
+
+	bool unlock = false;
+	if(raster->pixels == nil){
+		raster->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+		unlock = true;
+	}
+
+	assert(raster->pixels);
+	assert(image->width == raster->width);
+	assert(image->height == raster->height);
+	// GL is upside down, so compress and then flip the blocks
+	int32 size = (raster->width+3)/4 * (raster->height+3)/4 * blockSize;
+	uint8 *tmp = rwNewT(uint8, size, MEMDUR_FUNCTION | ID_DRIVER);
+	image->getPixelsDXT(dxt, tmp, dxtQuality);
+	flipDXT(dxt, raster->pixels, tmp, raster->width, raster->height);
+	rwFree(tmp);
+
+	if(unlock)
+		raster->unlock(0);
+
+	return 1;
+}
+
 bool32
 rasterFromImage(Raster *raster, Image *image)
 {
 	if((raster->type&0xF) != Raster::TEXTURE)
 		return 0;
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
+	if(GETGL3RASTEREXT(raster)->isCompressed)
+		return rasterFromImageDXT(raster, image);
+
+	int32 srcFormat, dstFormat;
 
 	// Unpalettize image if necessary but don't change original
 	Image *truecolimg = nil;
@@ -656,33 +708,35 @@ rasterFromImage(Raster *raster, Image *image)
 
 	Gl3Raster *natras = GETGL3RASTEREXT(raster);
 	int32 format = raster->format&0xF00;
-	assert(!natras->isCompressed);
 	switch(image->depth){
 	case 32:
+		srcFormat = PIXFMT_RGBA8888;
 		if(gl3Caps.gles)
-			conv = conv_RGBA8888_from_RGBA8888;
+			dstFormat = PIXFMT_RGBA8888;
 		else if(format == Raster::C8888)
-			conv = conv_RGBA8888_from_RGBA8888;
+			dstFormat = PIXFMT_RGBA8888;
 		else if(format == Raster::C888)
-			conv = conv_RGB888_from_RGB888;
+			dstFormat = PIXFMT_RGB888;
 		else
 			goto err;
 		break;
 	case 24:
+		srcFormat = PIXFMT_RGB888;
 		if(gl3Caps.gles)
-			conv = conv_RGBA8888_from_RGB888;
+			dstFormat = PIXFMT_RGBA8888;
 		else if(format == Raster::C8888)
-			conv = conv_RGBA8888_from_RGB888;
+			dstFormat = PIXFMT_RGBA8888;
 		else if(format == Raster::C888)
-			conv = conv_RGB888_from_RGB888;
+			dstFormat = PIXFMT_RGB888;
 		else
 			goto err;
 		break;
 	case 16:
+		srcFormat = PIXFMT_ARGB1555;
 		if(gl3Caps.gles)
-			conv = conv_RGBA8888_from_ARGB1555;
+			dstFormat = PIXFMT_RGBA8888;
 		else if(format == Raster::C1555)
-			conv = conv_RGBA5551_from_ARGB1555;
+			dstFormat = PIXFMT_RGBA5551;
 		else
 			goto err;
 		break;
@@ -703,24 +757,13 @@ rasterFromImage(Raster *raster, Image *image)
 		unlock = true;
 	}
 
-	uint8 *pixels = raster->pixels;
-	assert(pixels);
-	uint8 *imgpixels = image->pixels + (image->height-1)*image->stride;
-
-	int x, y;
+	assert(raster->pixels);
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
-	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(rasrow, imgrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
-		imgpixels -= image->stride;
-		pixels += raster->stride;
-	}
+	// GL is upside down
+	convertPixels(raster->pixels, raster->stride, dstFormat,
+		image->pixels + (image->height-1)*image->stride, -image->stride, srcFormat,
+		image->width, image->height);
 	if(unlock)
 		raster->unlock(0);
 
@@ -744,24 +787,68 @@ rasterToImage(Raster *raster)
 
 	Gl3Raster *natras = GETGL3RASTEREXT(raster);
 	if(natras->isCompressed){
-		// TODO
-		RWERROR((ERR_INVRASTER));
-		return nil;
+		int32 dxt = 0, blockSize = 16;
+		switch(natras->internalFormat){
+#ifdef RW_OPENGL
+		case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+		case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+			dxt = 1;
+			blockSize = 8;
+			break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT:
+			dxt = 3;
+			break;
+		case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+			dxt = 5;
+			break;
+#endif
+		}
+		if(dxt == 0){
+			RWERROR((ERR_INVRASTER));
+			if(unlock)
+				raster->unlock(0);
+			return nil;
+		}
+
+		int w = raster->width;
+		int h = raster->height;
+		// pixels are in the upper left corner
+		if(w < 4) w = 4;
+		if(h < 4) h = 4;
+		image = Image::create(w, h, 32);
+		image->allocate();
+		// GL is upside down, so flip the blocks before decompressing
+		uint8 *tmp = rwNewT(uint8, w/4 * h/4 * blockSize, MEMDUR_FUNCTION | ID_DRIVER);
+		flipDXT(dxt, tmp, raster->pixels, raster->width, raster->height);
+		image->setPixelsDXT(dxt, tmp);
+		rwFree(tmp);
+		if(dxt == 1 && !natras->hasAlpha)
+			image->removeMask();
+		// fix it up again
+		image->width = raster->width;
+		image->height = raster->height;
+
+		if(unlock)
+			raster->unlock(0);
+		return image;
 	}
 
-	void (*conv)(uint8 *out, uint8 *in) = nil;
+	int32 srcFormat, dstFormat;
 	switch(raster->format & 0xF00){
 	case Raster::C1555:
 		depth = 16;
-		conv = conv_ARGB1555_from_RGBA5551;
+		srcFormat = PIXFMT_RGBA5551;
+		dstFormat = PIXFMT_ARGB1555;
 		break;
 	case Raster::C8888:
 		depth = 32;
-		conv = conv_RGBA8888_from_RGBA8888;
+		srcFormat = PIXFMT_RGBA8888;
+		dstFormat = PIXFMT_RGBA8888;
 		break;
 	case Raster::C888:
 		depth = 24;
-		conv = conv_RGB888_from_RGB888;
+		srcFormat = PIXFMT_RGB888;
+		dstFormat = PIXFMT_RGB888;
 		break;
 
 	default:
@@ -779,27 +866,23 @@ rasterToImage(Raster *raster)
 		return nil;
 	}
 		
-	uint8 *in, *out;
+	// GLES rasters are always RGBA8888
+	if(natras->bpp == 4){
+		srcFormat = PIXFMT_RGBA8888;
+		if(depth == 16){
+			depth = 32;
+			dstFormat = PIXFMT_RGBA8888;
+		}
+	}
+
 	image = Image::create(raster->width, raster->height, depth);
 	image->allocate();
 
-	uint8 *imgpixels = image->pixels + (image->height-1)*image->stride;
-	uint8 *pixels = raster->pixels;
-
-	int x, y;
 	assert(image->width == raster->width);
 	assert(image->height == raster->height);
-	for(y = 0; y < image->height; y++){
-		uint8 *imgrow = imgpixels;
-		uint8 *rasrow = pixels;
-		for(x = 0; x < image->width; x++){
-			conv(imgrow, rasrow);
-			imgrow += image->bpp;
-			rasrow += natras->bpp;
-		}
-		imgpixels -= image->stride;
-		pixels += raster->stride;
-	}
+	// GL is upside down
+	convertPixels(image->pixels + (image->height-1)*image->stride, -image->stride, dstFormat,
+		raster->pixels, raster->stride, srcFormat, image->width, image->height);
 
 	if(unlock)
 		raster->unlock(0);
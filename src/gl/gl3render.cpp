@@ -64,6 +64,7 @@ drawInst_GSemu(InstanceDataHeader *header, InstanceData *inst)
 void
 drawInst(InstanceDataHeader *header, InstanceData *inst)
 {
+	RWMETRIC(numMeshes, 1);
 	if(rw::GetRenderState(rw::GSALPHATEST))
 		drawInst_GSemu(header, inst);
 	else
@@ -158,17 +159,7 @@ defaultRenderCB(Atomic *atomic, InstanceDataHeader *header)
 
 		rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
 
-		if((vsBits & VSLIGHT_MASK) == 0){
-			if(getAlphaTest())
-				defaultShader->use();
-			else
-				defaultShader_noAT->use();
-		}else{
-			if(getAlphaTest())
-				defaultShader_fullLight->use();
-			else
-				defaultShader_fullLight_noAT->use();
-		}
+		defaultShaders->get(vsBits, getAlphaTest())->use();
 
 		drawInst(header, inst);
 		inst++;
@@ -13,6 +13,8 @@
 #include "rwgl3.h"
 #include "rwgl3shader.h"
 
+#define PLUGIN_ID ID_DRIVER
+
 namespace rw {
 namespace gl3 {
 
@@ -29,6 +31,26 @@ static int uniformTypesize[] = {
 	0, 4, 4, 16
 };
 
+// Open addressed name tables, index+1 and 0 for empty,
+// so looking up a name doesn't walk the whole registry.
+#define NAMEHASHSIZE 128	// power of two, at least twice MAX_UNIFORMS
+static int32 uniformHash[NAMEHASHSIZE];
+static int32 blockHash[NAMEHASHSIZE];
+
+const char *shaderCachePath;
+
+// FNV-1a
+static uint32
+hashString(uint32 h, const char *s)
+{
+	if(s == nil)
+		return h;
+	while(*s)
+		h = (h ^ (uint8)*s++) * 16777619u;
+	return h;
+}
+#define HASHSTART 2166136261u
+
 static char*
 shader_strdup(const char *name)
 {
@@ -58,6 +80,10 @@ registerUniform(const char *name, UniformType type, int32 num)
 	}
 	Uniform *u = &uniformRegistry.uniforms[uniformRegistry.numUniforms];
 	u->name = shader_strdup(name);
+	uint32 h = hashString(HASHSTART, name);
+	while(uniformHash[h & (NAMEHASHSIZE-1)])
+		h++;
+	uniformHash[h & (NAMEHASHSIZE-1)] = uniformRegistry.numUniforms+1;
 	u->type = type;
 	u->serialNum = 0;
 	if(type == UNIFORM_NA){
@@ -76,11 +102,15 @@ registerUniform(const char *name, UniformType type, int32 num)
 int32
 findUniform(const char *name)
 {
-	int i;
-	for(i = 0; i < uniformRegistry.numUniforms; i++)
-		if(strcmp(name, uniformRegistry.uniforms[i].name) == 0)
-			return i;
-	return -1;
+	int32 i;
+	uint32 h;
+	for(h = hashString(HASHSTART, name);; h++){
+		i = uniformHash[h & (NAMEHASHSIZE-1)];
+		if(i == 0)
+			return -1;
+		if(strcmp(name, uniformRegistry.uniforms[i-1].name) == 0)
+			return i-1;
+	}
 }
 
 int32
@@ -93,17 +123,25 @@ registerBlock(const char *name)
 	if(uniformRegistry.numBlocks+1 >= MAX_BLOCKS)
 		return -1;
 	uniformRegistry.blockNames[uniformRegistry.numBlocks] = shader_strdup(name);
+	uint32 h = hashString(HASHSTART, name);
+	while(blockHash[h & (NAMEHASHSIZE-1)])
+		h++;
+	blockHash[h & (NAMEHASHSIZE-1)] = uniformRegistry.numBlocks+1;
 	return uniformRegistry.numBlocks++;
 }
 
 int32
 findBlock(const char *name)
 {
-	int i;
-	for(i = 0; i < uniformRegistry.numBlocks; i++)
-		if(strcmp(name, uniformRegistry.blockNames[i]) == 0)
-			return i;
-	return -1;
+	int32 i;
+	uint32 h;
+	for(h = hashString(HASHSTART, name);; h++){
+		i = blockHash[h & (NAMEHASHSIZE-1)];
+		if(i == 0)
+			return -1;
+		if(strcmp(name, uniformRegistry.blockNames[i-1]) == 0)
+			return i-1;
+	}
 }
 
 void
@@ -115,6 +153,7 @@ setUniform(int32 id, void *data)
 		memcpy(u->data, data, uniformTypesize[u->type]*u->num * sizeof(float));
 		//u->dirty = true;
 		u->serialNum++;
+		uniformRegistry.serialNum++;
 	}
 }
 
@@ -224,6 +263,9 @@ linkprogram(GLint vs, GLint fs, GLuint *program)
 		glBindAttribLocation(prog, ATTRIB_TEXCOORDS1, "in_tex1");
 	}
 
+	if(gl3Caps.programBinary && shaderCachePath)
+		glProgramParameteri(prog, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+
 	glAttachShader(prog, vs);
 	glAttachShader(prog, fs);
 	glLinkProgram(prog);
@@ -241,32 +283,180 @@ linkprogram(GLint vs, GLint fs, GLuint *program)
 	return 0;
 }
 
+/*
+ * Program binary cache.
+ * Files are named after a hash of the sources and the driver,
+ * a binary the driver rejects is just compiled again.
+ */
+
+struct ShaderBinaryHeader
+{
+	uint32 magic;
+	uint32 hash;
+	uint32 format;
+	uint32 length;
+};
+#define SHADERBINARYMAGIC 0x42535752	// "RWSB"
+
+static uint32
+hashSources(const char **vsrc, const char **fsrc)
+{
+	uint32 h = HASHSTART;
+	h = hashString(h, (const char*)glGetString(GL_RENDERER));
+	h = hashString(h, (const char*)glGetString(GL_VERSION));
+	for(; *vsrc; vsrc++)
+		h = hashString(h, *vsrc);
+	h = hashString(h, "//fragment\n");
+	for(; *fsrc; fsrc++)
+		h = hashString(h, *fsrc);
+	return h;
+}
+
+static void
+binaryPath(char *path, size_t size, uint32 hash)
+{
+	snprintf(path, size, "%s/%08x.bin", shaderCachePath, hash);
+}
+
+static GLuint
+loadProgramBinary(uint32 hash)
+{
+	char path[1024];
+	ShaderBinaryHeader header;
+	void *f, *data;
+	GLuint prog;
+	GLint success;
+
+	binaryPath(path, sizeof(path), hash);
+	f = engine->filefuncs.rwfopen(path, "rb");
+	if(f == nil)
+		return 0;
+	prog = 0;
+	if(engine->filefuncs.rwfread(&header, sizeof(header), 1, f) == 1 &&
+	   header.magic == SHADERBINARYMAGIC && header.hash == hash &&
+	   header.length > 0 && header.length < 64*1024*1024){
+		data = rwMalloc(header.length, MEMDUR_FUNCTION | ID_DRIVER);
+		if(engine->filefuncs.rwfread(data, 1, header.length, f) == header.length){
+			prog = glCreateProgram();
+			glProgramBinary(prog, header.format, data, header.length);
+			glGetProgramiv(prog, GL_LINK_STATUS, &success);
+			if(!success){
+				glDeleteProgram(prog);
+				prog = 0;
+			}
+		}
+		rwFree(data);
+	}
+	engine->filefuncs.rwfclose(f);
+	return prog;
+}
+
+static void
+saveProgramBinary(GLuint prog, uint32 hash)
+{
+	char path[1024];
+	ShaderBinaryHeader header;
+	void *f, *data;
+	GLint len;
+	GLenum format;
+
+	glGetProgramiv(prog, GL_PROGRAM_BINARY_LENGTH, &len);
+	if(len <= 0)
+		return;
+	data = rwMalloc(len, MEMDUR_FUNCTION | ID_DRIVER);
+	glGetProgramBinary(prog, len, &len, &format, data);
+	binaryPath(path, sizeof(path), hash);
+	f = engine->filefuncs.rwfopen(path, "wb");
+	if(f){
+		header.magic = SHADERBINARYMAGIC;
+		header.hash = hash;
+		header.format = format;
+		header.length = len;
+		engine->filefuncs.rwfwrite(&header, sizeof(header), 1, f);
+		engine->filefuncs.rwfwrite(data, 1, len, f);
+		engine->filefuncs.rwfclose(f);
+	}
+	rwFree(data);
+}
+
+// Concatenate the sources into one block we own:
+// a nil terminated array with a single string, followed by the text.
+static const char**
+copySources(const char **src)
+{
+	int n;
+	size_t len;
+	const char **dst;
+	char *text;
+	len = 1;
+	for(n = 0; src[n]; n++)
+		len += strlen(src[n]);
+	dst = (const char**)rwMalloc(2*sizeof(const char*) + len, MEMDUR_EVENT | ID_DRIVER);
+	text = (char*)&dst[2];
+	dst[0] = text;
+	dst[1] = nil;
+	for(n = 0; src[n]; n++){
+		len = strlen(src[n]);
+		memcpy(text, src[n], len);
+		text += len;
+	}
+	*text = '\0';
+	return dst;
+}
+
+// Copies the sources, the program is built on first use.
 Shader*
 Shader::create(const char **vsrc, const char **fsrc)
+{
+	Shader *sh = rwNewT(Shader, 1, MEMDUR_EVENT | ID_DRIVER);	 // or global?
+	sh->program = 0;
+	sh->uniformLocations = nil;
+	sh->serialNums = nil;
+	sh->numUniforms = 0;
+	sh->vsrc = copySources(vsrc);
+	sh->fsrc = copySources(fsrc);
+	return sh;
+}
+
+void
+Shader::compile(void)
 {
 	GLuint vs, fs, program;
+	uint32 hash;
+	bool32 useCache;
 	int i;
 	int fail;
 
-	fail = compileshader(GL_VERTEX_SHADER, vsrc, &vs);
-	if(fail)
-		return nil;
-
-	fail = compileshader(GL_FRAGMENT_SHADER, fsrc, &fs);
-	if(fail){
-		glDeleteShader(vs);
-		return nil;
+	program = 0;
+	hash = 0;
+	useCache = gl3Caps.programBinary && shaderCachePath;
+	if(useCache){
+		hash = hashSources(this->vsrc, this->fsrc);
+		program = loadProgramBinary(hash);
 	}
 
-	fail = linkprogram(vs, fs, &program);
+	if(program == 0){
+		fail = compileshader(GL_VERTEX_SHADER, this->vsrc, &vs);
+		if(fail)
+			goto out;
 
-	glDeleteShader(vs);
-	glDeleteShader(fs);
-	if(fail){
-		return nil;
-	}
+		fail = compileshader(GL_FRAGMENT_SHADER, this->fsrc, &fs);
+		if(fail){
+			glDeleteShader(vs);
+			goto out;
+		}
 
-	Shader *sh = rwNewT(Shader, 1, MEMDUR_EVENT | ID_DRIVER);	 // or global?
+		fail = linkprogram(vs, fs, &program);
+
+		glDeleteShader(vs);
+		glDeleteShader(fs);
+		if(fail){
+			program = 0;
+			goto out;
+		}
+		if(useCache)
+			saveProgramBinary(program, hash);
+	}
 
 #ifdef xxxRW_GLES2
 	int numUniforms;
@@ -303,15 +493,23 @@ Shader::create(const char **vsrc, const char **fsrc)
 			glUniformBlockBinding(program, idx, i);
 	}
 
-	// query uniform locations
-	sh->program = program;
-	sh->numUniforms = uniformRegistry.numUniforms;
-	sh->uniformLocations = rwNewT(GLint, uniformRegistry.numUniforms, MEMDUR_EVENT | ID_DRIVER);
-	sh->serialNums = rwNewT(uint32, uniformRegistry.numUniforms, MEMDUR_EVENT | ID_DRIVER);
+out:
+	// query uniform locations,
+	// a program that failed to build just has none
+	this->program = program;
+	this->numUniforms = uniformRegistry.numUniforms;
+	this->uniformLocations = rwNewT(GLint, uniformRegistry.numUniforms, MEMDUR_EVENT | ID_DRIVER);
+	this->serialNums = rwNewT(uint32, uniformRegistry.numUniforms, MEMDUR_EVENT | ID_DRIVER);
 	for(i = 0; i < uniformRegistry.numUniforms; i++){
-		sh->uniformLocations[i] = glGetUniformLocation(program,
-			uniformRegistry.uniforms[i].name);
-		sh->serialNums[i] = ~0;	// let's hope this means dirty
+		this->uniformLocations[i] = program ? glGetUniformLocation(program,
+			uniformRegistry.uniforms[i].name) : -1;
+		this->serialNums[i] = ~0;	// let's hope this means dirty
+	}
+	// a new shader may reuse a freed one's address, make sure it gets flushed
+	uniformRegistry.serialNum++;
+	if(program == 0){
+		RWERROR((ERR_GENERAL, "shader failed to build"));
+		return;
 	}
 
 	// set samplers
@@ -327,14 +525,14 @@ Shader::create(const char **vsrc, const char **fsrc)
 	// reset program
 	if(currentShader)
 		glUseProgram(currentShader->program);
-
-	return sh;
 }
 
 void
 Shader::use(void)
 {
 	if(currentShader != this){
+		if(this->uniformLocations == nil)
+			this->compile();
 		glUseProgram(this->program);
 		currentShader = this;
 	}
@@ -343,9 +541,84 @@ Shader::use(void)
 void
 Shader::destroy(void)
 {
-	glDeleteProgram(this->program);
+	if(currentShader == this)
+		currentShader = nil;
+	if(this->program)
+		glDeleteProgram(this->program);
 	rwFree(this->uniformLocations);
 	rwFree(this->serialNums);
+	rwFree(this->vsrc);
+	rwFree(this->fsrc);
+	rwFree(this);
+}
+
+/*
+ * Permutations
+ */
+
+// indexed by VSLIGHT_DIRECT|VSLIGHT_POINT|VSLIGHT_SPOT
+static const char *lightDefines[VSLIGHT_MASK+1] = {
+	"",
+	"#define DIRECTIONALS\n",
+	"#define POINTLIGHTS\n",
+	"#define DIRECTIONALS\n#define POINTLIGHTS\n",
+	"#define SPOTLIGHTS\n",
+	"#define DIRECTIONALS\n#define SPOTLIGHTS\n",
+	"#define POINTLIGHTS\n#define SPOTLIGHTS\n",
+	"#define DIRECTIONALS\n#define POINTLIGHTS\n#define SPOTLIGHTS\n",
+};
+
+ShaderPermutations*
+ShaderPermutations::create(const char **vsrc, const char **fsrc)
+{
+	int i;
+	ShaderPermutations *perm = rwNewT(ShaderPermutations, 1, MEMDUR_EVENT | ID_DRIVER);
+	perm->vsrc = copySources(vsrc);
+	perm->fsrc = copySources(fsrc);
+	for(i = 0; i < NUM_SHADERVARIANTS; i++)
+		perm->shaders[i] = nil;
+	return perm;
+}
+
+Shader*
+ShaderPermutations::get(int32 vsBits, bool32 alphaTest)
+{
+	int32 n, key;
+	const char *vs[16], *fs[16];
+
+	key = vsBits & VSLIGHT_MASK;
+	if(!alphaTest)
+		key |= SHADER_NOAT;
+	if(this->shaders[key])
+		return this->shaders[key];
+
+	vs[0] = shaderDecl;
+	vs[1] = lightDefines[key & VSLIGHT_MASK];
+	for(n = 0; this->vsrc[n]; n++){
+		assert(n+3 <= (int32)nelem(vs));
+		vs[n+2] = this->vsrc[n];
+	}
+	vs[n+2] = nil;
+	fs[0] = shaderDecl;
+	fs[1] = key & SHADER_NOAT ? "#define NO_ALPHATEST\n" : "";
+	for(n = 0; this->fsrc[n]; n++){
+		assert(n+3 <= (int32)nelem(fs));
+		fs[n+2] = this->fsrc[n];
+	}
+	fs[n+2] = nil;
+	this->shaders[key] = Shader::create(vs, fs);
+	return this->shaders[key];
+}
+
+void
+ShaderPermutations::destroy(void)
+{
+	int i;
+	for(i = 0; i < NUM_SHADERVARIANTS; i++)
+		if(this->shaders[i])
+			this->shaders[i]->destroy();
+	rwFree(this->vsrc);
+	rwFree(this->fsrc);
 	rwFree(this);
 }
 
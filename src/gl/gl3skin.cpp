@@ -24,8 +24,7 @@ namespace gl3 {
 
 #ifdef RW_OPENGL
 
-static Shader *skinShader, *skinShader_noAT;
-static Shader *skinShader_fullLight, *skinShader_fullLight_noAT;
+static ShaderPermutations *skinShaders;
 static int32 u_boneMatrices;
 
 void
@@ -196,6 +195,7 @@ skinInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
 	glBindBuffer(GL_ARRAY_BUFFER, header->vbo);
 	glBufferData(GL_ARRAY_BUFFER, header->totalNumVertex*attribs[0].stride,
 	             header->vertexBuffer, GL_STATIC_DRAW);
+	RWMETRIC(numInstanceBytes, header->totalNumVertex*attribs[0].stride);
 #ifdef RW_GL_USE_VAOS
 	setAttribPointers(header->attribDesc, header->numAttribs);
 	glBindVertexArray(0);
@@ -273,17 +273,7 @@ skinRenderCB(Atomic *atomic, InstanceDataHeader *header)
 
 		rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
 
-		if((vsBits & VSLIGHT_MASK) == 0){
-			if(getAlphaTest())
-				skinShader->use();
-			else
-				skinShader_noAT->use();
-		}else{
-			if(getAlphaTest())
-				skinShader_fullLight->use();
-			else
-				skinShader_fullLight_noAT->use();
-		}
+		skinShaders->get(vsBits, getAlphaTest())->use();
 
 		drawInst(header, inst);
 		inst++;
@@ -298,20 +288,10 @@ skinOpen(void *o, int32, int32)
 
 #include "shaders/simple_fs_gl.inc"
 #include "shaders/skin_gl.inc"
-	const char *vs[] = { shaderDecl, header_vert_src, skin_vert_src, nil };
-	const char *vs_fullLight[] = { shaderDecl, "#define DIRECTIONALS\n#define POINTLIGHTS\n#define SPOTLIGHTS\n", header_vert_src, skin_vert_src, nil };
-	const char *fs[] = { shaderDecl, header_frag_src, simple_frag_src, nil };
-	const char *fs_noAT[] = { shaderDecl, "#define NO_ALPHATEST\n", header_frag_src, simple_frag_src, nil };
-
-	skinShader = Shader::create(vs, fs);
-	assert(skinShader);
-	skinShader_noAT = Shader::create(vs, fs_noAT);
-	assert(skinShader_noAT);
+	const char *vs[] = { header_vert_src, skin_vert_src, nil };
+	const char *fs[] = { header_frag_src, simple_frag_src, nil };
 
-	skinShader_fullLight = Shader::create(vs_fullLight, fs);
-	assert(skinShader_fullLight);
-	skinShader_fullLight_noAT = Shader::create(vs_fullLight, fs_noAT);
-	assert(skinShader_fullLight_noAT);
+	skinShaders = ShaderPermutations::create(vs, fs);
 
 	return o;
 }
@@ -322,14 +302,8 @@ skinClose(void *o, int32, int32)
 	((ObjPipeline*)skinGlobals.pipelines[PLATFORM_GL3])->destroy();
 	skinGlobals.pipelines[PLATFORM_GL3] = nil;
 
-	skinShader->destroy();
-	skinShader = nil;
-	skinShader_noAT->destroy();
-	skinShader_noAT = nil;
-	skinShader_fullLight->destroy();
-	skinShader_fullLight = nil;
-	skinShader_fullLight_noAT->destroy();
-	skinShader_fullLight_noAT = nil;
+	skinShaders->destroy();
+	skinShaders = nil;
 
 	return o;
 }
@@ -20,6 +20,7 @@ struct EngineOpenParams
 #endif
 	int width, height;
 	const char *windowtitle;
+	const char *shaderCachePath;	// existing directory for shader binaries, may be nil
 };
 #endif
 
@@ -96,7 +97,10 @@ struct InstanceDataHeader : rw::InstanceDataHeader
 #ifdef RW_GL3
 
 struct Shader;
+struct ShaderPermutations;
 
+extern ShaderPermutations *defaultShaders;
+// the default variants with all or no lights
 extern Shader *defaultShader, *defaultShader_noAT;
 extern Shader *defaultShader_fullLight, *defaultShader_fullLight_noAT;
 
@@ -172,7 +176,9 @@ extern const char *shaderDecl;	// #version stuff
 extern const char *header_vert_src;
 extern const char *header_frag_src;
 
-extern Shader *im2dOverrideShader;
+// Im2D is drawn with this shader instead of the default one if not nil
+void setIm2DOverrideShader(Shader *shader);
+Shader *getIm2DOverrideShader(void);
 
 // per Scene
 void setProjectionMatrix(float32*);
@@ -267,6 +273,7 @@ struct Gl3Caps
 	bool dxtSupported;
 	bool astcSupported;	// not used yet
 	float maxAnisotropy;
+	bool programBinary;
 };
 extern Gl3Caps gl3Caps;
 // GLES can't read back textures very nicely.
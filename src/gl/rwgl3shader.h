@@ -34,6 +34,9 @@ struct UniformRegistry
 
 	int32 numBlocks;
 	char *blockNames[MAX_BLOCKS];
+
+	// bumped whenever any uniform changes
+	uint32 serialNum;
 };
 
 int32 registerUniform(const char *name, UniformType type = UNIFORM_NA, int32 num = 1);
@@ -50,19 +53,45 @@ struct Shader
 {
 	GLuint program;
 	// same number of elements as UniformRegistry::numUniforms
-	GLint *uniformLocations;
+	GLint *uniformLocations;	// nil until compiled
 	uint32 *serialNums;
 	int32 numUniforms;	// just to be sure!
+	// own copy of the sources, compiled on first use
+	const char **vsrc;
+	const char **fsrc;
 
 	static Shader *create(const char **vsrc, const char **fsrc);
 //	static Shader *fromFiles(const char *vs, const char *fs);
 //	static Shader *fromStrings(const char *vsrc, const char *fsrc);
+	void compile(void);
 	void use(void);
 	void destroy(void);
 };
 
 extern Shader *currentShader;
 
+// Variants of one shader for the light types lightingCB reports
+// and with or without alpha test. Sources are given without
+// shaderDecl and defines, variants are created when first asked for.
+enum {
+	SHADER_NOAT = VSLIGHT_MASK+1,
+	NUM_SHADERVARIANTS = SHADER_NOAT*2
+};
+
+struct ShaderPermutations
+{
+	const char **vsrc;
+	const char **fsrc;
+	Shader *shaders[NUM_SHADERVARIANTS];
+
+	static ShaderPermutations *create(const char **vsrc, const char **fsrc);
+	Shader *get(int32 vsBits, bool32 alphaTest);
+	void destroy(void);
+};
+
+// Directory for compiled program binaries, nil to always compile
+extern const char *shaderCachePath;
+
 }
 }
 
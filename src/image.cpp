@@ -111,218 +111,6 @@ Image::setPixels(uint8 *pixels)
 	this->flags |= 1;
 }
 
-void
-decompressDXT1(uint8 *adst, int32 w, int32 h, uint8 *src)
-{
-	/* j loops through old texels
-	 * x and y loop through new texels */
-	int32 x = 0, y = 0;
-	uint32 c[4][4];
-	uint8 idx[16];
-	uint8 (*dst)[4] = (uint8(*)[4])adst;
-	for(int32 j = 0; j < w*h/2; j += 8){
-		/* calculate colors */
-		uint32 col0 = *((uint16*)&src[j+0]);
-		uint32 col1 = *((uint16*)&src[j+2]);
-		c[0][0] = ((col0>>11) & 0x1F)*0xFF/0x1F;
-		c[0][1] = ((col0>> 5) & 0x3F)*0xFF/0x3F;
-		c[0][2] = ( col0      & 0x1F)*0xFF/0x1F;
-		c[0][3] = 0xFF;
-
-		c[1][0] = ((col1>>11) & 0x1F)*0xFF/0x1F;
-		c[1][1] = ((col1>> 5) & 0x3F)*0xFF/0x3F;
-		c[1][2] = ( col1      & 0x1F)*0xFF/0x1F;
-		c[1][3] = 0xFF;
-		if(col0 > col1){
-			c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
-			c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
-			c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
-			c[2][3] = 0xFF;
-
-			c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
-			c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
-			c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
-			c[3][3] = 0xFF;
-		}else{
-			c[2][0] = (c[0][0] + c[1][0])/2;
-			c[2][1] = (c[0][1] + c[1][1])/2;
-			c[2][2] = (c[0][2] + c[1][2])/2;
-			c[2][3] = 0xFF;
-
-			c[3][0] = 0x00;
-			c[3][1] = 0x00;
-			c[3][2] = 0x00;
-			c[3][3] = 0x00;
-		}
-
-		/* make index list */
-		uint32 indices = *((uint32*)&src[j+4]);
-		for(int32 k = 0; k < 16; k++){
-			idx[k] = indices & 0x3;
-			indices >>= 2;
-		}
-
-		/* write bytes */
-		for(uint32 l = 0; l < 4; l++)
-			for(uint32 k = 0; k < 4; k++){
-				dst[(y+l)*w + x+k][0] = c[idx[l*4+k]][0];
-				dst[(y+l)*w + x+k][1] = c[idx[l*4+k]][1];
-				dst[(y+l)*w + x+k][2] = c[idx[l*4+k]][2];
-				dst[(y+l)*w + x+k][3] = c[idx[l*4+k]][3];
-			}
-		x += 4;
-		if(x >= w){
-			y += 4;
-			x = 0;
-		}
-	}
-}
-
-void
-decompressDXT3(uint8 *adst, int32 w, int32 h, uint8 *src)
-{
-	/* j loops through old texels
-	 * x and y loop through new texels */
-	int32 x = 0, y = 0;
-	uint32 c[4][4];
-	uint8 idx[16];
-	uint8 a[16];
-	uint8 (*dst)[4] = (uint8(*)[4])adst;
-	for(int32 j = 0; j < w*h; j += 16){
-		/* calculate colors */
-		uint32 col0 = *((uint16*)&src[j+8]);
-		uint32 col1 = *((uint16*)&src[j+10]);
-		c[0][0] = ((col0>>11) & 0x1F)*0xFF/0x1F;
-		c[0][1] = ((col0>> 5) & 0x3F)*0xFF/0x3F;
-		c[0][2] = ( col0      & 0x1F)*0xFF/0x1F;
-
-		c[1][0] = ((col1>>11) & 0x1F)*0xFF/0x1F;
-		c[1][1] = ((col1>> 5) & 0x3F)*0xFF/0x3F;
-		c[1][2] = ( col1      & 0x1F)*0xFF/0x1F;
-
-		c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
-		c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
-		c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
-
-		c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
-		c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
-		c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
-
-		/* make index list */
-		uint32 indices = *((uint32*)&src[j+12]);
-		for(int32 k = 0; k < 16; k++){
-			idx[k] = indices & 0x3;
-			indices >>= 2;
-		}
-		uint64 alphas = *((uint64*)&src[j+0]);
-		for(int32 k = 0; k < 16; k++){
-			a[k] = (alphas & 0xF)*17;
-			alphas >>= 4;
-		}
-
-		/* write bytes */
-		for(uint32 l = 0; l < 4; l++)
-			for(uint32 k = 0; k < 4; k++){
-				dst[(y+l)*w + x+k][0] = c[idx[l*4+k]][0];
-				dst[(y+l)*w + x+k][1] = c[idx[l*4+k]][1];
-				dst[(y+l)*w + x+k][2] = c[idx[l*4+k]][2];
-				dst[(y+l)*w + x+k][3] = a[l*4+k];
-			}
-		x += 4;
-		if(x >= w){
-			y += 4;
-			x = 0;
-		}
-	}
-}
-
-void
-decompressDXT5(uint8 *adst, int32 w, int32 h, uint8 *src)
-{
-	/* j loops through old texels
-	 * x and y loop through new texels */
-	int32 x = 0, y = 0;
-	uint32 c[4][4];
-	uint32 a[8];
-	uint8 idx[16];
-	uint8 aidx[16];
-	uint8 (*dst)[4] = (uint8(*)[4])adst;
-	for(int32 j = 0; j < w*h; j += 16){
-		/* calculate colors */
-		uint32 col0 = *((uint16*)&src[j+8]);
-		uint32 col1 = *((uint16*)&src[j+10]);
-		c[0][0] = ((col0>>11) & 0x1F)*0xFF/0x1F;
-		c[0][1] = ((col0>> 5) & 0x3F)*0xFF/0x3F;
-		c[0][2] = ( col0      & 0x1F)*0xFF/0x1F;
-
-		c[1][0] = ((col1>>11) & 0x1F)*0xFF/0x1F;
-		c[1][1] = ((col1>> 5) & 0x3F)*0xFF/0x3F;
-		c[1][2] = ( col1      & 0x1F)*0xFF/0x1F;
-		if(col0 > col1){
-			c[2][0] = (2*c[0][0] + 1*c[1][0])/3;
-			c[2][1] = (2*c[0][1] + 1*c[1][1])/3;
-			c[2][2] = (2*c[0][2] + 1*c[1][2])/3;
-
-			c[3][0] = (1*c[0][0] + 2*c[1][0])/3;
-			c[3][1] = (1*c[0][1] + 2*c[1][1])/3;
-			c[3][2] = (1*c[0][2] + 2*c[1][2])/3;
-		}else{
-			c[2][0] = (c[0][0] + c[1][0])/2;
-			c[2][1] = (c[0][1] + c[1][1])/2;
-			c[2][2] = (c[0][2] + c[1][2])/2;
-
-			c[3][0] = 0x00;
-			c[3][1] = 0x00;
-			c[3][2] = 0x00;
-		}
-
-		a[0] = src[j+0];
-		a[1] = src[j+1];
-		if(a[0] > a[1]){
-			a[2] = (6*a[0] + 1*a[1])/7;
-			a[3] = (5*a[0] + 2*a[1])/7;
-			a[4] = (4*a[0] + 3*a[1])/7;
-			a[5] = (3*a[0] + 4*a[1])/7;
-			a[6] = (2*a[0] + 5*a[1])/7;
-			a[7] = (1*a[0] + 6*a[1])/7;
-		}else{
-			a[2] = (4*a[0] + 1*a[1])/5;
-			a[3] = (3*a[0] + 2*a[1])/5;
-			a[4] = (2*a[0] + 3*a[1])/5;
-			a[5] = (1*a[0] + 4*a[1])/5;
-			a[6] = 0;
-			a[7] = 0xFF;
-		}
-
-		/* make index list */
-		uint32 indices = *((uint32*)&src[j+12]);
-		for(int32 k = 0; k < 16; k++){
-			idx[k] = indices & 0x3;
-			indices >>= 2;
-		}
-		// only 6 indices
-		uint64 alphas = *((uint64*)&src[j+2]);
-		for(int32 k = 0; k < 16; k++){
-			aidx[k] = alphas & 0x7;
-			alphas >>= 3;
-		}
-
-		/* write bytes */
-		for(uint32 l = 0; l < 4; l++)
-			for(uint32 k = 0; k < 4; k++){
-				dst[(y+l)*w + x+k][0] = c[idx[l*4+k]][0];
-				dst[(y+l)*w + x+k][1] = c[idx[l*4+k]][1];
-				dst[(y+l)*w + x+k][2] = c[idx[l*4+k]][2];
-				dst[(y+l)*w + x+k][3] = a[aidx[l*4+k]];
-			}
-		x += 4;
-		if(x >= w){
-			y += 4;
-			x = 0;
-		}
-	}
-}
-
 // not strictly image but related
 
 // flip a DXT 2-bit block
@@ -431,7 +219,7 @@ flipDXT1(uint8 *dst, uint8 *src, uint32 width, uint32 height)
 			uint8 *s = src;
 			uint8 *d = dst;
 			for(x = 0; x < bw; x++){
-				flipBlock_half(dst, src);
+				flipBlock_half(d, s);
 				s += 8;
 				d += 8;
 			}
@@ -546,17 +334,25 @@ flipDXT(int32 type, uint8 *dst, uint8 *src, uint32 width, uint32 height)
 void
 Image::setPixelsDXT(int32 type, uint8 *pixels)
 {
-	switch(type){
-	case 1:
-		decompressDXT1(this->pixels, this->width, this->height, pixels);
-		break;
-	case 3:
-		decompressDXT3(this->pixels, this->width, this->height, pixels);
-		break;
-	case 5:
-		decompressDXT5(this->pixels, this->width, this->height, pixels);
-		break;
+	decompressDXT(type, this->pixels, this->width, this->height, pixels);
+}
+
+// Compress into DXT1, 3 or 5, dst must have space for all blocks
+void
+Image::getPixelsDXT(int32 type, uint8 *dst, int32 quality)
+{
+	// Convert to 32 bits if necessary but don't change original
+	Image *img = this;
+	if(this->depth != 32){
+		img = Image::create(this->width, this->height, this->depth);
+		img->pixels = this->pixels;
+		img->stride = this->stride;
+		img->palette = this->palette;
+		img->convertTo32();
 	}
+	compressDXT(type, dst, img->width, img->height, img->pixels, img->stride, quality);
+	if(img != this)
+		img->destroy();
 }
 
 void
@@ -630,7 +426,7 @@ Image::convertTo32(void)
 	int32 newstride = this->width*4;
 	uint8 *newpixels;
 
-	void (*fun)(uint8 *out, uint8 *in) = nil;
+	int32 srcFormat;
 	switch(this->depth){
 	case 4:
 	case 8:
@@ -638,10 +434,10 @@ Image::convertTo32(void)
 		this->unpalettize(true);
 		return;
 	case 16:
-		fun = conv_RGBA8888_from_ARGB1555;
+		srcFormat = PIXFMT_ARGB1555;
 		break;
 	case 24:
-		fun = conv_RGBA8888_from_RGB888;
+		srcFormat = PIXFMT_RGB888;
 		break;
 	default:
 		return;
@@ -649,17 +445,8 @@ Image::convertTo32(void)
 
 	newpixels = rwNewT(uint8, newstride*this->height, MEMDUR_EVENT | ID_IMAGE);
 	uint8 *pixels32 = newpixels;
-	for(int y = 0; y < this->height; y++){
-		uint8 *line = pixels;
-		uint8 *newline = newpixels;
-		for(int x = 0; x < this->width; x++){
-			fun(newline, line);
-			line += this->bpp;
-			newline += 4;
-		}
-		pixels += this->stride;
-		newpixels += newstride;
-	}
+	convertPixels(newpixels, newstride, PIXFMT_RGBA8888,
+		pixels, this->stride, srcFormat, this->width, this->height);
 
 	this->free();
 	this->depth = 32;
@@ -1098,23 +885,23 @@ makeTreeAddr(RGBA color)
 	return addr;
 }
 
-void
-ColorQuant::Node::destroy(void)
-{
-	int i;
-	for(i = 0; i < 16; i++)
-		if(this->children[i])
-			this->children[i]->destroy();
-	if(this->link.next)
-		this->link.remove();
-	rwFree(this);
-}
-
 ColorQuant::Node*
 ColorQuant::createNode(int32 level)
 {
 	int i;
-	ColorQuant::Node *node = rwNewT(ColorQuant::Node, 1, MEMDUR_EVENT | ID_IMAGE);
+	ColorQuant::Node *node;
+	if(this->freeNodes){
+		node = this->freeNodes;
+		this->freeNodes = node->parent;
+	}else{
+		if(this->blocks == nil || this->blockUsed == NODEBLOCKSIZE){
+			NodeBlock *block = rwNewT(NodeBlock, 1, MEMDUR_EVENT | ID_IMAGE);
+			block->next = this->blocks;
+			this->blocks = block;
+			this->blockUsed = 0;
+		}
+		node = &this->blocks->nodes[this->blockUsed++];
+	}
 	node->parent = nil;
 	for(i = 0; i < 16; i++)
 		node->children[i] = nil;
@@ -1123,42 +910,65 @@ ColorQuant::createNode(int32 level)
 	node->b = 0;
 	node->a = 0;
 	node->numPixels = 0;
+	node->level = level;
+	node->numChildren = 0;
+	node->numLeafChildren = 0;
 	node->link.init();
+	this->numNodes++;
 
-	if(level == 0)
+	if(level == 0){
 		this->leaves.append(&node->link);
+		this->numLeaves++;
+	}
 
 	return node;
 }
 
+// Put a node back into the pool, children are not touched
+void
+ColorQuant::freeNode(Node *node)
+{
+	if(node->link.next){
+		node->link.remove();
+		this->numLeaves--;
+	}
+	node->parent = this->freeNodes;
+	this->freeNodes = node;
+	this->numNodes--;
+}
+
 ColorQuant::Node*
 ColorQuant::getNode(ColorQuant::Node *root, uint32 addr, int32 level)
 {
-	if(level == 0)
-		return root;
-
-	uint32 a = addr & 0xF;
-	if(root->children[a] == nil){
-		root->children[a] = this->createNode(level-1);
-		root->children[a]->parent = root;
+	while(level > 0){
+		uint32 a = addr & 0xF;
+		if(root->children[a] == nil){
+			root->children[a] = this->createNode(level-1);
+			root->children[a]->parent = root;
+			root->numChildren++;
+		}
+		root = root->children[a];
+		addr >>= 4;
+		level--;
 	}
-
-	return this->getNode(root->children[a], addr>>4, level-1);
+	return root;
 }
 
 ColorQuant::Node*
 ColorQuant::findNode(ColorQuant::Node *root, uint32 addr, int32 level)
 {
-	if(level == 0)
-		return root;
-
-	uint32 a = addr & 0xF;
-	if(root->children[a] == nil)
-		return root;
-
-	return this->findNode(root->children[a], addr>>4, level-1);
+	while(level > 0){
+		uint32 a = addr & 0xF;
+		if(root->children[a] == nil)
+			break;
+		root = root->children[a];
+		addr >>= 4;
+		level--;
+	}
+	return root;
 }
 
+// Merge all children of a node into it. Children must be leaves.
 void
 ColorQuant::reduceNode(Node *node)
 {
@@ -1166,17 +976,21 @@ ColorQuant::reduceNode(Node *node)
 	assert(node->numPixels == 0);
 	for(i = 0; i < 16; i++)
 		if(node->children[i]){
+			assert(node->children[i]->isLeaf());
 			node->r += node->children[i]->r;
 			node->g += node->children[i]->g;
 			node->b += node->children[i]->b;
 			node->a += node->children[i]->a;
 			node->numPixels += node->children[i]->numPixels;
-			node->children[i]->destroy();
+			this->freeNode(node->children[i]);
 			node->children[i] = nil;
 		}
+	node->numChildren = 0;
+	node->numLeafChildren = 0;
 	assert(node->link.next == nil);
 	assert(node->link.prev == nil);
 	this->leaves.append(&node->link);
+	this->numLeaves++;
 }
 
 void
@@ -1193,13 +1007,28 @@ void
 ColorQuant::init(void)
 {
 	this->leaves.init();
+	this->numLeaves = 0;
+	this->numNodes = 0;
+	this->blocks = nil;
+	this->blockUsed = 0;
+	this->freeNodes = nil;
 	this->root = this->createNode(QUANTDEPTH);
 }
 
 void
 ColorQuant::destroy(void)
 {
-	this->root->destroy();
+	NodeBlock *block, *next;
+	for(block = this->blocks; block; block = next){
+		next = block->next;
+		rwFree(block);
+	}
+	this->blocks = nil;
+	this->freeNodes = nil;
+	this->root = nil;
+	this->leaves.init();
+	this->numLeaves = 0;
+	this->numNodes = 0;
 }
 
 void
@@ -1218,57 +1047,170 @@ ColorQuant::findColor(RGBA color)
 	return node->numPixels;
 }
 
+static RGBA
+getPixelColor(Image *img, uint8 *p)
+{
+	RGBA col;
+	uint8 rgba[4];
+	switch(img->depth){
+	case 4: case 8:
+		conv_RGBA8888_from_RGBA8888(rgba, &img->palette[p[0]*4]);
+		break;
+	case 32:
+		conv_RGBA8888_from_RGBA8888(rgba, p);
+		break;
+	case 24:
+		conv_RGBA8888_from_RGB888(rgba, p);
+		break;
+	case 16:
+		conv_RGBA8888_from_ARGB1555(rgba, p);
+		break;
+	default: assert(0 && "invalid depth");
+	}
+	col.red = rgba[0];
+	col.green = rgba[1];
+	col.blue = rgba[2];
+	col.alpha = rgba[3];
+	return col;
+}
+
+static uint32
+colorKey(RGBA col)
+{
+	return col.red | col.green<<8 | col.blue<<16 | (uint32)col.alpha<<24;
+}
+
 void
 ColorQuant::addImage(Image *img)
 {
 	RGBA col;
-	uint8 rgba[4];
+	uint32 key, lastKey = 0;
+	Node *lastNode = nil;
 	uint8 *pixels = img->pixels;
 	for(int y = 0; y < img->height; y++){
 		uint8 *line = pixels;
 		for(int x = 0; x < img->width; x++){
-			uint8 *p = line;
-			switch(img->depth){
-			case 4: case 8:
-				conv_RGBA8888_from_RGBA8888(rgba, &img->palette[p[0]*4]);
-				break;
-			case 32:
-				conv_RGBA8888_from_RGBA8888(rgba, p);
-				break;
-			case 24:
-				conv_RGBA8888_from_RGB888(rgba, p);
-				break;
-			case 16:
-				conv_RGBA8888_from_ARGB1555(rgba, p);
-				break;
-			default: assert(0 && "invalid depth");
+			col = getPixelColor(img, line);
+			// runs of the same colour are common, skip the tree walk
+			key = colorKey(col);
+			if(lastNode == nil || key != lastKey){
+				lastNode = this->getNode(root, makeTreeAddr(col), QUANTDEPTH);
+				lastKey = key;
 			}
-			col.red = rgba[0];
-			col.green = rgba[1];
-			col.blue = rgba[2];
-			col.alpha = rgba[3];
-			this->addColor(col);
+			lastNode->addColor(col);
 			line += img->bpp;
 		}
 		pixels += img->stride;
 	}
 }
 
+// Binary min-heap of reducible nodes, i.e. nodes whose children are all leaves.
+// Nodes covering the fewest pixels are reduced first, deeper ones on ties.
+struct ReduceEntry
+{
+	ColorQuant::Node *node;
+	int32 weight;
+};
+
+static bool
+reduceBefore(ReduceEntry *a, ReduceEntry *b)
+{
+	if(a->weight != b->weight)
+		return a->weight < b->weight;
+	return a->node->level < b->node->level;
+}
+
+static void
+heapPush(ReduceEntry *heap, int32 *size, ColorQuant::Node *node)
+{
+	int32 i, parent;
+	ReduceEntry e;
+	e.node = node;
+	e.weight = 0;
+	for(i = 0; i < 16; i++)
+		if(node->children[i])
+			e.weight += node->children[i]->numPixels;
+
+	i = (*size)++;
+	while(i > 0){
+		parent = (i-1)/2;
+		if(!reduceBefore(&e, &heap[parent]))
+			break;
+		heap[i] = heap[parent];
+		i = parent;
+	}
+	heap[i] = e;
+}
+
+static ColorQuant::Node*
+heapPop(ReduceEntry *heap, int32 *size)
+{
+	int32 i, child;
+	ColorQuant::Node *top = heap[0].node;
+	ReduceEntry e = heap[--*size];
+	i = 0;
+	for(;;){
+		child = 2*i+1;
+		if(child >= *size)
+			break;
+		if(child+1 < *size && reduceBefore(&heap[child+1], &heap[child]))
+			child++;
+		if(!reduceBefore(&heap[child], &e))
+			break;
+		heap[i] = heap[child];
+		i = child;
+	}
+	heap[i] = e;
+	return top;
+}
+
 void
 ColorQuant::makePalette(int32 numColors, RGBA *colors)
 {
-	while(this->leaves.count() > numColors){
-		Node *n = LLLinkGetData(this->leaves.link.next, Node, link);
-		this->reduceNode(n->parent);
+	int32 i, sp, heapSize;
+	Node *n;
+	Node *stack[QUANTDEPTH*16 + 1];
+	ReduceEntry *heap = rwNewT(ReduceEntry, this->numNodes, MEMDUR_FUNCTION | ID_IMAGE);
+
+	// find all reducible nodes
+	heapSize = 0;
+	sp = 0;
+	stack[sp++] = this->root;
+	while(sp > 0){
+		n = stack[--sp];
+		if(n->isLeaf())
+			continue;
+		n->numLeafChildren = 0;
+		for(i = 0; i < 16; i++)
+			if(n->children[i]){
+				if(n->children[i]->isLeaf())
+					n->numLeafChildren++;
+				else
+					stack[sp++] = n->children[i];
+			}
+		if(n->numLeafChildren == n->numChildren)
+			heapPush(heap, &heapSize, n);
+	}
+
+	while(this->numLeaves > numColors && heapSize > 0){
+		n = heapPop(heap, &heapSize);
+		this->reduceNode(n);
+		// parent may have become reducible now
+		Node *p = n->parent;
+		if(p && ++p->numLeafChildren == p->numChildren)
+			heapPush(heap, &heapSize, p);
 	}
+	rwFree(heap);
 
-	int i = 0;
+	i = 0;
 	FORLIST(lnk, this->leaves){
-		Node *n = LLLinkGetData(lnk, Node, link);
-		n->r /= n->numPixels;
-		n->g /= n->numPixels;
-		n->b /= n->numPixels;
-		n->a /= n->numPixels;
+		n = LLLinkGetData(lnk, Node, link);
+		if(n->numPixels){
+			n->r /= n->numPixels;
+			n->g /= n->numPixels;
+			n->b /= n->numPixels;
+			n->a /= n->numPixels;
+		}
 		colors[i].red = n->r;
 		colors[i].green = n->g;
 		colors[i].blue = n->b;
@@ -1277,39 +1219,33 @@ ColorQuant::makePalette(int32 numColors, RGBA *colors)
 	}
 }
 
+// direct mapped colour -> index cache for matchImage
+#define MATCHCACHEBITS 12
+
 void
 ColorQuant::matchImage(uint8 *dstPixels, uint32 dstStride, Image *img)
 {
 	RGBA col;
-	uint8 rgba[4];
+	uint32 key, h;
+	int32 i;
+	uint32 *cacheKeys = rwNewT(uint32, 1<<MATCHCACHEBITS, MEMDUR_FUNCTION | ID_IMAGE);
+	int16 *cacheIndices = rwNewT(int16, 1<<MATCHCACHEBITS, MEMDUR_FUNCTION | ID_IMAGE);
+	for(i = 0; i < 1<<MATCHCACHEBITS; i++)
+		cacheIndices[i] = -1;
+
 	uint8 *pixels = img->pixels;
 	for(int y = 0; y < img->height; y++){
 		uint8 *line = pixels;
 		uint8 *dline = dstPixels;
 		for(int x = 0; x < img->width; x++){
-			uint8 *p = line;
-			uint8 *d = dline;
-			switch(img->depth){
-			case 4: case 8:
-				conv_RGBA8888_from_RGBA8888(rgba, &img->palette[p[0]*4]);
-				break;
-			case 32:
-				conv_RGBA8888_from_RGBA8888(rgba, p);
-				break;
-			case 24:
-				conv_RGBA8888_from_RGB888(rgba, p);
-				break;
-			case 16:
-				conv_RGBA8888_from_ARGB1555(rgba, p);
-				break;
-			default: assert(0 && "invalid depth");
+			col = getPixelColor(img, line);
+			key = colorKey(col);
+			h = (key*2654435761u) >> (32-MATCHCACHEBITS);
+			if(cacheIndices[h] < 0 || cacheKeys[h] != key){
+				cacheKeys[h] = key;
+				cacheIndices[h] = this->findColor(col);
 			}
-			
-			col.red = rgba[0];
-			col.green = rgba[1];
-			col.blue = rgba[2];
-			col.alpha = rgba[3];
-			*d = this->findColor(col);
+			*dline = cacheIndices[h];
 
 			line += img->bpp;
 			dline++;
@@ -1317,6 +1253,8 @@ ColorQuant::matchImage(uint8 *dstPixels, uint32 dstStride, Image *img)
 		pixels += img->stride;
 		dstPixels += dstStride;
 	}
+	rwFree(cacheKeys);
+	rwFree(cacheIndices);
 }
 
 
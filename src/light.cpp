@@ -27,6 +27,8 @@ worldLightSync(ObjectWithFrame *obj)
 {
 	Light *light = (Light*)obj;
 	light->originalSync(obj);
+	if(light->world && light->getType() >= Light::POINT)
+		light->world->lightMoved(light);
 }
 
 Light*
@@ -58,6 +60,8 @@ Light::create(int32 type)
 	light->world = nil;
 	light->originalSync = light->object.syncCB;
 	light->object.syncCB = worldLightSync;
+	light->sector = nil;
+	light->inSector.init();
 
 	s_plglist.construct(light);
 	return light;
@@ -74,6 +78,25 @@ Light::destroy(void)
 	numAllocated--;
 }
 
+// Use this instead of writing radius so world sectors are updated
+void
+Light::setRadius(float32 radius)
+{
+	this->radius = radius;
+	if(this->world && this->getType() >= Light::POINT)
+		this->world->lightMoved(this);
+}
+
+void
+Light::setFlags(uint32 flags)
+{
+	// light clusters only hold lights that light atomics
+	if(this->world && this->world->lightClusters &&
+	   (this->object.object.flags ^ flags) & LIGHTATOMICS)
+		this->world->lightClusters->camera = nil;
+	this->object.object.flags = flags;
+}
+
 void
 Light::setAngle(float32 angle)
 {
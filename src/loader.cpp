@@ -0,0 +1,448 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+// No threads on the PS2, files are read by update() there
+#ifndef RW_PS2
+#define RW_LOADERTHREADS
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <chrono>
+#endif
+
+#define PLUGIN_ID 0
+
+namespace rw {
+
+enum {
+	LOAD_QUEUED,
+	LOAD_READING,
+	LOAD_READ,
+	LOAD_FAILED,
+	LOAD_PARSING,	// texture dictionary, one texture per step
+	LOAD_PARSED
+};
+
+struct StreamLoader::Request
+{
+	char *path;
+	uint32 type;
+	Callback cb;
+	void *data;
+	TexDictionary *texDict;
+	int32 state;
+	uint8 *buffer;
+	uint32 size;
+	uint32 position;	// where LOAD_PARSING continues in buffer
+	int32 numLeft;	// textures still to read
+	void *object;
+	LLLink *nextInstance;	// atomic of a clump to instance next
+	Request *next;
+	Request *nextRead;
+};
+
+#ifdef RW_LOADERTHREADS
+struct StreamLoader::Workers
+{
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::thread *threads;
+	int32 numThreads;
+	Request *readHead, *readTail;
+	bool32 quit;
+};
+#endif
+
+// microseconds since some fixed point
+static uint64
+loaderTime(void)
+{
+#ifdef RW_LOADERTHREADS
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+#else
+	return (uint64)clock()*1000000/CLOCKS_PER_SEC;
+#endif
+}
+
+// Whole file into memory, may be called from a worker
+static bool32
+readFile(const char *path, uint8 **buffer, uint32 *size)
+{
+	FileFunctions *ff = &engine->filefuncs;
+	void *f;
+	long len;
+
+	*buffer = nil;
+	*size = 0;
+	f = ff->rwfopen(path, "rb");
+	if(f == nil)
+		return 0;
+	ff->rwfseek(f, 0, SEEK_END);
+	len = ff->rwftell(f);
+	ff->rwfseek(f, 0, SEEK_SET);
+	if(len <= 0){
+		ff->rwfclose(f);
+		return 0;
+	}
+	// not rwMalloc, that records the allocation site in a global
+	*buffer = (uint8*)Engine::memfuncs.rwmalloc(len, MEMDUR_EVENT);
+	if(*buffer == nil){
+		ff->rwfclose(f);
+		return 0;
+	}
+	*size = (uint32)ff->rwfread(*buffer, 1, len, f);
+	ff->rwfclose(f);
+	return *size == (uint32)len;
+}
+
+#ifdef RW_LOADERTHREADS
+static void
+workerThread(StreamLoader::Workers *w)
+{
+	StreamLoader::Request *r;
+	uint8 *buffer;
+	uint32 size;
+	bool32 success;
+
+	std::unique_lock<std::mutex> lock(w->mutex);
+	for(;;){
+		while(!w->quit && w->readHead == nil)
+			w->cond.wait(lock);
+		if(w->quit)
+			return;
+		r = w->readHead;
+		w->readHead = r->nextRead;
+		if(w->readHead == nil)
+			w->readTail = nil;
+		r->state = LOAD_READING;
+
+		lock.unlock();
+		success = readFile(r->path, &buffer, &size);
+		lock.lock();
+
+		r->buffer = buffer;
+		r->size = size;
+		r->state = success ? LOAD_READ : LOAD_FAILED;
+	}
+}
+#endif
+
+StreamLoader*
+StreamLoader::create(int32 numThreads)
+{
+	StreamLoader *loader = rwNewT(StreamLoader, 1, MEMDUR_EVENT);
+	loader->head = nil;
+	loader->tail = nil;
+	loader->numPending = 0;
+	loader->workers = nil;
+#ifdef RW_LOADERTHREADS
+	if(numThreads > 0){
+		Workers *w = new Workers;
+		w->numThreads = numThreads;
+		w->readHead = w->readTail = nil;
+		w->quit = 0;
+		w->threads = new std::thread[numThreads];
+		for(int32 i = 0; i < numThreads; i++)
+			w->threads[i] = std::thread(workerThread, w);
+		loader->workers = w;
+	}
+#else
+	(void)numThreads;
+#endif
+	return loader;
+}
+
+static void
+freeRequest(StreamLoader::Request *r)
+{
+	rwFree(r->buffer);
+	rwFree(r->path);
+	rwFree(r);
+}
+
+// Pending requests are dropped without calling their callbacks,
+// objects that were already made are destroyed.
+void
+StreamLoader::destroy(void)
+{
+	Request *r, *next;
+#ifdef RW_LOADERTHREADS
+	Workers *w = this->workers;
+	if(w){
+		{
+			std::lock_guard<std::mutex> lock(w->mutex);
+			w->quit = 1;
+		}
+		w->cond.notify_all();
+		for(int32 i = 0; i < w->numThreads; i++)
+			w->threads[i].join();
+		delete[] w->threads;
+		delete w;
+	}
+#endif
+	for(r = this->head; r; r = next){
+		next = r->next;
+		if(r->object)
+			switch(r->type){
+			case ID_CLUMP:
+				((Clump*)r->object)->destroy();
+				break;
+			case ID_GEOMETRY:
+				((Geometry*)r->object)->destroy();
+				break;
+			case ID_TEXDICTIONARY:
+				((TexDictionary*)r->object)->destroy();
+				break;
+			}
+		freeRequest(r);
+	}
+	rwFree(this);
+}
+
+bool32
+StreamLoader::load(const char *path, uint32 type, Callback cb, void *data, TexDictionary *texDict)
+{
+	Request *r;
+
+	assert(cb);
+	if(type != ID_CLUMP && type != ID_GEOMETRY && type != ID_TEXDICTIONARY){
+		RWERROR((ERR_GENERAL, "can't load this type"));
+		return 0;
+	}
+	r = rwNewT(Request, 1, MEMDUR_EVENT);
+	r->path = rwStrdup(path, MEMDUR_EVENT);
+	r->type = type;
+	r->cb = cb;
+	r->data = data;
+	r->texDict = texDict;
+	r->state = LOAD_QUEUED;
+	r->buffer = nil;
+	r->size = 0;
+	r->position = 0;
+	r->numLeft = 0;
+	r->object = nil;
+	r->nextInstance = nil;
+	r->next = nil;
+	r->nextRead = nil;
+
+	if(this->tail)
+		this->tail->next = r;
+	else
+		this->head = r;
+	this->tail = r;
+	this->numPending++;
+
+#ifdef RW_LOADERTHREADS
+	Workers *w = this->workers;
+	if(w){
+		{
+			std::lock_guard<std::mutex> lock(w->mutex);
+			if(w->readTail)
+				w->readTail->nextRead = r;
+			else
+				w->readHead = r;
+			w->readTail = r;
+		}
+		w->cond.notify_one();
+	}
+#endif
+	return 1;
+}
+
+static void
+parseRequest(StreamLoader::Request *r)
+{
+	StreamMemory mem;
+	TexDictionary *prevDict;
+
+	mem.open(r->buffer, r->size);
+	if(!findChunk(&mem, r->type, nil, nil)){
+		RWERROR((ERR_CHUNK, r->type == ID_CLUMP ? "CLUMP" :
+		                    r->type == ID_GEOMETRY ? "GEOMETRY" : "TEXDICTIONARY"));
+		return;
+	}
+	prevDict = TexDictionary::getCurrent();
+	if(r->texDict)
+		TexDictionary::setCurrent(r->texDict);
+	switch(r->type){
+	case ID_CLUMP:
+		r->object = Clump::streamRead(&mem);
+		if(r->object)
+			r->nextInstance = ((Clump*)r->object)->atomics.link.next;
+		break;
+	case ID_GEOMETRY:
+		r->object = Geometry::streamRead(&mem);
+		break;
+	case ID_TEXDICTIONARY:
+		// only the header, textures are read by stepTexDict
+		if(!findChunk(&mem, ID_STRUCT, nil, nil)){
+			RWERROR((ERR_CHUNK, "STRUCT"));
+			break;
+		}
+		r->numLeft = mem.readI16();
+		mem.readI16();	// device id
+		r->object = TexDictionary::create();
+		r->position = mem.tell();
+		break;
+	}
+	if(r->texDict)
+		TexDictionary::setCurrent(prevDict);
+	mem.close();
+}
+
+// Read the next texture of a dictionary, or its extensions after
+// the last one, like TexDictionary::streamRead. Returns whether done.
+static bool32
+stepTexDict(StreamLoader::Request *r)
+{
+	StreamMemory mem;
+	TexDictionary *prevDict;
+	TexDictionary *txd;
+	Texture *tex;
+	bool32 success, done;
+
+	txd = (TexDictionary*)r->object;
+	mem.open(r->buffer, r->size);
+	mem.seek(r->position, 0);
+	prevDict = TexDictionary::getCurrent();
+	if(r->texDict)
+		TexDictionary::setCurrent(r->texDict);
+	if(r->numLeft > 0){
+		r->numLeft--;
+		tex = nil;
+		if(!findChunk(&mem, ID_TEXTURENATIVE, nil, nil))
+			RWERROR((ERR_CHUNK, "TEXTURENATIVE"));
+		else
+			tex = Texture::streamReadNative(&mem);
+		if(tex){
+			Texture::s_plglist.streamRead(&mem, tex);
+			txd->add(tex);
+		}
+		success = tex != nil;
+		done = 0;
+	}else{
+		success = TexDictionary::s_plglist.streamRead(&mem, txd);
+		done = 1;
+	}
+	if(r->texDict)
+		TexDictionary::setCurrent(prevDict);
+	r->position = mem.tell();
+	mem.close();
+	if(!success){
+		txd->destroy();
+		r->object = nil;
+		return 1;
+	}
+	return done;
+}
+
+// Do the next piece of work on a request, returns whether it is done.
+static bool32
+stepRequest(StreamLoader::Request *r)
+{
+	Clump *clump;
+	Atomic *a;
+
+	switch(r->state){
+	case LOAD_FAILED:
+		RWERROR((ERR_FILE, r->path));
+		return 1;
+
+	case LOAD_READ:
+		parseRequest(r);
+		if(r->object && r->type == ID_TEXDICTIONARY){
+			r->state = LOAD_PARSING;
+			return 0;
+		}
+		rwFree(r->buffer);
+		r->buffer = nil;
+		r->state = LOAD_PARSED;
+		return r->object == nil || r->type != ID_CLUMP;
+
+	case LOAD_PARSING:
+		if(!stepTexDict(r))
+			return 0;
+		rwFree(r->buffer);
+		r->buffer = nil;
+		r->state = LOAD_PARSED;
+		return 1;
+
+	case LOAD_PARSED:
+		// one atomic at a time so the budget is kept
+		clump = (Clump*)r->object;
+		if(r->nextInstance != clump->atomics.end()){
+			a = Atomic::fromClump(r->nextInstance);
+			r->nextInstance = r->nextInstance->next;
+			if(a->geometry)
+				a->instance();
+		}
+		return r->nextInstance == clump->atomics.end();
+	}
+	return 0;
+}
+
+// Create objects from files that have been read and call the callbacks
+// until about budget milliseconds have passed. Requests are finished
+// in the order they were made. Returns the number still pending.
+// The budget is checked between steps: one texture of a dictionary,
+// one atomic of a clump to instance, or the parse of a whole clump or
+// geometry, which is only started first thing in an update.
+int32
+StreamLoader::update(float32 budget)
+{
+	Request *r;
+	int32 state;
+	bool32 first, parsed;
+	uint64 start = loaderTime();
+
+	first = 1;
+
+	while(r = this->head, r){
+#ifdef RW_LOADERTHREADS
+		if(this->workers){
+			std::lock_guard<std::mutex> lock(this->workers->mutex);
+			state = r->state;
+		}else
+#endif
+			state = r->state;
+		if(state == LOAD_QUEUED && this->workers == nil){
+			r->state = readFile(r->path, &r->buffer, &r->size) ? LOAD_READ : LOAD_FAILED;
+			state = r->state;
+		}
+		// still being read
+		if(state == LOAD_QUEUED || state == LOAD_READING)
+			break;
+
+		// a one piece parse doesn't go on top of other work
+		parsed = state == LOAD_READ && r->type != ID_TEXDICTIONARY;
+		if(parsed && !first)
+			break;
+		first = 0;
+
+		if(stepRequest(r)){
+			this->head = r->next;
+			if(this->head == nil)
+				this->tail = nil;
+			this->numPending--;
+			r->cb(r->object, r->type, r->data);
+			freeRequest(r);
+		}else if(parsed)
+			break;	// instance the atomics in the next updates
+		if((loaderTime() - start)/1000.0f >= budget)
+			break;
+	}
+	return this->numPending;
+}
+
+}
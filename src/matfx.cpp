@@ -19,6 +19,8 @@
 #include "gl/rwwdgl.h"
 #include "gl/rwgl3.h"
 #include "gl/rwgl3plg.h"
+#include "soft/rwsoft.h"
+#include "soft/rwsoftplg.h"
 
 #define PLUGIN_ID ID_MATFX
 
@@ -619,6 +621,7 @@ registerMatFXPlugin(void)
 	d3d9::initMatFX();
 	wdgl::initMatFX();
 	gl3::initMatFX();
+	soft::initMatFX();
 
 	matFXGlobals.atomicOffset =
 	Atomic::registerPlugin(sizeof(int32), ID_MATFX,
@@ -0,0 +1,473 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <time.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+
+#ifndef RW_PS2
+#define RW_METRICSTHREADS
+#include <chrono>
+#include <mutex>
+#endif
+
+#define PLUGIN_ID ID_METRICSMODULE
+
+namespace rw {
+
+struct TraceEvent
+{
+	const char *name;
+	uint64 start;
+	uint64 duration;
+};
+
+struct MetricsGlobals
+{
+	Metrics frame;
+	Metrics last;
+	TraceEvent *events;	// nil if not tracing
+	int32 numEvents;
+	int32 maxEvents;
+	uint64 traceStart;
+};
+int32 metricsModuleOffset;
+Metrics *currentMetrics;
+
+#define METRICSGLOBAL(v) (PLUGINOFFSET(MetricsGlobals, engine, metricsModuleOffset)->v)
+
+static void*
+metricsOpen(void *object, int32 offset, int32 size)
+{
+	metricsModuleOffset = offset;
+	memset(&METRICSGLOBAL(frame), 0, sizeof(Metrics));
+	memset(&METRICSGLOBAL(last), 0, sizeof(Metrics));
+	METRICSGLOBAL(events) = nil;
+	METRICSGLOBAL(numEvents) = 0;
+	METRICSGLOBAL(maxEvents) = 0;
+	currentMetrics = &METRICSGLOBAL(frame);
+	return object;
+}
+
+static void*
+metricsClose(void *object, int32 offset, int32 size)
+{
+	currentMetrics = nil;
+	rwFree(METRICSGLOBAL(events));
+	METRICSGLOBAL(events) = nil;
+	return object;
+}
+
+void
+Metrics::registerModule(void)
+{
+	Engine::registerPlugin(sizeof(MetricsGlobals), ID_METRICSMODULE, metricsOpen, metricsClose);
+}
+
+static void dumpMemoryStats(void);
+
+Metrics*
+Metrics::get(void)
+{
+	return &METRICSGLOBAL(last);
+}
+
+void
+Metrics::endFrame(void)
+{
+	if(currentMetrics == nil)
+		return;
+	METRICSGLOBAL(last) = METRICSGLOBAL(frame);
+	memset(&METRICSGLOBAL(frame), 0, sizeof(Metrics));
+	dumpMemoryStats();
+}
+
+uint64
+Metrics::getTime(void)
+{
+#ifdef RW_PS2
+	return (uint64)clock()*1000000/CLOCKS_PER_SEC;
+#else
+	using namespace std::chrono;
+	return duration_cast<microseconds>(steady_clock::now().time_since_epoch()).count();
+#endif
+}
+
+// Events after the first maxEvents are dropped
+bool32
+Metrics::beginTrace(int32 maxEvents)
+{
+	if(currentMetrics == nil || maxEvents <= 0)
+		return 0;
+	rwFree(METRICSGLOBAL(events));
+	// raw memfuncs, the trace shouldn't show up in its own allocation counts
+	METRICSGLOBAL(events) = (TraceEvent*)Engine::memfuncs.rwmalloc(maxEvents*sizeof(TraceEvent), MEMDUR_EVENT);
+	if(METRICSGLOBAL(events) == nil){
+		RWERROR((ERR_ALLOC, maxEvents*sizeof(TraceEvent)));
+		return 0;
+	}
+	METRICSGLOBAL(numEvents) = 0;
+	METRICSGLOBAL(maxEvents) = maxEvents;
+	METRICSGLOBAL(traceStart) = getTime();
+	return 1;
+}
+
+// Stops recording, the events are kept for writeTrace
+void
+Metrics::endTrace(void)
+{
+	if(currentMetrics == nil)
+		return;
+	METRICSGLOBAL(maxEvents) = 0;
+}
+
+bool32
+Metrics::writeTrace(const char *path)
+{
+	StreamFile file;
+	TraceEvent *e;
+	char buf[256];
+	int32 i, len;
+
+	if(currentMetrics == nil || METRICSGLOBAL(events) == nil)
+		return 0;
+	if(file.open(path, "wb") == nil){
+		RWERROR((ERR_FILE, path));
+		return 0;
+	}
+	len = sprintf(buf, "{\"traceEvents\":[\n");
+	file.write8(buf, len);
+	for(i = 0; i < METRICSGLOBAL(numEvents); i++){
+		e = &METRICSGLOBAL(events)[i];
+		len = snprintf(buf, sizeof(buf),
+			"%s{\"name\":\"%s\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%llu,\"dur\":%llu}",
+			i ? ",\n" : "", e->name,
+			(unsigned long long)(e->start - METRICSGLOBAL(traceStart)),
+			(unsigned long long)e->duration);
+		file.write8(buf, len);
+	}
+	len = sprintf(buf, "\n]}\n");
+	file.write8(buf, len);
+	file.close();
+	return 1;
+}
+
+MetricsTimer::MetricsTimer(const char *name)
+{
+	this->name = name;
+	this->start = 0;
+	if(currentMetrics && METRICSGLOBAL(numEvents) < METRICSGLOBAL(maxEvents))
+		this->start = Metrics::getTime();
+}
+
+MetricsTimer::~MetricsTimer(void)
+{
+	TraceEvent *e;
+	if(this->start == 0 || currentMetrics == nil ||
+	   METRICSGLOBAL(numEvents) >= METRICSGLOBAL(maxEvents))
+		return;
+	e = &METRICSGLOBAL(events)[METRICSGLOBAL(numEvents)++];
+	e->name = this->name;
+	e->start = this->start;
+	e->duration = Metrics::getTime() - this->start;
+}
+
+//
+// Memory tracking
+//
+
+// In front of every tracked allocation, keeps the alignment of malloc
+struct TrackHeader
+{
+	size_t sz;
+	uint32 hint;
+	uint32 pad[(16 - sizeof(size_t) - sizeof(uint32))/4];
+};
+
+// ids are found by open addressing, the last slot takes what doesn't fit
+#define OTHERID 0xFFFFFFFF
+static MemoryStats::Entry trackTotal;
+static MemoryStats::Entry trackDurations[Metrics::NUMMEMDUR];
+static MemoryStats::Entry trackIds[MemoryStats::MAXIDS];
+static bool32 trackIdUsed[MemoryStats::MAXIDS];
+static int32 numTrackIds;
+#ifdef RW_METRICSTHREADS
+static std::mutex trackMutex;
+#define TRACKLOCK std::lock_guard<std::mutex> lock(trackMutex)
+#else
+#define TRACKLOCK
+#endif
+
+static MemoryStats::Entry*
+trackEntry(uint32 id)
+{
+	uint32 i, n;
+	i = (id*2654435761u) % (MemoryStats::MAXIDS-1);
+	for(n = 0; n < MemoryStats::MAXIDS-1; n++){
+		if(!trackIdUsed[i]){
+			trackIdUsed[i] = 1;
+			trackIds[i].id = id;
+			numTrackIds++;
+			return &trackIds[i];
+		}
+		if(trackIds[i].id == id)
+			return &trackIds[i];
+		i = (i+1) % (MemoryStats::MAXIDS-1);
+	}
+	i = MemoryStats::MAXIDS-1;
+	if(!trackIdUsed[i]){
+		trackIdUsed[i] = 1;
+		trackIds[i].id = OTHERID;
+		numTrackIds++;
+	}
+	return &trackIds[i];
+}
+
+static void
+entryAdd(MemoryStats::Entry *e, size_t sz)
+{
+	e->numLive++;
+	e->liveBytes += sz;
+	if(e->liveBytes > e->peakBytes)
+		e->peakBytes = e->liveBytes;
+	e->numAllocs++;
+	e->allocBytes += sz;
+}
+
+static void
+entrySub(MemoryStats::Entry *e, size_t sz)
+{
+	e->numLive--;
+	e->liveBytes -= sz;
+}
+
+static uint32
+hintDuration(uint32 hint)
+{
+	uint32 dur = (hint>>16) & 0xF;
+	return dur < Metrics::NUMMEMDUR ? dur : 0;
+}
+
+static void
+trackAdd(size_t sz, uint32 hint)
+{
+	TRACKLOCK;
+	entryAdd(&trackTotal, sz);
+	entryAdd(&trackDurations[hintDuration(hint)], sz);
+	entryAdd(trackEntry(hint & 0xFFFF), sz);
+}
+
+static void
+trackSub(size_t sz, uint32 hint)
+{
+	TRACKLOCK;
+	entrySub(&trackTotal, sz);
+	entrySub(&trackDurations[hintDuration(hint)], sz);
+	entrySub(trackEntry(hint & 0xFFFF), sz);
+}
+
+static void*
+malloc_tracked(size_t sz, uint32 hint)
+{
+	TrackHeader *h;
+	if(sz == 0) return nil;
+	h = (TrackHeader*)malloc(sz + sizeof(TrackHeader));
+	if(h == nil)
+		return nil;
+	h->sz = sz;
+	h->hint = hint;
+	trackAdd(sz, hint);
+	return h+1;
+}
+
+static void*
+realloc_tracked(void *p, size_t sz, uint32 hint)
+{
+	TrackHeader *h, *nh;
+	if(p == nil)
+		return malloc_tracked(sz, hint);
+	h = (TrackHeader*)p - 1;
+	nh = (TrackHeader*)realloc(h, sz + sizeof(TrackHeader));
+	if(nh == nil)
+		return nil;
+	trackSub(nh->sz, nh->hint);
+	nh->sz = sz;
+	nh->hint = hint;
+	trackAdd(sz, hint);
+	return nh+1;
+}
+
+static void
+free_tracked(void *p)
+{
+	TrackHeader *h;
+	if(p == nil)
+		return;
+	h = (TrackHeader*)p - 1;
+	trackSub(h->sz, h->hint);
+	free(h);
+}
+
+MemoryFunctions trackedMemfuncs = {
+	malloc_tracked,
+	realloc_tracked,
+	free_tracked,
+	nil,
+	nil
+};
+
+void
+MemoryStats::snapshot(MemoryStats *stats)
+{
+	int32 i;
+	TRACKLOCK;
+	stats->time = Metrics::getTime();
+	stats->total = trackTotal;
+	for(i = 0; i < Metrics::NUMMEMDUR; i++){
+		stats->durations[i] = trackDurations[i];
+		stats->durations[i].id = i<<16;
+	}
+	stats->numIds = 0;
+	for(i = 0; i < MAXIDS; i++)
+		if(trackIdUsed[i])
+			stats->ids[stats->numIds++] = trackIds[i];
+}
+
+static void
+entryDiff(MemoryStats::Entry *dst, const MemoryStats::Entry *now, const MemoryStats::Entry *before)
+{
+	dst->id = now->id;
+	dst->numLive = now->numLive - before->numLive;
+	dst->liveBytes = now->liveBytes - before->liveBytes;
+	dst->peakBytes = now->peakBytes;
+	dst->numAllocs = now->numAllocs - before->numAllocs;
+	dst->allocBytes = now->allocBytes - before->allocBytes;
+}
+
+void
+MemoryStats::diff(MemoryStats *dst, const MemoryStats *now, const MemoryStats *before)
+{
+	static const MemoryStats::Entry zero = {};
+	const MemoryStats::Entry *b;
+	int32 i, j;
+
+	dst->time = now->time - before->time;
+	entryDiff(&dst->total, &now->total, &before->total);
+	for(i = 0; i < Metrics::NUMMEMDUR; i++)
+		entryDiff(&dst->durations[i], &now->durations[i], &before->durations[i]);
+	// ids are only ever added
+	dst->numIds = now->numIds;
+	for(i = 0; i < now->numIds; i++){
+		b = &zero;
+		for(j = 0; j < before->numIds; j++)
+			if(before->ids[j].id == now->ids[i].id){
+				b = &before->ids[j];
+				break;
+			}
+		entryDiff(&dst->ids[i], &now->ids[i], b);
+	}
+}
+
+static const char*
+idName(uint32 id)
+{
+	switch(id){
+	case ID_NAOBJECT: return "unknown";
+	case ID_CAMERA: return "camera";
+	case ID_TEXTURE: return "texture";
+	case ID_MATERIAL: return "material";
+	case ID_WORLD: return "world";
+	case ID_MATRIX: return "matrix";
+	case ID_FRAMELIST: return "frame";
+	case ID_GEOMETRY: return "geometry";
+	case ID_CLUMP: return "clump";
+	case ID_LIGHT: return "light";
+	case ID_ATOMIC: return "atomic";
+	case ID_TEXDICTIONARY: return "texdict";
+	case ID_IMAGE: return "image";
+	case ID_ANIMANIMATION: return "animation";
+	case ID_UVANIMDICT: return "uvanimdict";
+	case ID_SKIN: return "skin";
+	case ID_HANIM: return "hanim";
+	case ID_USERDATA: return "userdata";
+	case ID_MATFX: return "matfx";
+	case ID_PDS: return "pds";
+	case ID_ADC: return "adc";
+	case ID_UVANIMATION: return "uvanim";
+	case ID_FRAMEMODULE: return "frame module";
+	case ID_IMAGEMODULE: return "image module";
+	case ID_RASTERMODULE: return "raster module";
+	case ID_TEXTUREMODULE: return "texture module";
+	case ID_METRICSMODULE: return "metrics";
+	case ID_RASTERPS2: return "ps2 raster";
+	case ID_DRIVER: return "driver";
+	case OTHERID: return "other";
+	}
+	return nil;
+}
+
+static void
+printEntry(const MemoryStats::Entry *e, const char *name)
+{
+	printf("  %-16s %8d live %12lld bytes %12lld peak %10llu allocs %12llu bytes\n",
+		name, e->numLive, (long long)e->liveBytes, (long long)e->peakBytes,
+		(unsigned long long)e->numAllocs, (unsigned long long)e->allocBytes);
+}
+
+void
+MemoryStats::print(void)
+{
+	static const char *durNames[Metrics::NUMMEMDUR] = {
+		"MEMDUR_NA", "MEMDUR_FUNCTION", "MEMDUR_FRAME", "MEMDUR_EVENT", "MEMDUR_GLOBAL"
+	};
+	char buf[16];
+	const char *name;
+	int32 i;
+
+	printEntry(&this->total, "total");
+	for(i = 0; i < Metrics::NUMMEMDUR; i++)
+		printEntry(&this->durations[i], durNames[i]);
+	for(i = 0; i < this->numIds; i++){
+		name = idName(this->ids[i].id);
+		if(name == nil){
+			sprintf(buf, "id %X", this->ids[i].id);
+			name = buf;
+		}
+		printEntry(&this->ids[i], name);
+	}
+}
+
+static uint32 dumpInterval;
+static MemoryStats lastDump;
+
+void
+MemoryStats::setDumpInterval(uint32 ms)
+{
+	dumpInterval = ms;
+	if(ms)
+		MemoryStats::snapshot(&lastDump);
+}
+
+static void
+dumpMemoryStats(void)
+{
+	static MemoryStats now, change;
+	if(dumpInterval == 0 ||
+	   (Metrics::getTime() - lastDump.time)/1000 < dumpInterval)
+		return;
+	MemoryStats::snapshot(&now);
+	MemoryStats::diff(&change, &now, &lastDump);
+	printf("memory:\n");
+	now.print();
+	printf("change in the last %.1f seconds:\n", change.time/1000000.0);
+	change.print();
+	lastDump = now;
+}
+
+}
@@ -0,0 +1,277 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwsimd.h"
+
+#define PLUGIN_ID ID_IMAGE
+
+// Mipmap generation for images.
+// Filtering is done on linear float RGBA, colour is converted
+// from and back to sRGB so averages don't get too dark.
+
+namespace rw {
+
+static float32 srgbToLinearTab[256];
+static uint8 linearToSrgbTab[4096];
+static bool32 gammaTablesDone;
+
+static void
+makeGammaTables(void)
+{
+	int32 i;
+	float32 c;
+
+	if(gammaTablesDone)
+		return;
+	for(i = 0; i < 256; i++){
+		c = i/255.0f;
+		srgbToLinearTab[i] = c <= 0.04045f ? c/12.92f : powf((c+0.055f)/1.055f, 2.4f);
+	}
+	for(i = 0; i < 4096; i++){
+		c = i/4095.0f;
+		c = c <= 0.0031308f ? c*12.92f : 1.055f*powf(c, 1.0f/2.4f) - 0.055f;
+		linearToSrgbTab[i] = (uint8)(c*255.0f + 0.5f);
+	}
+	gammaTablesDone = 1;
+}
+
+static float32*
+imageToLinear(Image *img, bool32 srgb)
+{
+	int32 x, y;
+	uint8 *line, *p;
+	float32 *px = rwNewT(float32, img->width*img->height*4, MEMDUR_FUNCTION | ID_IMAGE);
+	float32 *dst = px;
+
+	assert(img->depth == 32);
+	line = img->pixels;
+	for(y = 0; y < img->height; y++){
+		p = line;
+		for(x = 0; x < img->width; x++){
+			if(srgb){
+				dst[0] = srgbToLinearTab[p[0]];
+				dst[1] = srgbToLinearTab[p[1]];
+				dst[2] = srgbToLinearTab[p[2]];
+			}else{
+				dst[0] = p[0]/255.0f;
+				dst[1] = p[1]/255.0f;
+				dst[2] = p[2]/255.0f;
+			}
+			dst[3] = p[3]/255.0f;
+			dst += 4;
+			p += 4;
+		}
+		line += img->stride;
+	}
+	return px;
+}
+
+static void
+linearToImage(Image *img, float32 *px, bool32 srgb)
+{
+	int32 x, y, i;
+	uint8 *line, *p;
+	float32 c;
+
+	assert(img->depth == 32);
+	line = img->pixels;
+	for(y = 0; y < img->height; y++){
+		p = line;
+		for(x = 0; x < img->width; x++){
+			for(i = 0; i < 4; i++){
+				c = px[i];
+				c = c < 0.0f ? 0.0f : c > 1.0f ? 1.0f : c;
+				if(srgb && i < 3)
+					p[i] = linearToSrgbTab[(int32)(c*4095.0f + 0.5f)];
+				else
+					p[i] = (uint8)(c*255.0f + 0.5f);
+			}
+			px += 4;
+			p += 4;
+		}
+		line += img->stride;
+	}
+}
+
+// dst[0..3] = sum of w[i]*src[i][0..3]
+static void
+filterTaps(float32 *dst, float32 **src, const float32 *w, int32 n)
+{
+	int32 i;
+#ifdef RW_SSE2
+	__m128 sum = _mm_setzero_ps();
+	for(i = 0; i < n; i++)
+		sum = _mm_add_ps(sum, _mm_mul_ps(_mm_loadu_ps(src[i]), _mm_set1_ps(w[i])));
+	_mm_storeu_ps(dst, sum);
+#else
+	dst[0] = dst[1] = dst[2] = dst[3] = 0.0f;
+	for(i = 0; i < n; i++){
+		dst[0] += w[i]*src[i][0];
+		dst[1] += w[i]*src[i][1];
+		dst[2] += w[i]*src[i][2];
+		dst[3] += w[i]*src[i][3];
+	}
+#endif
+}
+
+// 2x2 average, odd edges are clamped
+static void
+downsampleBox(float32 *dst, float32 *src, int32 w, int32 h)
+{
+	static const float32 weights[4] = { 0.25f, 0.25f, 0.25f, 0.25f };
+	int32 dw = w > 1 ? w/2 : 1;
+	int32 dh = h > 1 ? h/2 : 1;
+	int32 x, y, x1, y1;
+	float32 *src4[4];
+
+	for(y = 0; y < dh; y++){
+		y1 = 2*y+1 < h ? 2*y+1 : h-1;
+		for(x = 0; x < dw; x++){
+			x1 = 2*x+1 < w ? 2*x+1 : w-1;
+			src4[0] = &src[(2*y*w + 2*x)*4];
+			src4[1] = &src[(2*y*w + x1)*4];
+			src4[2] = &src[(y1*w + 2*x)*4];
+			src4[3] = &src[(y1*w + x1)*4];
+			filterTaps(dst, src4, weights, 4);
+			dst += 4;
+		}
+	}
+}
+
+// Kaiser windowed sinc, 6 taps per axis.
+// Taps are at source distances -2.5 .. 2.5 from the destination centre.
+#define KAISERTAPS 6
+static float32 kaiserWeights[KAISERTAPS];
+static bool32 kaiserDone;
+
+static float32
+besselI0(float32 x)
+{
+	float32 sum = 1.0f, term = 1.0f;
+	for(int32 k = 1; k < 20; k++){
+		term *= (x/(2.0f*k)) * (x/(2.0f*k));
+		sum += term;
+	}
+	return sum;
+}
+
+static void
+makeKaiserWeights(void)
+{
+	const float32 alpha = 4.0f;
+	const float32 width = 3.0f;
+	float32 d, x, w, sum;
+	int32 i;
+
+	if(kaiserDone)
+		return;
+	sum = 0.0f;
+	for(i = 0; i < KAISERTAPS; i++){
+		d = i - KAISERTAPS/2 + 0.5f;
+		// sinc at half the source frequency
+		x = d*0.5f*(float32)M_PI;
+		w = x == 0.0f ? 1.0f : sinf(x)/x;
+		x = d/width;
+		w *= besselI0(alpha*sqrtf(1.0f - x*x)) / besselI0(alpha);
+		kaiserWeights[i] = w;
+		sum += w;
+	}
+	for(i = 0; i < KAISERTAPS; i++)
+		kaiserWeights[i] /= sum;
+	kaiserDone = 1;
+}
+
+static void
+downsampleKaiser(float32 *dst, float32 *src, int32 w, int32 h)
+{
+	int32 dw = w > 1 ? w/2 : 1;
+	int32 dh = h > 1 ? h/2 : 1;
+	int32 x, y, i, j;
+	float32 *taps[KAISERTAPS];
+	float32 *tmp = rwNewT(float32, dw*h*4, MEMDUR_FUNCTION | ID_IMAGE);
+	float32 *p;
+
+	makeKaiserWeights();
+
+	// horizontal
+	p = tmp;
+	for(y = 0; y < h; y++)
+		for(x = 0; x < dw; x++){
+			for(i = 0; i < KAISERTAPS; i++){
+				j = 2*x - KAISERTAPS/2 + 1 + i;
+				j = j < 0 ? 0 : j >= w ? w-1 : j;
+				taps[i] = &src[(y*w + j)*4];
+			}
+			filterTaps(p, taps, kaiserWeights, KAISERTAPS);
+			p += 4;
+		}
+
+	// vertical
+	for(y = 0; y < dh; y++)
+		for(x = 0; x < dw; x++){
+			for(i = 0; i < KAISERTAPS; i++){
+				j = 2*y - KAISERTAPS/2 + 1 + i;
+				j = j < 0 ? 0 : j >= h ? h-1 : j;
+				taps[i] = &tmp[(j*dw + x)*4];
+			}
+			filterTaps(dst, taps, kaiserWeights, KAISERTAPS);
+			dst += 4;
+		}
+
+	rwFree(tmp);
+}
+
+// Make the next smaller mip level of this image as a new 32 bit image.
+// srgb means colour is gamma corrected while filtering.
+Image*
+Image::makeMipmap(int32 filter, bool32 srgb)
+{
+	// Convert to 32 bits if necessary but don't change original
+	Image *img = this;
+	if(this->depth != 32){
+		img = Image::create(this->width, this->height, this->depth);
+		img->pixels = this->pixels;
+		img->stride = this->stride;
+		img->palette = this->palette;
+		img->convertTo32();
+	}
+
+	int32 w = img->width;
+	int32 h = img->height;
+	int32 dw = w > 1 ? w/2 : 1;
+	int32 dh = h > 1 ? h/2 : 1;
+
+	makeGammaTables();
+	float32 *src = imageToLinear(img, srgb);
+	float32 *dst = rwNewT(float32, dw*dh*4, MEMDUR_FUNCTION | ID_IMAGE);
+	switch(filter){
+	case MIPFILTER_KAISER:
+		downsampleKaiser(dst, src, w, h);
+		break;
+	case MIPFILTER_BOX:
+	default:
+		downsampleBox(dst, src, w, h);
+		break;
+	}
+
+	Image *mip = Image::create(dw, dh, 32);
+	mip->allocate();
+	linearToImage(mip, dst, srgb);
+
+	rwFree(src);
+	rwFree(dst);
+	if(img != this)
+		img->destroy();
+	return mip;
+}
+
+}
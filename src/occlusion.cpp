@@ -0,0 +1,325 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+#include <math.h>
+
+#include "rwbase.h"
+#include "rwerror.h"
+#include "rwplg.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwsimd.h"
+
+#define PLUGIN_ID ID_CAMERA
+
+// CPU occlusion culling.
+// Occluders are rasterised in view space with perspective divide
+// into a small depth buffer, everything else tests its world box.
+// Only perspective cameras are supported, with a parallel camera
+// all candidates are rendered.
+
+namespace rw {
+
+struct ScreenVert
+{
+	float32 x, y, d;
+};
+
+OcclusionBuffer*
+OcclusionBuffer::create(int32 width, int32 height)
+{
+	OcclusionBuffer *buf = rwNewT(OcclusionBuffer, 1, MEMDUR_EVENT | ID_CAMERA);
+	buf->width = (width+3) & ~3;
+	buf->height = height;
+	buf->depth = rwNewT(float32, buf->width*buf->height, MEMDUR_EVENT | ID_CAMERA);
+	buf->camera = nil;
+	buf->verts = nil;
+	buf->maxVerts = 0;
+	buf->candidates = nil;
+	buf->numCandidates = 0;
+	buf->maxCandidates = 0;
+	return buf;
+}
+
+void
+OcclusionBuffer::destroy(void)
+{
+	rwFree(this->depth);
+	rwFree(this->verts);
+	rwFree(this->candidates);
+	rwFree(this);
+}
+
+void
+OcclusionBuffer::begin(Camera *cam)
+{
+	this->camera = cam;
+	this->viewMatrix = cam->viewMatrix;
+	this->numCandidates = 0;
+	memset(this->depth, 0, this->width*this->height*sizeof(float32));
+}
+
+// Occluders are drawn right away, they only have to be
+// in the buffer before end() tests the others.
+void
+OcclusionBuffer::addAtomic(Atomic *atomic)
+{
+	if(this->numCandidates >= this->maxCandidates){
+		this->maxCandidates = this->maxCandidates ? this->maxCandidates*2 : 256;
+		this->candidates = rwResizeT(Atomic*, this->candidates, this->maxCandidates,
+			MEMDUR_EVENT | ID_CAMERA);
+	}
+	this->candidates[this->numCandidates++] = atomic;
+	if(atomic->object.object.flags & Atomic::OCCLUDER)
+		this->drawAtomic(atomic);
+}
+
+void
+OcclusionBuffer::end(CullStats *stats)
+{
+	Atomic *a;
+	bool32 persp = this->camera->projection == Camera::PERSPECTIVE;
+	for(int32 i = 0; i < this->numCandidates; i++){
+		a = this->candidates[i];
+		if(!persp || a->getFrame() == nil ||
+		   a->object.object.flags & Atomic::OCCLUDER ||
+		   this->testBBox(a->getWorldBoundingBox()))
+			a->render();
+		else if(stats)
+			stats->atomicsOccluded++;
+	}
+	this->numCandidates = 0;
+}
+
+// Keep the larger 1/z of all pixels inside the triangle
+static void
+drawTriangle(OcclusionBuffer *buf, const ScreenVert *v0, const ScreenVert *v1, const ScreenVert *v2)
+{
+	float32 area, a01, b01, c01, a12, b12, c12, a20, b20, c20;
+	float32 da, db, dc;
+	int32 minx, maxx, miny, maxy, x, y;
+	float32 *row;
+	const ScreenVert *tmp;
+
+	area = (v1->x - v0->x)*(v2->y - v0->y) - (v2->x - v0->x)*(v1->y - v0->y);
+	if(area < 0.0f){
+		// occluders don't need to be closed, draw both sides
+		tmp = v1;
+		v1 = v2;
+		v2 = tmp;
+		area = -area;
+	}
+	if(area < 1.0e-6f)
+		return;
+
+	minx = (int32)floorf(v0->x < v1->x ? (v0->x < v2->x ? v0->x : v2->x) : (v1->x < v2->x ? v1->x : v2->x));
+	maxx = (int32)ceilf(v0->x > v1->x ? (v0->x > v2->x ? v0->x : v2->x) : (v1->x > v2->x ? v1->x : v2->x));
+	miny = (int32)floorf(v0->y < v1->y ? (v0->y < v2->y ? v0->y : v2->y) : (v1->y < v2->y ? v1->y : v2->y));
+	maxy = (int32)ceilf(v0->y > v1->y ? (v0->y > v2->y ? v0->y : v2->y) : (v1->y > v2->y ? v1->y : v2->y));
+	if(minx < 0) minx = 0;
+	if(miny < 0) miny = 0;
+	if(maxx > buf->width-1) maxx = buf->width-1;
+	if(maxy > buf->height-1) maxy = buf->height-1;
+	if(minx > maxx || miny > maxy)
+		return;
+	minx &= ~3;
+
+	// edge functions, positive inside
+	a01 = v0->y - v1->y; b01 = v1->x - v0->x; c01 = -a01*v0->x - b01*v0->y;
+	a12 = v1->y - v2->y; b12 = v2->x - v1->x; c12 = -a12*v1->x - b12*v1->y;
+	a20 = v2->y - v0->y; b20 = v0->x - v2->x; c20 = -a20*v2->x - b20*v2->y;
+	// depth plane from barycentrics
+	da = (a12*v0->d + a20*v1->d + a01*v2->d)/area;
+	db = (b12*v0->d + b20*v1->d + b01*v2->d)/area;
+	dc = (c12*v0->d + c20*v1->d + c01*v2->d)/area;
+
+#ifdef RW_SSE2
+	__m128 zero = _mm_setzero_ps();
+	__m128 offs = _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f);
+	__m128 va01 = _mm_set1_ps(a01), va12 = _mm_set1_ps(a12), va20 = _mm_set1_ps(a20);
+	__m128 vda = _mm_set1_ps(da);
+	for(y = miny; y <= maxy; y++){
+		float32 py = y + 0.5f;
+		__m128 r01 = _mm_set1_ps(b01*py + c01);
+		__m128 r12 = _mm_set1_ps(b12*py + c12);
+		__m128 r20 = _mm_set1_ps(b20*py + c20);
+		__m128 rd = _mm_set1_ps(db*py + dc);
+		row = &buf->depth[y*buf->width];
+		for(x = minx; x <= maxx; x += 4){
+			__m128 px = _mm_add_ps(_mm_set1_ps((float32)x), offs);
+			__m128 mask = _mm_and_ps(
+				_mm_and_ps(_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(va01, px), r01), zero),
+				           _mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(va12, px), r12), zero)),
+				_mm_cmpge_ps(_mm_add_ps(_mm_mul_ps(va20, px), r20), zero));
+			__m128 old = _mm_loadu_ps(&row[x]);
+			__m128 d = _mm_max_ps(old, _mm_add_ps(_mm_mul_ps(vda, px), rd));
+			_mm_storeu_ps(&row[x], _mm_or_ps(_mm_and_ps(mask, d), _mm_andnot_ps(mask, old)));
+		}
+	}
+#else
+	float32 px, py, d;
+	for(y = miny; y <= maxy; y++){
+		py = y + 0.5f;
+		row = &buf->depth[y*buf->width];
+		for(x = minx; x <= maxx; x++){
+			px = x + 0.5f;
+			if(a01*px + b01*py + c01 < 0.0f ||
+			   a12*px + b12*py + c12 < 0.0f ||
+			   a20*px + b20*py + c20 < 0.0f)
+				continue;
+			d = da*px + db*py + dc;
+			if(d > row[x])
+				row[x] = d;
+		}
+	}
+#endif
+}
+
+static void
+project(OcclusionBuffer *buf, ScreenVert *sv, const V3d *v)
+{
+	float32 recip = 1.0f/v->z;
+	sv->x = v->x*recip*buf->width;
+	sv->y = v->y*recip*buf->height;
+	sv->d = recip;
+}
+
+// Clip a view space triangle against the near plane and draw it
+static void
+clipAndDraw(OcclusionBuffer *buf, const V3d *v0, const V3d *v1, const V3d *v2, float32 nearPlane)
+{
+	const V3d *in[3] = { v0, v1, v2 };
+	V3d clipped[4];
+	ScreenVert sv[4];
+	int32 i, n;
+	float32 t;
+
+	n = 0;
+	for(i = 0; i < 3; i++){
+		const V3d *a = in[i];
+		const V3d *b = in[(i+1)%3];
+		if(a->z >= nearPlane)
+			clipped[n++] = *a;
+		if((a->z >= nearPlane) != (b->z >= nearPlane)){
+			t = (nearPlane - a->z)/(b->z - a->z);
+			clipped[n++] = lerp(*a, *b, t);
+		}
+	}
+	if(n < 3)
+		return;
+	for(i = 0; i < n; i++)
+		project(buf, &sv[i], &clipped[i]);
+	drawTriangle(buf, &sv[0], &sv[1], &sv[2]);
+	if(n == 4)
+		drawTriangle(buf, &sv[0], &sv[2], &sv[3]);
+}
+
+// Rasterise the triangles of the first morph target.
+// Native geometry has no triangles left and is ignored.
+void
+OcclusionBuffer::drawAtomic(Atomic *atomic)
+{
+	Geometry *geo = atomic->geometry;
+	Matrix m;
+	Triangle *t;
+	int32 i;
+	float32 nearPlane;
+
+	if(this->camera->projection != Camera::PERSPECTIVE ||
+	   geo == nil || atomic->getFrame() == nil ||
+	   geo->triangles == nil || geo->morphTargets[0].vertices == nil)
+		return;
+
+	if(geo->numVertices > this->maxVerts){
+		this->maxVerts = geo->numVertices;
+		rwFree(this->verts);
+		this->verts = rwNewT(V3d, this->maxVerts, MEMDUR_EVENT | ID_CAMERA);
+	}
+	Matrix::mult(&m, atomic->getFrame()->getLTM(), &this->viewMatrix);
+	V3d::transformPoints(this->verts, geo->morphTargets[0].vertices, geo->numVertices, &m);
+
+	nearPlane = this->camera->nearPlane;
+	t = geo->triangles;
+	for(i = 0; i < geo->numTriangles; i++, t++){
+		V3d *v0 = &this->verts[t->v[0]];
+		V3d *v1 = &this->verts[t->v[1]];
+		V3d *v2 = &this->verts[t->v[2]];
+		if(v0->z >= nearPlane && v1->z >= nearPlane && v2->z >= nearPlane){
+			ScreenVert sv[3];
+			project(this, &sv[0], v0);
+			project(this, &sv[1], v1);
+			project(this, &sv[2], v2);
+			drawTriangle(this, &sv[0], &sv[1], &sv[2]);
+		}else
+			clipAndDraw(this, v0, v1, v2, nearPlane);
+	}
+}
+
+// Returns whether any part of the box might be visible,
+// i.e. there is a pixel under it where no occluder is nearer.
+bool32
+OcclusionBuffer::testBBox(const BBox *box)
+{
+	V3d corners[8], v[8];
+	float32 minx, maxx, miny, maxy, minz, recip, sx, sy, boxd;
+	int32 i, x0, x1, y0, y1, x, y;
+	float32 *row;
+
+	for(i = 0; i < 8; i++){
+		corners[i].x = i & 1 ? box->sup.x : box->inf.x;
+		corners[i].y = i & 2 ? box->sup.y : box->inf.y;
+		corners[i].z = i & 4 ? box->sup.z : box->inf.z;
+	}
+	V3d::transformPoints(v, corners, 8, &this->viewMatrix);
+
+	minx = miny = 1.0e30f;
+	maxx = maxy = -1.0e30f;
+	minz = 1.0e30f;
+	for(i = 0; i < 8; i++){
+		// crossing the near plane, can't say anything
+		if(v[i].z < this->camera->nearPlane)
+			return 1;
+		recip = 1.0f/v[i].z;
+		sx = v[i].x*recip*this->width;
+		sy = v[i].y*recip*this->height;
+		if(sx < minx) minx = sx;
+		if(sx > maxx) maxx = sx;
+		if(sy < miny) miny = sy;
+		if(sy > maxy) maxy = sy;
+		if(v[i].z < minz) minz = v[i].z;
+	}
+	x0 = (int32)floorf(minx);
+	x1 = (int32)ceilf(maxx);
+	y0 = (int32)floorf(miny);
+	y1 = (int32)ceilf(maxy);
+	if(x0 < 0) x0 = 0;
+	if(y0 < 0) y0 = 0;
+	if(x1 > this->width-1) x1 = this->width-1;
+	if(y1 > this->height-1) y1 = this->height-1;
+	if(x0 > x1 || y0 > y1)
+		return 1;	// off screen, leave that to the frustum test
+	x0 &= ~3;
+	boxd = 1.0f/minz;
+
+#ifdef RW_SSE2
+	__m128 vd = _mm_set1_ps(boxd);
+	for(y = y0; y <= y1; y++){
+		row = &this->depth[y*this->width];
+		for(x = x0; x <= x1; x += 4)
+			if(_mm_movemask_ps(_mm_cmplt_ps(_mm_loadu_ps(&row[x]), vd)))
+				return 1;
+	}
+#else
+	for(y = y0; y <= y1; y++){
+		row = &this->depth[y*this->width];
+		for(x = x0; x <= x1; x++)
+			if(row[x] < boxd)
+				return 1;
+	}
+#endif
+	return 0;
+}
+
+}
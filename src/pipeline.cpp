@@ -5,6 +5,7 @@
 
 #include "rwbase.h"
 #include "rwplg.h"
+#include "rwrender.h"
 #include "rwpipeline.h"
 #include "rwobjects.h"
 #include "rwengine.h"
@@ -39,6 +40,22 @@ ObjPipeline::destroy(void)
 	rwFree(this);
 }
 
+void
+ObjPipeline::instance(Atomic *atomic)
+{
+	RWTIMER("instance");
+	this->impl.instance(this, atomic);
+}
+
+void
+ObjPipeline::render(Atomic *atomic)
+{
+	RWTIMER("render");
+	RWMETRIC(numAtomics, 1);
+	FlushImmediate();
+	this->impl.render(this, atomic);
+}
+
 // helper functions
 
 void
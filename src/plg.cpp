@@ -39,17 +39,93 @@ PluginList::close(void)
 		p->inParentList.remove();
 		p->inGlobalList.remove();
 		rwFree(p);
+		rwFree(l->table);
+		l->table = nil;
+		l->dirty = 1;
 		if(l->plugins.isEmpty())
 			l->size = l->defaultSize;
 	}
 	assert(allPlugins.isEmpty());
 }
 
+// Build the flat table and index arrays in list order.
+// Everything is in one allocation.
 void
-PluginList::construct(void *object)
+PluginList::compile(void)
 {
+	int32 i, j, n;
+	Plugin *p;
+
+	rwFree(this->table);
+	this->table = nil;
+	this->numPlugins = 0;
+	this->numCtors = 0;
+	this->numDtors = 0;
+	this->numCopies = 0;
+	this->numAlways = 0;
+	this->dirty = 0;
+
+	n = this->plugins.count();
+	if(n == 0)
+		return;
+	uint8 *data = (uint8*)rwMalloc(n*sizeof(Plugin) + 5*n*sizeof(int32), MEMDUR_GLOBAL);
+	this->table = (Plugin*)data;
+	data += n*sizeof(Plugin);
+	this->ctors = (int32*)data;
+	this->dtors = this->ctors + n;
+	this->copies = this->dtors + n;
+	this->always = this->copies + n;
+	this->byID = this->always + n;
+
+	i = 0;
 	FORLIST(lnk, this->plugins){
-		Plugin *p = PLG(lnk);
+		p = &this->table[i];
+		*p = *PLG(lnk);
+		if(p->constructor != defCtor)
+			this->ctors[this->numCtors++] = i;
+		if(p->destructor != defDtor)
+			this->dtors[this->numDtors++] = i;
+		if(p->copy != defCopy)
+			this->copies[this->numCopies++] = i;
+		if(p->alwaysCallback)
+			this->always[this->numAlways++] = i;
+		// insertion sort, equal IDs stay in list order
+		for(j = i; j > 0 && this->table[this->byID[j-1]].id > p->id; j--)
+			this->byID[j] = this->byID[j-1];
+		this->byID[j] = i;
+		i++;
+	}
+	this->numPlugins = n;
+}
+
+// index into byID of the first plugin with this ID, -1 if there is none
+int32
+PluginList::findFirst(uint32 id)
+{
+	int32 lo, hi, mid;
+	if(this->dirty)
+		this->compile();
+	lo = 0;
+	hi = this->numPlugins;
+	while(lo < hi){
+		mid = (lo+hi)/2;
+		if(this->table[this->byID[mid]].id < id)
+			lo = mid+1;
+		else
+			hi = mid;
+	}
+	if(lo < this->numPlugins && this->table[this->byID[lo]].id == id)
+		return lo;
+	return -1;
+}
+
+void
+PluginList::construct(void *object)
+{
+	if(this->dirty)
+		this->compile();
+	for(int32 i = 0; i < this->numCtors; i++){
+		Plugin *p = &this->table[this->ctors[i]];
 		p->constructor(object, p->offset, p->size);
 	}
 }
@@ -57,8 +133,10 @@ PluginList::construct(void *object)
 void
 PluginList::destruct(void *object)
 {
-	FORLIST(lnk, this->plugins){
-		Plugin *p = PLG(lnk);
+	if(this->dirty)
+		this->compile();
+	for(int32 i = 0; i < this->numDtors; i++){
+		Plugin *p = &this->table[this->dtors[i]];
 		p->destructor(object, p->offset, p->size);
 	}
 }
@@ -66,8 +144,10 @@ PluginList::destruct(void *object)
 void
 PluginList::copy(void *dst, void *src)
 {
-	FORLIST(lnk, this->plugins){
-		Plugin *p = PLG(lnk);
+	if(this->dirty)
+		this->compile();
+	for(int32 i = 0; i < this->numCopies; i++){
+		Plugin *p = &this->table[this->copies[i]];
 		p->copy(dst, src, p->offset, p->size);
 	}
 }
@@ -75,7 +155,8 @@ PluginList::copy(void *dst, void *src)
 bool
 PluginList::streamRead(Stream *stream, void *object)
 {
-	int32 length;
+	int32 length, i;
+	Plugin *p;
 	ChunkHeaderInfo header;
 	if(!findChunk(stream, ID_EXTENSION, (uint32*)&length, nil))
 		return false;
@@ -83,24 +164,27 @@ PluginList::streamRead(Stream *stream, void *object)
 		if(!readChunkHeaderInfo(stream, &header))
 			return false;
 		length -= 12;
-		FORLIST(lnk, this->plugins){
-			Plugin *p = PLG(lnk);
-			if(p->id == header.type && p->read){
-				p->read(stream, header.length,
-				        object, p->offset, p->size);
-				goto cont;
+		i = this->findFirst(header.type);
+		if(i >= 0)
+			for(; i < this->numPlugins; i++){
+				p = &this->table[this->byID[i]];
+				if(p->id != header.type)
+					break;
+				if(p->read){
+					p->read(stream, header.length,
+					        object, p->offset, p->size);
+					goto cont;
+				}
 			}
-		}
 		stream->seek(header.length);
 cont:
 		length -= header.length;
 	}
 
 	// now the always callbacks
-	FORLIST(lnk, this->plugins){
-		Plugin *p = PLG(lnk);
-		if(p->alwaysCallback)
-			p->alwaysCallback(object, p->offset, p->size);
+	for(i = 0; i < this->numAlways; i++){
+		p = &this->table[this->always[i]];
+		p->alwaysCallback(object, p->offset, p->size);
 	}
 	return true;
 }
@@ -152,14 +236,12 @@ PluginList::streamSkip(Stream *stream)
 void
 PluginList::assertRights(void *object, uint32 pluginID, uint32 data)
 {
-	FORLIST(lnk, this->plugins){
-		Plugin *p = PLG(lnk);
-		if(p->id == pluginID){
-			if(p->rightsCallback)
-				p->rightsCallback(object,
-				                  p->offset, p->size, data);
-			return;
-		}
+	int32 i = this->findFirst(pluginID);
+	if(i >= 0){
+		Plugin *p = &this->table[this->byID[i]];
+		if(p->rightsCallback)
+			p->rightsCallback(object,
+			                  p->offset, p->size, data);
 	}
 }
 
@@ -187,6 +269,7 @@ PluginList::registerPlugin(int32 size, uint32 id,
 	p->parentList = this;
 	this->plugins.add(&p->inParentList);
 	allPlugins.add(&p->inGlobalList);
+	this->dirty = 1;
 	return p->offset;
 }
 
@@ -200,6 +283,7 @@ PluginList::registerStream(uint32 id,
 			p->read = read;
 			p->write = write;
 			p->getSize = getSize;
+			this->dirty = 1;
 			return p->offset;
 		}
 	}
@@ -213,6 +297,7 @@ PluginList::setStreamRightsCallback(uint32 id, RightsCallback cb)
 		Plugin *p = PLG(lnk);
 		if(p->id == id){
 			p->rightsCallback = cb;
+			this->dirty = 1;
 			return p->offset;
 		}
 	}
@@ -226,6 +311,7 @@ PluginList::setStreamAlwaysCallback(uint32 id, AlwaysCallback cb)
 		Plugin *p = PLG(lnk);
 		if(p->id == id){
 			p->alwaysCallback = cb;
+			this->dirty = 1;
 			return p->offset;
 		}
 	}
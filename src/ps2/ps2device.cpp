@@ -40,7 +40,8 @@ Device renderdevice = {
 	null::im3DRenderPrimitive,
 	null::im3DRenderIndexedPrimitive,
 	null::im3DEnd,
-	null::deviceSystem
+	null::deviceSystem,
+	0, 0
 };
 
 }
@@ -1367,6 +1367,65 @@ swizzle(uint32 x, uint32 y, uint32 logw)
 	return n | nx<<2 | ny<<(logw-1+2);
 }
 
+// Swizzling is done in strips of 4 rows. Within a strip the swizzled
+// offset only depends on x and the lowest three bits of y,
+// so the pattern repeats every two strips.
+// We keep one pair of tables per power-of-two width (up to 1024):
+//   swizzleTabs:   linear offset -> swizzled offset
+//   unswizzleTabs: swizzled offset -> linear offset
+// Each table holds two strips (8 rows), both directions are
+// strip-relative. The table for logw starts at 8*((1<<logw)-1).
+#define MAXLOGW 10
+static uint16 swizzleTabs[8*((2<<MAXLOGW)-1)];
+static uint16 unswizzleTabs[8*((2<<MAXLOGW)-1)];
+static bool32 swizzleTabsDone[MAXLOGW+1];
+
+static uint16*
+getSwizzleTable(int32 logw, bool32 inverse)
+{
+	int32 x, y, w;
+	uint32 a, s, mask;
+	uint16 *fwd, *inv;
+
+	fwd = &swizzleTabs[8*((1<<logw)-1)];
+	inv = &unswizzleTabs[8*((1<<logw)-1)];
+	if(!swizzleTabsDone[logw]){
+		w = 1<<logw;
+		mask = (1<<(logw+2))-1;
+		for(y = 0; y < 8; y++)
+			for(x = 0; x < w; x++){
+				a = (y<<logw) + x;
+				s = swizzle(x, y, logw)&mask;
+				fwd[a] = s;
+				inv[(a&~mask) + s] = a&mask;
+			}
+		swizzleTabsDone[logw] = 1;
+	}
+	return inverse ? inv : fwd;
+}
+
+// Only power-of-two widths can use the tables, everything else
+// goes through swizzle() per pixel. Below 16 pixels the swizzle
+// isn't a permutation of the strip, but swizzled rasters are never
+// that narrow anyway (see transferMinSize).
+static bool32
+canUseSwizzleTable(int32 w, int32 logw)
+{
+	return w == 1<<logw && logw >= 4 && logw <= MAXLOGW;
+}
+
+// unpack nibbles to one byte per pixel
+static void
+expandNibbles(uint8 *dst, uint8 *src, int32 n)
+{
+	int32 i;
+	for(i = 0; i < n; i++){
+		dst[0] = src[i] & 0xF;
+		dst[1] = src[i] >> 4;
+		dst += 2;
+	}
+}
+
 void
 unswizzleRaster(Raster *raster)
 {
@@ -1376,7 +1435,8 @@ unswizzleRaster(Raster *raster)
 	int32 i;
 	int32 logw;
 	Ps2Raster *natras = GETPS2RASTEREXT(raster);
-	uint8 *px;
+	uint8 *px, *dst;
+	uint16 *tab;
 
 	if((raster->format & (Raster::PAL4|Raster::PAL8)) == 0)
 		return;
@@ -1391,6 +1451,17 @@ unswizzleRaster(Raster *raster)
 	mask = (1<<(logw+2))-1;
 
 	if(raster->format & Raster::PAL4 && natras->flags & Ps2Raster::SWIZZLED4){
+		if(canUseSwizzleTable(w, logw)){
+			// work on one byte per pixel, then write whole bytes back
+			for(y = 0; y < h; y += 4){
+				tab = getSwizzleTable(logw, 0) + ((y&4)<<logw);
+				dst = &px[y<<(logw-1)];
+				expandNibbles(tmpbuf, dst, 2*w);
+				for(i = 0; i < 4*w; i += 2)
+					*dst++ = tmpbuf[tab[i]] | tmpbuf[tab[i+1]]<<4;
+			}
+			return;
+		}
 		for(y = 0; y < h; y += 4){
 			memcpy(tmpbuf, &px[y<<(logw-1)], 2*w);
 			for(i = 0; i < 4; i++)
@@ -1402,6 +1473,16 @@ unswizzleRaster(Raster *raster)
 				}
 		}
 	}else if(raster->format & Raster::PAL8 && natras->flags & Ps2Raster::SWIZZLED8){
+		if(canUseSwizzleTable(w, logw)){
+			for(y = 0; y < h; y += 4){
+				tab = getSwizzleTable(logw, 0) + ((y&4)<<logw);
+				dst = &px[y<<logw];
+				memcpy(tmpbuf, dst, 4*w);
+				for(i = 0; i < 4*w; i++)
+					dst[i] = tmpbuf[tab[i]];
+			}
+			return;
+		}
 		for(y = 0; y < h; y += 4){
 			memcpy(tmpbuf, &px[y<<logw], 4*w);
 			for(i = 0; i < 4; i++)
@@ -1423,7 +1504,8 @@ swizzleRaster(Raster *raster)
 	int32 i;
 	int32 logw;
 	Ps2Raster *natras = GETPS2RASTEREXT(raster);
-	uint8 *px;
+	uint8 *px, *dst;
+	uint16 *tab;
 
 	if((raster->format & (Raster::PAL4|Raster::PAL8)) == 0)
 		return;
@@ -1438,6 +1520,16 @@ swizzleRaster(Raster *raster)
 	mask = (1<<(logw+2))-1;
 
 	if(raster->format & Raster::PAL4 && natras->flags & Ps2Raster::SWIZZLED4){
+		if(canUseSwizzleTable(w, logw)){
+			for(y = 0; y < h; y += 4){
+				tab = getSwizzleTable(logw, 1) + ((y&4)<<logw);
+				dst = &px[y<<(logw-1)];
+				expandNibbles(tmpbuf, dst, 2*w);
+				for(i = 0; i < 4*w; i += 2)
+					*dst++ = tmpbuf[tab[i]] | tmpbuf[tab[i+1]]<<4;
+			}
+			return;
+		}
 		for(y = 0; y < h; y += 4){
 			for(i = 0; i < 4; i++)
 				for(x = 0; x < w; x++){
@@ -1449,6 +1541,16 @@ swizzleRaster(Raster *raster)
 			memcpy(&px[y<<(logw-1)], tmpbuf, 2*w);
 		}
 	}else if(raster->format & Raster::PAL8 && natras->flags & Ps2Raster::SWIZZLED8){
+		if(canUseSwizzleTable(w, logw)){
+			for(y = 0; y < h; y += 4){
+				tab = getSwizzleTable(logw, 1) + ((y&4)<<logw);
+				dst = &px[y<<logw];
+				memcpy(tmpbuf, dst, 4*w);
+				for(i = 0; i < 4*w; i++)
+					dst[i] = tmpbuf[tab[i]];
+			}
+			return;
+		}
 		for(y = 0; y < h; y += 4){
 			for(i = 0; i < 4; i++)
 				for(x = 0; x < w; x++){
@@ -6,9 +6,11 @@
 #include "rwbase.h"
 #include "rwerror.h"
 #include "rwplg.h"
+#include "rwrender.h"
 #include "rwpipeline.h"
 #include "rwobjects.h"
 #include "rwengine.h"
+#include "rwsimd.h"
 //#include "ps2/rwps2.h"
 #include "d3d/rwd3d.h"
 #include "d3d/rwxbox.h"
@@ -95,6 +97,7 @@ Raster::subRaster(Raster *parent, Rect *r)
 void
 Raster::destroy(void)
 {
+	FlushImmediate();
 	s_plglist.destruct(this);
 	rwFree(this);
 	numAllocated--;
@@ -103,12 +106,14 @@ Raster::destroy(void)
 uint8*
 Raster::lock(int32 level, int32 lockMode)
 {
+	FlushImmediate();
 	return engine->driver[this->platform]->rasterLock(this, level, lockMode);
 }
 
 void
 Raster::unlock(int32 level)
 {
+	FlushImmediate();
 	engine->driver[this->platform]->rasterUnlock(this, level);
 }
 
@@ -187,6 +192,7 @@ Raster::toImage(void)
 void
 Raster::show(uint32 flags)
 {
+	FlushImmediate();
 	engine->device.showRaster(this, flags);
 }
 
@@ -220,6 +226,7 @@ Raster::getCurrentContext(void)
 bool32
 Raster::renderFast(int32 x, int32 y)
 {
+	FlushImmediate();
 	return engine->device.rasterRenderFast(this,x, y);
 }
 
@@ -340,48 +347,368 @@ conv_ABGR1555_from_ARGB1555(uint8 *out, uint8 *in)
 void
 expandPal4(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
-	int32 x, y;
-	for(y = 0; y < h; y++)
-		for(x = 0; x < w/2; x++){
-			dst[y*dststride + x*2 + 0] = src[y*srcstride + x] & 0xF;
-			dst[y*dststride + x*2 + 1] = src[y*srcstride + x] >> 4;
-		}
+	convertPixels(dst, dststride, PIXFMT_8, src, srcstride, PIXFMT_PAL4, w&~1, h);
 }
 void
 compressPal4(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
-	int32 x, y;
-	for(y = 0; y < h; y++)
-		for(x = 0; x < w/2; x++)
-			dst[y*dststride + x] = src[y*srcstride + x*2 + 0] | src[y*srcstride + x*2 + 1] << 4;
+	convertPixels(dst, dststride, PIXFMT_PAL4, src, srcstride, PIXFMT_8, w&~1, h);
 }
 
 void
 expandPal4_BE(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
-	int32 x, y;
-	for(y = 0; y < h; y++)
-		for(x = 0; x < w/2; x++){
-			dst[y*dststride + x*2 + 1] = src[y*srcstride + x] & 0xF;
-			dst[y*dststride + x*2 + 0] = src[y*srcstride + x] >> 4;
-		}
+	convertPixels(dst, dststride, PIXFMT_8, src, srcstride, PIXFMT_PAL4_BE, w&~1, h);
 }
 void
 compressPal4_BE(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
-	int32 x, y;
-	for(y = 0; y < h; y++)
-		for(x = 0; x < w/2; x++)
-			dst[y*dststride + x] = src[y*srcstride + x*2 + 1] | src[y*srcstride + x*2 + 0] << 4;
+	convertPixels(dst, dststride, PIXFMT_PAL4_BE, src, srcstride, PIXFMT_8, w&~1, h);
 }
 
 void
 copyPal8(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h)
 {
-	int32 x, y;
-	for(y = 0; y < h; y++)
-		for(x = 0; x < w; x++)
-			dst[y*dststride + x] = src[y*srcstride + x];
+	convertPixels(dst, dststride, PIXFMT_8, src, srcstride, PIXFMT_8, w, h);
+}
+
+/*
+ * Row converters.
+ * The SIMD loops do the bulk of a row, the rest is done per pixel.
+ */
+
+static void row_copy8(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n); }
+static void row_copy16(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n*2); }
+static void row_copy24(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n*3); }
+static void row_copy32(uint8 *out, uint8 *in, int32 n) { memcpy(out, in, n*4); }
+
+// RGBA <-> BGRA
+static void
+row_swapRB32(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifdef RW_SSE2
+	__m128i maskAG = _mm_set1_epi32(0xFF00FF00);
+	__m128i maskRB = _mm_set1_epi32(0x00FF00FF);
+	for(; i+4 <= n; i += 4){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*4));
+		__m128i rb = _mm_and_si128(v, maskRB);
+		rb = _mm_or_si128(_mm_slli_epi32(rb, 16), _mm_srli_epi32(rb, 16));
+		v = _mm_or_si128(_mm_and_si128(v, maskAG), rb);
+		_mm_storeu_si128((__m128i*)(out + i*4), v);
+	}
+#endif
+	for(; i < n; i++)
+		conv_BGRA8888_from_RGBA8888(out + i*4, in + i*4);
+}
+
+static void
+row_RGBA8888_from_RGB888(uint8 *out, uint8 *in, int32 n)
+{
+	for(int32 i = 0; i < n; i++){
+		out[0] = in[0];
+		out[1] = in[1];
+		out[2] = in[2];
+		out[3] = 0xFF;
+		in += 3;
+		out += 4;
+	}
+}
+
+static void
+row_BGRA8888_from_RGB888(uint8 *out, uint8 *in, int32 n)
+{
+	for(int32 i = 0; i < n; i++){
+		out[0] = in[2];
+		out[1] = in[1];
+		out[2] = in[0];
+		out[3] = 0xFF;
+		in += 3;
+		out += 4;
+	}
+}
+
+static void
+row_RGB888_from_RGBA8888(uint8 *out, uint8 *in, int32 n)
+{
+	for(int32 i = 0; i < n; i++){
+		out[0] = in[0];
+		out[1] = in[1];
+		out[2] = in[2];
+		in += 4;
+		out += 3;
+	}
+}
+
+static void
+row_RGB888_from_BGRA8888(uint8 *out, uint8 *in, int32 n)
+{
+	for(int32 i = 0; i < n; i++){
+		out[0] = in[2];
+		out[1] = in[1];
+		out[2] = in[0];
+		in += 4;
+		out += 3;
+	}
+}
+
+static void
+row_swapRB24(uint8 *out, uint8 *in, int32 n)
+{
+	for(int32 i = 0; i < n; i++){
+		uint8 r = in[0];
+		out[1] = in[1];
+		out[0] = in[2];
+		out[2] = r;
+		in += 3;
+		out += 3;
+	}
+}
+
+static void
+row_ARGB1555_from_RGB555(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifdef RW_SSE2
+	__m128i a = _mm_set1_epi16((int16)0x8000);
+	for(; i+8 <= n; i += 8){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*2));
+		_mm_storeu_si128((__m128i*)(out + i*2), _mm_or_si128(v, a));
+	}
+#endif
+	for(; i < n; i++)
+		conv_ARGB1555_from_RGB555(out + i*2, in + i*2);
+}
+
+// ARGB1555 -> RGBA5551 is a rotate left by one bit
+static void
+row_RGBA5551_from_ARGB1555(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifdef RW_SSE2
+	for(; i+8 <= n; i += 8){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*2));
+		v = _mm_or_si128(_mm_slli_epi16(v, 1), _mm_srli_epi16(v, 15));
+		_mm_storeu_si128((__m128i*)(out + i*2), v);
+	}
+#endif
+	for(; i < n; i++)
+		conv_RGBA5551_from_ARGB1555(out + i*2, in + i*2);
+}
+
+static void
+row_ARGB1555_from_RGBA5551(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifdef RW_SSE2
+	for(; i+8 <= n; i += 8){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*2));
+		v = _mm_or_si128(_mm_srli_epi16(v, 1), _mm_slli_epi16(v, 15));
+		_mm_storeu_si128((__m128i*)(out + i*2), v);
+	}
+#endif
+	for(; i < n; i++)
+		conv_ARGB1555_from_RGBA5551(out + i*2, in + i*2);
+}
+
+static void
+row_swapRB1555(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifdef RW_SSE2
+	__m128i maskAG = _mm_set1_epi16((int16)0x83E0);
+	__m128i mask5 = _mm_set1_epi16(0x1F);
+	for(; i+8 <= n; i += 8){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*2));
+		__m128i r = _mm_and_si128(_mm_srli_epi16(v, 10), mask5);
+		__m128i b = _mm_slli_epi16(_mm_and_si128(v, mask5), 10);
+		v = _mm_or_si128(_mm_and_si128(v, maskAG), _mm_or_si128(r, b));
+		_mm_storeu_si128((__m128i*)(out + i*2), v);
+	}
+#endif
+	for(; i < n; i++)
+		conv_ABGR1555_from_ARGB1555(out + i*2, in + i*2);
+}
+
+static void
+row_RGBA8888_from_ARGB1555(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+#ifdef RW_SSE2
+	// c*255/31 == (c*255*8457)>>18 for all 5 bit c
+	__m128i mask5 = _mm_set1_epi16(0x1F);
+	__m128i scale = _mm_set1_epi16(255);
+	__m128i div31 = _mm_set1_epi16(8457);
+	for(; i+8 <= n; i += 8){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i*2));
+		__m128i r = _mm_and_si128(_mm_srli_epi16(v, 10), mask5);
+		__m128i g = _mm_and_si128(_mm_srli_epi16(v, 5), mask5);
+		__m128i b = _mm_and_si128(v, mask5);
+		__m128i a = _mm_srai_epi16(v, 15);	// 0 or 0xFFFF
+		r = _mm_srli_epi16(_mm_mulhi_epu16(_mm_mullo_epi16(r, scale), div31), 2);
+		g = _mm_srli_epi16(_mm_mulhi_epu16(_mm_mullo_epi16(g, scale), div31), 2);
+		b = _mm_srli_epi16(_mm_mulhi_epu16(_mm_mullo_epi16(b, scale), div31), 2);
+		__m128i rg = _mm_or_si128(r, _mm_slli_epi16(g, 8));
+		__m128i ba = _mm_or_si128(b, _mm_slli_epi16(a, 8));
+		_mm_storeu_si128((__m128i*)(out + i*4), _mm_unpacklo_epi16(rg, ba));
+		_mm_storeu_si128((__m128i*)(out + i*4 + 16), _mm_unpackhi_epi16(rg, ba));
+	}
+#endif
+	for(; i < n; i++)
+		conv_RGBA8888_from_ARGB1555(out + i*4, in + i*2);
+}
+
+static void
+row_8_from_PAL4(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+	n /= 2;
+#ifdef RW_SSE2
+	__m128i mask4 = _mm_set1_epi8(0xF);
+	for(; i+16 <= n; i += 16){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i));
+		__m128i lo = _mm_and_si128(v, mask4);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask4);
+		_mm_storeu_si128((__m128i*)(out + i*2), _mm_unpacklo_epi8(lo, hi));
+		_mm_storeu_si128((__m128i*)(out + i*2 + 16), _mm_unpackhi_epi8(lo, hi));
+	}
+#endif
+	for(; i < n; i++){
+		out[i*2 + 0] = in[i] & 0xF;
+		out[i*2 + 1] = in[i] >> 4;
+	}
+}
+
+static void
+row_8_from_PAL4_BE(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+	n /= 2;
+#ifdef RW_SSE2
+	__m128i mask4 = _mm_set1_epi8(0xF);
+	for(; i+16 <= n; i += 16){
+		__m128i v = _mm_loadu_si128((__m128i*)(in + i));
+		__m128i lo = _mm_and_si128(v, mask4);
+		__m128i hi = _mm_and_si128(_mm_srli_epi16(v, 4), mask4);
+		_mm_storeu_si128((__m128i*)(out + i*2), _mm_unpacklo_epi8(hi, lo));
+		_mm_storeu_si128((__m128i*)(out + i*2 + 16), _mm_unpackhi_epi8(hi, lo));
+	}
+#endif
+	for(; i < n; i++){
+		out[i*2 + 1] = in[i] & 0xF;
+		out[i*2 + 0] = in[i] >> 4;
+	}
+}
+
+static void
+row_PAL4_from_8(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+	n /= 2;
+#ifdef RW_SSE2
+	__m128i mask8 = _mm_set1_epi16(0xFF);
+	for(; i+16 <= n; i += 16){
+		__m128i v0 = _mm_loadu_si128((__m128i*)(in + i*2));
+		__m128i v1 = _mm_loadu_si128((__m128i*)(in + i*2 + 16));
+		// each 16 bit lane holds a pair of pixels
+		v0 = _mm_or_si128(_mm_and_si128(v0, mask8), _mm_slli_epi16(_mm_srli_epi16(v0, 8), 4));
+		v1 = _mm_or_si128(_mm_and_si128(v1, mask8), _mm_slli_epi16(_mm_srli_epi16(v1, 8), 4));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(v0, v1));
+	}
+#endif
+	for(; i < n; i++)
+		out[i] = in[i*2 + 0] | in[i*2 + 1] << 4;
+}
+
+static void
+row_PAL4_BE_from_8(uint8 *out, uint8 *in, int32 n)
+{
+	int32 i = 0;
+	n /= 2;
+#ifdef RW_SSE2
+	__m128i mask8 = _mm_set1_epi16(0xFF);
+	for(; i+16 <= n; i += 16){
+		__m128i v0 = _mm_loadu_si128((__m128i*)(in + i*2));
+		__m128i v1 = _mm_loadu_si128((__m128i*)(in + i*2 + 16));
+		v0 = _mm_or_si128(_mm_srli_epi16(v0, 8), _mm_slli_epi16(_mm_and_si128(v0, mask8), 4));
+		v1 = _mm_or_si128(_mm_srli_epi16(v1, 8), _mm_slli_epi16(_mm_and_si128(v1, mask8), 4));
+		_mm_storeu_si128((__m128i*)(out + i), _mm_packus_epi16(v0, v1));
+	}
+#endif
+	for(; i < n; i++)
+		out[i] = in[i*2 + 1] | in[i*2 + 0] << 4;
+}
+
+struct RowConverter
+{
+	int32 dstFormat;
+	int32 srcFormat;
+	ConvRowFunc func;
+};
+
+static RowConverter rowConverters[] = {
+	{ PIXFMT_RGBA8888, PIXFMT_RGBA8888, row_copy32 },
+	{ PIXFMT_BGRA8888, PIXFMT_BGRA8888, row_copy32 },
+	{ PIXFMT_BGRA8888, PIXFMT_RGBA8888, row_swapRB32 },
+	{ PIXFMT_RGBA8888, PIXFMT_BGRA8888, row_swapRB32 },
+	{ PIXFMT_RGBA8888, PIXFMT_RGB888, row_RGBA8888_from_RGB888 },
+	{ PIXFMT_BGRA8888, PIXFMT_BGR888, row_RGBA8888_from_RGB888 },
+	{ PIXFMT_BGRA8888, PIXFMT_RGB888, row_BGRA8888_from_RGB888 },
+	{ PIXFMT_RGBA8888, PIXFMT_BGR888, row_BGRA8888_from_RGB888 },
+	{ PIXFMT_RGB888, PIXFMT_RGBA8888, row_RGB888_from_RGBA8888 },
+	{ PIXFMT_BGR888, PIXFMT_BGRA8888, row_RGB888_from_RGBA8888 },
+	{ PIXFMT_RGB888, PIXFMT_BGRA8888, row_RGB888_from_BGRA8888 },
+	{ PIXFMT_BGR888, PIXFMT_RGBA8888, row_RGB888_from_BGRA8888 },
+	{ PIXFMT_RGB888, PIXFMT_RGB888, row_copy24 },
+	{ PIXFMT_BGR888, PIXFMT_BGR888, row_copy24 },
+	{ PIXFMT_BGR888, PIXFMT_RGB888, row_swapRB24 },
+	{ PIXFMT_RGB888, PIXFMT_BGR888, row_swapRB24 },
+	{ PIXFMT_ARGB1555, PIXFMT_ARGB1555, row_copy16 },
+	{ PIXFMT_ARGB1555, PIXFMT_RGB555, row_ARGB1555_from_RGB555 },
+	{ PIXFMT_RGBA5551, PIXFMT_ARGB1555, row_RGBA5551_from_ARGB1555 },
+	{ PIXFMT_ARGB1555, PIXFMT_RGBA5551, row_ARGB1555_from_RGBA5551 },
+	{ PIXFMT_ABGR1555, PIXFMT_ARGB1555, row_swapRB1555 },
+	{ PIXFMT_ARGB1555, PIXFMT_ABGR1555, row_swapRB1555 },
+	{ PIXFMT_RGBA8888, PIXFMT_ARGB1555, row_RGBA8888_from_ARGB1555 },
+	{ PIXFMT_8, PIXFMT_8, row_copy8 },
+	{ PIXFMT_8, PIXFMT_PAL4, row_8_from_PAL4 },
+	{ PIXFMT_PAL4, PIXFMT_8, row_PAL4_from_8 },
+	{ PIXFMT_8, PIXFMT_PAL4_BE, row_8_from_PAL4_BE },
+	{ PIXFMT_PAL4_BE, PIXFMT_8, row_PAL4_BE_from_8 },
+};
+
+static ConvRowFunc rowConvTable[NUM_PIXFMTS][NUM_PIXFMTS];
+static bool32 rowConvTableDone;
+
+ConvRowFunc
+findRowConverter(int32 dstFormat, int32 srcFormat)
+{
+	if(!rowConvTableDone){
+		for(int32 i = 0; i < (int32)nelem(rowConverters); i++){
+			RowConverter *c = &rowConverters[i];
+			rowConvTable[c->dstFormat][c->srcFormat] = c->func;
+		}
+		rowConvTableDone = 1;
+	}
+	if(dstFormat < 0 || dstFormat >= NUM_PIXFMTS ||
+	   srcFormat < 0 || srcFormat >= NUM_PIXFMTS)
+		return nil;
+	return rowConvTable[dstFormat][srcFormat];
+}
+
+bool32
+convertPixels(uint8 *dst, int32 dststride, int32 dstFormat,
+	uint8 *src, int32 srcstride, int32 srcFormat, int32 w, int32 h)
+{
+	ConvRowFunc conv = findRowConverter(dstFormat, srcFormat);
+	if(conv == nil)
+		return 0;
+	for(int32 y = 0; y < h; y++){
+		conv(dst, src, w);
+		dst += dststride;
+		src += srcstride;
+	}
+	return 1;
 }
 
 
@@ -421,15 +748,45 @@ xbox_to_d3d(rw::Raster *ras)
 	return newras;
 }
 
+#ifdef RW_GL3
+// BGRA to RGBA and flipped, so mipmaps don't go through Image
 static rw::Raster*
-d3d_to_gl3(rw::Raster *ras)
+d3d_to_gl3_8888(rw::Raster *ras)
 {
-#ifdef RW_GL3
 	using namespace rw;
 
-	if(!gl3::gl3Caps.dxtSupported)
+	if((ras->format & (Raster::PAL4 | Raster::PAL8 | 0xF00)) != Raster::C8888)
 		return nil;
 
+	Raster *newras = Raster::create(ras->width, ras->height, 32,
+		                        ras->format | Raster::TEXTURE);
+	if(newras == nil)
+		return nil;
+	int numLevels = ras->getNumLevels();
+	if(newras->getNumLevels() != numLevels){
+		newras->destroy();
+		return nil;
+	}
+	for(int i = 0; i < numLevels; i++){
+		uint8 *srcpx = ras->lock(i, Raster::LOCKREAD);
+		uint8 *dstpx = newras->lock(i, Raster::LOCKWRITE | Raster::LOCKNOFETCH);
+		convertPixels(dstpx, newras->stride, PIXFMT_RGBA8888,
+			srcpx + (ras->height-1)*ras->stride, -ras->stride, PIXFMT_BGRA8888,
+			ras->width, ras->height);
+		ras->unlock(i);
+		newras->unlock(i);
+	}
+
+	return newras;
+}
+#endif
+
+static rw::Raster*
+d3d_to_gl3(rw::Raster *ras)
+{
+#ifdef RW_GL3
+	using namespace rw;
+
 	int dxt = 0;
 	d3d::D3dRaster *d3dras = GETD3DRASTEREXT(ras);
 	if(d3dras->customFormat){
@@ -440,6 +797,9 @@ d3d_to_gl3(rw::Raster *ras)
 		}
 	}
 	if(dxt == 0)
+		return d3dras->customFormat ? nil : d3d_to_gl3_8888(ras);
+
+	if(!gl3::gl3Caps.dxtSupported)
 		return nil;
 
 	Raster *newras = Raster::create(ras->width, ras->height, ras->depth,
@@ -496,6 +856,148 @@ xbox_to_gl3(rw::Raster *ras)
 #endif
 }
 
+// DXT type of a D3D or GL3 raster, 0 if not compressed
+static int32
+getDXTType(rw::Raster *ras, bool32 *hasAlpha)
+{
+	using namespace rw;
+
+	int32 dxt = 0;
+	if(ras->platform == PLATFORM_D3D8 || ras->platform == PLATFORM_D3D9){
+		d3d::D3dRaster *d3dras = GETD3DRASTEREXT(ras);
+		if(d3dras->customFormat){
+			switch(d3dras->format){
+			case d3d::D3DFMT_DXT1: dxt = 1; break;
+			case d3d::D3DFMT_DXT3: dxt = 3; break;
+			case d3d::D3DFMT_DXT5: dxt = 5; break;
+			}
+		}
+		*hasAlpha = d3dras->hasAlpha;
+	}
+#ifdef RW_GL3
+	else if(ras->platform == PLATFORM_GL3){
+		gl3::Gl3Raster *glras = PLUGINOFFSET(gl3::Gl3Raster, ras, gl3::nativeRasterOffset);
+		if(glras->isCompressed){
+			switch(glras->internalFormat){
+			case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+			case GL_COMPRESSED_RGB_S3TC_DXT1_EXT: dxt = 1; break;
+			case GL_COMPRESSED_RGBA_S3TC_DXT3_EXT: dxt = 3; break;
+			case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT: dxt = 5; break;
+			}
+		}
+		*hasAlpha = glras->hasAlpha;
+	}
+#endif
+	return dxt;
+}
+
+// Create a copy of a texture raster with room for numLevels mipmaps
+// and the first level copied over.
+static rw::Raster*
+createMipmappedCopy(rw::Raster *ras, int32 dxt, bool32 hasAlpha, int32 numLevels)
+{
+	using namespace rw;
+
+	int32 format = (ras->format | Raster::MIPMAP) & ~Raster::AUTOMIPMAP;
+	Raster *newras;
+	if(dxt){
+		newras = Raster::create(ras->width, ras->height, ras->depth,
+		                        format | Raster::TEXTURE | Raster::DONTALLOCATE, ras->platform);
+		if(newras == nil)
+			return nil;
+		if(ras->platform == PLATFORM_GL3){
+#ifdef RW_GL3
+			gl3::allocateDXT(newras, dxt, numLevels, hasAlpha);
+#endif
+		}else
+			d3d::allocateDXT(newras, dxt, numLevels, hasAlpha);
+	}else{
+		newras = Raster::create(ras->width, ras->height, ras->depth,
+		                        format | Raster::TEXTURE, ras->platform);
+		if(newras == nil)
+			return nil;
+	}
+
+	uint8 *srcpx = ras->lock(0, Raster::LOCKREAD);
+	if(srcpx == nil){
+		newras->destroy();
+		return nil;
+	}
+	uint8 *dstpx = newras->lock(0, Raster::LOCKWRITE | Raster::LOCKNOFETCH);
+	if(dstpx == nil){
+		ras->unlock(0);
+		newras->destroy();
+		return nil;
+	}
+	if(dxt)
+		memcpy(dstpx, srcpx, (ras->width+3)/4 * ((ras->height+3)/4) * (dxt == 1 ? 8 : 16));
+	else{
+		int32 rowSize = ras->stride < newras->stride ? ras->stride : newras->stride;
+		for(int32 y = 0; y < ras->height; y++)
+			memcpy(dstpx + y*newras->stride, srcpx + y*ras->stride, rowSize);
+	}
+	ras->unlock(0);
+	newras->unlock(0);
+	return newras;
+}
+
+// Generate all mipmap levels of a texture raster from the first one.
+// If the raster has no room for them a new one is created
+// and the old one destroyed. DXT rasters are compressed again.
+rw::Raster*
+Raster::buildMipmaps(rw::Raster *ras, int32 filter)
+{
+	using namespace rw;
+
+	// only these can take the pixels of the new levels back
+	if(ras->platform != PLATFORM_D3D8 && ras->platform != PLATFORM_D3D9 &&
+	   ras->platform != PLATFORM_GL3)
+		return ras;
+
+	int32 numLevels = Raster::calculateNumLevels(ras->width, ras->height);
+	bool32 hasAlpha = 0;
+	int32 dxt = getDXTType(ras, &hasAlpha);
+	int32 format = ras->format & (Raster::PAL4 | Raster::PAL8 | 0xF00);
+	// we can only write these back without converting
+	if(dxt == 0 && format != Raster::C8888 && format != Raster::C888)
+		return ras;
+
+	// already has all levels
+	if((ras->format & (Raster::MIPMAP|Raster::AUTOMIPMAP)) == Raster::MIPMAP &&
+	   ras->getNumLevels() >= numLevels)
+		return ras;
+
+	Raster *newras = createMipmappedCopy(ras, dxt, hasAlpha, numLevels);
+	if(newras == nil)
+		return ras;
+
+	Image *img = newras->toImage();
+	if(img == nil){
+		newras->destroy();
+		return ras;
+	}
+	for(int32 i = 1; i < numLevels; i++){
+		Image *mip = img->makeMipmap(filter);
+		img->destroy();
+		img = mip;
+		if(newras->lock(i, Raster::LOCKWRITE|Raster::LOCKNOFETCH) == nil)
+			goto fail;
+		Raster *ok = newras->setFromImage(img, newras->platform);
+		newras->unlock(i);
+		if(ok == nil)
+			goto fail;
+	}
+	img->destroy();
+
+	ras->destroy();
+	return newras;
+
+fail:
+	img->destroy();
+	newras->destroy();
+	return ras;
+}
+
 rw::Raster*
 Raster::convertTexToCurrentPlatform(rw::Raster *ras)
 {
@@ -1,16 +1,192 @@
 #include <stdio.h>
+#include <string.h>
+#include <assert.h>
 
 #include "rwbase.h"
+#include "rwerror.h"
 #include "rwplg.h"
-#include "rwengine.h"
 #include "rwrender.h"
+#include "rwpipeline.h"
+#include "rwobjects.h"
+#include "rwengine.h"
+#include "rwsimd.h"
 
 namespace rw {
 
+// Batching of immediate mode calls.
+// Consecutive Im2D primitives, or Im3D primitives with the same matrix,
+// are collected as one indexed list and drawn together when the render
+// state changes or something else is about to be drawn.
+
+enum {
+	BATCHNONE,
+	BATCH2D,
+	BATCH3D,
+
+	BATCHVERTICES = 4096,
+	BATCHINDICES = 8192,
+	MAXVERTEXSIZE = 48
+};
+
+static struct {
+	int32 type;
+	PrimitiveType primType;	// list type of the batch
+	uint8 vertices[BATCHVERTICES*MAXVERTEXSIZE];
+	uint16 indices[BATCHINDICES];
+	int32 numVertices;
+	int32 numIndices;
+	// Im3D
+	Matrix world;
+	bool32 identity;
+	uint32 flags;
+} batch;
+
+// Current Im3D transform, vertices are only copied when rendered
+static struct {
+	void *vertices;
+	int32 numVertices;
+	Matrix world;
+	bool32 identity;
+	uint32 flags;
+	int32 base;	// first vertex in batch, -1 if not copied yet
+} im3dCur;
+
+void
+FlushImmediate(void)
+{
+	int32 type = batch.type;
+	if(type == BATCHNONE)
+		return;
+	batch.type = BATCHNONE;
+	im3dCur.base = -1;
+	if(batch.numIndices == 0)
+		return;
+	if(type == BATCH2D)
+		engine->device.im2DRenderIndexedPrimitive(batch.primType,
+			batch.vertices, batch.numVertices,
+			batch.indices, batch.numIndices);
+	else{
+		engine->device.im3DTransform(batch.vertices, batch.numVertices,
+			batch.identity ? nil : &batch.world, batch.flags);
+		engine->device.im3DRenderIndexedPrimitive(batch.primType,
+			batch.indices, batch.numIndices);
+		engine->device.im3DEnd();
+	}
+}
+
+// The list type a primitive is drawn as and how many indices that takes
+static PrimitiveType
+listType(PrimitiveType type, int32 n, int32 *numIndices)
+{
+	switch(type){
+	case PRIMTYPELINELIST:
+		*numIndices = n;
+		return PRIMTYPELINELIST;
+	case PRIMTYPEPOLYLINE:
+		*numIndices = n < 2 ? 0 : (n-1)*2;
+		return PRIMTYPELINELIST;
+	case PRIMTYPETRILIST:
+		*numIndices = n;
+		return PRIMTYPETRILIST;
+	case PRIMTYPETRISTRIP:
+	case PRIMTYPETRIFAN:
+		*numIndices = n < 3 ? 0 : (n-2)*3;
+		return PRIMTYPETRILIST;
+	case PRIMTYPEPOINTLIST:
+		*numIndices = n;
+		return PRIMTYPEPOINTLIST;
+	default:
+		*numIndices = 0;
+		return PRIMTYPENONE;
+	}
+}
+
+// Can a primitive go into the batch? Flushes it if not.
+// Returns false if it has to be drawn on its own.
+static bool32
+beginBatch(int32 type, PrimitiveType listType, int32 vertexSize, int32 numVertices, int32 numIndices)
+{
+	if(vertexSize == 0 || vertexSize > MAXVERTEXSIZE ||
+	   numVertices > BATCHVERTICES || numIndices > BATCHINDICES){
+		FlushImmediate();
+		return 0;
+	}
+	if(batch.type != type || batch.primType != listType ||
+	   batch.numVertices + numVertices > BATCHVERTICES ||
+	   batch.numIndices + numIndices > BATCHINDICES)
+		FlushImmediate();
+	if(batch.type == BATCHNONE){
+		batch.type = type;
+		batch.primType = listType;
+		batch.numVertices = 0;
+		batch.numIndices = 0;
+	}
+	return 1;
+}
+
+// Write the indices of a primitive as a list, returns the end.
+// idx is nil for non-indexed primitives.
+static uint16*
+listIndices(uint16 *dst, PrimitiveType type, uint16 *idx, int32 n, int32 base)
+{
+	int32 i;
+#define IDX(j) (uint16)(base + (idx ? idx[j] : (j)))
+	switch(type){
+	case PRIMTYPEPOLYLINE:
+		for(i = 0; i < n-1; i++){
+			*dst++ = IDX(i);
+			*dst++ = IDX(i+1);
+		}
+		break;
+	case PRIMTYPETRISTRIP:
+		// keep the winding of odd triangles
+		for(i = 0; i < n-2; i++){
+			*dst++ = IDX(i + (i&1));
+			*dst++ = IDX(i+1 - (i&1));
+			*dst++ = IDX(i+2);
+		}
+		break;
+	case PRIMTYPETRIFAN:
+		for(i = 0; i < n-2; i++){
+			*dst++ = IDX(0);
+			*dst++ = IDX(i+1);
+			*dst++ = IDX(i+2);
+		}
+		break;
+	default:
+		for(i = 0; i < n; i++)
+			*dst++ = IDX(i);
+		break;
+	}
+#undef IDX
+	return dst;
+}
+
+static void
+addIndices(PrimitiveType type, uint16 *idx, int32 n, int32 base)
+{
+	uint16 *dst = listIndices(&batch.indices[batch.numIndices], type, idx, n, base);
+	batch.numIndices = dst - batch.indices;
+}
+
+static int32
+addVertices(void *verts, int32 numVerts, int32 vertexSize)
+{
+	int32 base = batch.numVertices;
+	memcpy(&batch.vertices[base*vertexSize], verts, numVerts*vertexSize);
+	batch.numVertices += numVerts;
+	return base;
+}
+
+// Changing state only flushes if the value is really different
 void SetRenderState(int32 state, uint32 value){
-	engine->device.setRenderState(state, (void*)(uintptr)value); }
+	SetRenderStatePtr(state, (void*)(uintptr)value); }
 
 void SetRenderStatePtr(int32 state, void *value){
+	if(engine->device.getRenderState(state) != value){
+		RWMETRIC(numRenderStateChanges, 1);
+		FlushImmediate();
+	}
 	engine->device.setRenderState(state, value); }
 
 uint32 GetRenderState(int32 state){
@@ -28,22 +204,53 @@ float32 GetFarZ(void) { return engine->device.zFar; }
 void
 RenderLine(void *verts, int32 numVerts, int32 vert1, int32 vert2)
 {
-	engine->device.im2DRenderLine(verts, numVerts, vert1, vert2);
+	int32 sz = engine->device.im2DVertexSize;
+	if(!beginBatch(BATCH2D, PRIMTYPELINELIST, sz, 2, 2)){
+		engine->device.im2DRenderLine(verts, numVerts, vert1, vert2);
+		return;
+	}
+	addVertices((uint8*)verts + vert1*sz, 1, sz);
+	addVertices((uint8*)verts + vert2*sz, 1, sz);
+	addIndices(PRIMTYPELINELIST, nil, 2, batch.numVertices-2);
 }
 void
 RenderTriangle(void *verts, int32 numVerts, int32 vert1, int32 vert2, int32 vert3)
 {
-	engine->device.im2DRenderTriangle(verts, numVerts, vert1, vert2, vert3);
+	int32 sz = engine->device.im2DVertexSize;
+	if(!beginBatch(BATCH2D, PRIMTYPETRILIST, sz, 3, 3)){
+		engine->device.im2DRenderTriangle(verts, numVerts, vert1, vert2, vert3);
+		return;
+	}
+	addVertices((uint8*)verts + vert1*sz, 1, sz);
+	addVertices((uint8*)verts + vert2*sz, 1, sz);
+	addVertices((uint8*)verts + vert3*sz, 1, sz);
+	addIndices(PRIMTYPETRILIST, nil, 3, batch.numVertices-3);
 }
 void
 RenderIndexedPrimitive(PrimitiveType type, void *verts, int32 numVerts, void *indices, int32 numIndices)
 {
-	engine->device.im2DRenderIndexedPrimitive(type, verts, numVerts, indices, numIndices);
+	int32 n;
+	PrimitiveType lt = listType(type, numIndices, &n);
+	if(lt == PRIMTYPENONE ||
+	   !beginBatch(BATCH2D, lt, engine->device.im2DVertexSize, numVerts, n)){
+		engine->device.im2DRenderIndexedPrimitive(type, verts, numVerts, indices, numIndices);
+		return;
+	}
+	int32 base = addVertices(verts, numVerts, engine->device.im2DVertexSize);
+	addIndices(type, (uint16*)indices, numIndices, base);
 }
 void
 RenderPrimitive(PrimitiveType type, void *verts, int32 numVerts)
 {
-	engine->device.im2DRenderPrimitive(type, verts, numVerts);
+	int32 n;
+	PrimitiveType lt = listType(type, numVerts, &n);
+	if(lt == PRIMTYPENONE ||
+	   !beginBatch(BATCH2D, lt, engine->device.im2DVertexSize, numVerts, n)){
+		engine->device.im2DRenderPrimitive(type, verts, numVerts);
+		return;
+	}
+	int32 base = addVertices(verts, numVerts, engine->device.im2DVertexSize);
+	addIndices(type, nil, numVerts, base);
 }
 
 }
@@ -52,10 +259,414 @@ RenderPrimitive(PrimitiveType type, void *verts, int32 numVerts)
 
 namespace im3d {
 
+// Transforming and clipping on the CPU, the result is drawn as Im2D.
+// Only for devices whose Im2D and Im3D vertices look like these
+// (GL3 and D3D), colour is copied as is so its byte order doesn't matter.
+
+struct CpuIm3DVertex
+{
+	V3d position;
+	uint8 color[4];
+	float32 u, v;
+};
+
+struct CpuIm2DVertex
+{
+	float32 x, y, z, w;
+	uint8 color[4];
+	float32 u, v;
+};
+
+// Camera space as made by the camera's view matrix,
+// x/z and y/z are 0..1 across the screen (x and y for parallel)
+struct CpuVertex
+{
+	float32 x, y, z;
+	uint32 clip;
+	int32 chunk;	// output chunk this was projected into
+	int32 out;
+};
+
+struct ClipVert
+{
+	float32 x, y, z;
+	float32 color[4];
+	float32 u, v;
+};
+
+enum {
+	CLIPLEFT   = 1,
+	CLIPRIGHT  = 2,
+	CLIPTOP    = 4,
+	CLIPBOTTOM = 8,
+	CLIPNEAR   = 16,
+	CLIPFAR    = 32,
+	NUMCLIPPLANES = 6,
+	MAXCLIPVERTS = 3+NUMCLIPPLANES
+};
+
+static struct {
+	bool32 active;
+	CpuIm3DVertex *src;
+	int32 numVertices;
+	CpuVertex *verts;
+	int32 maxVerts;
+	uint16 *list;	// current primitive as list
+	int32 maxList;
+	bool32 persp;
+	bool32 clip;
+	float32 nearPlane, farPlane;
+	float32 zScale, zShift;
+	float32 width, height;
+	// output
+	PrimitiveType outType;
+	CpuIm2DVertex out[BATCHVERTICES];
+	uint16 outIndices[BATCHINDICES];
+	int32 numOut;
+	int32 numOutIndices;
+	int32 chunk;
+} cpu;
+
+static bool32
+cpuAvailable(void)
+{
+	return engine->device.im3DVertexSize == sizeof(CpuIm3DVertex) &&
+		engine->device.im2DVertexSize == sizeof(CpuIm2DVertex) &&
+		engine->currentCamera && engine->currentCamera->frameBuffer;
+}
+
+static void
+cpuTransform(CpuVertex *dst, CpuIm3DVertex *src, int32 n, const Matrix *m)
+{
+	int32 i;
+#ifdef RW_SSE2
+	__m128 right = _mm_setr_ps(m->right.x, m->right.y, m->right.z, 0.0f);
+	__m128 up = _mm_setr_ps(m->up.x, m->up.y, m->up.z, 0.0f);
+	__m128 at = _mm_setr_ps(m->at.x, m->at.y, m->at.z, 0.0f);
+	__m128 pos = _mm_setr_ps(m->pos.x, m->pos.y, m->pos.z, 0.0f);
+	for(i = 0; i < n; i++){
+		__m128 p = _mm_add_ps(
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(src[i].position.x), right),
+			           _mm_mul_ps(_mm_set1_ps(src[i].position.y), up)),
+			_mm_add_ps(_mm_mul_ps(_mm_set1_ps(src[i].position.z), at), pos));
+		// also clears clip
+		_mm_storeu_ps(&dst[i].x, p);
+	}
+#else
+	V3d *p;
+	for(i = 0; i < n; i++){
+		p = &src[i].position;
+		dst[i].x = p->x*m->right.x + p->y*m->up.x + p->z*m->at.x + m->pos.x;
+		dst[i].y = p->x*m->right.y + p->y*m->up.y + p->z*m->at.y + m->pos.y;
+		dst[i].z = p->x*m->right.z + p->y*m->up.z + p->z*m->at.z + m->pos.z;
+		dst[i].clip = 0;
+	}
+#endif
+	for(i = 0; i < n; i++)
+		dst[i].chunk = -1;
+}
+
+static uint32
+cpuClipCode(float32 x, float32 y, float32 z)
+{
+	float32 w = cpu.persp ? z : 1.0f;
+	uint32 code = 0;
+	if(x < 0.0f) code |= CLIPLEFT;
+	if(x > w) code |= CLIPRIGHT;
+	if(y < 0.0f) code |= CLIPTOP;
+	if(y > w) code |= CLIPBOTTOM;
+	if(z < cpu.nearPlane) code |= CLIPNEAR;
+	if(z > cpu.farPlane) code |= CLIPFAR;
+	return code;
+}
+
+// positive inside
+static float32
+cpuPlaneDist(const ClipVert *v, int32 plane)
+{
+	float32 w = cpu.persp ? v->z : 1.0f;
+	switch(plane){
+	case 0: return v->x;
+	case 1: return w - v->x;
+	case 2: return v->y;
+	case 3: return w - v->y;
+	case 4: return v->z - cpu.nearPlane;
+	default: return cpu.farPlane - v->z;
+	}
+}
+
+static void
+cpuLerp(ClipVert *dst, const ClipVert *a, const ClipVert *b, float32 t)
+{
+	dst->x = a->x + (b->x - a->x)*t;
+	dst->y = a->y + (b->y - a->y)*t;
+	dst->z = a->z + (b->z - a->z)*t;
+	for(int32 i = 0; i < 4; i++)
+		dst->color[i] = a->color[i] + (b->color[i] - a->color[i])*t;
+	dst->u = a->u + (b->u - a->u)*t;
+	dst->v = a->v + (b->v - a->v)*t;
+}
+
+static void
+cpuProject(CpuIm2DVertex *dst, float32 x, float32 y, float32 z)
+{
+	float32 recip;
+	if(cpu.persp){
+		recip = 1.0f/z;
+		dst->x = x*recip*cpu.width;
+		dst->y = y*recip*cpu.height;
+		dst->z = cpu.zScale*recip + cpu.zShift;
+		dst->w = z;
+	}else{
+		dst->x = x*cpu.width;
+		dst->y = y*cpu.height;
+		dst->z = cpu.zScale*z + cpu.zShift;
+		dst->w = 1.0f;
+	}
+}
+
+static void
+cpuFlushOut(void)
+{
+	if(cpu.numOutIndices)
+		im2d::RenderIndexedPrimitive(cpu.outType, cpu.out, cpu.numOut,
+			cpu.outIndices, cpu.numOutIndices);
+	cpu.numOut = 0;
+	cpu.numOutIndices = 0;
+	cpu.chunk++;
+}
+
+// Output index of an unclipped vertex, each is projected once per chunk
+static uint16
+cpuEmitVertex(int32 i)
+{
+	CpuVertex *cv = &cpu.verts[i];
+	CpuIm3DVertex *sv = &cpu.src[i];
+	CpuIm2DVertex *dst;
+	if(cv->chunk != cpu.chunk){
+		dst = &cpu.out[cpu.numOut];
+		cpuProject(dst, cv->x, cv->y, cv->z);
+		memcpy(dst->color, sv->color, 4);
+		dst->u = sv->u;
+		dst->v = sv->v;
+		cv->chunk = cpu.chunk;
+		cv->out = cpu.numOut++;
+	}
+	return cv->out;
+}
+
+static uint16
+cpuEmitClipped(const ClipVert *v)
+{
+	CpuIm2DVertex *dst = &cpu.out[cpu.numOut];
+	cpuProject(dst, v->x, v->y, v->z);
+	for(int32 i = 0; i < 4; i++)
+		dst->color[i] = (uint8)(v->color[i] + 0.5f);
+	dst->u = v->u;
+	dst->v = v->v;
+	return cpu.numOut++;
+}
+
+// Clip a line (n = 2) or triangle (n = 3) against the planes in mask.
+// Returns the number of vertices left.
+static int32
+cpuClip(ClipVert *poly, int32 n, uint32 mask)
+{
+	ClipVert tmp[MAXCLIPVERTS];
+	ClipVert *in = poly, *out = tmp, *swap;
+	float32 da, db;
+	int32 p, i, m, ne;
+
+	for(p = 0; p < NUMCLIPPLANES; p++){
+		if((mask & (1<<p)) == 0)
+			continue;
+		m = 0;
+		// a line is an open polygon
+		ne = n == 2 ? 1 : n;
+		if(n == 2 && cpuPlaneDist(&in[0], p) >= 0.0f)
+			out[m++] = in[0];
+		for(i = 0; i < ne; i++){
+			ClipVert *a = &in[i];
+			ClipVert *b = &in[(i+1)%n];
+			da = cpuPlaneDist(a, p);
+			db = cpuPlaneDist(b, p);
+			if(n != 2 && da >= 0.0f)
+				out[m++] = *a;
+			if((da >= 0.0f) != (db >= 0.0f))
+				cpuLerp(&out[m++], a, b, da/(da - db));
+			if(n == 2 && db >= 0.0f)
+				out[m++] = *b;
+		}
+		if(m < (n == 2 ? 2 : 3))
+			return 0;
+		n = m;
+		swap = in; in = out; out = swap;
+	}
+	if(in != poly)
+		memcpy(poly, in, n*sizeof(ClipVert));
+	return n;
+}
+
+static void
+cpuClipVert(ClipVert *dst, int32 i)
+{
+	CpuVertex *cv = &cpu.verts[i];
+	CpuIm3DVertex *sv = &cpu.src[i];
+	dst->x = cv->x;
+	dst->y = cv->y;
+	dst->z = cv->z;
+	for(int32 j = 0; j < 4; j++)
+		dst->color[j] = sv->color[j];
+	dst->u = sv->u;
+	dst->v = sv->v;
+}
+
+// One point, line or triangle of the current list
+static void
+cpuPrimitive(uint16 *idx, int32 nv)
+{
+	ClipVert poly[MAXCLIPVERTS];
+	uint16 first;
+	uint32 all, any;
+	int32 i, n;
+
+	if(cpu.numOut + MAXCLIPVERTS > BATCHVERTICES ||
+	   cpu.numOutIndices + (MAXCLIPVERTS-2)*3 > BATCHINDICES)
+		cpuFlushOut();
+
+	all = ~0u;
+	any = 0;
+	if(cpu.clip)
+		for(i = 0; i < nv; i++){
+			all &= cpu.verts[idx[i]].clip;
+			any |= cpu.verts[idx[i]].clip;
+		}
+	if(any == 0){
+		for(i = 0; i < nv; i++)
+			cpu.outIndices[cpu.numOutIndices++] = cpuEmitVertex(idx[i]);
+		return;
+	}
+	// points are either in or out
+	if(all || nv == 1)
+		return;
+
+	for(i = 0; i < nv; i++)
+		cpuClipVert(&poly[i], idx[i]);
+	n = cpuClip(poly, nv, any);
+	if(n == 0)
+		return;
+	if(nv == 2){
+		cpu.outIndices[cpu.numOutIndices++] = cpuEmitClipped(&poly[0]);
+		cpu.outIndices[cpu.numOutIndices++] = cpuEmitClipped(&poly[1]);
+		return;
+	}
+	first = cpu.numOut;
+	for(i = 0; i < n; i++)
+		cpuEmitClipped(&poly[i]);
+	for(i = 2; i < n; i++){
+		cpu.outIndices[cpu.numOutIndices++] = first;
+		cpu.outIndices[cpu.numOutIndices++] = first+i-1;
+		cpu.outIndices[cpu.numOutIndices++] = first+i;
+	}
+}
+
+static void
+cpuBegin(void *vertices, int32 numVertices, Matrix *world, uint32 flags)
+{
+	Camera *cam = engine->currentCamera;
+	Matrix m;
+	int32 i;
+
+	if(numVertices > cpu.maxVerts){
+		cpu.maxVerts = numVertices;
+		cpu.verts = rwResizeT(CpuVertex, cpu.verts, cpu.maxVerts, MEMDUR_EVENT);
+	}
+	cpu.active = 1;
+	cpu.src = (CpuIm3DVertex*)vertices;
+	cpu.numVertices = numVertices;
+	cpu.persp = cam->projection == Camera::PERSPECTIVE;
+	cpu.clip = (flags & NOCLIP) == 0;
+	cpu.nearPlane = cam->nearPlane;
+	cpu.farPlane = cam->farPlane;
+	cpu.zScale = cam->zScale;
+	cpu.zShift = cam->zShift;
+	cpu.width = cam->frameBuffer->width;
+	cpu.height = cam->frameBuffer->height;
+	cpu.numOut = 0;
+	cpu.numOutIndices = 0;
+	cpu.outType = PRIMTYPENONE;
+
+	if(world){
+		Matrix::mult(&m, world, &cam->viewMatrix);
+		cpuTransform(cpu.verts, cpu.src, numVertices, &m);
+	}else
+		cpuTransform(cpu.verts, cpu.src, numVertices, &cam->viewMatrix);
+	if(cpu.clip)
+		for(i = 0; i < numVertices; i++)
+			cpu.verts[i].clip = cpuClipCode(cpu.verts[i].x, cpu.verts[i].y, cpu.verts[i].z);
+}
+
+static void
+cpuRender(PrimitiveType primType, void *indices, int32 numIndices)
+{
+	int32 n, nv, i;
+	PrimitiveType lt = listType(primType, numIndices, &n);
+	if(lt == PRIMTYPENONE || n == 0)
+		return;
+	if(lt != cpu.outType){
+		cpuFlushOut();
+		cpu.outType = lt;
+	}
+	if(n > cpu.maxList){
+		cpu.maxList = n;
+		cpu.list = rwResizeT(uint16, cpu.list, cpu.maxList, MEMDUR_EVENT);
+	}
+	listIndices(cpu.list, primType, (uint16*)indices, numIndices, 0);
+	nv = lt == PRIMTYPETRILIST ? 3 : lt == PRIMTYPELINELIST ? 2 : 1;
+	n -= n % nv;
+	for(i = 0; i < n; i += nv)
+		cpuPrimitive(&cpu.list[i], nv);
+}
+
+static void
+cpuEnd(void)
+{
+	cpuFlushOut();
+	cpu.active = 0;
+}
+
+// Nothing is done until something is rendered, unless batching is off
 void
 Transform(void *vertices, int32 numVertices, Matrix *world, uint32 flags)
 {
-	engine->device.im3DTransform(vertices, numVertices, world, flags);
+	if(cpu.active)
+		cpuEnd();
+	if(flags & CPUTRANSFORM && cpuAvailable()){
+		// the device would do this in its transform
+		if((flags & VERTEXUV) == 0)
+			SetRenderStatePtr(TEXTURERASTER, nil);
+		im3dCur.vertices = nil;
+		cpuBegin(vertices, numVertices, world, flags);
+		return;
+	}
+	if(engine->device.im3DVertexSize == 0 ||
+	   engine->device.im3DVertexSize > MAXVERTEXSIZE ||
+	   numVertices > BATCHVERTICES){
+		FlushImmediate();
+		im3dCur.vertices = nil;
+		engine->device.im3DTransform(vertices, numVertices, world, flags);
+		return;
+	}
+	im3dCur.vertices = vertices;
+	im3dCur.numVertices = numVertices;
+	im3dCur.identity = world == nil;
+	if(world)
+		im3dCur.world = *world;
+	im3dCur.flags = flags;
+	im3dCur.base = -1;
+	// the device would do this in its transform
+	if((flags & VERTEXUV) == 0)
+		SetRenderStatePtr(TEXTURERASTER, nil);
 }
 void
 RenderLine(int32 vert1, int32 vert2)
@@ -74,20 +685,87 @@ RenderTriangle(int32 vert1, int32 vert2, int32 vert3)
 	indices[2] = vert3;
 	RenderIndexedPrimitive(rw::PRIMTYPETRILIST, indices, 3);
 }
+// For what doesn't fit into a batch
+static void
+renderUnbatched3D(PrimitiveType primType, void *indices, int32 numIndices)
+{
+	engine->device.im3DTransform(im3dCur.vertices, im3dCur.numVertices,
+		im3dCur.identity ? nil : &im3dCur.world, im3dCur.flags);
+	if(indices)
+		engine->device.im3DRenderIndexedPrimitive(primType, indices, numIndices);
+	else
+		engine->device.im3DRenderPrimitive(primType);
+	engine->device.im3DEnd();
+}
+
+// Make the current transform's vertices part of the batch
+static bool32
+beginBatch3D(PrimitiveType lt, int32 numIndices)
+{
+	if(batch.type == BATCH3D &&
+	   (batch.identity != im3dCur.identity || batch.flags != im3dCur.flags ||
+	    (!im3dCur.identity && memcmp(&batch.world, &im3dCur.world, sizeof(Matrix)) != 0)))
+		FlushImmediate();
+	// only flushes if the vertices don't fit anymore, that also resets base
+	int32 nv = im3dCur.base < 0 ? im3dCur.numVertices : 0;
+	if(!beginBatch(BATCH3D, lt, engine->device.im3DVertexSize, nv, numIndices))
+		return 0;
+	if(im3dCur.base < 0){
+		batch.world = im3dCur.world;
+		batch.identity = im3dCur.identity;
+		batch.flags = im3dCur.flags;
+		im3dCur.base = addVertices(im3dCur.vertices, im3dCur.numVertices,
+			engine->device.im3DVertexSize);
+	}
+	return 1;
+}
+
 void
 RenderPrimitive(PrimitiveType primType)
 {
-	engine->device.im3DRenderPrimitive(primType);
+	int32 n;
+	PrimitiveType lt = listType(primType, im3dCur.numVertices, &n);
+	if(cpu.active){
+		cpuRender(primType, nil, cpu.numVertices);
+		return;
+	}
+	if(im3dCur.vertices == nil){
+		engine->device.im3DRenderPrimitive(primType);
+		return;
+	}
+	if(lt == PRIMTYPENONE || !beginBatch3D(lt, n)){
+		renderUnbatched3D(primType, nil, 0);
+		return;
+	}
+	addIndices(primType, nil, im3dCur.numVertices, im3dCur.base);
 }
 void
 RenderIndexedPrimitive(PrimitiveType primType, void *indices, int32 numIndices)
 {
-	engine->device.im3DRenderIndexedPrimitive(primType, indices, numIndices);
+	int32 n;
+	PrimitiveType lt = listType(primType, numIndices, &n);
+	if(cpu.active){
+		cpuRender(primType, indices, numIndices);
+		return;
+	}
+	if(im3dCur.vertices == nil){
+		engine->device.im3DRenderIndexedPrimitive(primType, indices, numIndices);
+		return;
+	}
+	if(lt == PRIMTYPENONE || !beginBatch3D(lt, n)){
+		renderUnbatched3D(primType, indices, numIndices);
+		return;
+	}
+	addIndices(primType, (uint16*)indices, numIndices, im3dCur.base);
 }
 void
 End(void)
 {
-	engine->device.im3DEnd();
+	if(cpu.active)
+		cpuEnd();
+	else if(im3dCur.vertices == nil)
+		engine->device.im3DEnd();
+	im3dCur.vertices = nil;
 }
 
 }
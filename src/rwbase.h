@@ -40,6 +40,10 @@
 #define RW_OPENGL
 #endif
 
+#ifdef RW_SOFT
+#define RWDEVICE soft
+#endif
+
 namespace rw {
 
 #ifdef RW_PS2
@@ -530,7 +534,7 @@ enum Platform
 	PLATFORM_PS2  = 4,
 	PLATFORM_XBOX = 5,
 	// GAMECUBE
-	// SOFTRAS
+	PLATFORM_SOFT = 7,	// software rasteriser
 	PLATFORM_D3D8 = 8,
 	PLATFORM_D3D9 = 9,
 	// PSP
@@ -612,6 +616,7 @@ enum PluginID
 	ID_RASTERD3D9    = MAKEPLUGINID(VEND_RASTER, PLATFORM_D3D9),
 	ID_RASTERWDGL    = MAKEPLUGINID(VEND_RASTER, PLATFORM_WDGL),
 	ID_RASTERGL3     = MAKEPLUGINID(VEND_RASTER, PLATFORM_GL3),
+	ID_RASTERSOFT    = MAKEPLUGINID(VEND_RASTER, PLATFORM_SOFT),
 
 	// anything driver/device related (only as allocation tag)
 	ID_DRIVER        = MAKEPLUGINID(VEND_DRIVER, 0)
@@ -627,7 +632,7 @@ enum CoreModuleID
 	// camera
 	ID_IMAGEMODULE   = MAKEPLUGINID(VEND_CRITERIONINT, 0x06),
 	ID_RASTERMODULE  = MAKEPLUGINID(VEND_CRITERIONINT, 0x07),
-	ID_TEXTUREMODULE = MAKEPLUGINID(VEND_CRITERIONINT, 0x08)
+	ID_TEXTUREMODULE = MAKEPLUGINID(VEND_CRITERIONINT, 0x08),
 	// pip
 	// immediate
 	// resources
@@ -635,7 +640,7 @@ enum CoreModuleID
 	// color
 	// unused
 	// error
-	// metrics
+	ID_METRICSMODULE = MAKEPLUGINID(VEND_CRITERIONINT, 0x10)
 	// driver
 	// chunk group
 };
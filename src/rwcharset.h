@@ -1,5 +1,7 @@
 namespace rw {
 
+struct TextLayout;
+
 struct Charset
 {
 	struct Desc {
@@ -16,10 +18,14 @@ struct Charset
 	void destroy(void);
 	Charset *setColors(const RGBA *foreground, const RGBA *background);
 	void print(const char *str, int32 x, int32 y, bool32 hideSpaces);
+	// Glyphs of a string are cached and reused when the same string
+	// is printed at the same place again. Nothing is drawn until
+	// flushBuffer, which can be called once per frame.
 	void printBuffered(const char *str, int32 x, int32 y, bool32 hideSpaces);
 	static void flushBuffer(void);
 private:
-	void printChar(int32 c, int32 x, int32 y);
+	void buildChar(void *vertices, int32 c, int32 x, int32 y);
+	TextLayout *makeLayout(uint32 hash, const char *str, int32 x, int32 y, bool32 hideSpaces);
 };
 
 }
@@ -67,6 +67,10 @@ struct Device
 	void (*im3DEnd)(void);
 
 	DeviceSystem *system;
+
+	// Im2D and Im3D calls are only batched if these are set
+	int32 im2DVertexSize;
+	int32 im3DVertexSize;
 };
 
 // This is for platform-dependent but portable things
@@ -121,6 +125,33 @@ struct MemoryFunctions
 	void *(*rwmustrealloc)(void *p, size_t sz, uint32 hint);
 };
 
+// Allocator for objects of one size, e.g. a plugin extended struct.
+// Entries are cut from blocks and freed entries are reused,
+// blocks are only given back when the list is destroyed.
+// Between beginBulk(n) and endBulk() the next n entries are contiguous
+// unless there are enough freed entries to reuse.
+struct FreeList
+{
+	int32 entrySize;
+	int32 entriesPerBlock;
+	uint32 hint;
+	uint8 *blocks;
+	uint8 *freeEntries;
+	int32 numFree;
+	// unused space at the end of the newest block
+	uint8 *next, *end;
+	// reserved by beginBulk
+	uint8 *bulkNext, *bulkEnd;
+	int32 numUsed;
+
+	static FreeList *create(int32 entrySize, int32 entriesPerBlock, uint32 hint);
+	void destroy(void);
+	void *alloc(void);
+	void free(void *entry);
+	void beginBulk(int32 n);
+	void endBulk(void);
+};
+
 struct FileFunctions
 {
 	void *(*rwfopen)(const char *path, const char *mode);
@@ -207,16 +238,96 @@ struct Engine
 
 extern Engine *engine;
 
+// Counters of one frame, a frame ends with Camera::showRaster
+struct Metrics
+{
+	enum { NUMMEMDUR = 5 };
+
+	uint32 numAtomics;	// rendered through object pipelines
+	uint32 numMeshes;	// drawn by the device
+	uint32 numRenderStateChanges;
+	uint32 numTextureBinds;
+	uint32 numInstanceBytes;	// uploaded when instancing
+	uint32 numFramesSynced;	// LTMs updated by Frame::syncDirty
+	uint32 numAllocations[NUMMEMDUR];	// by MEMDUR_ hint
+	uint32 numAllocatedBytes[NUMMEMDUR];
+
+	static void registerModule(void);
+	static Metrics *get(void);	// last complete frame
+	static void endFrame(void);
+	static uint64 getTime(void);	// microseconds
+
+	// Scoped timers are only recorded while tracing,
+	// writeTrace writes them in Chrome's trace event format.
+	static bool32 beginTrace(int32 maxEvents);
+	static void endTrace(void);
+	static bool32 writeTrace(const char *path);
+};
+
+// Memory use by allocation hint, only collected when the engine
+// was initialized with trackedMemfuncs
+struct MemoryStats
+{
+	enum { MAXIDS = 256 };
+	struct Entry
+	{
+		uint32 id;	// plugin ID of the hint, or MEMDUR_ value
+		int32 numLive;
+		int64 liveBytes;
+		int64 peakBytes;
+		uint64 numAllocs;	// since the start
+		uint64 allocBytes;
+	};
+	uint64 time;	// Metrics::getTime() of the snapshot
+	Entry total;
+	Entry durations[Metrics::NUMMEMDUR];
+	Entry ids[MAXIDS];
+	int32 numIds;
+
+	static void snapshot(MemoryStats *stats);
+	// changes from before to now, peaks are those of now
+	static void diff(MemoryStats *dst, const MemoryStats *now, const MemoryStats *before);
+	void print(void);
+	// print the stats and the changes every ms milliseconds
+	// from Metrics::endFrame, 0 to stop
+	static void setDumpInterval(uint32 ms);
+};
+
+// Counters of the current frame, nil when the engine isn't started
+extern Metrics *currentMetrics;
+
+#define RWMETRIC(field, n) (rw::currentMetrics ? (void)(rw::currentMetrics->field += (n)) : (void)0)
+
+// Time of the enclosing scope as a trace event
+struct MetricsTimer
+{
+	const char *name;
+	uint64 start;
+
+	MetricsTimer(const char *name);
+	~MetricsTimer(void);
+};
+#define RWTIMER(name) rw::MetricsTimer rwTimer_(name)
+
 #define RWTOSTR_(X) #X
 #define RWTOSTR(X) RWTOSTR_(X)
 #define RWHERE "file: " __FILE__ " line: " RWTOSTR(__LINE__)
 
 extern const char *allocLocation;
 
-inline void *malloc_LOC(size_t sz, uint32 hint, const char *here) { allocLocation = here; return rw::Engine::memfuncs.rwmalloc(sz,hint); }
-inline void *realloc_LOC(void *p, size_t sz, uint32 hint, const char *here) { allocLocation = here; return rw::Engine::memfuncs.rwrealloc(p,sz,hint); }
-inline void *mustmalloc_LOC(size_t sz, uint32 hint, const char *here) { allocLocation = here; return rw::Engine::memfuncs.rwmustmalloc(sz,hint); }
-inline void *mustrealloc_LOC(void *p, size_t sz, uint32 hint, const char *here) { allocLocation = here; return rw::Engine::memfuncs.rwmustrealloc(p,sz,hint); }
+inline void countAlloc(size_t sz, uint32 hint) {
+	if(currentMetrics){
+		uint32 dur = (hint>>16) & 0xF;
+		if(dur >= Metrics::NUMMEMDUR) dur = 0;
+		currentMetrics->numAllocations[dur]++;
+		currentMetrics->numAllocatedBytes[dur] += (uint32)sz;
+	}
+}
+
+inline void *malloc_LOC(size_t sz, uint32 hint, const char *here) { allocLocation = here; countAlloc(sz,hint); return rw::Engine::memfuncs.rwmalloc(sz,hint); }
+inline void *realloc_LOC(void *p, size_t sz, uint32 hint, const char *here) { allocLocation = here; countAlloc(sz,hint); return rw::Engine::memfuncs.rwrealloc(p,sz,hint); }
+inline void *mustmalloc_LOC(size_t sz, uint32 hint, const char *here) { allocLocation = here; countAlloc(sz,hint); return rw::Engine::memfuncs.rwmustmalloc(sz,hint); }
+inline void *mustrealloc_LOC(void *p, size_t sz, uint32 hint, const char *here) { allocLocation = here; countAlloc(sz,hint); return rw::Engine::memfuncs.rwmustrealloc(p,sz,hint); }
 
 char *strdup_LOC(const char *s, uint32 hint, const char *here);
 
@@ -233,6 +344,7 @@ char *strdup_LOC(const char *s, uint32 hint, const char *here);
 
 extern MemoryFunctions defaultMemfuncs;
 extern MemoryFunctions managedMemfuncs;
+extern MemoryFunctions trackedMemfuncs;	// see MemoryStats
 void printleaks(void);	// when using managed mem funcs
 
 namespace null {
@@ -2,8 +2,14 @@
 
 namespace rw {
 
+struct FreeList;
+
 struct Object
 {
+	enum {
+		// private flag, storage is part of a ClumpPrototype instance
+		INSTANCEBLOCK = 0x80
+	};
 	uint8 type;
 	uint8 subType;
 	uint8 flags;
@@ -21,7 +27,7 @@ struct Object
 		this->type = o->type;
 		this->subType = o->subType;
 		this->flags = o->flags;
-		this->privateFlags = o->privateFlags;
+		this->privateFlags = o->privateFlags & ~INSTANCEBLOCK;
 		this->parent = nil;
 	}
 };
@@ -56,6 +62,7 @@ struct Frame
 	Frame *root;
 
 	static int32 numAllocated;
+	static FreeList *freeList;
 
 	static Frame *create(void);
 	Frame *cloneHierarchy(void);
@@ -140,6 +147,8 @@ struct Image
 	void free(void);
 	void setPixels(uint8 *pixels);
 	void setPixelsDXT(int32 type, uint8 *pixels);
+	void getPixelsDXT(int32 type, uint8 *pixels, int32 quality);
+	Image *makeMipmap(int32 filter, bool32 srgb = 1);
 	void setPalette(uint8 *palette);
 	void compressPalette(void);	// turn 8 bit into 4 bit if possible
 	bool32 hasAlpha(void);
@@ -174,6 +183,11 @@ void writeBMP(Image *image, const char *filename);
 Image *readPNG(const char *filename);
 void writePNG(Image *image, const char *filename);
 
+enum MipmapFilter {
+	MIPFILTER_BOX,
+	MIPFILTER_KAISER
+};
+
 enum { QUANTDEPTH = 8 };
 
 struct ColorQuant
@@ -181,21 +195,35 @@ struct ColorQuant
 	struct Node {
 		uint32 r, g, b, a;
 		int32 numPixels;
+		int32 level;
+		int32 numChildren;
+		int32 numLeafChildren;
 		Node *parent;
 		Node *children[16];
 		LLLink link;
 
-		void destroy(void);
 		void addColor(RGBA color);
-		bool isLeaf(void) { for(int32 i = 0; i < 16; i++) if(this->children[i]) return false; return true; }
+		bool isLeaf(void) { return this->numChildren == 0; }
+	};
+	// nodes are allocated in blocks and all freed together
+	enum { NODEBLOCKSIZE = 256 };
+	struct NodeBlock {
+		NodeBlock *next;
+		Node nodes[NODEBLOCKSIZE];
 	};
 
 	Node *root;
 	LinkList leaves;
+	int32 numLeaves;
+	int32 numNodes;
+	NodeBlock *blocks;
+	int32 blockUsed;
+	Node *freeNodes;
 
 	void init(void);
 	void destroy(void);
 	Node *createNode(int32 level);
+	void freeNode(Node *node);
 	Node *getNode(Node *root, uint32 addr, int32 level);
 	Node *findNode(Node *root, uint32 addr, int32 level);
 	void reduceNode(Node *node);
@@ -269,6 +297,7 @@ struct Raster
 	bool32 renderFast(int32 x, int32 y);
 
 	static Raster *convertTexToCurrentPlatform(Raster *ras);
+	static Raster *buildMipmaps(Raster *ras, int32 filter);
 #ifndef RWPUBLIC
 	static void registerModule(void);
 #endif
@@ -339,12 +368,59 @@ void expandPal4_BE(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, i
 void compressPal4_BE(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h);
 void copyPal8(uint8 *dst, uint32 dststride, uint8 *src, uint32 srcstride, int32 w, int32 h);
 
+// Whole row conversion. Formats are in memory byte order like the conv functions above.
+enum PixelFormat
+{
+	PIXFMT_RGBA8888,
+	PIXFMT_BGRA8888,
+	PIXFMT_RGB888,
+	PIXFMT_BGR888,
+	PIXFMT_ARGB1555,
+	PIXFMT_RGB555,
+	PIXFMT_RGBA5551,
+	PIXFMT_ABGR1555,
+	PIXFMT_8,
+	PIXFMT_PAL4,		// two pixels per byte, low nibble first
+	PIXFMT_PAL4_BE,		// high nibble first
+
+	NUM_PIXFMTS
+};
+typedef void (*ConvRowFunc)(uint8 *out, uint8 *in, int32 n);
+ConvRowFunc findRowConverter(int32 dstFormat, int32 srcFormat);
+// strides may be negative to flip vertically
+bool32 convertPixels(uint8 *dst, int32 dststride, int32 dstFormat,
+	uint8 *src, int32 srcstride, int32 srcFormat, int32 w, int32 h);
+
 void flipDXT(int32 type, uint8 *dst, uint8 *src, uint32 width, uint32 height);
 
+enum DXTQuality {
+	DXT_FAST,	// range fit
+	DXT_HIGH	// cluster fit
+};
+// quality used when rasterFromImage has to compress
+extern int32 dxtQuality;
+void decompressDXT(int32 type, uint8 *dst, int32 w, int32 h, uint8 *src);
+void compressDXT(int32 type, uint8 *dst, int32 w, int32 h, uint8 *src, int32 stride, int32 quality);
+
 
 #define IGNORERASTERIMP 0
 
 struct TexDictionary;
+struct Texture;
+
+// Interned lowercase texture name.
+// Also caches the texture of that name last added to a dictionary.
+struct TexName
+{
+	char name[32];
+	uint32 hash;
+	TexName *next;
+	Texture *cache;
+
+	static uint32 hashName(const char *name);
+	static TexName *find(const char *name);
+	static TexName *intern(const char *name);
+};
 
 struct Texture
 {
@@ -367,14 +443,18 @@ struct Texture
 	Raster *raster;
 	TexDictionary *dict;
 	LLLink inDict;
+	// name must not change while the texture is in a dictionary
 	char name[32];
 	char mask[32];
+	TexName *iname;		// set while in a dictionary
+	Texture *hashNext;	// in the dictionary's bucket
 	uint32 filterAddressing; // VVVVUUUU FFFFFFFF
 	int32 refCount;
 
 	LLLink inGlobalList;	// actually not in RW
 
 	static int32 numAllocated;
+	static FreeList *freeList;
 
 	static Texture *create(Raster *raster);
 	void addRef(void) { this->refCount++; }
@@ -403,6 +483,8 @@ struct Texture
 	static void setAutoMipmapping(bool32);	// default: false
 	static bool32 getMipmapping(void);
 	static bool32 getAutoMipmapping(void);
+	static void setBuildMipmaps(bool32, int32 filter = MIPFILTER_BOX);	// default: false
+	static bool32 getBuildMipmaps(void);
 
 	void setMaxAnisotropy(int32 maxaniso);	// only if plugin is attached
 	int32 getMaxAnisotropy(void);
@@ -434,6 +516,7 @@ struct Material
 	int32 refCount;
 
 	static int32 numAllocated;
+	static FreeList *freeList;
 
 	static Material *create(void);
 	void addRef(void) { this->refCount++; }
@@ -477,10 +560,13 @@ struct MorphTarget
 {
 	Geometry *parent;
 	Sphere boundingSphere;
+	BBox boundingBox;
 	V3d *vertices;
 	V3d *normals;
 
 	Sphere calculateBoundingSphere(void) const;
+	void calculateBounds(void);
+	void boxFromSphere(void);
 };
 
 struct InstanceDataHeader
@@ -603,6 +689,19 @@ void registerNativeDataPlugin(void);
 
 struct Clump;
 struct World;
+struct WorldSector;
+struct Camera;
+struct OcclusionBuffer;
+
+// Counters of a visibility pass
+struct CullStats
+{
+	int32 sectorsTested;
+	int32 sectorsCulled;
+	int32 atomicsTested;
+	int32 atomicsCulled;
+	int32 atomicsOccluded;
+};
 
 struct Atomic
 {
@@ -613,6 +712,7 @@ struct Atomic
 	// flags
 		COLLISIONTEST = 0x01,	// unused here
 		RENDER = 0x04,
+		OCCLUDER = 0x08,	// drawn into the camera's occlusion buffer
 	// private flags
 		WORLDBOUNDDIRTY = 0x01,
 	// for setGeometry
@@ -623,6 +723,8 @@ struct Atomic
 	Geometry *geometry;
 	Sphere boundingSphere;
 	Sphere worldBoundingSphere;
+	BBox boundingBox;
+	BBox worldBoundingBox;
 	Clump *clump;
 	LLLink inClump;
 	ObjPipeline *pipeline;
@@ -630,8 +732,11 @@ struct Atomic
 
 	World *world;
 	ObjectWithFrame::Sync originalSync;
+	WorldSector *sector;	// nil if not placed yet
+	LLLink inSector;
 
 	static int32 numAllocated;
+	static FreeList *freeList;
 
 	static Atomic *create(void);
 	Atomic *clone(void);
@@ -643,8 +748,12 @@ struct Atomic
 	Frame *getFrame(void) const { return (Frame*)this->object.object.parent; }
 	static Atomic *fromClump(LLLink *lnk){
 		return LLLinkGetData(lnk, Atomic, inClump); }
+	static Atomic *fromSector(LLLink *lnk){
+		return LLLinkGetData(lnk, Atomic, inSector); }
 	void setGeometry(Geometry *geo, uint32 flags);
 	Sphere *getWorldBoundingSphere(void);
+	BBox *getWorldBoundingBox(void);
+	void calculateWorldBounds(const Matrix *ltm);
 	ObjPipeline *getPipeline(void);
 	void instance(void);
 	void uninstance(void);
@@ -662,6 +771,11 @@ struct Atomic
 	uint32 streamGetSize(void);
 
 	static void defaultRenderCB(Atomic *atomic);
+	// render those with RENDER flag that are in the camera's frustum
+	enum { CULLBATCH = 64 };
+	// frustumCull only compacts the array to those and returns their number
+	static int32 frustumCull(Atomic **atomics, int32 n, Camera *cam, CullStats *stats);
+	static void renderCulled(Atomic **atomics, int32 n, Camera *cam, CullStats *stats);
 };
 
 void registerAtomicRightsPlugin(void);
@@ -683,6 +797,9 @@ struct Light
 	// world extension
 	World *world;
 	ObjectWithFrame::Sync originalSync;
+	WorldSector *sector;	// only local lights, nil if not placed yet
+	LLLink inSector;
+	uint32 worldSerial;	// order of local lights in World::localLights
 
 	static int32 numAllocated;
 
@@ -694,11 +811,14 @@ struct Light
 		return LLLinkGetData(lnk, Light, inClump); }
 	static Light *fromWorld(LLLink *lnk){
 		return LLLinkGetData(lnk, Light, inWorld); }
+	static Light *fromSector(LLLink *lnk){
+		return LLLinkGetData(lnk, Light, inSector); }
+	void setRadius(float32 radius);
 	void setAngle(float32 angle);
 	float32 getAngle(void);
 	void setColor(float32 r, float32 g, float32 b);
 	int32 getType(void){ return this->object.object.subType; }
-	void setFlags(uint32 flags) { this->object.object.flags = flags; }
+	void setFlags(uint32 flags);
 	uint32 getFlags(void) { return this->object.object.flags; }
 	static Light *streamRead(Stream *stream);
 	bool streamWrite(Stream *stream);
@@ -736,6 +856,8 @@ struct Camera
 	enum { CLEARIMAGE = 0x1, CLEARZ = 0x2, CLEARSTENCIL = 0x4 };
 	// return value of frustumTestSphere
 	enum { SPHEREOUTSIDE, SPHEREBOUNDARY, SPHEREINSIDE };
+	// return value of frustumTestBBox
+	enum { BOXOUTSIDE, BOXBOUNDARY, BOXINSIDE };
 
 	ObjectWithFrame object;
 	void (*beginUpdateCB)(Camera*);
@@ -753,6 +875,8 @@ struct Camera
 	V3d frustumCorners[8];
 	BBox frustumBoundBox;
 
+	OcclusionBuffer *occlusion;	// nil if occlusion culling is off
+
 	Raster *frameBuffer;
 	Raster *zBuffer;
 
@@ -791,6 +915,10 @@ struct Camera
 	void setViewOffset(const V2d *offset);
 	void setProjection(int32 proj);
 	int32 frustumTestSphere(const Sphere *s) const;
+	int32 frustumTestBBox(const BBox *box) const;
+	int32 frustumTestSpheres(const float32 *x, const float32 *y, const float32 *z,
+		const float32 *radius, uint8 *visible, int32 n) const;
+	void setOcclusion(int32 width, int32 height);
 	static Camera *streamRead(Stream *stream);
 	bool streamWrite(Stream *stream);
 	uint32 streamGetSize(void);
@@ -837,6 +965,33 @@ struct Clump
 	void render(void);
 };
 
+// Precomputed layout of a clump's frames and atomics so instances
+// are made with one allocation and a copy instead of Clump::clone.
+// Lights and cameras aren't instanced, same as with Clump::clone.
+// The source clump must not change or go away while the prototype exists.
+struct ClumpPrototype
+{
+	Clump *clump;
+	int32 numFrames;
+	int32 numAtomics;
+	Frame **frames;		// source frames in clone order
+	int32 *frameLinks;	// parent, child, next per frame, -1 if none
+	Atomic **atomics;
+	int32 *atomicFrames;
+	int32 frameStride;
+	int32 atomicStride;
+	int32 frameOffset;
+	int32 atomicOffset;
+	int32 size;
+	uint8 *image;		// instance with everything that doesn't need fixing up
+
+	static ClumpPrototype *create(Clump *clump);
+	void destroy(void);
+	Clump *instance(void);
+	// free an object that has INSTANCEBLOCK set
+	static void release(void *object);
+};
+
 // used by enumerateLights for lighting callback
 struct WorldLights
 {
@@ -848,16 +1003,101 @@ struct WorldLights
 	Light **locals;	// points, (soft)spots
 };
 
+// Local lights binned into view space clusters, done once per camera update.
+// Clusters are screen tiles times depth slices that grow exponentially
+// from the near to the far plane. Lights are kept in world list order,
+// so lookups give the same result as testing all lights in that order.
+struct LightClusters
+{
+	enum {
+		TILESX = 16,
+		TILESY = 8,
+		SLICES = 16,
+		NUMCLUSTERS = TILESX*TILESY*SLICES
+	};
+	Camera *camera;	// nil if not valid
+	Matrix viewMatrix;
+	bool32 perspective;
+	float32 nearPlane;
+	float32 sliceScale;
+	Light **lights;
+	Sphere *spheres;	// of the lights when they were binned
+	int32 numLights;
+	int32 maxLights;
+	// lights of cluster c are indices[offsets[c]] .. indices[offsets[c+1]-1]
+	int32 offsets[NUMCLUSTERS+1];
+	int32 *indices;
+	int32 maxIndices;
+	// per light cluster range, and last lookup it was found in
+	int32 *ranges;
+	uint32 *stamps;
+	uint32 stamp;
+	int32 *found;	// scratch for lookups
+};
+
+// Low resolution depth buffer for CPU occlusion culling.
+// Atomics flagged OCCLUDER are rasterised into it, the rest
+// are only rendered if some part of their world box is in front.
+// Depth is stored as 1/z so bigger is nearer and 0 is empty.
+struct OcclusionBuffer
+{
+	int32 width, height;	// width is a multiple of 4
+	float32 *depth;
+	Camera *camera;
+	Matrix viewMatrix;
+	V3d *verts;	// scratch for transformed occluder vertices
+	int32 maxVerts;
+	// atomics waiting for the occlusion test
+	Atomic **candidates;
+	int32 numCandidates;
+	int32 maxCandidates;
+
+	static OcclusionBuffer *create(int32 width, int32 height);
+	void destroy(void);
+	void begin(Camera *cam);
+	void addAtomic(Atomic *atomic);
+	void end(CullStats *stats);
+	void drawAtomic(Atomic *atomic);
+	bool32 testBBox(const BBox *box);
+};
+
+// Node of a world's loose octree.
+// An object lives in the smallest sector whose loose bounds contain it;
+// loose bounds are the sector's box grown by half its size on every side.
+struct WorldSector
+{
+	BBox box;
+	BBox looseBox;
+	WorldSector *parent;
+	WorldSector *children[8];
+	int32 depth;
+	LinkList atomics;
+	LinkList lights;
+	// objects in this sector and below, to skip empty subtrees
+	int32 numAtomics;
+	int32 numLights;
+};
+
 // A bit of a stub right now
 struct World
 {
 	PLUGINBASE
 	enum { ID = 7 };
+	enum { MAXSECTORDEPTH = 8 };
 	Object object;
 	LinkList localLights;	// these have positions (type >= 0x80)
 	LinkList globalLights;	// these do not (type < 0x80)
 	LinkList clumps;
 
+	WorldSector *rootSector;
+	int32 maxSectorDepth;	// 0 if created without a bounding box
+	// objects that moved since the last updateSectors
+	LinkList dirtyAtomics;
+	LinkList dirtyLights;
+	CullStats cullStats;	// of the last render
+	LightClusters *lightClusters;
+	uint32 lightSerial;	// next Light::worldSerial
+
 	static int32 numAllocated;
 
 	static World *create(BBox *bbox = nil);	// TODO: should probably make this non-optional
@@ -872,6 +1112,11 @@ struct World
 	void removeClump(Clump *clump);
 	void render(void);
 	void enumerateLights(Atomic *atomic, WorldLights *lightData);
+	void clusterLights(Camera *cam);
+	// sector placement of moved objects is deferred to this
+	void updateSectors(void);
+	void atomicMoved(Atomic *atomic);
+	void lightMoved(Light *light);
 };
 
 struct TexDictionary
@@ -881,6 +1126,10 @@ struct TexDictionary
 	Object object;
 	LinkList textures;
 	LLLink inGlobalList;
+	// textures hashed by interned name
+	Texture **buckets;
+	int32 numBuckets;
+	int32 numHashed;
 
 	static int32 numAllocated;
 
@@ -901,4 +1150,30 @@ struct TexDictionary
 	static TexDictionary *getCurrent(void);
 };
 
+// Loads RW files in the background. Worker threads read the files into
+// memory, update() then makes the objects on the main thread until its
+// time budget is used up, so device objects are only created there.
+// With worker threads the file and memory functions must be thread safe.
+struct StreamLoader
+{
+	// object is nil if loading failed
+	typedef void (*Callback)(void *object, uint32 type, void *data);
+	struct Request;
+	struct Workers;
+
+	Request *head, *tail;
+	int32 numPending;
+	Workers *workers;	// nil if update() reads the files
+
+	static StreamLoader *create(int32 numThreads);
+	void destroy(void);
+	// type is ID_CLUMP, ID_GEOMETRY or ID_TEXDICTIONARY,
+	// texDict is made current while the object is read
+	bool32 load(const char *path, uint32 type, Callback cb, void *data, TexDictionary *texDict = nil);
+	// budget is in milliseconds. Clumps and geometries are parsed in
+	// one go, so an update can still take as long as the largest of
+	// them (plus reading its file without worker threads).
+	int32 update(float32 budget);
+};
+
 }
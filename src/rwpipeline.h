@@ -31,9 +31,9 @@ public:
 		void (*render)(ObjPipeline *pipe, Atomic *atomic);
 	} impl;
 	// just for convenience
-	void instance(Atomic *atomic) { this->impl.instance(this, atomic); }
+	void instance(Atomic *atomic);
 	void uninstance(Atomic *atomic) { this->impl.uninstance(this, atomic); }
-	void render(Atomic *atomic) { this->impl.render(this, atomic); }
+	void render(Atomic *atomic);
 };
 
 void findMinVertAndNumVertices(uint16 *indices, uint32 numIndices, uint32 *minVert, int32 *numVertices);
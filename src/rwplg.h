@@ -12,15 +12,29 @@ typedef int32 (*StreamGetSize)(void *object, int32 offset, int32 size);
 typedef void (*RightsCallback)(void *object, int32 offset, int32 size, uint32 data);
 typedef void (*AlwaysCallback)(void *object, int32 offset, int32 size);
 
+struct Plugin;
+
 struct PluginList
 {
 	int32 size;
 	int32 defaultSize;
 	LinkList plugins;
 
+	// Flat copy of the list for the hot paths, built on first use
+	// after any change. The index arrays point into table and only
+	// have the plugins that do something, byID is sorted by ID.
+	bool32 dirty;
+	Plugin *table;
+	int32 numPlugins;
+	int32 *ctors, numCtors;
+	int32 *dtors, numDtors;
+	int32 *copies, numCopies;
+	int32 *always, numAlways;
+	int32 *byID;
+
 	PluginList(void) {}
 	PluginList(int32 defSize)
-	 : size(defSize), defaultSize(defSize)
+	 : size(defSize), defaultSize(defSize), dirty(1), table(nil)
 	{ plugins.init(); }
 
 	static void open(void);
@@ -41,6 +55,8 @@ struct PluginList
 	int32 setStreamRightsCallback(uint32 id, RightsCallback cb);
 	int32 setStreamAlwaysCallback(uint32 id, AlwaysCallback cb);
 	int32 getPluginOffset(uint32 id);
+	void compile(void);
+	int32 findFirst(uint32 id);
 };
 
 struct Plugin
@@ -99,6 +99,11 @@ void SetRenderStatePtr(int32 state, void *value);
 uint32 GetRenderState(int32 state);
 void *GetRenderStatePtr(int32 state);
 
+// Im2D and Im3D primitives are batched, this draws what is pending.
+// Anything that changes rendering other than through SetRenderState
+// (e.g. direct graphics API calls) has to call this first.
+void FlushImmediate(void);
+
 // Im2D
 
 namespace im2d {
@@ -123,6 +128,7 @@ enum TransformFlags
 	NOCLIP        = 4,	// don't frustum clip
 	VERTEXXYZ     = 8,	// has position
 	VERTEXRGBA    = 16,	// has color
+	CPUTRANSFORM  = 32,	// transform and clip on the CPU, draw as Im2D
 	EVERYTHING = VERTEXUV|VERTEXXYZ|VERTEXRGBA
 };
 
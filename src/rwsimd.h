@@ -0,0 +1,7 @@
+// Internal header: which SIMD instruction sets we can use.
+// Everything using these must have a plain C++ fallback.
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define RW_SSE2
+#include <emmintrin.h>
+#endif
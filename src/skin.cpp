@@ -19,6 +19,8 @@
 #include "gl/rwwdgl.h"
 #include "gl/rwgl3.h"
 #include "gl/rwgl3plg.h"
+#include "soft/rwsoft.h"
+#include "soft/rwsoftplg.h"
 
 #define PLUGIN_ID ID_SKIN
 
@@ -373,6 +375,7 @@ registerSkinPlugin(void)
 	d3d9::initSkin();
 	wdgl::initSkin();
 	gl3::initSkin();
+	soft::initSkin();
 
 	int32 o;
 	o = Geometry::registerPlugin(sizeof(Skin*), ID_SKIN,
@@ -0,0 +1,129 @@
+namespace rw {
+
+#ifdef RW_SOFT
+struct EngineOpenParams
+{
+	int32 numThreads;	// rasteriser workers besides the main thread, < 0 for one per core
+};
+#endif
+
+namespace soft {
+
+void registerPlatformPlugins(void);
+
+extern Device renderdevice;
+
+struct Im3DVertex
+{
+	V3d     position;
+	uint8   r, g, b, a;
+	float32 u, v;
+
+	void setX(float32 x) { this->position.x = x; }
+	void setY(float32 y) { this->position.y = y; }
+	void setZ(float32 z) { this->position.z = z; }
+	void setColor(uint8 r, uint8 g, uint8 b, uint8 a) {
+		this->r = r; this->g = g; this->b = b; this->a = a; }
+	void setU(float32 u) { this->u = u; }
+	void setV(float32 v) { this->v = v; }
+
+	float getX(void) { return this->position.x; }
+	float getY(void) { return this->position.y; }
+	float getZ(void) { return this->position.z; }
+	RGBA getColor(void) { return makeRGBA(this->r, this->g, this->b, this->a); }
+	float getU(void) { return this->u; }
+	float getV(void) { return this->v; }
+};
+
+struct Im2DVertex
+{
+	float32 x, y, z, w;
+	uint8   r, g, b, a;
+	float32 u, v;
+
+	void setScreenX(float32 x) { this->x = x; }
+	void setScreenY(float32 y) { this->y = y; }
+	void setScreenZ(float32 z) { this->z = z; }
+	void setCameraZ(float32 z) { this->w = z; }
+	void setRecipCameraZ(float32 recipz) { this->w = 1.0f/recipz; }
+	void setColor(uint8 r, uint8 g, uint8 b, uint8 a) {
+		this->r = r; this->g = g; this->b = b; this->a = a; }
+	void setU(float32 u, float recipz) { this->u = u; }
+	void setV(float32 v, float recipz) { this->v = v; }
+
+	float getScreenX(void) { return this->x; }
+	float getScreenY(void) { return this->y; }
+	float getScreenZ(void) { return this->z; }
+	float getCameraZ(void) { return this->w; }
+	float getRecipCameraZ(void) { return 1.0f/this->w; }
+	RGBA getColor(void) { return makeRGBA(this->r, this->g, this->b, this->a); }
+	float getU(void) { return this->u; }
+	float getV(void) { return this->v; }
+};
+
+struct InstanceData
+{
+	uint32    numIndex;	// triangle list
+	uint32    minVert;
+	int32     numVertices;
+	Material *material;
+	bool32    vertexAlpha;
+	uint16   *indices;	// into the whole vertex arrays
+};
+
+// Vertex data is kept in object space, everything else is done per frame
+struct InstanceDataHeader : rw::InstanceDataHeader
+{
+	uint32     serialNumber;
+	uint32     numMeshes;
+	int32      totalNumVertex;
+	uint32     totalNumIndex;
+	V3d       *positions;
+	V3d       *normals;	// nil without normals
+	RGBA      *colors;	// nil if not prelit
+	TexCoords *texCoords[2];
+	int32      numTexCoordSets;
+	uint16    *indices;
+
+	InstanceData *inst;
+};
+
+class ObjPipeline : public rw::ObjPipeline
+{
+public:
+	void init(void);
+	static ObjPipeline *create(void);
+
+	void (*instanceCB)(Geometry *geo, InstanceDataHeader *header, bool32 reinstance);
+	void (*uninstanceCB)(Geometry *geo, InstanceDataHeader *header);
+	void (*renderCB)(Atomic *atomic, InstanceDataHeader *header);
+};
+
+void defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance);
+void defaultUninstanceCB(Geometry *geo, InstanceDataHeader *header);
+void defaultRenderCB(Atomic *atomic, InstanceDataHeader *header);
+int32 lightingCB(Atomic *atomic);
+
+void *destroyNativeData(void *object, int32, int32);
+
+ObjPipeline *makeDefaultPipeline(void);
+
+// Native Raster
+
+// All colour rasters are RGBA8 in memory, top row first, with all their
+// mip levels one after the other. Z-buffers are float32.
+struct SoftRaster
+{
+	uint8 *pixels;
+	int32 size;		// of all levels in bytes
+	int8 numLevels;
+	bool hasAlpha;
+	bool autogenMipmap;
+};
+
+extern int32 nativeRasterOffset;
+void registerNativeRaster(void);
+#define GETSOFTRASTEREXT(raster) PLUGINOFFSET(rw::soft::SoftRaster, raster, rw::soft::nativeRasterOffset)
+
+}
+}
@@ -0,0 +1,158 @@
+namespace rw {
+namespace soft {
+
+// Screen space vertex as the rasteriser wants it.
+// Colour is 0-255, q is 1/w and f the fog factor (1 is no fog).
+struct RasVertex
+{
+	float32 x, y, z, q;
+	float32 r, g, b, a;
+	float32 u, v;
+	float32 f;
+};
+
+// Part of a colour raster and z-buffer that is rendered to
+struct Canvas
+{
+	uint8 *fb;		// RGBA8
+	float32 *zbuf;		// nil if there is none
+	int32 fbStride;		// in bytes
+	int32 zStride;		// in floats
+	int32 width, height;
+};
+
+// One mip level of a texture as it is sampled
+struct TexLevel
+{
+	uint8 *pixels;
+	int32 width, height;
+	int32 stride;
+};
+
+enum { MAXTEXLEVELS = 16 };
+
+struct RasState
+{
+	Raster *raster;
+	// what's sampled, no levels if raster isn't a soft raster
+	TexLevel levels[MAXTEXLEVELS];
+	int32 numLevels;
+	int32 filter;
+	int32 addressU, addressV;
+
+	bool32 vertexAlpha;
+	bool32 textureAlpha;
+	int32 srcBlend, destBlend;
+	bool32 zTest, zWrite;
+	bool32 fogEnable;
+	uint32 fogColor;
+	int32 cullMode;
+	int32 alphaFunc;
+	int32 alphaRef;
+	bool32 gsAlpha;
+	int32 gsAlphaRef;
+	bool32 gsEmu;		// set while a pipeline draws
+	// only stored
+	uint32 stencilEnable, stencilFail, stencilZFail, stencilPass;
+	uint32 stencilFunc, stencilRef, stencilMask, stencilWriteMask;
+};
+
+// What the current camera needs for projection and fog
+struct CamState
+{
+	bool32 persp;
+	float32 nearPlane, farPlane;
+	float32 zScale, zShift;
+	float32 width, height;
+	float32 fogStart, fogEnd;
+};
+
+extern Canvas canvas;
+extern RasState rasState;
+extern CamState camState;
+
+void setTexture(Texture *tex);
+bool32 getAlphaBlend(void);
+float32 vertexFog(float32 w);
+
+// Rasteriser, primitives are only binned until the next flush
+void drawTriangle(RasVertex *v1, RasVertex *v2, RasVertex *v3);
+void drawLine(RasVertex *v1, RasVertex *v2);
+void drawPoint(RasVertex *v);
+void flushRaster(void);
+void openRaster(int32 numThreads);
+void closeRaster(void);
+
+// Camera space vertex as made by the camera's view matrix,
+// x/z and y/z are 0..1 across the screen (x and y for parallel).
+// Colour is 0-1.
+struct CamVertex
+{
+	V3d pos;
+	uint32 clip;
+	RGBAf color;
+	float32 u, v;
+};
+
+enum {
+	CLIPLEFT   = 1,
+	CLIPRIGHT  = 2,
+	CLIPTOP    = 4,
+	CLIPBOTTOM = 8,
+	CLIPNEAR   = 16,
+	CLIPFAR    = 32
+};
+
+void transformVertices(CamVertex *dst, V3d *src, int32 n, Matrix *m);
+void projectVertex(RasVertex *dst, CamVertex *src);
+void submitTriangles(CamVertex *verts, uint16 *indices, int32 numIndices);
+void submitLines(CamVertex *verts, uint16 *indices, int32 numIndices);
+void submitPoints(CamVertex *verts, uint16 *indices, int32 numIndices);
+
+// Transform and lighting of one atomic
+struct TnLBuffers
+{
+	V3d *worldPos;
+	V3d *worldNormals;
+	CamVertex *verts;
+	int32 numVertices;
+	int32 maxVertices;
+};
+extern TnLBuffers tnl;
+
+int32 setLights(WorldLights *lightData);
+void transformAtomic(InstanceDataHeader *header, Matrix *ltm, V3d *positions, V3d *normals);
+void lightMesh(InstanceDataHeader *header, InstanceData *inst,
+	const RGBAf &mult, float32 minColor);
+void texCoordsMesh(InstanceDataHeader *header, InstanceData *inst, int32 set);
+void drawInst(InstanceDataHeader *header, InstanceData *inst);
+void renderMesh(InstanceDataHeader *header, InstanceData *inst, uint32 flags);
+void closeTnL(void);
+
+void im2DRenderLine(void *vertices, int32 numVertices,
+  int32 vert1, int32 vert2);
+void im2DRenderTriangle(void *vertices, int32 numVertices,
+  int32 vert1, int32 vert2, int32 vert3);
+void im2DRenderPrimitive(PrimitiveType primType,
+   void *vertices, int32 numVertices);
+void im2DRenderIndexedPrimitive(PrimitiveType primType,
+   void *vertices, int32 numVertices, void *indices, int32 numIndices);
+
+void im3DTransform(void *vertices, int32 numVertices, Matrix *world, uint32 flags);
+void im3DRenderPrimitive(PrimitiveType primType);
+void im3DRenderIndexedPrimitive(PrimitiveType primType, void *indices, int32 numIndices);
+void im3DEnd(void);
+void closeIm(void);
+
+Raster *rasterCreate(Raster *raster);
+uint8 *rasterLock(Raster*, int32 level, int32 lockMode);
+void rasterUnlock(Raster*, int32);
+int32 rasterNumLevels(Raster*);
+bool32 imageFindRasterFormat(Image *img, int32 type,
+	int32 *width, int32 *height, int32 *depth, int32 *format);
+bool32 rasterFromImage(Raster *raster, Image *image);
+Image *rasterToImage(Raster *raster);
+int32 getLevels(Raster *raster, TexLevel *levels);
+
+}
+}
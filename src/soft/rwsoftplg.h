@@ -0,0 +1,13 @@
+namespace rw {
+namespace soft {
+
+void initMatFX(void);
+ObjPipeline *makeMatFXPipeline(void);
+void matfxRenderCB(Atomic *atomic, InstanceDataHeader *header);
+
+void initSkin(void);
+ObjPipeline *makeSkinPipeline(void);
+void skinRenderCB(Atomic *atomic, InstanceDataHeader *header);
+
+}
+}
@@ -0,0 +1,50 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwengine.h"
+
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+namespace rw {
+namespace soft {
+
+static void*
+driverOpen(void *o, int32, int32)
+{
+	engine->driver[PLATFORM_SOFT]->defaultPipeline = makeDefaultPipeline();
+	engine->driver[PLATFORM_SOFT]->rasterNativeOffset = nativeRasterOffset;
+	engine->driver[PLATFORM_SOFT]->rasterCreate       = rasterCreate;
+	engine->driver[PLATFORM_SOFT]->rasterLock         = rasterLock;
+	engine->driver[PLATFORM_SOFT]->rasterUnlock       = rasterUnlock;
+	engine->driver[PLATFORM_SOFT]->rasterNumLevels    = rasterNumLevels;
+	engine->driver[PLATFORM_SOFT]->imageFindRasterFormat = imageFindRasterFormat;
+	engine->driver[PLATFORM_SOFT]->rasterFromImage    = rasterFromImage;
+	engine->driver[PLATFORM_SOFT]->rasterToImage      = rasterToImage;
+
+	return o;
+}
+
+static void*
+driverClose(void *o, int32, int32)
+{
+	return o;
+}
+
+void
+registerPlatformPlugins(void)
+{
+	Driver::registerPlugin(PLATFORM_SOFT, 0, PLATFORM_SOFT,
+	                       driverOpen, driverClose);
+	registerNativeRaster();
+}
+
+}
+}
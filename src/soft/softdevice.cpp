@@ -0,0 +1,468 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwengine.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+namespace rw {
+namespace soft {
+
+Canvas canvas;
+RasState rasState;
+CamState camState;
+static int32 numRasterThreads = -1;
+
+static void
+setRasterStage(Raster *raster)
+{
+	SoftRaster *natras;
+
+	if(raster == rasState.raster)
+		return;
+	RWMETRIC(numTextureBinds, 1);
+	rasState.raster = raster;
+	rasState.numLevels = raster ? getLevels(raster, rasState.levels) : 0;
+	if(rasState.numLevels){
+		natras = GETSOFTRASTEREXT(raster->parent);
+		rasState.textureAlpha = natras->hasAlpha;
+	}else
+		rasState.textureAlpha = 0;
+}
+
+void
+setTexture(Texture *tex)
+{
+	if(tex == nil || tex->raster == nil){
+		setRasterStage(nil);
+		return;
+	}
+	setRasterStage(tex->raster);
+	rasState.filter = tex->getFilter();
+	rasState.addressU = tex->getAddressU();
+	rasState.addressV = tex->getAddressV();
+}
+
+// Blending and alpha test are switched on by vertex or texture alpha
+bool32
+getAlphaBlend(void)
+{
+	return rasState.vertexAlpha || rasState.textureAlpha;
+}
+
+float32
+vertexFog(float32 w)
+{
+	float32 f;
+	if(camState.fogStart == camState.fogEnd)
+		return 1.0f;
+	f = (w - camState.fogEnd)/(camState.fogStart - camState.fogEnd);
+	return f < 0.0f ? 0.0f : f > 1.0f ? 1.0f : f;
+}
+
+static void
+setRenderState(int32 state, void *pvalue)
+{
+	uint32 value = (uint32)(uintptr)pvalue;
+	switch(state){
+	case TEXTURERASTER:
+		setRasterStage((Raster*)pvalue);
+		break;
+	case TEXTUREADDRESS:
+		rasState.addressU = value;
+		rasState.addressV = value;
+		break;
+	case TEXTUREADDRESSU:
+		rasState.addressU = value;
+		break;
+	case TEXTUREADDRESSV:
+		rasState.addressV = value;
+		break;
+	case TEXTUREFILTER:
+		rasState.filter = value;
+		break;
+	case VERTEXALPHA:
+		rasState.vertexAlpha = value;
+		break;
+	case SRCBLEND:
+		rasState.srcBlend = value;
+		break;
+	case DESTBLEND:
+		rasState.destBlend = value;
+		break;
+	case ZTESTENABLE:
+		rasState.zTest = value;
+		break;
+	case ZWRITEENABLE:
+		rasState.zWrite = value;
+		break;
+	case FOGENABLE:
+		rasState.fogEnable = value;
+		break;
+	case FOGCOLOR:
+		rasState.fogColor = value;
+		break;
+	case CULLMODE:
+		rasState.cullMode = value;
+		break;
+
+	// no stencil buffer, only remembered
+	case STENCILENABLE:
+		rasState.stencilEnable = value;
+		break;
+	case STENCILFAIL:
+		rasState.stencilFail = value;
+		break;
+	case STENCILZFAIL:
+		rasState.stencilZFail = value;
+		break;
+	case STENCILPASS:
+		rasState.stencilPass = value;
+		break;
+	case STENCILFUNCTION:
+		rasState.stencilFunc = value;
+		break;
+	case STENCILFUNCTIONREF:
+		rasState.stencilRef = value;
+		break;
+	case STENCILFUNCTIONMASK:
+		rasState.stencilMask = value;
+		break;
+	case STENCILFUNCTIONWRITEMASK:
+		rasState.stencilWriteMask = value;
+		break;
+
+	case ALPHATESTFUNC:
+		rasState.alphaFunc = value;
+		break;
+	case ALPHATESTREF:
+		rasState.alphaRef = value;
+		break;
+	case GSALPHATEST:
+		rasState.gsAlpha = value;
+		break;
+	case GSALPHATESTREF:
+		rasState.gsAlphaRef = value;
+		break;
+	}
+}
+
+static void*
+getRenderState(int32 state)
+{
+	uint32 val;
+	switch(state){
+	case TEXTURERASTER:
+		return rasState.raster;
+	case TEXTUREADDRESS:
+		if(rasState.addressU == rasState.addressV)
+			val = rasState.addressU;
+		else
+			val = 0;	// invalid
+		break;
+	case TEXTUREADDRESSU:
+		val = rasState.addressU;
+		break;
+	case TEXTUREADDRESSV:
+		val = rasState.addressV;
+		break;
+	case TEXTUREFILTER:
+		val = rasState.filter;
+		break;
+
+	case VERTEXALPHA:
+		val = rasState.vertexAlpha;
+		break;
+	case SRCBLEND:
+		val = rasState.srcBlend;
+		break;
+	case DESTBLEND:
+		val = rasState.destBlend;
+		break;
+	case ZTESTENABLE:
+		val = rasState.zTest;
+		break;
+	case ZWRITEENABLE:
+		val = rasState.zWrite;
+		break;
+	case FOGENABLE:
+		val = rasState.fogEnable;
+		break;
+	case FOGCOLOR:
+		val = rasState.fogColor;
+		break;
+	case CULLMODE:
+		val = rasState.cullMode;
+		break;
+
+	case STENCILENABLE:
+		val = rasState.stencilEnable;
+		break;
+	case STENCILFAIL:
+		val = rasState.stencilFail;
+		break;
+	case STENCILZFAIL:
+		val = rasState.stencilZFail;
+		break;
+	case STENCILPASS:
+		val = rasState.stencilPass;
+		break;
+	case STENCILFUNCTION:
+		val = rasState.stencilFunc;
+		break;
+	case STENCILFUNCTIONREF:
+		val = rasState.stencilRef;
+		break;
+	case STENCILFUNCTIONMASK:
+		val = rasState.stencilMask;
+		break;
+	case STENCILFUNCTIONWRITEMASK:
+		val = rasState.stencilWriteMask;
+		break;
+
+	case ALPHATESTFUNC:
+		val = rasState.alphaFunc;
+		break;
+	case ALPHATESTREF:
+		val = rasState.alphaRef;
+		break;
+	case GSALPHATEST:
+		val = rasState.gsAlpha;
+		break;
+	case GSALPHATESTREF:
+		val = rasState.gsAlphaRef;
+		break;
+	default:
+		val = 0;
+	}
+	return (void*)(uintptr)val;
+}
+
+// Same defaults as the GL3 device
+static void
+resetRenderState(void)
+{
+	memset(&rasState, 0, sizeof(rasState));
+	rasState.filter = Texture::NEAREST;
+	rasState.addressU = Texture::WRAP;
+	rasState.addressV = Texture::WRAP;
+	rasState.srcBlend = BLENDSRCALPHA;
+	rasState.destBlend = BLENDINVSRCALPHA;
+	rasState.zTest = 1;
+	rasState.zWrite = 1;
+	rasState.fogColor = 0xFFFFFFFF;
+	rasState.cullMode = CULLNONE;
+	rasState.alphaFunc = ALPHAGREATEREQUAL;
+	rasState.alphaRef = 10;
+	rasState.gsAlphaRef = 128;
+	rasState.stencilFail = STENCILKEEP;
+	rasState.stencilZFail = STENCILKEEP;
+	rasState.stencilPass = STENCILKEEP;
+	rasState.stencilFunc = STENCILALWAYS;
+	rasState.stencilMask = 0xFFFFFFFF;
+	rasState.stencilWriteMask = 0xFFFFFFFF;
+}
+
+// Find the memory a camera renders to. Sub rasters render into their parent.
+static void
+getCanvas(Canvas *c, Camera *cam)
+{
+	Raster *fb, *zb, *parent;
+	SoftRaster *natras;
+
+	memset(c, 0, sizeof(Canvas));
+	fb = cam->frameBuffer;
+	if(fb == nil)
+		return;
+	parent = fb->parent;
+	if(parent->platform != PLATFORM_SOFT || parent->type == Raster::ZBUFFER)
+		return;
+	natras = GETSOFTRASTEREXT(parent);
+	if(natras->pixels == nil)
+		return;
+	c->fbStride = parent->originalStride;
+	c->fb = natras->pixels + fb->offsetY*c->fbStride + fb->offsetX*4;
+	c->width = fb->width;
+	c->height = fb->height;
+
+	zb = cam->zBuffer;
+	if(zb == nil)
+		return;
+	parent = zb->parent;
+	if(parent->platform != PLATFORM_SOFT || parent->type != Raster::ZBUFFER)
+		return;
+	natras = GETSOFTRASTEREXT(parent);
+	if(natras->pixels == nil)
+		return;
+	c->zStride = parent->originalWidth;
+	c->zbuf = (float32*)natras->pixels + zb->offsetY*c->zStride + zb->offsetX;
+	// only draw where there is both colour and depth
+	if(zb->width < c->width) c->width = zb->width;
+	if(zb->height < c->height) c->height = zb->height;
+}
+
+static void
+beginUpdate(Camera *cam)
+{
+	flushRaster();
+	getCanvas(&canvas, cam);
+	camState.persp = cam->projection == Camera::PERSPECTIVE;
+	camState.nearPlane = cam->nearPlane;
+	camState.farPlane = cam->farPlane;
+	camState.zScale = cam->zScale;
+	camState.zShift = cam->zShift;
+	camState.width = cam->frameBuffer ? cam->frameBuffer->width : 0.0f;
+	camState.height = cam->frameBuffer ? cam->frameBuffer->height : 0.0f;
+	camState.fogStart = cam->fogPlane;
+	camState.fogEnd = cam->farPlane;
+}
+
+static void
+endUpdate(Camera *cam)
+{
+	flushRaster();
+}
+
+static void
+clearCamera(Camera *cam, RGBA *col, uint32 mode)
+{
+	Canvas c;
+	uint8 *px;
+	float32 *zp;
+	int32 x, y;
+
+	flushRaster();
+	getCanvas(&c, cam);
+	if(c.fb == nil)
+		return;
+	if(mode & Camera::CLEARIMAGE)
+		for(y = 0; y < c.height; y++){
+			px = c.fb + y*c.fbStride;
+			for(x = 0; x < c.width; x++){
+				px[0] = col->red;
+				px[1] = col->green;
+				px[2] = col->blue;
+				px[3] = col->alpha;
+				px += 4;
+			}
+		}
+	if((mode & Camera::CLEARZ) && c.zbuf)
+		for(y = 0; y < c.height; y++){
+			zp = c.zbuf + y*c.zStride;
+			for(x = 0; x < c.width; x++)
+				zp[x] = 1.0f;
+		}
+}
+
+// Nothing to show, the application reads the camera raster
+static void
+showRaster(Raster *raster, uint32 flags)
+{
+}
+
+static bool32
+rasterRenderFast(Raster *raster, int32 x, int32 y)
+{
+	Raster *src = raster;
+	Raster *dst = Raster::getCurrentContext();
+	SoftRaster *natsrc, *natdst;
+	uint8 *sp, *dp;
+	int32 w, h, sx, sy, i;
+
+	if(dst == nil || src->platform != PLATFORM_SOFT || dst->platform != PLATFORM_SOFT ||
+	   src->type == Raster::ZBUFFER || dst->type == Raster::ZBUFFER)
+		return 0;
+	natsrc = GETSOFTRASTEREXT(src->parent);
+	natdst = GETSOFTRASTEREXT(dst->parent);
+	if(natsrc->pixels == nil || natdst->pixels == nil)
+		return 0;
+	flushRaster();
+
+	// clip source rectangle against destination
+	sx = 0;
+	sy = 0;
+	w = src->width;
+	h = src->height;
+	if(x < 0){ sx = -x; w += x; x = 0; }
+	if(y < 0){ sy = -y; h += y; y = 0; }
+	if(x + w > dst->width) w = dst->width - x;
+	if(y + h > dst->height) h = dst->height - y;
+	if(w <= 0 || h <= 0)
+		return 1;
+
+	sp = natsrc->pixels + (src->offsetY+sy)*src->parent->originalStride + (src->offsetX+sx)*4;
+	dp = natdst->pixels + (dst->offsetY+y)*dst->parent->originalStride + (dst->offsetX+x)*4;
+	for(i = 0; i < h; i++){
+		memmove(dp, sp, w*4);
+		sp += src->parent->originalStride;
+		dp += dst->parent->originalStride;
+	}
+	return 1;
+}
+
+static int
+deviceSystem(DeviceReq req, void *arg, int32 n)
+{
+	switch(req){
+	case DEVICEOPEN:
+#ifdef RW_SOFT
+		if(arg)
+			numRasterThreads = ((EngineOpenParams*)arg)->numThreads;
+#endif
+		return 1;
+	case DEVICEINIT:
+		resetRenderState();
+		memset(&canvas, 0, sizeof(canvas));
+		memset(&camState, 0, sizeof(camState));
+		openRaster(numRasterThreads);
+		return 1;
+	case DEVICETERM:
+		closeRaster();
+		closeIm();
+		closeTnL();
+		return 1;
+
+	case DEVICEGETNUMSUBSYSTEMS:
+		return 0;
+	case DEVICEGETCURRENTSUBSYSTEM:
+		return 0;
+	case DEVICEGETSUBSSYSTEMINFO:
+		return 0;
+	default: break;
+	}
+	return 1;
+}
+
+Device renderdevice = {
+	0.0f, 1.0f,
+	soft::beginUpdate,
+	soft::endUpdate,
+	soft::clearCamera,
+	soft::showRaster,
+	soft::rasterRenderFast,
+	soft::setRenderState,
+	soft::getRenderState,
+	soft::im2DRenderLine,
+	soft::im2DRenderTriangle,
+	soft::im2DRenderPrimitive,
+	soft::im2DRenderIndexedPrimitive,
+	soft::im3DTransform,
+	soft::im3DRenderPrimitive,
+	soft::im3DRenderIndexedPrimitive,
+	soft::im3DEnd,
+	soft::deviceSystem,
+	sizeof(soft::Im2DVertex),
+	sizeof(soft::Im3DVertex)
+};
+
+}
+}
@@ -0,0 +1,280 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwengine.h"
+
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+namespace rw {
+namespace soft {
+
+// Scratch memory, grows as needed and lives until the device is closed
+static RasVertex *rasVerts;
+static int32 maxRasVerts;
+static CamVertex *im3DVerts;
+static int32 maxIm3DVerts;
+static int32 num3DVertices;
+static uint16 *listBuf;
+static int32 maxList;
+
+// Indices of a primitive as a list of lines, triangles or points.
+// indices is nil for non-indexed primitives.
+static uint16*
+makeList(PrimitiveType type, uint16 *indices, int32 n, int32 *numList)
+{
+	int32 i, num;
+	uint16 *dst;
+
+	switch(type){
+	case PRIMTYPEPOLYLINE:
+		num = n < 2 ? 0 : (n-1)*2;
+		break;
+	case PRIMTYPETRISTRIP:
+	case PRIMTYPETRIFAN:
+		num = n < 3 ? 0 : (n-2)*3;
+		break;
+	default:
+		num = n;
+		break;
+	}
+	if(num > maxList){
+		maxList = num;
+		listBuf = rwResizeT(uint16, listBuf, maxList, MEMDUR_EVENT | ID_DRIVER);
+	}
+	dst = listBuf;
+#define IDX(j) (indices ? indices[j] : (uint16)(j))
+	switch(type){
+	case PRIMTYPEPOLYLINE:
+		for(i = 0; i < n-1; i++){
+			*dst++ = IDX(i);
+			*dst++ = IDX(i+1);
+		}
+		break;
+	case PRIMTYPETRISTRIP:
+		// keep the winding of odd triangles
+		for(i = 0; i < n-2; i++){
+			*dst++ = IDX(i + (i&1));
+			*dst++ = IDX(i+1 - (i&1));
+			*dst++ = IDX(i+2);
+		}
+		break;
+	case PRIMTYPETRIFAN:
+		for(i = 0; i < n-2; i++){
+			*dst++ = IDX(0);
+			*dst++ = IDX(i+1);
+			*dst++ = IDX(i+2);
+		}
+		break;
+	default:
+		for(i = 0; i < n; i++)
+			*dst++ = IDX(i);
+		break;
+	}
+#undef IDX
+	*numList = num;
+	return listBuf;
+}
+
+// Im2D
+
+static void
+convertIm2D(Im2DVertex *verts, int32 numVertices)
+{
+	RasVertex *dst;
+	int32 i;
+
+	if(numVertices > maxRasVerts){
+		maxRasVerts = numVertices;
+		rasVerts = rwResizeT(RasVertex, rasVerts, maxRasVerts, MEMDUR_EVENT | ID_DRIVER);
+	}
+	for(i = 0; i < numVertices; i++){
+		dst = &rasVerts[i];
+		dst->x = verts[i].x;
+		dst->y = verts[i].y;
+		dst->z = verts[i].z;
+		dst->q = verts[i].w > 0.0f ? 1.0f/verts[i].w : 1.0f;
+		dst->r = verts[i].r;
+		dst->g = verts[i].g;
+		dst->b = verts[i].b;
+		dst->a = verts[i].a;
+		dst->u = verts[i].u;
+		dst->v = verts[i].v;
+		dst->f = vertexFog(verts[i].w);
+	}
+}
+
+static void
+drawIm2D(PrimitiveType primType, uint16 *list, int32 numList, int32 numVertices)
+{
+	int32 i;
+
+	switch(primType){
+	case PRIMTYPELINELIST:
+	case PRIMTYPEPOLYLINE:
+		for(i = 0; i+1 < numList; i += 2)
+			if(list[i] < numVertices && list[i+1] < numVertices)
+				drawLine(&rasVerts[list[i]], &rasVerts[list[i+1]]);
+		break;
+	case PRIMTYPETRILIST:
+	case PRIMTYPETRISTRIP:
+	case PRIMTYPETRIFAN:
+		for(i = 0; i+2 < numList; i += 3)
+			if(list[i] < numVertices && list[i+1] < numVertices && list[i+2] < numVertices)
+				drawTriangle(&rasVerts[list[i]], &rasVerts[list[i+1]], &rasVerts[list[i+2]]);
+		break;
+	case PRIMTYPEPOINTLIST:
+		for(i = 0; i < numList; i++)
+			if(list[i] < numVertices)
+				drawPoint(&rasVerts[list[i]]);
+		break;
+	default:
+		break;
+	}
+}
+
+void
+im2DRenderLine(void *vertices, int32 numVertices, int32 vert1, int32 vert2)
+{
+	uint16 idx[2] = { (uint16)vert1, (uint16)vert2 };
+	im2DRenderIndexedPrimitive(PRIMTYPELINELIST, vertices, numVertices, idx, 2);
+}
+
+void
+im2DRenderTriangle(void *vertices, int32 numVertices, int32 vert1, int32 vert2, int32 vert3)
+{
+	uint16 idx[3] = { (uint16)vert1, (uint16)vert2, (uint16)vert3 };
+	im2DRenderIndexedPrimitive(PRIMTYPETRILIST, vertices, numVertices, idx, 3);
+}
+
+void
+im2DRenderPrimitive(PrimitiveType primType, void *vertices, int32 numVertices)
+{
+	uint16 *list;
+	int32 numList;
+
+	convertIm2D((Im2DVertex*)vertices, numVertices);
+	list = makeList(primType, nil, numVertices, &numList);
+	drawIm2D(primType, list, numList, numVertices);
+}
+
+void
+im2DRenderIndexedPrimitive(PrimitiveType primType,
+	void *vertices, int32 numVertices,
+	void *indices, int32 numIndices)
+{
+	uint16 *list;
+	int32 numList;
+
+	convertIm2D((Im2DVertex*)vertices, numVertices);
+	list = makeList(primType, (uint16*)indices, numIndices, &numList);
+	drawIm2D(primType, list, numList, numVertices);
+}
+
+// Im3D
+
+void
+im3DTransform(void *vertices, int32 numVertices, Matrix *world, uint32 flags)
+{
+	Im3DVertex *verts = (Im3DVertex*)vertices;
+	Camera *cam = (Camera*)engine->currentCamera;
+	Matrix m;
+	int32 i;
+
+	if((flags & im3d::VERTEXUV) == 0)
+		SetRenderStatePtr(TEXTURERASTER, nil);
+
+	num3DVertices = 0;
+	if(cam == nil)
+		return;
+	if(numVertices > maxIm3DVerts){
+		maxIm3DVerts = numVertices;
+		im3DVerts = rwResizeT(CamVertex, im3DVerts, maxIm3DVerts, MEMDUR_EVENT | ID_DRIVER);
+	}
+	if(world)
+		Matrix::mult(&m, world, &cam->viewMatrix);
+	else
+		m = cam->viewMatrix;
+	for(i = 0; i < numVertices; i++){
+		transformVertices(&im3DVerts[i], &verts[i].position, 1, &m);
+		im3DVerts[i].color.red = verts[i].r/255.0f;
+		im3DVerts[i].color.green = verts[i].g/255.0f;
+		im3DVerts[i].color.blue = verts[i].b/255.0f;
+		im3DVerts[i].color.alpha = verts[i].a/255.0f;
+		im3DVerts[i].u = verts[i].u;
+		im3DVerts[i].v = verts[i].v;
+	}
+	num3DVertices = numVertices;
+}
+
+static void
+submitIm3D(PrimitiveType primType, uint16 *indices, int32 n)
+{
+	uint16 *list;
+	int32 numList, i;
+
+	list = makeList(primType, indices, n, &numList);
+	// don't trust the application's indices
+	for(i = 0; i < numList; i++)
+		if(list[i] >= num3DVertices)
+			return;
+	switch(primType){
+	case PRIMTYPELINELIST:
+	case PRIMTYPEPOLYLINE:
+		submitLines(im3DVerts, list, numList);
+		break;
+	case PRIMTYPETRILIST:
+	case PRIMTYPETRISTRIP:
+	case PRIMTYPETRIFAN:
+		submitTriangles(im3DVerts, list, numList);
+		break;
+	case PRIMTYPEPOINTLIST:
+		submitPoints(im3DVerts, list, numList);
+		break;
+	default:
+		break;
+	}
+}
+
+void
+im3DRenderPrimitive(PrimitiveType primType)
+{
+	submitIm3D(primType, nil, num3DVertices);
+}
+
+void
+im3DRenderIndexedPrimitive(PrimitiveType primType, void *indices, int32 numIndices)
+{
+	submitIm3D(primType, (uint16*)indices, numIndices);
+}
+
+void
+im3DEnd(void)
+{
+	num3DVertices = 0;
+}
+
+void
+closeIm(void)
+{
+	rwFree(rasVerts);
+	rasVerts = nil;
+	maxRasVerts = 0;
+	rwFree(im3DVerts);
+	im3DVerts = nil;
+	maxIm3DVerts = 0;
+	rwFree(listBuf);
+	listBuf = nil;
+	maxList = 0;
+}
+
+}
+}
@@ -0,0 +1,183 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwengine.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwanim.h"
+#include "../rwplugins.h"
+
+#include "rwsoft.h"
+#include "rwsoftplg.h"
+#include "rwsoftimpl.h"
+
+// The GL3 env shader blends both passes in one go,
+// here the second pass is drawn on top of the first.
+
+namespace rw {
+namespace soft {
+
+static Matrix normal2texcoord;
+
+static void
+envTexCoords(InstanceDataHeader *header, InstanceData *inst, Frame *frame)
+{
+	Matrix invMat, texMat;
+	V3d *n, t;
+	CamVertex *cv;
+	int32 i;
+
+	if(frame == nil)
+		frame = engine->currentCamera->getFrame();
+	Matrix::invert(&invMat, frame->getLTM());
+	invMat.pos.set(0.0f, 0.0f, 0.0f);
+	normal2texcoord.right.x = MatFX::envMapFlipU ? -0.5f : 0.5f;
+	Matrix::mult(&texMat, &invMat, &normal2texcoord);
+
+	n = &tnl.worldNormals[inst->minVert];
+	cv = &tnl.verts[inst->minVert];
+	for(i = 0; i < inst->numVertices; i++, n++, cv++){
+		V3d::transformPoints(&t, n, 1, &texMat);
+		cv->u = t.x;
+		cv->v = t.y;
+	}
+}
+
+static void
+matfxEnvRender(InstanceDataHeader *header, InstanceData *inst, uint32 flags, MatFX::Env *env)
+{
+	Material *m = inst->material;
+	RGBAf envColor;
+	uint32 fogColor;
+	int32 src, dst;
+
+	renderMesh(header, inst, flags);
+	if(env->tex == nil || env->coefficient == 0.0f || header->normals == nil)
+		return;
+
+	if(MatFX::envMapUseMatColor)
+		convColor(&envColor, &m->color);
+	else
+		convColor(&envColor, &MatFX::envMapColor);
+	envColor = scale(envColor, env->coefficient);
+	// Clamping the color up to 1 ignores lighting, that way both PC and PS2 style works
+	lightMesh(header, inst, envColor, MatFX::envMapApplyLight ? 0.0f : 1.0f);
+	envTexCoords(header, inst, env->frame);
+
+	// additive, fogged towards black
+	src = rasState.srcBlend;
+	dst = rasState.destBlend;
+	fogColor = rasState.fogColor;
+	setTexture(env->tex);
+	rasState.fogColor = 0;
+	rw::SetRenderState(VERTEXALPHA, 1);
+	rw::SetRenderState(SRCBLEND, env->fbAlpha ? BLENDSRCALPHA : BLENDONE);
+	rw::SetRenderState(DESTBLEND, BLENDONE);
+	rw::SetRenderState(ZWRITEENABLE, 0);
+	drawInst(header, inst);
+	rw::SetRenderState(ZWRITEENABLE, 1);
+	rw::SetRenderState(SRCBLEND, src);
+	rw::SetRenderState(DESTBLEND, dst);
+	rasState.fogColor = fogColor;
+}
+
+static void
+matfxDualRender(InstanceDataHeader *header, InstanceData *inst, uint32 flags, MatFX::Dual *dual)
+{
+	int32 src, dst;
+
+	renderMesh(header, inst, flags);
+	if(dual->tex == nil)
+		return;
+
+	texCoordsMesh(header, inst, header->numTexCoordSets > 1 ? 1 : 0);
+	src = rasState.srcBlend;
+	dst = rasState.destBlend;
+	setTexture(dual->tex);
+	rw::SetRenderState(SRCBLEND, dual->srcBlend);
+	rw::SetRenderState(DESTBLEND, dual->dstBlend);
+	rw::SetRenderState(ZWRITEENABLE, 0);
+	drawInst(header, inst);
+	rw::SetRenderState(ZWRITEENABLE, 1);
+	rw::SetRenderState(SRCBLEND, src);
+	rw::SetRenderState(DESTBLEND, dst);
+}
+
+void
+matfxRenderCB(Atomic *atomic, InstanceDataHeader *header)
+{
+	uint32 flags = atomic->geometry->flags;
+	lightingCB(atomic);
+	transformAtomic(header, atomic->getFrame()->getLTM(),
+		header->positions, header->normals);
+
+	InstanceData *inst = header->inst;
+	int32 n = header->numMeshes;
+	while(n--){
+		MatFX *matfx = MatFX::get(inst->material);
+		if(matfx == nil)
+			renderMesh(header, inst, flags);
+		else switch(matfx->type){
+		case MatFX::ENVMAP:
+			matfxEnvRender(header, inst, flags, &matfx->fx[0].env);
+			break;
+		case MatFX::DUAL:
+			matfxDualRender(header, inst, flags, &matfx->fx[0].dual);
+			break;
+		default:
+			renderMesh(header, inst, flags);
+			break;
+		}
+		inst++;
+	}
+}
+
+ObjPipeline*
+makeMatFXPipeline(void)
+{
+	ObjPipeline *pipe = ObjPipeline::create();
+	pipe->instanceCB = defaultInstanceCB;
+	pipe->uninstanceCB = defaultUninstanceCB;
+	pipe->renderCB = matfxRenderCB;
+	pipe->pluginID = ID_MATFX;
+	pipe->pluginData = 0;
+	return pipe;
+}
+
+static void*
+matfxOpen(void *o, int32, int32)
+{
+	matFXGlobals.pipelines[PLATFORM_SOFT] = makeMatFXPipeline();
+
+	normal2texcoord.setIdentity();
+	normal2texcoord.right.x = 0.5f;
+	normal2texcoord.up.y = -0.5f;
+	normal2texcoord.pos.set(0.5f, 0.5f, 0.0f);
+	normal2texcoord.flags = 0;
+	return o;
+}
+
+static void*
+matfxClose(void *o, int32, int32)
+{
+	((ObjPipeline*)matFXGlobals.pipelines[PLATFORM_SOFT])->destroy();
+	matFXGlobals.pipelines[PLATFORM_SOFT] = nil;
+	return o;
+}
+
+void
+initMatFX(void)
+{
+	Driver::registerPlugin(PLATFORM_SOFT, 0, ID_MATFX,
+	                       matfxOpen, matfxClose);
+}
+
+}
+}
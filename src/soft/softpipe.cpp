@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwengine.h"
+
+#include "rwsoft.h"
+
+namespace rw {
+namespace soft {
+
+void
+freeInstanceData(Geometry *geometry)
+{
+	if(geometry->instData == nil ||
+	   geometry->instData->platform != PLATFORM_SOFT)
+		return;
+	InstanceDataHeader *header = (InstanceDataHeader*)geometry->instData;
+	geometry->instData = nil;
+	rwFree(header->positions);
+	rwFree(header->normals);
+	rwFree(header->colors);
+	rwFree(header->texCoords[0]);
+	rwFree(header->texCoords[1]);
+	rwFree(header->indices);
+	rwFree(header->inst);
+	rwFree(header);
+}
+
+void*
+destroyNativeData(void *object, int32, int32)
+{
+	freeInstanceData((Geometry*)object);
+	return object;
+}
+
+// Number of list indices a mesh turns into
+static uint32
+listSize(Mesh *mesh, bool32 strip)
+{
+	if(!strip)
+		return mesh->numIndices;
+	return mesh->numIndices < 3 ? 0 : (mesh->numIndices-2)*3;
+}
+
+static InstanceDataHeader*
+instanceMesh(rw::ObjPipeline *rwpipe, Geometry *geo)
+{
+	InstanceDataHeader *header = rwNewT(InstanceDataHeader, 1, MEMDUR_EVENT | ID_GEOMETRY);
+	MeshHeader *meshh = geo->meshHeader;
+	bool32 strip = meshh->flags == MeshHeader::TRISTRIP;
+	uint32 i, j;
+	geo->instData = header;
+	header->platform = PLATFORM_SOFT;
+
+	header->serialNumber = meshh->serialNum;
+	header->numMeshes = meshh->numMeshes;
+	header->totalNumVertex = geo->numVertices;
+	header->inst = rwNewT(InstanceData, header->numMeshes, MEMDUR_EVENT | ID_GEOMETRY);
+
+	// everything is drawn as triangle lists
+	Mesh *mesh = meshh->getMeshes();
+	header->totalNumIndex = 0;
+	for(i = 0; i < header->numMeshes; i++)
+		header->totalNumIndex += listSize(&mesh[i], strip);
+	header->indices = rwNewT(uint16, header->totalNumIndex, MEMDUR_EVENT | ID_GEOMETRY);
+
+	InstanceData *inst = header->inst;
+	uint16 *dst = header->indices;
+	for(i = 0; i < header->numMeshes; i++){
+		findMinVertAndNumVertices(mesh->indices, mesh->numIndices,
+		                          &inst->minVert, &inst->numVertices);
+		assert(inst->minVert != 0xFFFFFFFF);
+		inst->numIndex = listSize(mesh, strip);
+		inst->material = mesh->material;
+		inst->vertexAlpha = 0;
+		inst->indices = dst;
+		if(strip){
+			// keep the winding of odd triangles
+			for(j = 0; j+2 < mesh->numIndices; j++){
+				*dst++ = mesh->indices[j + (j&1)];
+				*dst++ = mesh->indices[j+1 - (j&1)];
+				*dst++ = mesh->indices[j+2];
+			}
+		}else{
+			memcpy(dst, mesh->indices, inst->numIndex*2);
+			dst += inst->numIndex;
+		}
+		mesh++;
+		inst++;
+	}
+	RWMETRIC(numInstanceBytes, header->totalNumIndex*2);
+
+	header->positions = nil;
+	header->normals = nil;
+	header->colors = nil;
+	header->texCoords[0] = nil;
+	header->texCoords[1] = nil;
+	header->numTexCoordSets = 0;
+
+	return header;
+}
+
+static void
+instance(rw::ObjPipeline *rwpipe, Atomic *atomic)
+{
+	ObjPipeline *pipe = (ObjPipeline*)rwpipe;
+	Geometry *geo = atomic->geometry;
+	// don't try to (re)instance native data
+	if(geo->flags & Geometry::NATIVE)
+		return;
+
+	InstanceDataHeader *header = (InstanceDataHeader*)geo->instData;
+	if(geo->instData){
+		// Already have instanced data, so check if we have to reinstance
+		assert(header->platform == PLATFORM_SOFT);
+		if(header->serialNumber != geo->meshHeader->serialNum){
+			// Mesh changed, so reinstance everything
+			freeInstanceData(geo);
+		}
+	}
+
+	// no instance or complete reinstance
+	if(geo->instData == nil){
+		geo->instData = instanceMesh(rwpipe, geo);
+		pipe->instanceCB(geo, (InstanceDataHeader*)geo->instData, 0);
+	}else if(geo->lockedSinceInst)
+		pipe->instanceCB(geo, (InstanceDataHeader*)geo->instData, 1);
+
+	geo->lockedSinceInst = 0;
+}
+
+static void
+uninstance(rw::ObjPipeline *rwpipe, Atomic *atomic)
+{
+	assert(0 && "can't uninstance");
+}
+
+static void
+render(rw::ObjPipeline *rwpipe, Atomic *atomic)
+{
+	ObjPipeline *pipe = (ObjPipeline*)rwpipe;
+	Geometry *geo = atomic->geometry;
+	pipe->instance(atomic);
+	assert(geo->instData != nil);
+	assert(geo->instData->platform == PLATFORM_SOFT);
+	if(pipe->renderCB)
+		pipe->renderCB(atomic, (InstanceDataHeader*)geo->instData);
+}
+
+void
+ObjPipeline::init(void)
+{
+	this->rw::ObjPipeline::init(PLATFORM_SOFT);
+	this->impl.instance = soft::instance;
+	this->impl.uninstance = soft::uninstance;
+	this->impl.render = soft::render;
+	this->instanceCB = nil;
+	this->uninstanceCB = nil;
+	this->renderCB = nil;
+}
+
+ObjPipeline*
+ObjPipeline::create(void)
+{
+	ObjPipeline *pipe = rwNewT(ObjPipeline, 1, MEMDUR_GLOBAL);
+	pipe->init();
+	return pipe;
+}
+
+// Vertex data stays in object space, only copied so the header
+// doesn't depend on the geometry's arrays.
+void
+defaultInstanceCB(Geometry *geo, InstanceDataHeader *header, bool32 reinstance)
+{
+	bool isPrelit = !!(geo->flags & Geometry::PRELIT);
+	bool hasNormals = !!(geo->flags & Geometry::NORMALS);
+	int32 numVerts = header->totalNumVertex;
+	int32 n, i;
+
+	if(!reinstance){
+		header->positions = rwNewT(V3d, numVerts, MEMDUR_EVENT | ID_GEOMETRY);
+		if(hasNormals)
+			header->normals = rwNewT(V3d, numVerts, MEMDUR_EVENT | ID_GEOMETRY);
+		if(isPrelit)
+			header->colors = rwNewT(RGBA, numVerts, MEMDUR_EVENT | ID_GEOMETRY);
+		// only two sets are ever used
+		header->numTexCoordSets = geo->numTexCoordSets < 2 ? geo->numTexCoordSets : 2;
+		for(n = 0; n < header->numTexCoordSets; n++)
+			header->texCoords[n] = rwNewT(TexCoords, numVerts, MEMDUR_EVENT | ID_GEOMETRY);
+	}
+
+	if(!reinstance || geo->lockedSinceInst&Geometry::LOCKVERTICES)
+		memcpy(header->positions, geo->morphTargets[0].vertices, numVerts*sizeof(V3d));
+
+	if(hasNormals && (!reinstance || geo->lockedSinceInst&Geometry::LOCKNORMALS))
+		memcpy(header->normals, geo->morphTargets[0].normals, numVerts*sizeof(V3d));
+
+	if(isPrelit && (!reinstance || geo->lockedSinceInst&Geometry::LOCKPRELIGHT)){
+		memcpy(header->colors, geo->colors, numVerts*sizeof(RGBA));
+		InstanceData *inst = header->inst;
+		for(n = 0; n < (int32)header->numMeshes; n++){
+			inst->vertexAlpha = 0;
+			for(i = 0; i < inst->numVertices; i++)
+				if(header->colors[inst->minVert+i].alpha != 0xFF){
+					inst->vertexAlpha = 1;
+					break;
+				}
+			inst++;
+		}
+	}
+
+	for(n = 0; n < header->numTexCoordSets; n++)
+		if(!reinstance || geo->lockedSinceInst&(Geometry::LOCKTEXCOORDS<<n))
+			memcpy(header->texCoords[n], geo->texCoords[n], numVerts*sizeof(TexCoords));
+
+	RWMETRIC(numInstanceBytes, numVerts*(sizeof(V3d)*(hasNormals ? 2 : 1) +
+		(isPrelit ? sizeof(RGBA) : 0) + header->numTexCoordSets*sizeof(TexCoords)));
+}
+
+void
+defaultUninstanceCB(Geometry *geo, InstanceDataHeader *header)
+{
+	assert(0 && "can't uninstance");
+}
+
+ObjPipeline*
+makeDefaultPipeline(void)
+{
+	ObjPipeline *pipe = ObjPipeline::create();
+	pipe->instanceCB = defaultInstanceCB;
+	pipe->uninstanceCB = defaultUninstanceCB;
+	pipe->renderCB = defaultRenderCB;
+	return pipe;
+}
+
+}
+}
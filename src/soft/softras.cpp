@@ -0,0 +1,943 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwengine.h"
+#include "../rwsimd.h"
+
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+// No threads on the PS2, tiles are drawn by the calling thread there
+#ifndef RW_PS2
+#define RW_RASTERTHREADS
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#endif
+
+// The rasteriser grew out of the one in tools/playground/ras_test.cpp.
+// Primitives are set up and binned into screen tiles when they're drawn,
+// the tiles are shaded when the bins are flushed, in parallel if there
+// are worker threads. Each tile is copied into a small buffer first
+// so its colour and depth stay in cache.
+// Everything is float: attributes are planes over the screen,
+// perspective-correct ones are interpolated premultiplied by q = 1/w.
+// Pixel centers are at .5, edges follow the top-left rule.
+
+namespace rw {
+namespace soft {
+
+enum {
+	AZ, AQ,
+	AR, AG, AB, AA,
+	AU, AV,
+	AF,
+	NUMATTRIBS
+};
+
+enum {
+	TILESHIFT = 6,
+	TILESIZE = 1<<TILESHIFT,	// 64x64 colour and depth are 32kb
+	MAXPRIMS = 1<<16,		// bins are flushed when full
+	MAXTHREADS = 16
+};
+
+// Render state as the tiles see it, made when a primitive is binned.
+// Equal states are shared, only the part before levels is compared.
+struct DrawState
+{
+	Raster *raster;
+	int32 numLevels;	// 0 if untextured
+	bool32 linear;
+	int32 addressU, addressV;
+	bool32 blend;
+	int32 alphaFunc;	// ALPHAALWAYS if there is no test
+	float32 alphaRef;
+	bool32 gsAlpha;		// PS2 test, failing only skips z
+	float32 gsAlphaRef;
+	int32 srcBlend, destBlend;
+	bool32 zTest, zWrite;
+	bool32 fog;
+	float32 fogColor[3];
+	TexLevel levels[MAXTEXLEVELS];
+};
+
+enum {
+	PRIMTRI,
+	PRIMLINE,
+	PRIMPOINT
+};
+
+// A set up primitive. Attributes are a0 at (ox, oy) and change by
+// gx and gy per pixel. Edges go through the upper of their vertices,
+// so triangles sharing an edge evaluate it to exactly the negated value
+// and never both or neither own a pixel.
+// Lines step from (ox, oy) by edge[0][0..1] in edge[0][2] steps,
+// gx is the change of attributes over the whole line.
+struct Prim
+{
+	int32 type;
+	int32 state;
+	int32 level;		// of the texture
+	int32 topLeft;		// one bit per edge
+	int32 x0, y0, x1, y1;	// pixel bounds, half open
+	float32 ox, oy;
+	float32 edge[3][4];	// a, b and a point, positive inside
+	float32 a0[NUMATTRIBS];
+	float32 gx[NUMATTRIBS];
+	float32 gy[NUMATTRIBS];
+};
+
+struct Bin
+{
+	int32 *prims;
+	int32 numPrims;
+	int32 maxPrims;
+};
+
+// One per thread
+struct Tile
+{
+	int32 x, y, w, h;
+	uint8 color[TILESIZE*TILESIZE*4];
+	float32 depth[TILESIZE*TILESIZE];
+};
+
+static DrawState *states;
+static int32 numStates, maxStates;
+static Prim *prims;
+static int32 numPrims, maxPrims;
+static Bin *bins;
+static int32 numTilesX, numTilesY, maxBins;
+static int32 *activeTiles;	// bins with primitives, in order of use
+static int32 numActive;
+static Tile *tiles;
+static int32 numTiles;
+
+#ifdef RW_RASTERTHREADS
+static struct {
+	std::mutex mutex;
+	std::condition_variable cond;
+	std::condition_variable doneCond;
+	std::thread *threads;
+	int32 numThreads;
+	uint32 generation;	// bumped for every flush
+	int32 numBusy;
+	std::atomic<int32> nextTile;
+	bool32 quit;
+} workers;
+#endif
+
+/*
+ * Binning
+ */
+
+static int32
+getState(void)
+{
+	DrawState s;
+
+	memset(&s, 0, offsetof(DrawState, levels));
+	s.raster = rasState.raster;
+	s.numLevels = rasState.numLevels;
+	if(s.numLevels){
+		switch(rasState.filter){
+		case Texture::LINEAR:
+		case Texture::MIPLINEAR:
+		case Texture::LINEARMIPLINEAR:
+			s.linear = 1;
+			break;
+		}
+		s.addressU = rasState.addressU;
+		s.addressV = rasState.addressV;
+	}
+	s.blend = getAlphaBlend();
+	s.alphaFunc = ALPHAALWAYS;
+	if(s.blend){
+		if(rasState.gsEmu && rasState.gsAlpha){
+			s.gsAlpha = 1;
+			s.gsAlphaRef = rasState.gsAlphaRef;
+		}else if(rasState.alphaFunc != ALPHAALWAYS){
+			s.alphaFunc = rasState.alphaFunc;
+			s.alphaRef = rasState.alphaRef;
+		}
+		s.srcBlend = rasState.srcBlend;
+		s.destBlend = rasState.destBlend;
+	}
+	s.zTest = rasState.zTest;
+	s.zWrite = rasState.zWrite;
+	s.fog = rasState.fogEnable;
+	if(s.fog){
+		s.fogColor[0] = rasState.fogColor & 0xFF;
+		s.fogColor[1] = (rasState.fogColor>>8) & 0xFF;
+		s.fogColor[2] = (rasState.fogColor>>16) & 0xFF;
+	}
+
+	if(numStates > 0 &&
+	   memcmp(&s, &states[numStates-1], offsetof(DrawState, levels)) == 0)
+		return numStates-1;
+	if(numStates >= maxStates){
+		maxStates = maxStates ? maxStates*2 : 64;
+		states = rwResizeT(DrawState, states, maxStates, MEMDUR_EVENT | ID_DRIVER);
+	}
+	memcpy(s.levels, rasState.levels, s.numLevels*sizeof(TexLevel));
+	states[numStates] = s;
+	return numStates++;
+}
+
+// Bins are sized for the canvas when the first primitive comes in
+static void
+setupBins(void)
+{
+	int32 n;
+
+	numTilesX = (canvas.width + TILESIZE-1) >> TILESHIFT;
+	numTilesY = (canvas.height + TILESIZE-1) >> TILESHIFT;
+	n = numTilesX*numTilesY;
+	if(n > maxBins){
+		bins = rwResizeT(Bin, bins, n, MEMDUR_EVENT | ID_DRIVER);
+		memset(&bins[maxBins], 0, (n-maxBins)*sizeof(Bin));
+		activeTiles = rwResizeT(int32, activeTiles, n, MEMDUR_EVENT | ID_DRIVER);
+		maxBins = n;
+	}
+}
+
+static Prim*
+newPrim(int32 type)
+{
+	Prim *p;
+
+	if(numPrims >= MAXPRIMS)
+		flushRaster();
+	if(numPrims == 0)
+		setupBins();
+	if(numPrims >= maxPrims){
+		maxPrims = maxPrims ? maxPrims*2 : 1024;
+		prims = rwResizeT(Prim, prims, maxPrims, MEMDUR_EVENT | ID_DRIVER);
+	}
+	p = &prims[numPrims];
+	p->type = type;
+	p->state = getState();
+	p->level = 0;
+	p->topLeft = 0;
+	return p;
+}
+
+// Can a triangle cover any pixel centre of the tile?
+static bool32
+touchesTile(Prim *p, int32 tx, int32 ty)
+{
+	float32 x0, y0, x1, y1, *e;
+	int32 i;
+
+	x0 = (tx<<TILESHIFT) + 0.5f;
+	y0 = (ty<<TILESHIFT) + 0.5f;
+	x1 = x0 + TILESIZE-1;
+	y1 = y0 + TILESIZE-1;
+	for(i = 0; i < 3; i++){
+		e = p->edge[i];
+		// corner where the edge function is largest
+		if(e[0]*((e[0] > 0.0f ? x1 : x0) - e[2]) + e[1]*((e[1] > 0.0f ? y1 : y0) - e[3]) < 0.0f)
+			return 0;
+	}
+	return 1;
+}
+
+static void
+binPrim(Prim *p)
+{
+	int32 tx0, ty0, tx1, ty1, tx, ty;
+	Bin *b;
+
+	if(p->x0 >= p->x1 || p->y0 >= p->y1)
+		return;
+	tx0 = p->x0 >> TILESHIFT;
+	ty0 = p->y0 >> TILESHIFT;
+	tx1 = (p->x1-1) >> TILESHIFT;
+	ty1 = (p->y1-1) >> TILESHIFT;
+	for(ty = ty0; ty <= ty1; ty++)
+		for(tx = tx0; tx <= tx1; tx++){
+			if(p->type == PRIMTRI && !touchesTile(p, tx, ty))
+				continue;
+			b = &bins[ty*numTilesX + tx];
+			if(b->numPrims == 0)
+				activeTiles[numActive++] = ty*numTilesX + tx;
+			if(b->numPrims >= b->maxPrims){
+				b->maxPrims = b->maxPrims ? b->maxPrims*2 : 64;
+				b->prims = rwResizeT(int32, b->prims, b->maxPrims, MEMDUR_EVENT | ID_DRIVER);
+			}
+			b->prims[b->numPrims++] = numPrims;
+		}
+	numPrims++;
+}
+
+/*
+ * Texture sampling
+ */
+
+static int32
+address(int32 i, int32 size, int32 mode)
+{
+	switch(mode){
+	case Texture::MIRROR:
+		i %= 2*size;
+		if(i < 0) i += 2*size;
+		return i < size ? i : 2*size-1 - i;
+	case Texture::CLAMP:
+		return i < 0 ? 0 : i >= size ? size-1 : i;
+	case Texture::BORDER:
+		return i < 0 || i >= size ? -1 : i;
+	default:
+		i %= size;
+		return i < 0 ? i + size : i;
+	}
+}
+
+static void
+texel(const DrawState *s, TexLevel *tex, int32 iu, int32 iv, float32 *t)
+{
+	iu = address(iu, tex->width, s->addressU);
+	iv = address(iv, tex->height, s->addressV);
+	// transparent black border
+	if(iu < 0 || iv < 0){
+		t[0] = t[1] = t[2] = t[3] = 0.0f;
+		return;
+	}
+	uint8 *p = &tex->pixels[iv*tex->stride + iu*4];
+	t[0] = p[0];
+	t[1] = p[1];
+	t[2] = p[2];
+	t[3] = p[3];
+}
+
+static void
+sample(const DrawState *s, TexLevel *tex, float32 u, float32 v, float32 *t)
+{
+	float32 fu, fv, su, sv;
+	float32 t00[4], t01[4], t10[4], t11[4];
+	int32 iu, iv, i;
+
+	if(!s->linear){
+		texel(s, tex, (int32)floorf(u*tex->width), (int32)floorf(v*tex->height), t);
+		return;
+	}
+	fu = u*tex->width - 0.5f;
+	fv = v*tex->height - 0.5f;
+	iu = (int32)floorf(fu);
+	iv = (int32)floorf(fv);
+	su = fu - iu;
+	sv = fv - iv;
+	texel(s, tex, iu, iv, t00);
+	texel(s, tex, iu+1, iv, t01);
+	texel(s, tex, iu, iv+1, t10);
+	texel(s, tex, iu+1, iv+1, t11);
+	for(i = 0; i < 4; i++)
+		t[i] = (t00[i]*(1.0f-su) + t01[i]*su)*(1.0f-sv) +
+		       (t10[i]*(1.0f-su) + t11[i]*su)*sv;
+}
+
+// One mip level per triangle from the ratio of texel to pixel area.
+// The LINEARMIP filters don't blend between levels.
+static int32
+selectLevel(float32 *a0, float32 *a1, float32 *a2, float32 area)
+{
+	float32 u0, v0, u1, v1, u2, v2, texArea, lod;
+	int32 level;
+
+	if(rasState.numLevels < 2 ||
+	   rasState.filter == Texture::NEAREST || rasState.filter == Texture::LINEAR)
+		return 0;
+	u0 = a0[AU]/a0[AQ]; v0 = a0[AV]/a0[AQ];
+	u1 = a1[AU]/a1[AQ]; v1 = a1[AV]/a1[AQ];
+	u2 = a2[AU]/a2[AQ]; v2 = a2[AV]/a2[AQ];
+	texArea = fabsf((u1-u0)*(v2-v0) - (u2-u0)*(v1-v0)) *
+		rasState.levels[0].width*rasState.levels[0].height;
+	if(texArea <= fabsf(area))
+		return 0;
+	lod = 0.5f*log2f(texArea/fabsf(area));
+	level = (int32)(lod + 0.5f);
+	if(level >= rasState.numLevels)
+		level = rasState.numLevels-1;
+	return level;
+}
+
+/*
+ * Per pixel
+ */
+
+static float32
+blendFactor(int32 f, float32 *src, float32 *dst, int32 i)
+{
+	switch(f){
+	case BLENDZERO: return 0.0f;
+	case BLENDONE: return 1.0f;
+	case BLENDSRCCOLOR: return src[i]/255.0f;
+	case BLENDINVSRCCOLOR: return 1.0f - src[i]/255.0f;
+	case BLENDSRCALPHA: return src[3]/255.0f;
+	case BLENDINVSRCALPHA: return 1.0f - src[3]/255.0f;
+	case BLENDDESTALPHA: return dst[3]/255.0f;
+	case BLENDINVDESTALPHA: return 1.0f - dst[3]/255.0f;
+	case BLENDDESTCOLOR: return dst[i]/255.0f;
+	case BLENDINVDESTCOLOR: return 1.0f - dst[i]/255.0f;
+	case BLENDSRCALPHASAT:
+		if(i == 3) return 1.0f;
+		return (src[3] < 255.0f - dst[3] ? src[3] : 255.0f - dst[3])/255.0f;
+	default: return 0.0f;
+	}
+}
+
+static uint8
+clampColor(float32 c)
+{
+	if(c <= 0.0f) return 0;
+	if(c >= 255.0f) return 255;
+	return (uint8)(c + 0.5f);
+}
+
+static void
+shadePixel(const DrawState *s, uint8 *px, float32 *zp, float32 *a, TexLevel *tex)
+{
+	float32 c[4], t[4], d[4];
+	float32 w, f;
+	bool32 zwrite;
+	int32 i;
+
+	if(zp && s->zTest && a[AZ] > *zp)
+		return;
+	zwrite = zp && s->zWrite;
+
+	w = 1.0f/a[AQ];
+	c[0] = a[AR]*w;
+	c[1] = a[AG]*w;
+	c[2] = a[AB]*w;
+	c[3] = a[AA]*w;
+	if(tex){
+		sample(s, tex, a[AU]*w, a[AV]*w, t);
+		for(i = 0; i < 4; i++)
+			c[i] = c[i]*t[i]/255.0f;
+	}
+	if(s->fog){
+		f = a[AF]*w;
+		f = f < 0.0f ? 0.0f : f > 1.0f ? 1.0f : f;
+		for(i = 0; i < 3; i++)
+			c[i] = s->fogColor[i] + (c[i] - s->fogColor[i])*f;
+	}
+
+	if(s->blend){
+		if(s->gsAlpha){
+			// PS2 GS alpha test FB_ONLY: failed alpha doesn't write z
+			if(zwrite && c[3] < s->gsAlphaRef)
+				zwrite = 0;
+		}else if(s->alphaFunc == ALPHAGREATEREQUAL){
+			if(c[3] < s->alphaRef)
+				return;
+		}else if(s->alphaFunc == ALPHALESS){
+			if(c[3] >= s->alphaRef)
+				return;
+		}
+		for(i = 0; i < 4; i++)
+			d[i] = px[i];
+		for(i = 0; i < 4; i++)
+			t[i] = c[i]*blendFactor(s->srcBlend, c, d, i) +
+			       d[i]*blendFactor(s->destBlend, c, d, i);
+		for(i = 0; i < 4; i++)
+			c[i] = t[i];
+	}
+
+	px[0] = clampColor(c[0]);
+	px[1] = clampColor(c[1]);
+	px[2] = clampColor(c[2]);
+	px[3] = clampColor(c[3]);
+	if(zwrite)
+		*zp = a[AZ];
+}
+
+/*
+ * Tiles
+ */
+
+// Coverage of the 4x4 quad at x, y, bit 4*row + column is set for every
+// pixel inside all edges.
+static uint32
+quadMask(Prim *p, int32 x, int32 y)
+{
+	uint32 mask = 0xFFFF;
+	float32 *e;
+	int32 i;
+#ifdef RW_SSE2
+	__m128 zero = _mm_setzero_ps();
+	__m128 px = _mm_add_ps(_mm_set1_ps((float32)x), _mm_set_ps(3.5f, 2.5f, 1.5f, 0.5f));
+	for(i = 0; i < 3; i++){
+		e = p->edge[i];
+		__m128 ex = _mm_mul_ps(_mm_set1_ps(e[0]), _mm_sub_ps(px, _mm_set1_ps(e[2])));
+		uint32 m = 0;
+		for(int32 row = 0; row < 4; row++){
+			float32 ey = e[1]*(y + row + 0.5f - e[3]);
+			__m128 v = _mm_add_ps(ex, _mm_set1_ps(ey));
+			__m128 in = (p->topLeft & (1<<i)) ? _mm_cmpge_ps(v, zero) : _mm_cmpgt_ps(v, zero);
+			m |= _mm_movemask_ps(in) << (row*4);
+		}
+		mask &= m;
+		if(mask == 0)
+			break;
+	}
+#else
+	float32 fx, fy, v;
+	int32 row, col;
+	for(i = 0; i < 3; i++){
+		e = p->edge[i];
+		uint32 m = 0;
+		for(row = 0; row < 4; row++){
+			fy = e[1]*(y + row + 0.5f - e[3]);
+			for(col = 0; col < 4; col++){
+				fx = e[0]*(x + col + 0.5f - e[2]);
+				v = fx + fy;
+				if(v > 0.0f || (v == 0.0f && (p->topLeft & (1<<i))))
+					m |= 1 << (row*4 + col);
+			}
+		}
+		mask &= m;
+		if(mask == 0)
+			break;
+	}
+#endif
+	return mask;
+}
+
+static void
+attribsAt(Prim *p, int32 x, int32 y, float32 *a)
+{
+	float32 fx = x + 0.5f - p->ox;
+	float32 fy = y + 0.5f - p->oy;
+	for(int32 i = 0; i < NUMATTRIBS; i++)
+		a[i] = p->a0[i] + p->gx[i]*fx + p->gy[i]*fy;
+}
+
+// Quads can reach past the canvas, the tile buffer is always
+// big enough and only the part on the canvas is written back.
+static void
+drawTriTile(Tile *t, Prim *p, const DrawState *s, TexLevel *tex)
+{
+	float32 a[NUMATTRIBS];
+	int32 x0, y0, x1, y1, qx, qy, i, lx, ly;
+	uint32 mask;
+	float32 *zp;
+
+	x0 = p->x0 > t->x ? p->x0 - t->x : 0;
+	y0 = p->y0 > t->y ? p->y0 - t->y : 0;
+	x1 = p->x1 < t->x+t->w ? p->x1 - t->x : t->w;
+	y1 = p->y1 < t->y+t->h ? p->y1 - t->y : t->h;
+	x0 &= ~3;
+	y0 &= ~3;
+	for(qy = y0; qy < y1; qy += 4)
+		for(qx = x0; qx < x1; qx += 4){
+			mask = quadMask(p, t->x+qx, t->y+qy);
+			for(i = 0; mask; i++, mask >>= 1){
+				if((mask & 1) == 0)
+					continue;
+				lx = qx + (i&3);
+				ly = qy + (i>>2);
+				attribsAt(p, t->x+lx, t->y+ly, a);
+				zp = canvas.zbuf ? &t->depth[ly*TILESIZE + lx] : nil;
+				shadePixel(s, &t->color[(ly*TILESIZE + lx)*4], zp, a, tex);
+			}
+		}
+}
+
+static void
+drawLineTile(Tile *t, Prim *p, const DrawState *s, TexLevel *tex)
+{
+	float32 a[NUMATTRIBS];
+	float32 f;
+	int32 n, i, j, ix, iy;
+	float32 *zp;
+
+	n = (int32)p->edge[0][2];
+	// last pixel is left out like GL does
+	for(i = 0; i < n; i++){
+		f = (float32)i/n;
+		ix = (int32)floorf(p->ox + p->edge[0][0]*f) - t->x;
+		iy = (int32)floorf(p->oy + p->edge[0][1]*f) - t->y;
+		if(ix < 0 || ix >= t->w || iy < 0 || iy >= t->h)
+			continue;
+		for(j = 0; j < NUMATTRIBS; j++)
+			a[j] = p->a0[j] + p->gx[j]*f;
+		zp = canvas.zbuf ? &t->depth[iy*TILESIZE + ix] : nil;
+		shadePixel(s, &t->color[(iy*TILESIZE + ix)*4], zp, a, tex);
+	}
+}
+
+static void
+drawPointTile(Tile *t, Prim *p, const DrawState *s, TexLevel *tex)
+{
+	float32 a[NUMATTRIBS];
+	int32 ix, iy;
+
+	ix = p->x0 - t->x;
+	iy = p->y0 - t->y;
+	memcpy(a, p->a0, sizeof(a));
+	shadePixel(s, &t->color[(iy*TILESIZE + ix)*4],
+		canvas.zbuf ? &t->depth[iy*TILESIZE + ix] : nil, a, tex);
+}
+
+static void
+runTile(Tile *t, int32 tile)
+{
+	Bin *b = &bins[tile];
+	Prim *p;
+	DrawState *s;
+	TexLevel *tex;
+	int32 i, y;
+
+	t->x = (tile % numTilesX) << TILESHIFT;
+	t->y = (tile / numTilesX) << TILESHIFT;
+	t->w = canvas.width - t->x < TILESIZE ? canvas.width - t->x : TILESIZE;
+	t->h = canvas.height - t->y < TILESIZE ? canvas.height - t->y : TILESIZE;
+	for(y = 0; y < t->h; y++)
+		memcpy(&t->color[y*TILESIZE*4], canvas.fb + (t->y+y)*canvas.fbStride + t->x*4, t->w*4);
+	if(canvas.zbuf)
+		for(y = 0; y < t->h; y++)
+			memcpy(&t->depth[y*TILESIZE], canvas.zbuf + (t->y+y)*canvas.zStride + t->x, t->w*4);
+
+	for(i = 0; i < b->numPrims; i++){
+		p = &prims[b->prims[i]];
+		s = &states[p->state];
+		tex = s->numLevels ? &s->levels[p->level] : nil;
+		switch(p->type){
+		case PRIMTRI:
+			drawTriTile(t, p, s, tex);
+			break;
+		case PRIMLINE:
+			drawLineTile(t, p, s, tex);
+			break;
+		case PRIMPOINT:
+			drawPointTile(t, p, s, tex);
+			break;
+		}
+	}
+
+	for(y = 0; y < t->h; y++)
+		memcpy(canvas.fb + (t->y+y)*canvas.fbStride + t->x*4, &t->color[y*TILESIZE*4], t->w*4);
+	if(canvas.zbuf)
+		for(y = 0; y < t->h; y++)
+			memcpy(canvas.zbuf + (t->y+y)*canvas.zStride + t->x, &t->depth[y*TILESIZE], t->w*4);
+}
+
+static void
+runTiles(Tile *t)
+{
+	int32 i;
+#ifdef RW_RASTERTHREADS
+	while((i = workers.nextTile++) < numActive)
+		runTile(t, activeTiles[i]);
+#else
+	for(i = 0; i < numActive; i++)
+		runTile(t, activeTiles[i]);
+#endif
+}
+
+#ifdef RW_RASTERTHREADS
+static void
+workerThread(Tile *t)
+{
+	uint32 generation = 0;
+
+	std::unique_lock<std::mutex> lock(workers.mutex);
+	for(;;){
+		while(!workers.quit && workers.generation == generation)
+			workers.cond.wait(lock);
+		if(workers.quit)
+			return;
+		generation = workers.generation;
+
+		lock.unlock();
+		runTiles(t);
+		lock.lock();
+
+		if(--workers.numBusy == 0)
+			workers.doneCond.notify_one();
+	}
+}
+#endif
+
+// Shade everything binned so far. Has to happen before
+// anything reads or changes the canvas or a texture.
+void
+flushRaster(void)
+{
+	int32 i;
+
+	if(numPrims == 0)
+		return;
+#ifdef RW_RASTERTHREADS
+	workers.nextTile = 0;
+	if(workers.numThreads > 0 && numActive > 1){
+		{
+			std::lock_guard<std::mutex> lock(workers.mutex);
+			workers.numBusy = workers.numThreads;
+			workers.generation++;
+		}
+		workers.cond.notify_all();
+		runTiles(&tiles[0]);
+		std::unique_lock<std::mutex> lock(workers.mutex);
+		while(workers.numBusy > 0)
+			workers.doneCond.wait(lock);
+	}else
+#endif
+		runTiles(&tiles[0]);
+
+	for(i = 0; i < numActive; i++)
+		bins[activeTiles[i]].numPrims = 0;
+	numActive = 0;
+	numPrims = 0;
+	numStates = 0;
+}
+
+// numThreads < 0 uses all cores
+void
+openRaster(int32 numThreads)
+{
+#ifdef RW_RASTERTHREADS
+	if(numThreads < 0)
+		numThreads = std::thread::hardware_concurrency()-1;
+	if(numThreads < 0)
+		numThreads = 0;
+	if(numThreads > MAXTHREADS)
+		numThreads = MAXTHREADS;
+#else
+	numThreads = 0;
+#endif
+	numTiles = numThreads+1;
+	tiles = rwNewT(Tile, numTiles, MEMDUR_EVENT | ID_DRIVER);
+#ifdef RW_RASTERTHREADS
+	workers.numThreads = numThreads;
+	workers.generation = 0;
+	workers.numBusy = 0;
+	workers.quit = 0;
+	workers.threads = nil;
+	if(numThreads > 0){
+		workers.threads = new std::thread[numThreads];
+		for(int32 i = 0; i < numThreads; i++)
+			workers.threads[i] = std::thread(workerThread, &tiles[i+1]);
+	}
+#endif
+}
+
+void
+closeRaster(void)
+{
+	int32 i;
+
+	flushRaster();
+#ifdef RW_RASTERTHREADS
+	if(workers.threads){
+		{
+			std::lock_guard<std::mutex> lock(workers.mutex);
+			workers.quit = 1;
+		}
+		workers.cond.notify_all();
+		for(i = 0; i < workers.numThreads; i++)
+			workers.threads[i].join();
+		delete[] workers.threads;
+		workers.threads = nil;
+	}
+	workers.numThreads = 0;
+#endif
+	rwFree(tiles);
+	tiles = nil;
+	numTiles = 0;
+	for(i = 0; i < maxBins; i++)
+		rwFree(bins[i].prims);
+	rwFree(bins);
+	rwFree(activeTiles);
+	bins = nil;
+	activeTiles = nil;
+	maxBins = 0;
+	rwFree(prims);
+	prims = nil;
+	maxPrims = 0;
+	rwFree(states);
+	states = nil;
+	maxStates = 0;
+}
+
+/*
+ * Primitives
+ */
+
+static int32
+pixelCeil(float32 x)
+{
+	x = ceilf(x - 0.5f);
+	// only has to be outside the canvas
+	if(x < -65536.0f) return -65536;
+	if(x > 65536.0f) return 65536;
+	return (int32)x;
+}
+
+static void
+getAttribs(float32 *a, RasVertex *v)
+{
+	a[AZ] = v->z;
+	a[AQ] = v->q;
+	a[AR] = v->r*v->q;
+	a[AG] = v->g*v->q;
+	a[AB] = v->b*v->q;
+	a[AA] = v->a*v->q;
+	a[AU] = v->u*v->q;
+	a[AV] = v->v*v->q;
+	a[AF] = v->f*v->q;
+}
+
+static void
+setEdge(Prim *p, int32 i, RasVertex *v1, RasVertex *v2, float32 sign)
+{
+	float32 *e = p->edge[i];
+	RasVertex *v;
+	e[0] = (v1->y - v2->y)*sign;
+	e[1] = (v2->x - v1->x)*sign;
+	v = v1->y < v2->y || (v1->y == v2->y && v1->x < v2->x) ? v1 : v2;
+	e[2] = v->x;
+	e[3] = v->y;
+	// left edges and horizontal top edges own their pixels
+	if(e[0] > 0.0f || (e[0] == 0.0f && e[1] > 0.0f))
+		p->topLeft |= 1<<i;
+}
+
+void
+drawTriangle(RasVertex *v1, RasVertex *v2, RasVertex *v3)
+{
+	float32 a1[NUMATTRIBS], a2[NUMATTRIBS];
+	float32 area, dx1, dy1, dx2, dy2, minx, maxx, miny, maxy;
+	int32 i;
+	Prim *p;
+
+	if(canvas.fb == nil)
+		return;
+	dx1 = v2->x - v1->x;
+	dy1 = v2->y - v1->y;
+	dx2 = v3->x - v1->x;
+	dy2 = v3->y - v1->y;
+	area = dx1*dy2 - dx2*dy1;
+	if(area == 0.0f || area != area)
+		return;
+	// y is down, so positive area is clockwise on screen
+	if((rasState.cullMode == CULLBACK && area > 0.0f) ||
+	   (rasState.cullMode == CULLFRONT && area < 0.0f))
+		return;
+
+	minx = v1->x < v2->x ? (v1->x < v3->x ? v1->x : v3->x) : (v2->x < v3->x ? v2->x : v3->x);
+	maxx = v1->x > v2->x ? (v1->x > v3->x ? v1->x : v3->x) : (v2->x > v3->x ? v2->x : v3->x);
+	miny = v1->y < v2->y ? (v1->y < v3->y ? v1->y : v3->y) : (v2->y < v3->y ? v2->y : v3->y);
+	maxy = v1->y > v2->y ? (v1->y > v3->y ? v1->y : v3->y) : (v2->y > v3->y ? v2->y : v3->y);
+	if(pixelCeil(maxx) <= 0 || pixelCeil(maxy) <= 0 ||
+	   pixelCeil(minx) >= canvas.width || pixelCeil(miny) >= canvas.height)
+		return;
+
+	p = newPrim(PRIMTRI);
+	p->x0 = pixelCeil(minx);
+	p->y0 = pixelCeil(miny);
+	p->x1 = pixelCeil(maxx);
+	p->y1 = pixelCeil(maxy);
+	if(p->x0 < 0) p->x0 = 0;
+	if(p->y0 < 0) p->y0 = 0;
+	if(p->x1 > canvas.width) p->x1 = canvas.width;
+	if(p->y1 > canvas.height) p->y1 = canvas.height;
+
+	// everything relative to the first vertex
+	p->ox = v1->x;
+	p->oy = v1->y;
+	setEdge(p, 0, v1, v2, area > 0.0f ? 1.0f : -1.0f);
+	setEdge(p, 1, v2, v3, area > 0.0f ? 1.0f : -1.0f);
+	setEdge(p, 2, v3, v1, area > 0.0f ? 1.0f : -1.0f);
+
+	// gradients of all attributes
+	getAttribs(p->a0, v1);
+	getAttribs(a1, v2);
+	getAttribs(a2, v3);
+	for(i = 0; i < NUMATTRIBS; i++){
+		p->gx[i] = ((a1[i]-p->a0[i])*dy2 - (a2[i]-p->a0[i])*dy1)/area;
+		p->gy[i] = ((a2[i]-p->a0[i])*dx1 - (a1[i]-p->a0[i])*dx2)/area;
+	}
+	if(rasState.numLevels)
+		p->level = selectLevel(p->a0, a1, a2, area);
+	binPrim(p);
+}
+
+void
+drawLine(RasVertex *v1, RasVertex *v2)
+{
+	float32 a1[NUMATTRIBS];
+	float32 dx, dy, t;
+	int32 i, x0, y0, x1, y1;
+	Prim *p;
+
+	if(canvas.fb == nil)
+		return;
+	dx = v2->x - v1->x;
+	dy = v2->y - v1->y;
+	t = fabsf(dx) > fabsf(dy) ? fabsf(dx) : fabsf(dy);
+	if(!(t < 65536.0f))
+		return;
+	x0 = (int32)floorf(v1->x < v2->x ? v1->x : v2->x);
+	y0 = (int32)floorf(v1->y < v2->y ? v1->y : v2->y);
+	x1 = (int32)floorf(v1->x > v2->x ? v1->x : v2->x) + 1;
+	y1 = (int32)floorf(v1->y > v2->y ? v1->y : v2->y) + 1;
+	if(x0 < 0) x0 = 0;
+	if(y0 < 0) y0 = 0;
+	if(x1 > canvas.width) x1 = canvas.width;
+	if(y1 > canvas.height) y1 = canvas.height;
+	if(x0 >= x1 || y0 >= y1)
+		return;
+
+	p = newPrim(PRIMLINE);
+	p->x0 = x0;
+	p->y0 = y0;
+	p->x1 = x1;
+	p->y1 = y1;
+	p->ox = v1->x;
+	p->oy = v1->y;
+	p->edge[0][0] = dx;
+	p->edge[0][1] = dy;
+	p->edge[0][2] = ceilf(t);
+	getAttribs(p->a0, v1);
+	getAttribs(a1, v2);
+	for(i = 0; i < NUMATTRIBS; i++)
+		p->gx[i] = a1[i] - p->a0[i];
+	binPrim(p);
+}
+
+void
+drawPoint(RasVertex *v)
+{
+	int32 ix, iy;
+	Prim *p;
+
+	if(canvas.fb == nil)
+		return;
+	ix = (int32)floorf(v->x);
+	iy = (int32)floorf(v->y);
+	if(ix < 0 || ix >= canvas.width || iy < 0 || iy >= canvas.height)
+		return;
+	p = newPrim(PRIMPOINT);
+	p->x0 = ix;
+	p->y0 = iy;
+	p->x1 = ix+1;
+	p->y1 = iy+1;
+	getAttribs(p->a0, v);
+	binPrim(p);
+}
+
+}
+}
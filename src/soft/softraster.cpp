@@ -0,0 +1,449 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwengine.h"
+
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+#define PLUGIN_ID ID_DRIVER
+
+namespace rw {
+namespace soft {
+
+int32 nativeRasterOffset;
+
+static void
+levelSize(Raster *raster, int32 level, int32 *w, int32 *h)
+{
+	*w = raster->originalWidth;
+	*h = raster->originalHeight;
+	for(int32 i = 0; i < level; i++){
+		if(*w > 1) *w /= 2;
+		if(*h > 1) *h /= 2;
+	}
+}
+
+static uint8*
+levelPixels(Raster *raster, int32 level)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	uint8 *px = natras->pixels;
+	int32 w, h;
+	for(int32 i = 0; i < level; i++){
+		levelSize(raster, i, &w, &h);
+		px += w*h*4;
+	}
+	return px;
+}
+
+// Every colour format is kept as RGBA8, C888 just has its alpha at 255
+// like D3D's X8R8G8B8
+static Raster*
+rasterCreateTexture(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	int32 w, h;
+
+	if(raster->format & (Raster::PAL4 | Raster::PAL8)){
+		RWERROR((ERR_NOTEXTURE));
+		return nil;
+	}
+
+	switch(raster->format & 0xF00){
+	case Raster::C888:
+		natras->hasAlpha = 0;
+		break;
+	case Raster::DEFAULT:
+	case Raster::C8888:
+	case Raster::C1555:
+	case Raster::C4444:
+		raster->format = (raster->format & ~0xF00) | Raster::C8888;
+		natras->hasAlpha = 1;
+		break;
+	case Raster::C565:
+	case Raster::C555:
+	case Raster::LUM8:
+		raster->format = (raster->format & ~0xF00) | Raster::C888;
+		natras->hasAlpha = 0;
+		break;
+	default:
+		RWERROR((ERR_INVRASTER));
+		return nil;
+	}
+	raster->depth = 32;
+	raster->stride = raster->width*4;
+
+	natras->numLevels = 1;
+	if(raster->format & Raster::MIPMAP)
+		natras->numLevels = Raster::calculateNumLevels(raster->width, raster->height);
+	natras->autogenMipmap = (raster->format & (Raster::MIPMAP|Raster::AUTOMIPMAP)) == (Raster::MIPMAP|Raster::AUTOMIPMAP);
+
+	w = raster->width;
+	h = raster->height;
+	natras->size = 0;
+	for(int32 i = 0; i < natras->numLevels; i++){
+		natras->size += w*h*4;
+		if(w > 1) w /= 2;
+		if(h > 1) h /= 2;
+	}
+	natras->pixels = rwNewT(uint8, natras->size, MEMDUR_EVENT | ID_DRIVER);
+	memset(natras->pixels, 0, natras->size);
+	return raster;
+}
+
+static Raster*
+rasterCreateCamera(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+
+	raster->format = Raster::C8888;
+	raster->depth = 32;
+	raster->stride = raster->width*4;
+	natras->hasAlpha = 1;
+	natras->size = raster->stride*raster->height;
+	natras->pixels = rwNewT(uint8, natras->size, MEMDUR_EVENT | ID_DRIVER);
+	memset(natras->pixels, 0, natras->size);
+	return raster;
+}
+
+static Raster*
+rasterCreateZbuffer(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+
+	raster->format = Raster::D32;
+	raster->depth = 32;
+	raster->stride = raster->width*4;
+	natras->size = raster->stride*raster->height;
+	natras->pixels = rwNewT(uint8, natras->size, MEMDUR_EVENT | ID_DRIVER);
+	float32 *z = (float32*)natras->pixels;
+	for(int32 i = 0; i < raster->width*raster->height; i++)
+		z[i] = 1.0f;
+	return raster;
+}
+
+Raster*
+rasterCreate(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+
+	natras->pixels = nil;
+	natras->size = 0;
+	natras->numLevels = 1;
+	natras->hasAlpha = 0;
+	natras->autogenMipmap = 0;
+
+	Raster *ret = raster;
+
+	if(raster->width == 0 || raster->height == 0){
+		raster->flags |= Raster::DONTALLOCATE;
+		raster->stride = 0;
+		goto ret;
+	}
+	if(raster->flags & Raster::DONTALLOCATE)
+		goto ret;
+
+	switch(raster->type){
+	case Raster::NORMAL:
+	case Raster::TEXTURE:
+		ret = rasterCreateTexture(raster);
+		break;
+	case Raster::CAMERA:
+	case Raster::CAMERATEXTURE:
+		ret = rasterCreateCamera(raster);
+		break;
+	case Raster::ZBUFFER:
+		ret = rasterCreateZbuffer(raster);
+		break;
+
+	default:
+		RWERROR((ERR_INVRASTER));
+		return nil;
+	}
+
+ret:
+	raster->originalWidth = raster->width;
+	raster->originalHeight = raster->height;
+	raster->originalStride = raster->stride;
+	raster->originalPixels = raster->pixels;
+	return ret;
+}
+
+// Memory is always there, so locking just points into it
+uint8*
+rasterLock(Raster *raster, int32 level, int32 lockMode)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	int32 w, h;
+
+	assert(raster->privateFlags == 0);
+	if(natras->pixels == nil || level >= natras->numLevels)
+		return nil;
+	// may be drawn to or sampled by binned primitives
+	flushRaster();
+
+	levelSize(raster, level, &w, &h);
+	raster->width = w;
+	raster->height = h;
+	raster->stride = w*4;
+	raster->pixels = levelPixels(raster, level);
+	raster->privateFlags = lockMode;
+	return raster->pixels;
+}
+
+// Box filter every level from the one above it
+static void
+generateMipmaps(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	int32 sw, sh, dw, dh;
+	int32 x, y, x1, y1, c;
+	uint8 *src, *dst, *p00, *p01, *p10, *p11;
+
+	for(int32 i = 1; i < natras->numLevels; i++){
+		levelSize(raster, i-1, &sw, &sh);
+		levelSize(raster, i, &dw, &dh);
+		src = levelPixels(raster, i-1);
+		dst = levelPixels(raster, i);
+		for(y = 0; y < dh; y++)
+			for(x = 0; x < dw; x++){
+				x1 = sw > 1 ? 1 : 0;
+				y1 = sh > 1 ? sw : 0;
+				p00 = &src[((y*2 < sh ? y*2 : 0)*sw + (x*2 < sw ? x*2 : 0))*4];
+				p01 = p00 + x1*4;
+				p10 = p00 + y1*4;
+				p11 = p10 + x1*4;
+				for(c = 0; c < 4; c++)
+					dst[(y*dw + x)*4 + c] = (p00[c] + p01[c] + p10[c] + p11[c] + 2)/4;
+			}
+	}
+}
+
+void
+rasterUnlock(Raster *raster, int32 level)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+
+	assert(raster->pixels);
+
+	if(raster->privateFlags & Raster::LOCKWRITE &&
+	   level == 0 && natras->autogenMipmap)
+		generateMipmaps(raster);
+
+	raster->width = raster->originalWidth;
+	raster->height = raster->originalHeight;
+	raster->stride = raster->originalStride;
+	raster->pixels = raster->originalPixels;
+	raster->privateFlags = 0;
+}
+
+int32
+rasterNumLevels(Raster *raster)
+{
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	return natras->autogenMipmap ? 1 : natras->numLevels;
+}
+
+// Levels of a texture for sampling, subrasters only have one
+int32
+getLevels(Raster *raster, TexLevel *levels)
+{
+	Raster *parent = raster->parent;
+	SoftRaster *natras;
+	int32 i, n;
+
+	if(parent == nil || parent->platform != PLATFORM_SOFT)
+		return 0;
+	natras = GETSOFTRASTEREXT(parent);
+	if(natras->pixels == nil || parent->type == Raster::ZBUFFER)
+		return 0;
+	if(parent != raster){
+		levels[0].pixels = natras->pixels + raster->offsetY*parent->originalStride + raster->offsetX*4;
+		levels[0].width = raster->width;
+		levels[0].height = raster->height;
+		levels[0].stride = parent->originalStride;
+		return 1;
+	}
+	n = natras->numLevels;
+	if(n > MAXTEXLEVELS)
+		n = MAXTEXLEVELS;
+	for(i = 0; i < n; i++){
+		levels[i].pixels = levelPixels(raster, i);
+		levelSize(raster, i, &levels[i].width, &levels[i].height);
+		levels[i].stride = levels[i].width*4;
+	}
+	return n;
+}
+
+bool32
+imageFindRasterFormat(Image *img, int32 type,
+	int32 *pWidth, int32 *pHeight, int32 *pDepth, int32 *pFormat)
+{
+	int32 format;
+
+	assert((type&0xF) == Raster::TEXTURE);
+
+	format = img->hasAlpha() ? Raster::C8888 : Raster::C888;
+
+	*pWidth = img->width;
+	*pHeight = img->height;
+	*pDepth = 32;
+	*pFormat = format | type;
+	return 1;
+}
+
+bool32
+rasterFromImage(Raster *raster, Image *image)
+{
+	int32 srcFormat;
+
+	if((raster->type&0xF) != Raster::TEXTURE &&
+	   (raster->type&0xF) != Raster::CAMERATEXTURE)
+		return 0;
+
+	// Unpalettize image if necessary but don't change original
+	Image *truecolimg = nil;
+	if(image->depth <= 8){
+		truecolimg = Image::create(image->width, image->height, image->depth);
+		truecolimg->pixels = image->pixels;
+		truecolimg->stride = image->stride;
+		truecolimg->palette = image->palette;
+		truecolimg->unpalettize();
+		image = truecolimg;
+	}
+
+	switch(image->depth){
+	case 32: srcFormat = PIXFMT_RGBA8888; break;
+	case 24: srcFormat = PIXFMT_RGB888; break;
+	case 16: srcFormat = PIXFMT_ARGB1555; break;
+	default:
+		if(truecolimg)
+			truecolimg->destroy();
+		RWERROR((ERR_INVRASTER));
+		return 0;
+	}
+
+	SoftRaster *natras = GETSOFTRASTEREXT(raster);
+	natras->hasAlpha = image->hasAlpha();
+
+	bool unlock = false;
+	if(raster->pixels == nil){
+		raster->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+		unlock = true;
+	}
+
+	assert(raster->pixels);
+	assert(image->width == raster->width);
+	assert(image->height == raster->height);
+	convertPixels(raster->pixels, raster->stride, PIXFMT_RGBA8888,
+		image->pixels, image->stride, srcFormat,
+		image->width, image->height);
+	// keep C888 opaque
+	if((raster->format & 0xF00) == Raster::C888){
+		uint8 *px = raster->pixels;
+		for(int32 i = 0; i < raster->width*raster->height; i++)
+			px[i*4+3] = 0xFF;
+		natras->hasAlpha = 0;
+	}
+	if(unlock)
+		raster->unlock(0);
+
+	if(truecolimg)
+		truecolimg->destroy();
+
+	return 1;
+}
+
+Image*
+rasterToImage(Raster *raster)
+{
+	int32 depth, dstFormat;
+	Image *image;
+
+	if(raster->type == Raster::ZBUFFER){
+		RWERROR((ERR_INVRASTER));
+		return nil;
+	}
+
+	bool unlock = false;
+	if(raster->pixels == nil){
+		if(raster->lock(0, Raster::LOCKREAD) == nil){
+			RWERROR((ERR_INVRASTER));
+			return nil;
+		}
+		unlock = true;
+	}
+
+	if((raster->format & 0xF00) == Raster::C888){
+		depth = 24;
+		dstFormat = PIXFMT_RGB888;
+	}else{
+		depth = 32;
+		dstFormat = PIXFMT_RGBA8888;
+	}
+
+	image = Image::create(raster->width, raster->height, depth);
+	image->allocate();
+	convertPixels(image->pixels, image->stride, dstFormat,
+		raster->pixels, raster->stride, PIXFMT_RGBA8888,
+		image->width, image->height);
+
+	if(unlock)
+		raster->unlock(0);
+
+	return image;
+}
+
+static void*
+createNativeRaster(void *object, int32 offset, int32)
+{
+	SoftRaster *ras = PLUGINOFFSET(SoftRaster, object, offset);
+	ras->pixels = nil;
+	ras->size = 0;
+	return object;
+}
+
+static void*
+destroyNativeRaster(void *object, int32 offset, int32)
+{
+	Raster *raster = (Raster*)object;
+	SoftRaster *natras = PLUGINOFFSET(SoftRaster, object, offset);
+	if(natras->pixels)
+		flushRaster();
+	if(rasState.raster == raster){
+		rasState.raster = nil;
+		rasState.numLevels = 0;
+	}
+	rwFree(natras->pixels);
+	natras->pixels = nil;
+	return object;
+}
+
+static void*
+copyNativeRaster(void *dst, void *, int32 offset, int32)
+{
+	SoftRaster *d = PLUGINOFFSET(SoftRaster, dst, offset);
+	d->pixels = nil;
+	d->size = 0;
+	return dst;
+}
+
+void registerNativeRaster(void)
+{
+	nativeRasterOffset = Raster::registerPlugin(sizeof(SoftRaster),
+	                                            ID_RASTERSOFT,
+	                                            createNativeRaster,
+	                                            destroyNativeRaster,
+	                                            copyNativeRaster);
+}
+
+}
+}
@@ -0,0 +1,581 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwengine.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+
+#include "rwsoft.h"
+#include "rwsoftimpl.h"
+
+// Transform, lighting and clipping on the CPU.
+// The lighting model is the one of the GL3 shaders.
+
+namespace rw {
+namespace soft {
+
+#define MAX_LIGHTS 8
+
+enum {
+	LIGHTDIRECT = 1,
+	LIGHTPOINT,
+	LIGHTSPOT
+};
+
+struct SoftLight
+{
+	int32 type;
+	RGBAf color;
+	V3d position;
+	V3d direction;
+	float32 radius;
+	float32 minusCosAngle;
+	float32 hardSpot;
+};
+
+static struct {
+	RGBAf ambient;
+	SoftLight lights[MAX_LIGHTS];
+	int32 numLights;
+} lighting;
+
+TnLBuffers tnl;
+
+// Projected vertices, stamped so each one is projected once per submit
+static RasVertex *projVerts;
+static int32 *projStamps;
+static int32 maxProj;
+static int32 projStamp;
+
+/*
+ * Lighting
+ */
+
+int32
+setLights(WorldLights *lightData)
+{
+	int32 i, n;
+	Light *l;
+	SoftLight *sl;
+
+	lighting.ambient = lightData->ambient;
+
+	n = 0;
+	for(i = 0; i < lightData->numDirectionals && n < MAX_LIGHTS; i++){
+		l = lightData->directionals[i];
+		sl = &lighting.lights[n++];
+		sl->type = LIGHTDIRECT;
+		sl->color = l->color;
+		sl->direction = l->getFrame()->getLTM()->at;
+	}
+	for(i = 0; i < lightData->numLocals && n < MAX_LIGHTS; i++){
+		l = lightData->locals[i];
+		switch(l->getType()){
+		case Light::POINT:
+			sl = &lighting.lights[n++];
+			sl->type = LIGHTPOINT;
+			sl->color = l->color;
+			sl->position = l->getFrame()->getLTM()->pos;
+			sl->radius = l->radius;
+			break;
+		case Light::SPOT:
+		case Light::SOFTSPOT:
+			sl = &lighting.lights[n++];
+			sl->type = LIGHTSPOT;
+			sl->color = l->color;
+			sl->position = l->getFrame()->getLTM()->pos;
+			sl->direction = l->getFrame()->getLTM()->at;
+			sl->radius = l->radius;
+			sl->minusCosAngle = l->minusCosAngle;
+			// lower bound of falloff
+			sl->hardSpot = l->getType() == Light::SOFTSPOT ? 0.0f : 1.0f;
+			break;
+		}
+	}
+	lighting.numLights = n;
+	return n;
+}
+
+int32
+lightingCB(Atomic *atomic)
+{
+	WorldLights lightData;
+	Light *directionals[8];
+	Light *locals[8];
+	lightData.directionals = directionals;
+	lightData.numDirectionals = 8;
+	lightData.locals = locals;
+	lightData.numLocals = 8;
+
+	if(atomic->geometry->flags & rw::Geometry::LIGHT){
+		((World*)engine->currentWorld)->enumerateLights(atomic, &lightData);
+		if((atomic->geometry->flags & rw::Geometry::NORMALS) == 0){
+			// Get rid of lights that need normals when we don't have any
+			lightData.numDirectionals = 0;
+			lightData.numLocals = 0;
+		}
+		return setLights(&lightData);
+	}else{
+		memset(&lightData, 0, sizeof(lightData));
+		return setLights(&lightData);
+	}
+}
+
+static void
+dynamicLight(RGBAf *color, const V3d &v, const V3d &n)
+{
+	SoftLight *sl;
+	V3d dir;
+	float32 l, dist, atten, pcos, ccos, falloff;
+	int32 i;
+
+	for(i = 0; i < lighting.numLights; i++){
+		sl = &lighting.lights[i];
+		if(sl->type == LIGHTDIRECT){
+			l = -dot(n, sl->direction);
+			if(l <= 0.0f)
+				continue;
+			atten = 1.0f;
+		}else{
+			dir = sub(v, sl->position);
+			dist = length(dir);
+			atten = 1.0f - dist/sl->radius;
+			if(atten <= 0.0f || dist == 0.0f)
+				continue;
+			dir = scale(dir, 1.0f/dist);
+			l = -dot(n, dir);
+			if(l <= 0.0f)
+				continue;
+			if(sl->type == LIGHTSPOT){
+				pcos = dot(dir, sl->direction);	// cos to point
+				ccos = -sl->minusCosAngle;
+				falloff = (pcos-ccos)/(1.0f-ccos);
+				if(falloff < 0.0f)	// outside of cone
+					continue;
+				l *= falloff > sl->hardSpot ? falloff : sl->hardSpot;
+			}
+		}
+		color->red += l*atten*sl->color.red;
+		color->green += l*atten*sl->color.green;
+		color->blue += l*atten*sl->color.blue;
+	}
+}
+
+static float32
+clamp01(float32 f)
+{
+	return f < 0.0f ? 0.0f : f > 1.0f ? 1.0f : f;
+}
+
+static float32
+maxf(float32 a, float32 b)
+{
+	return a > b ? a : b;
+}
+
+// color = max(clamp(prelit + ambient + dynamic), minColor) * mult
+void
+lightMesh(InstanceDataHeader *header, InstanceData *inst,
+	const RGBAf &mult, float32 minColor)
+{
+	SurfaceProperties *surf = &inst->material->surfaceProps;
+	RGBAf amb, c;
+	RGBA *col;
+	CamVertex *cv;
+	int32 i, v;
+	bool32 dynamic;
+
+	amb = scale(lighting.ambient, surf->ambient);
+	dynamic = lighting.numLights && header->normals;
+	for(i = 0; i < inst->numVertices; i++){
+		v = inst->minVert + i;
+		if(header->colors){
+			col = &header->colors[v];
+			c.red = col->red/255.0f;
+			c.green = col->green/255.0f;
+			c.blue = col->blue/255.0f;
+			c.alpha = col->alpha/255.0f;
+		}else{
+			c.red = c.green = c.blue = 0.0f;
+			c.alpha = 1.0f;
+		}
+		c.red += amb.red;
+		c.green += amb.green;
+		c.blue += amb.blue;
+		if(dynamic){
+			RGBAf dyn = { 0.0f, 0.0f, 0.0f, 0.0f };
+			dynamicLight(&dyn, tnl.worldPos[v], tnl.worldNormals[v]);
+			c.red += dyn.red*surf->diffuse;
+			c.green += dyn.green*surf->diffuse;
+			c.blue += dyn.blue*surf->diffuse;
+		}
+		cv = &tnl.verts[v];
+		cv->color.red = maxf(clamp01(c.red), minColor)*mult.red;
+		cv->color.green = maxf(clamp01(c.green), minColor)*mult.green;
+		cv->color.blue = maxf(clamp01(c.blue), minColor)*mult.blue;
+		cv->color.alpha = maxf(clamp01(c.alpha), minColor)*mult.alpha;
+	}
+}
+
+void
+texCoordsMesh(InstanceDataHeader *header, InstanceData *inst, int32 set)
+{
+	TexCoords *tc;
+	CamVertex *cv;
+	int32 i;
+
+	cv = &tnl.verts[inst->minVert];
+	if(set >= header->numTexCoordSets){
+		for(i = 0; i < inst->numVertices; i++, cv++)
+			cv->u = cv->v = 0.0f;
+		return;
+	}
+	tc = &header->texCoords[set][inst->minVert];
+	for(i = 0; i < inst->numVertices; i++, cv++, tc++){
+		cv->u = tc->u;
+		cv->v = tc->v;
+	}
+}
+
+/*
+ * Transformation
+ */
+
+static uint32
+clipCode(const V3d &p)
+{
+	float32 w = camState.persp ? p.z : 1.0f;
+	uint32 code = 0;
+	if(p.x < 0.0f) code |= CLIPLEFT;
+	if(p.x > w) code |= CLIPRIGHT;
+	if(p.y < 0.0f) code |= CLIPTOP;
+	if(p.y > w) code |= CLIPBOTTOM;
+	if(p.z < camState.nearPlane) code |= CLIPNEAR;
+	if(p.z > camState.farPlane) code |= CLIPFAR;
+	return code;
+}
+
+// m goes from src's space to the camera's view space
+void
+transformVertices(CamVertex *dst, V3d *src, int32 n, Matrix *m)
+{
+	V3d *p;
+	int32 i;
+	for(i = 0; i < n; i++){
+		p = &src[i];
+		dst[i].pos.x = p->x*m->right.x + p->y*m->up.x + p->z*m->at.x + m->pos.x;
+		dst[i].pos.y = p->x*m->right.y + p->y*m->up.y + p->z*m->at.y + m->pos.y;
+		dst[i].pos.z = p->x*m->right.z + p->y*m->up.z + p->z*m->at.z + m->pos.z;
+		dst[i].clip = clipCode(dst[i].pos);
+	}
+}
+
+static void
+growTnL(int32 n)
+{
+	if(n <= tnl.maxVertices)
+		return;
+	tnl.maxVertices = n;
+	tnl.worldPos = rwResizeT(V3d, tnl.worldPos, n, MEMDUR_EVENT | ID_DRIVER);
+	tnl.worldNormals = rwResizeT(V3d, tnl.worldNormals, n, MEMDUR_EVENT | ID_DRIVER);
+	tnl.verts = rwResizeT(CamVertex, tnl.verts, n, MEMDUR_EVENT | ID_DRIVER);
+}
+
+// positions and normals are in object space, normals may be nil
+void
+transformAtomic(InstanceDataHeader *header, Matrix *ltm, V3d *positions, V3d *normals)
+{
+	Camera *cam = (Camera*)engine->currentCamera;
+	Matrix m;
+	int32 n = header->totalNumVertex;
+
+	growTnL(n);
+	tnl.numVertices = n;
+	V3d::transformPoints(tnl.worldPos, positions, n, ltm);
+	if(normals)
+		V3d::transformVectors(tnl.worldNormals, normals, n, ltm);
+	Matrix::mult(&m, ltm, &cam->viewMatrix);
+	transformVertices(tnl.verts, positions, n, &m);
+}
+
+/*
+ * Clipping and projection
+ */
+
+void
+projectVertex(RasVertex *dst, CamVertex *src)
+{
+	float32 q;
+	if(camState.persp){
+		q = 1.0f/src->pos.z;
+		dst->x = src->pos.x*q*camState.width;
+		dst->y = src->pos.y*q*camState.height;
+		dst->z = camState.zScale*q + camState.zShift;
+		dst->q = q;
+	}else{
+		dst->x = src->pos.x*camState.width;
+		dst->y = src->pos.y*camState.height;
+		dst->z = camState.zScale*src->pos.z + camState.zShift;
+		dst->q = 1.0f;
+	}
+	dst->r = src->color.red*255.0f;
+	dst->g = src->color.green*255.0f;
+	dst->b = src->color.blue*255.0f;
+	dst->a = src->color.alpha*255.0f;
+	dst->u = src->u;
+	dst->v = src->v;
+	dst->f = vertexFog(src->pos.z);
+}
+
+enum {
+	NUMCLIPPLANES = 6,
+	MAXCLIPVERTS = 3+NUMCLIPPLANES
+};
+
+// Make sure indices up to max can be projected
+static void
+beginProject(uint16 *indices, int32 numIndices)
+{
+	int32 i, max;
+
+	max = 0;
+	for(i = 0; i < numIndices; i++)
+		if(indices[i] > max)
+			max = indices[i];
+	if(max >= maxProj){
+		maxProj = max+1;
+		projVerts = rwResizeT(RasVertex, projVerts, maxProj, MEMDUR_EVENT | ID_DRIVER);
+		projStamps = rwResizeT(int32, projStamps, maxProj, MEMDUR_EVENT | ID_DRIVER);
+		memset(projStamps, 0, maxProj*sizeof(int32));
+		projStamp = 0;
+	}
+	if(++projStamp == 0){
+		memset(projStamps, 0, maxProj*sizeof(int32));
+		projStamp = 1;
+	}
+}
+
+static RasVertex*
+getProjected(CamVertex *verts, int32 i)
+{
+	if(projStamps[i] != projStamp){
+		projectVertex(&projVerts[i], &verts[i]);
+		projStamps[i] = projStamp;
+	}
+	return &projVerts[i];
+}
+
+// positive inside
+static float32
+planeDist(const CamVertex *v, int32 plane)
+{
+	float32 w = camState.persp ? v->pos.z : 1.0f;
+	switch(plane){
+	case 0: return v->pos.x;
+	case 1: return w - v->pos.x;
+	case 2: return v->pos.y;
+	case 3: return w - v->pos.y;
+	case 4: return v->pos.z - camState.nearPlane;
+	default: return camState.farPlane - v->pos.z;
+	}
+}
+
+static void
+lerpVertex(CamVertex *dst, const CamVertex *a, const CamVertex *b, float32 t)
+{
+	dst->pos = add(a->pos, scale(sub(b->pos, a->pos), t));
+	dst->color.red = a->color.red + (b->color.red - a->color.red)*t;
+	dst->color.green = a->color.green + (b->color.green - a->color.green)*t;
+	dst->color.blue = a->color.blue + (b->color.blue - a->color.blue)*t;
+	dst->color.alpha = a->color.alpha + (b->color.alpha - a->color.alpha)*t;
+	dst->u = a->u + (b->u - a->u)*t;
+	dst->v = a->v + (b->v - a->v)*t;
+	dst->clip = 0;
+}
+
+// Clip a line (n = 2) or triangle (n = 3) against the planes in mask.
+// Returns the number of vertices left.
+static int32
+clipPoly(CamVertex *poly, int32 n, uint32 mask)
+{
+	CamVertex tmp[MAXCLIPVERTS];
+	CamVertex *in = poly, *out = tmp, *swap;
+	float32 da, db;
+	int32 p, i, m, ne;
+
+	for(p = 0; p < NUMCLIPPLANES; p++){
+		if((mask & (1<<p)) == 0)
+			continue;
+		m = 0;
+		// a line is an open polygon
+		ne = n == 2 ? 1 : n;
+		if(n == 2 && planeDist(&in[0], p) >= 0.0f)
+			out[m++] = in[0];
+		for(i = 0; i < ne; i++){
+			CamVertex *a = &in[i];
+			CamVertex *b = &in[(i+1)%n];
+			da = planeDist(a, p);
+			db = planeDist(b, p);
+			if(n != 2 && da >= 0.0f)
+				out[m++] = *a;
+			if((da >= 0.0f) != (db >= 0.0f))
+				lerpVertex(&out[m++], a, b, da/(da - db));
+			if(n == 2 && db >= 0.0f)
+				out[m++] = *b;
+		}
+		if(m < (n == 2 ? 2 : 3))
+			return 0;
+		n = m;
+		swap = in; in = out; out = swap;
+	}
+	if(in != poly)
+		memcpy(poly, in, n*sizeof(CamVertex));
+	return n;
+}
+
+void
+submitTriangles(CamVertex *verts, uint16 *indices, int32 numIndices)
+{
+	CamVertex poly[MAXCLIPVERTS];
+	RasVertex ras[MAXCLIPVERTS];
+	CamVertex *v0, *v1, *v2;
+	int32 i, j, n;
+
+	beginProject(indices, numIndices);
+	for(i = 0; i+2 < numIndices; i += 3){
+		v0 = &verts[indices[i]];
+		v1 = &verts[indices[i+1]];
+		v2 = &verts[indices[i+2]];
+		if(v0->clip & v1->clip & v2->clip)
+			continue;
+		if((v0->clip | v1->clip | v2->clip) == 0){
+			drawTriangle(getProjected(verts, indices[i]),
+				getProjected(verts, indices[i+1]),
+				getProjected(verts, indices[i+2]));
+			continue;
+		}
+		poly[0] = *v0;
+		poly[1] = *v1;
+		poly[2] = *v2;
+		n = clipPoly(poly, 3, v0->clip | v1->clip | v2->clip);
+		for(j = 0; j < n; j++)
+			projectVertex(&ras[j], &poly[j]);
+		for(j = 1; j+1 < n; j++)
+			drawTriangle(&ras[0], &ras[j], &ras[j+1]);
+	}
+}
+
+void
+submitLines(CamVertex *verts, uint16 *indices, int32 numIndices)
+{
+	CamVertex line[MAXCLIPVERTS];
+	RasVertex ras[2];
+	CamVertex *v0, *v1;
+	int32 i;
+
+	beginProject(indices, numIndices);
+	for(i = 0; i+1 < numIndices; i += 2){
+		v0 = &verts[indices[i]];
+		v1 = &verts[indices[i+1]];
+		if(v0->clip & v1->clip)
+			continue;
+		if((v0->clip | v1->clip) == 0){
+			drawLine(getProjected(verts, indices[i]),
+				getProjected(verts, indices[i+1]));
+			continue;
+		}
+		line[0] = *v0;
+		line[1] = *v1;
+		if(clipPoly(line, 2, v0->clip | v1->clip) != 2)
+			continue;
+		projectVertex(&ras[0], &line[0]);
+		projectVertex(&ras[1], &line[1]);
+		drawLine(&ras[0], &ras[1]);
+	}
+}
+
+void
+submitPoints(CamVertex *verts, uint16 *indices, int32 numIndices)
+{
+	int32 i;
+
+	beginProject(indices, numIndices);
+	for(i = 0; i < numIndices; i++)
+		if(verts[indices[i]].clip == 0)
+			drawPoint(getProjected(verts, indices[i]));
+}
+
+/*
+ * Meshes
+ */
+
+void
+drawInst(InstanceDataHeader *header, InstanceData *inst)
+{
+	RWMETRIC(numMeshes, 1);
+	// the GS alpha test only applies to pipelines
+	rasState.gsEmu = 1;
+	submitTriangles(tnl.verts, inst->indices, inst->numIndex);
+	rasState.gsEmu = 0;
+}
+
+void
+renderMesh(InstanceDataHeader *header, InstanceData *inst, uint32 flags)
+{
+	static RGBAf white = { 1.0f, 1.0f, 1.0f, 1.0f };
+	Material *m = inst->material;
+	RGBAf matColor;
+
+	if(flags & Geometry::MODULATE)
+		convColor(&matColor, &m->color);
+	else
+		matColor = white;
+	lightMesh(header, inst, matColor, 0.0f);
+	texCoordsMesh(header, inst, 0);
+
+	setTexture(m->texture);
+	rw::SetRenderState(VERTEXALPHA, inst->vertexAlpha || m->color.alpha != 0xFF);
+
+	drawInst(header, inst);
+}
+
+void
+defaultRenderCB(Atomic *atomic, InstanceDataHeader *header)
+{
+	uint32 flags = atomic->geometry->flags;
+	lightingCB(atomic);
+	transformAtomic(header, atomic->getFrame()->getLTM(),
+		header->positions, header->normals);
+
+	InstanceData *inst = header->inst;
+	int32 n = header->numMeshes;
+	while(n--){
+		renderMesh(header, inst, flags);
+		inst++;
+	}
+}
+
+void
+closeTnL(void)
+{
+	rwFree(tnl.worldPos);
+	rwFree(tnl.worldNormals);
+	rwFree(tnl.verts);
+	memset(&tnl, 0, sizeof(tnl));
+	rwFree(projVerts);
+	rwFree(projStamps);
+	projVerts = nil;
+	projStamps = nil;
+	maxProj = 0;
+	projStamp = 0;
+}
+
+}
+}
@@ -0,0 +1,185 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <assert.h>
+
+#include "../rwbase.h"
+#include "../rwerror.h"
+#include "../rwplg.h"
+#include "../rwrender.h"
+#include "../rwengine.h"
+#include "../rwpipeline.h"
+#include "../rwobjects.h"
+#include "../rwanim.h"
+#include "../rwplugins.h"
+
+#include "rwsoft.h"
+#include "rwsoftplg.h"
+#include "rwsoftimpl.h"
+
+namespace rw {
+namespace soft {
+
+// Skinning is done on the CPU into object space,
+// the rest is the default pipeline.
+
+static Matrix *skinMatrices;
+static int32 maxSkinMatrices;
+static V3d *skinnedPositions;
+static V3d *skinnedNormals;
+static int32 maxSkinned;
+
+// Same matrices as the GL3 skin shader gets
+static void
+buildSkinMatrices(Atomic *a)
+{
+	int i;
+	Skin *skin = Skin::get(a->geometry);
+	HAnimHierarchy *hier = Skin::getHierarchy(a);
+	Matrix *m;
+
+	if(skin->numBones > maxSkinMatrices){
+		maxSkinMatrices = skin->numBones;
+		skinMatrices = rwResizeT(Matrix, skinMatrices, maxSkinMatrices, MEMDUR_EVENT | ID_SKIN);
+	}
+	m = skinMatrices;
+
+	if(hier){
+		Matrix *invMats = (Matrix*)skin->inverseMatrices;
+		Matrix tmp;
+
+		assert(skin->numBones == hier->numNodes);
+		if(hier->flags & HAnimHierarchy::LOCALSPACEMATRICES){
+			for(i = 0; i < hier->numNodes; i++){
+				invMats[i].flags = 0;
+				Matrix::mult(m, &invMats[i], &hier->matrices[i]);
+				m++;
+			}
+		}else{
+			Matrix invAtmMat;
+			Matrix::invert(&invAtmMat, a->getFrame()->getLTM());
+			for(i = 0; i < hier->numNodes; i++){
+				invMats[i].flags = 0;
+				Matrix::mult(&tmp, &hier->matrices[i], &invAtmMat);
+				Matrix::mult(m, &invMats[i], &tmp);
+				m++;
+			}
+		}
+	}else{
+		for(i = 0; i < skin->numBones; i++){
+			m->setIdentity();
+			m++;
+		}
+	}
+}
+
+static void
+skinVertices(InstanceDataHeader *header, Skin *skin)
+{
+	int32 i, j, n;
+	float32 *w;
+	uint8 *idx;
+	Matrix *m;
+	V3d *p, *nrm, *dp, *dn;
+
+	n = header->totalNumVertex;
+	if(n > maxSkinned){
+		maxSkinned = n;
+		skinnedPositions = rwResizeT(V3d, skinnedPositions, n, MEMDUR_EVENT | ID_SKIN);
+		skinnedNormals = rwResizeT(V3d, skinnedNormals, n, MEMDUR_EVENT | ID_SKIN);
+	}
+	w = skin->weights;
+	idx = skin->indices;
+	for(i = 0; i < n; i++, w += 4, idx += 4){
+		p = &header->positions[i];
+		dp = &skinnedPositions[i];
+		dp->x = dp->y = dp->z = 0.0f;
+		nrm = header->normals ? &header->normals[i] : nil;
+		dn = &skinnedNormals[i];
+		dn->x = dn->y = dn->z = 0.0f;
+		for(j = 0; j < 4; j++){
+			if(w[j] == 0.0f)
+				continue;
+			m = &skinMatrices[idx[j]];
+			dp->x += w[j]*(p->x*m->right.x + p->y*m->up.x + p->z*m->at.x + m->pos.x);
+			dp->y += w[j]*(p->x*m->right.y + p->y*m->up.y + p->z*m->at.y + m->pos.y);
+			dp->z += w[j]*(p->x*m->right.z + p->y*m->up.z + p->z*m->at.z + m->pos.z);
+			if(nrm){
+				dn->x += w[j]*(nrm->x*m->right.x + nrm->y*m->up.x + nrm->z*m->at.x);
+				dn->y += w[j]*(nrm->x*m->right.y + nrm->y*m->up.y + nrm->z*m->at.y);
+				dn->z += w[j]*(nrm->x*m->right.z + nrm->y*m->up.z + nrm->z*m->at.z);
+			}
+		}
+	}
+}
+
+void
+skinRenderCB(Atomic *atomic, InstanceDataHeader *header)
+{
+	uint32 flags = atomic->geometry->flags;
+	Skin *skin = Skin::get(atomic->geometry);
+
+	if(skin == nil){
+		defaultRenderCB(atomic, header);
+		return;
+	}
+
+	lightingCB(atomic);
+	buildSkinMatrices(atomic);
+	skinVertices(header, skin);
+	transformAtomic(header, atomic->getFrame()->getLTM(),
+		skinnedPositions, header->normals ? skinnedNormals : nil);
+
+	InstanceData *inst = header->inst;
+	int32 n = header->numMeshes;
+	while(n--){
+		renderMesh(header, inst, flags);
+		inst++;
+	}
+}
+
+static void*
+skinOpen(void *o, int32, int32)
+{
+	skinGlobals.pipelines[PLATFORM_SOFT] = makeSkinPipeline();
+	return o;
+}
+
+static void*
+skinClose(void *o, int32, int32)
+{
+	((ObjPipeline*)skinGlobals.pipelines[PLATFORM_SOFT])->destroy();
+	skinGlobals.pipelines[PLATFORM_SOFT] = nil;
+
+	rwFree(skinMatrices);
+	skinMatrices = nil;
+	maxSkinMatrices = 0;
+	rwFree(skinnedPositions);
+	rwFree(skinnedNormals);
+	skinnedPositions = nil;
+	skinnedNormals = nil;
+	maxSkinned = 0;
+	return o;
+}
+
+void
+initSkin(void)
+{
+	Driver::registerPlugin(PLATFORM_SOFT, 0, ID_SKIN,
+	                       skinOpen, skinClose);
+}
+
+ObjPipeline*
+makeSkinPipeline(void)
+{
+	ObjPipeline *pipe = ObjPipeline::create();
+	pipe->instanceCB = defaultInstanceCB;
+	pipe->uninstanceCB = defaultUninstanceCB;
+	pipe->renderCB = skinRenderCB;
+	pipe->pluginID = ID_SKIN;
+	pipe->pluginData = 1;
+	return pipe;
+}
+
+}
+}
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <ctype.h>
 
 #define WITH_D3D
 #include "rwbase.h"
@@ -23,6 +24,7 @@
 namespace rw {
 
 int32 Texture::numAllocated;
+FreeList *Texture::freeList;
 int32 TexDictionary::numAllocated;
 
 PluginList TexDictionary::s_plglist(sizeof(TexDictionary));
@@ -39,9 +41,17 @@ struct TextureGlobals
 	bool32 makeDummies;
 	bool32 mipmapping;
 	bool32 autoMipmapping;
+	// generate missing mip levels of native textures on load
+	bool32 buildMipmaps;
+	int32 mipmapFilter;
 	LinkList texDicts;
 
 	LinkList textures;
+
+	// interned names
+	TexName **nameBuckets;
+	int32 numNameBuckets;
+	int32 numNames;
 };
 int32 textureModuleOffset;
 
@@ -54,6 +64,9 @@ textureOpen(void *object, int32 offset, int32 size)
 	textureModuleOffset = offset;
 	TEXTUREGLOBAL(texDicts).init();
 	TEXTUREGLOBAL(textures).init();
+	TEXTUREGLOBAL(nameBuckets) = nil;
+	TEXTUREGLOBAL(numNameBuckets) = 0;
+	TEXTUREGLOBAL(numNames) = 0;
 	texdict = TexDictionary::create();
 	TEXTUREGLOBAL(initialTexDict) = texdict;
 	TexDictionary::setCurrent(texdict);
@@ -61,6 +74,8 @@ textureOpen(void *object, int32 offset, int32 size)
 	TEXTUREGLOBAL(makeDummies) = 0;
 	TEXTUREGLOBAL(mipmapping) = 0;
 	TEXTUREGLOBAL(autoMipmapping) = 0;
+	TEXTUREGLOBAL(buildMipmaps) = 0;
+	TEXTUREGLOBAL(mipmapFilter) = MIPFILTER_BOX;
 	return object;
 }
 static void*
@@ -77,6 +92,17 @@ textureClose(void *object, int32 offset, int32 size)
 		assert(tex->dict == nil);
 		tex->destroy();
 	}
+
+	TexName *n, *next;
+	for(int32 i = 0; i < TEXTUREGLOBAL(numNameBuckets); i++)
+		for(n = TEXTUREGLOBAL(nameBuckets)[i]; n; n = next){
+			next = n->next;
+			rwFree(n);
+		}
+	rwFree(TEXTUREGLOBAL(nameBuckets));
+	TEXTUREGLOBAL(nameBuckets) = nil;
+	TEXTUREGLOBAL(numNameBuckets) = 0;
+	TEXTUREGLOBAL(numNames) = 0;
 	return object;
 }
 
@@ -103,6 +129,92 @@ void Texture::setAutoMipmapping(bool32 b) { TEXTUREGLOBAL(autoMipmapping) = b; }
 bool32 Texture::getMipmapping(void) { return TEXTUREGLOBAL(mipmapping); }
 bool32 Texture::getAutoMipmapping(void) { return TEXTUREGLOBAL(autoMipmapping); }
 
+void
+Texture::setBuildMipmaps(bool32 b, int32 filter)
+{
+	TEXTUREGLOBAL(buildMipmaps) = b;
+	TEXTUREGLOBAL(mipmapFilter) = filter;
+}
+
+bool32 Texture::getBuildMipmaps(void) { return TEXTUREGLOBAL(buildMipmaps); }
+
+//
+// TexName
+//
+
+// FNV-1a of the lowercase name
+uint32
+TexName::hashName(const char *name)
+{
+	uint32 h = 2166136261u;
+	for(int32 i = 0; i < 32 && name[i]; i++){
+		h ^= (uint8)tolower(name[i]);
+		h *= 16777619u;
+	}
+	return h;
+}
+
+static TexName*
+findName(const char *name, uint32 hash)
+{
+	TexName *n;
+	if(TEXTUREGLOBAL(numNameBuckets) == 0)
+		return nil;
+	n = TEXTUREGLOBAL(nameBuckets)[hash & (TEXTUREGLOBAL(numNameBuckets)-1)];
+	for(; n; n = n->next)
+		if(n->hash == hash && strncmp_ci(n->name, name, 32) == 0)
+			return n;
+	return nil;
+}
+
+// nil if no texture in a dictionary was ever called that
+TexName*
+TexName::find(const char *name)
+{
+	return findName(name, hashName(name));
+}
+
+TexName*
+TexName::intern(const char *name)
+{
+	int32 i, j, size;
+	uint32 hash = hashName(name);
+	TexName *n, *next, **buckets;
+
+	n = findName(name, hash);
+	if(n)
+		return n;
+
+	if(TEXTUREGLOBAL(numNames) >= TEXTUREGLOBAL(numNameBuckets)){
+		size = TEXTUREGLOBAL(numNameBuckets) ? TEXTUREGLOBAL(numNameBuckets)*2 : 256;
+		buckets = rwNewT(TexName*, size, MEMDUR_EVENT | ID_TEXTUREMODULE);
+		memset(buckets, 0, size*sizeof(TexName*));
+		for(i = 0; i < TEXTUREGLOBAL(numNameBuckets); i++)
+			for(n = TEXTUREGLOBAL(nameBuckets)[i]; n; n = next){
+				next = n->next;
+				j = n->hash & (size-1);
+				n->next = buckets[j];
+				buckets[j] = n;
+			}
+		rwFree(TEXTUREGLOBAL(nameBuckets));
+		TEXTUREGLOBAL(nameBuckets) = buckets;
+		TEXTUREGLOBAL(numNameBuckets) = size;
+	}
+
+	n = rwNewT(TexName, 1, MEMDUR_EVENT | ID_TEXTUREMODULE);
+	for(i = 0; i < 32 && name[i]; i++)
+		n->name[i] = tolower(name[i]);
+	for(; i < 32; i++)
+		n->name[i] = '\0';
+	n->hash = hash;
+	n->cache = nil;
+	j = hash & (TEXTUREGLOBAL(numNameBuckets)-1);
+	n->next = TEXTUREGLOBAL(nameBuckets)[j];
+	TEXTUREGLOBAL(nameBuckets)[j] = n;
+	TEXTUREGLOBAL(numNames)++;
+	return n;
+}
+
 //
 // TexDictionary
 //
@@ -118,6 +230,9 @@ TexDictionary::create(void)
 	numAllocated++;
 	dict->object.init(TexDictionary::ID, 0);
 	dict->textures.init();
+	dict->buckets = nil;
+	dict->numBuckets = 0;
+	dict->numHashed = 0;
 	TEXTUREGLOBAL(texDicts).add(&dict->inGlobalList);
 	s_plglist.construct(dict);
 	return dict;
@@ -135,23 +250,72 @@ TexDictionary::destroy(void)
 	}
 	s_plglist.destruct(this);
 	this->inGlobalList.remove();
+	rwFree(this->buckets);
 	rwFree(this);
 	numAllocated--;
 }
 
+static void
+hashTexture(TexDictionary *dict, Texture *t)
+{
+	int32 i, j, size;
+	Texture *tex, *next, **buckets;
+
+	if(dict->numHashed >= dict->numBuckets){
+		size = dict->numBuckets ? dict->numBuckets*2 : 16;
+		buckets = rwNewT(Texture*, size, MEMDUR_EVENT | ID_TEXDICTIONARY);
+		memset(buckets, 0, size*sizeof(Texture*));
+		for(i = 0; i < dict->numBuckets; i++)
+			for(tex = dict->buckets[i]; tex; tex = next){
+				next = tex->hashNext;
+				j = tex->iname->hash & (size-1);
+				tex->hashNext = buckets[j];
+				buckets[j] = tex;
+			}
+		rwFree(dict->buckets);
+		dict->buckets = buckets;
+		dict->numBuckets = size;
+	}
+	t->iname = TexName::intern(t->name);
+	t->iname->cache = t;
+	j = t->iname->hash & (dict->numBuckets-1);
+	t->hashNext = dict->buckets[j];
+	dict->buckets[j] = t;
+	dict->numHashed++;
+}
+
+static void
+unhashTexture(TexDictionary *dict, Texture *t)
+{
+	Texture **p;
+	p = &dict->buckets[t->iname->hash & (dict->numBuckets-1)];
+	for(; *p; p = &(*p)->hashNext)
+		if(*p == t){
+			*p = t->hashNext;
+			break;
+		}
+	if(t->iname->cache == t)
+		t->iname->cache = nil;
+	t->iname = nil;
+	t->hashNext = nil;
+	dict->numHashed--;
+}
+
 void
 TexDictionary::add(Texture *t)
 {
 	if(t->dict)
-		t->inDict.remove();
+		t->dict->remove(t);
 	t->dict = this;
 	this->textures.append(&t->inDict);
+	hashTexture(this, t);
 }
 
 void
 TexDictionary::remove(Texture *t)
 {
 	assert(t->dict == this);
+	unhashTexture(this, t);
 	t->inDict.remove();
 	t->dict = nil;
 }
@@ -160,17 +324,36 @@ void
 TexDictionary::addFront(Texture *t)
 {
 	if(t->dict)
-		t->inDict.remove();
+		t->dict->remove(t);
 	t->dict = this;
 	this->textures.add(&t->inDict);
+	hashTexture(this, t);
 }
 
+// With duplicate names the one nearest the front of the list is found
 Texture*
 TexDictionary::find(const char *name)
 {
+	TexName *n;
+	Texture *tex, *found;
+
+	n = TexName::find(name);
+	if(n == nil || this->numBuckets == 0)
+		return nil;
+	found = nil;
+	for(tex = this->buckets[n->hash & (this->numBuckets-1)]; tex; tex = tex->hashNext)
+		if(tex->iname == n){
+			if(found)
+				goto dups;
+			found = tex;
+		}
+	return found;
+
+dups:
+	// rare, fall back to list order
 	FORLIST(lnk, this->textures){
-		Texture *tex = Texture::fromDict(lnk);
-		if(strncmp_ci(tex->name, name, 32) == 0)
+		tex = Texture::fromDict(lnk);
+		if(tex->iname == n)
 			return tex;
 	}
 	return nil;
@@ -179,6 +362,7 @@ TexDictionary::find(const char *name)
 TexDictionary*
 TexDictionary::streamRead(Stream *stream)
 {
+	RWTIMER("load texdict");
 	if(!findChunk(stream, ID_STRUCT, nil, nil)){
 		RWERROR((ERR_CHUNK, "STRUCT"));
 		return nil;
@@ -266,7 +450,7 @@ Texture *(*Texture::readCB)(const char *name, const char *mask) = defaultReadCB;
 Texture*
 Texture::create(Raster *raster)
 {
-	Texture *tex = (Texture*)rwMalloc(s_plglist.size, MEMDUR_EVENT | ID_TEXTURE);
+	Texture *tex = (Texture*)freeList->alloc();
 	if(tex == nil){
 		RWERROR((ERR_ALLOC, s_plglist.size));
 		return nil;
@@ -274,6 +458,8 @@ Texture::create(Raster *raster)
 	numAllocated++;
 	tex->dict = nil;
 	tex->inDict.init();
+	tex->iname = nil;
+	tex->hashNext = nil;
 	memset(tex->name, 0, 32);
 	memset(tex->mask, 0, 32);
 	tex->filterAddressing = (WRAP << 12) | (WRAP << 8) | NEAREST;
@@ -291,11 +477,11 @@ Texture::destroy(void)
 	if(this->refCount <= 0){
 		s_plglist.destruct(this);
 		if(this->dict)
-			this->inDict.remove();
+			this->dict->remove(this);
 		if(this->raster)
 			this->raster->destroy();
 		this->inGlobalList.remove();
-		rwFree(this);
+		freeList->free(this);
 		numAllocated--;
 	}
 }
@@ -303,9 +489,20 @@ Texture::destroy(void)
 static Texture*
 defaultFindCB(const char *name)
 {
+	TexName *n;
 	if(TEXTUREGLOBAL(currentTexDict))
 		return TEXTUREGLOBAL(currentTexDict)->find(name);
-	// TODO: RW searches *all* TXDs otherwise
+	// RW searches all TXDs, the name cache has the last one added
+	n = TexName::find(name);
+	if(n == nil)
+		return nil;
+	if(n->cache)
+		return n->cache;
+	FORLIST(lnk, TEXTUREGLOBAL(texDicts)){
+		Texture *tex = TexDictionary::fromLink(lnk)->find(name);
+		if(tex)
+			return n->cache = tex;
+	}
 	return nil;
 }
 
@@ -356,7 +553,7 @@ Texture::read(const char *name, const char *mask)
 	}
 	if(tex && TEXTUREGLOBAL(currentTexDict)){
 		if(tex->dict)
-			tex->inDict.remove();
+			tex->dict->remove(tex);
 		TEXTUREGLOBAL(currentTexDict)->add(tex);
 	}
 	return tex;
@@ -471,18 +668,25 @@ Texture::streamReadNative(Stream *stream)
 	}
 	uint32 platform = stream->readU32();
 	stream->seek(-16);
+	Texture *tex;
 	if(platform == FOURCC_PS2)
-		return ps2::readNativeTexture(stream);
-	if(platform == PLATFORM_D3D8)
-		return d3d8::readNativeTexture(stream);
-	if(platform == PLATFORM_D3D9)
-		return d3d9::readNativeTexture(stream);
-	if(platform == PLATFORM_XBOX)
-		return xbox::readNativeTexture(stream);
-	if(platform == PLATFORM_GL3)
-		return gl3::readNativeTexture(stream);
-	assert(0 && "unsupported platform");
-	return nil;
+		tex = ps2::readNativeTexture(stream);
+	else if(platform == PLATFORM_D3D8)
+		tex = d3d8::readNativeTexture(stream);
+	else if(platform == PLATFORM_D3D9)
+		tex = d3d9::readNativeTexture(stream);
+	else if(platform == PLATFORM_XBOX)
+		tex = xbox::readNativeTexture(stream);
+	else if(platform == PLATFORM_GL3)
+		tex = gl3::readNativeTexture(stream);
+	else{
+		assert(0 && "unsupported platform");
+		return nil;
+	}
+	if(tex && tex->raster && TEXTUREGLOBAL(buildMipmaps) &&
+	   tex->raster->format & (Raster::MIPMAP|Raster::AUTOMIPMAP))
+		tex->raster = Raster::buildMipmaps(tex->raster, TEXTUREGLOBAL(mipmapFilter));
+	return tex;
 }
 
 void
@@ -2,6 +2,7 @@
 #include <stdlib.h>
 #include <string.h>
 #include <assert.h>
+#include <math.h>
 
 #include "rwbase.h"
 #include "rwerror.h"
@@ -18,6 +19,134 @@ int32 World::numAllocated = 0;
 
 PluginList World::s_plglist(sizeof(World));
 
+//
+// Sectors
+//
+
+static WorldSector*
+createSector(WorldSector *parent, BBox *box)
+{
+	int32 i;
+	WorldSector *s = rwNewT(WorldSector, 1, MEMDUR_EVENT | ID_WORLD);
+	V3d half = scale(sub(box->sup, box->inf), 0.5f);
+	s->box = *box;
+	s->looseBox.inf = sub(box->inf, half);
+	s->looseBox.sup = add(box->sup, half);
+	s->parent = parent;
+	for(i = 0; i < 8; i++)
+		s->children[i] = nil;
+	s->depth = parent ? parent->depth+1 : 0;
+	s->atomics.init();
+	s->lights.init();
+	s->numAtomics = 0;
+	s->numLights = 0;
+	return s;
+}
+
+static void
+destroySector(WorldSector *s)
+{
+	int32 i;
+	for(i = 0; i < 8; i++)
+		if(s->children[i])
+			destroySector(s->children[i]);
+	rwFree(s);
+}
+
+// Find the smallest sector whose loose bounds contain the sphere,
+// creating sectors as needed.
+// Anything outside the world's box goes into the root.
+static WorldSector*
+findSector(World *world, Sphere *sphere)
+{
+	int32 i;
+	float32 childSize;
+	V3d mid;
+	BBox box;
+	V3d *c = &sphere->center;
+	WorldSector *s = world->rootSector;
+
+	if(!s->box.containsPoint(c))
+		return s;
+	while(s->depth < world->maxSectorDepth){
+		// a child's loose bounds hold spheres up to half the child's size
+		childSize = (s->box.sup.x - s->box.inf.x)*0.5f;
+		if(sphere->radius > childSize*0.5f)
+			break;
+		mid = scale(add(s->box.sup, s->box.inf), 0.5f);
+		i = (c->x >= mid.x) | (c->y >= mid.y)<<1 | (c->z >= mid.z)<<2;
+		if(s->children[i] == nil){
+			box.inf.x = i&1 ? mid.x : s->box.inf.x;
+			box.sup.x = i&1 ? s->box.sup.x : mid.x;
+			box.inf.y = i&2 ? mid.y : s->box.inf.y;
+			box.sup.y = i&2 ? s->box.sup.y : mid.y;
+			box.inf.z = i&4 ? mid.z : s->box.inf.z;
+			box.sup.z = i&4 ? s->box.sup.z : mid.z;
+			s->children[i] = createSector(s, &box);
+		}
+		s = s->children[i];
+	}
+	return s;
+}
+
+static void
+sectorAddAtomic(WorldSector *s, Atomic *atomic)
+{
+	atomic->sector = s;
+	s->atomics.append(&atomic->inSector);
+	for(; s; s = s->parent)
+		s->numAtomics++;
+}
+
+// Remove from sector or dirty list
+static void
+sectorRemoveAtomic(Atomic *atomic)
+{
+	WorldSector *s;
+	if(atomic->inSector.next == nil)
+		return;
+	atomic->inSector.remove();
+	atomic->inSector.init();
+	for(s = atomic->sector; s; s = s->parent)
+		s->numAtomics--;
+	atomic->sector = nil;
+}
+
+static void
+sectorAddLight(WorldSector *s, Light *light)
+{
+	light->sector = s;
+	s->lights.append(&light->inSector);
+	for(; s; s = s->parent)
+		s->numLights++;
+}
+
+static void
+sectorRemoveLight(Light *light)
+{
+	WorldSector *s;
+	if(light->inSector.next == nil)
+		return;
+	light->inSector.remove();
+	light->inSector.init();
+	for(s = light->sector; s; s = s->parent)
+		s->numLights--;
+	light->sector = nil;
+}
+
+static bool32
+sphereIntersectsBox(Sphere *sph, BBox *box)
+{
+	float32 d, dist = 0.0f;
+	if(sph->center.x < box->inf.x){ d = box->inf.x - sph->center.x; dist += d*d; }
+	else if(sph->center.x > box->sup.x){ d = sph->center.x - box->sup.x; dist += d*d; }
+	if(sph->center.y < box->inf.y){ d = box->inf.y - sph->center.y; dist += d*d; }
+	else if(sph->center.y > box->sup.y){ d = sph->center.y - box->sup.y; dist += d*d; }
+	if(sph->center.z < box->inf.z){ d = box->inf.z - sph->center.z; dist += d*d; }
+	else if(sph->center.z > box->sup.z){ d = sph->center.z - box->sup.z; dist += d*d; }
+	return dist <= sph->radius*sph->radius;
+}
+
 World*
 World::create(BBox *bbox)
 {
@@ -31,6 +160,30 @@ World::create(BBox *bbox)
 	world->localLights.init();
 	world->globalLights.init();
 	world->clumps.init();
+	world->dirtyAtomics.init();
+	world->dirtyLights.init();
+	memset(&world->cullStats, 0, sizeof(CullStats));
+	world->lightClusters = nil;
+	world->lightSerial = 0;
+	if(bbox){
+		// make it a cube so sectors don't get too flat
+		BBox box;
+		V3d mid = scale(add(bbox->sup, bbox->inf), 0.5f);
+		V3d size = sub(bbox->sup, bbox->inf);
+		float32 half = size.x > size.y ? size.x : size.y;
+		half = (half > size.z ? half : size.z)*0.5f;
+		box.inf.set(mid.x-half, mid.y-half, mid.z-half);
+		box.sup.set(mid.x+half, mid.y+half, mid.z+half);
+		world->rootSector = createSector(nil, &box);
+		world->maxSectorDepth = MAXSECTORDEPTH;
+	}else{
+		// everything goes into the root
+		BBox box;
+		box.inf.set(0.0f, 0.0f, 0.0f);
+		box.sup.set(0.0f, 0.0f, 0.0f);
+		world->rootSector = createSector(nil, &box);
+		world->maxSectorDepth = 0;
+	}
 	s_plglist.construct(world);
 	return world;
 }
@@ -39,6 +192,17 @@ void
 World::destroy(void)
 {
 	s_plglist.destruct(this);
+	destroySector(this->rootSector);
+	if(this->lightClusters){
+		LightClusters *lc = this->lightClusters;
+		rwFree(lc->lights);
+		rwFree(lc->indices);
+		rwFree(lc->ranges);
+		rwFree(lc->stamps);
+		rwFree(lc->found);
+		rwFree(lc->spheres);
+		rwFree(lc);
+	}
 	rwFree(this);
 	numAllocated--;
 }
@@ -52,6 +216,8 @@ World::addLight(Light *light)
 		this->globalLights.append(&light->inWorld);
 	}else{
 		this->localLights.append(&light->inWorld);
+		light->worldSerial = this->lightSerial++;
+		this->lightMoved(light);
 		if(light->getFrame())
 			light->getFrame()->updateObjects();
 	}
@@ -62,7 +228,10 @@ World::removeLight(Light *light)
 {
 	assert(light->world == this);
 	light->inWorld.remove();
+	sectorRemoveLight(light);
 	light->world = nil;
+	if(this->lightClusters)
+		this->lightClusters->camera = nil;
 }
 
 void
@@ -86,6 +255,7 @@ World::addAtomic(Atomic *atomic)
 {
 	assert(atomic->world == nil);
 	atomic->world = this;
+	this->atomicMoved(atomic);
 	if(atomic->getFrame())
 		atomic->getFrame()->updateObjects();
 }
@@ -94,6 +264,7 @@ void
 World::removeAtomic(Atomic *atomic)
 {
 	assert(atomic->world == this);
+	sectorRemoveAtomic(atomic);
 	atomic->world = nil;
 }
 
@@ -130,12 +301,372 @@ World::removeClump(Clump *clump)
 	clump->world = nil;
 }
 
+// Called from the sync callbacks, placement happens in updateSectors
+void
+World::atomicMoved(Atomic *atomic)
+{
+	if(atomic->sector == nil && atomic->inSector.next)
+		return;	// already dirty
+	sectorRemoveAtomic(atomic);
+	this->dirtyAtomics.append(&atomic->inSector);
+}
+
+void
+World::lightMoved(Light *light)
+{
+	if(this->lightClusters)
+		this->lightClusters->camera = nil;
+	if(light->sector == nil && light->inSector.next)
+		return;	// already dirty
+	sectorRemoveLight(light);
+	this->dirtyLights.append(&light->inSector);
+}
+
+void
+World::updateSectors(void)
+{
+	FORLIST(lnk, this->dirtyAtomics){
+		Atomic *a = Atomic::fromSector(lnk);
+		a->inSector.init();
+		if(a->getFrame())
+			sectorAddAtomic(findSector(this, a->getWorldBoundingSphere()), a);
+		else
+			sectorAddAtomic(this->rootSector, a);
+	}
+	this->dirtyAtomics.init();
+
+	FORLIST(lnk, this->dirtyLights){
+		Light *l = Light::fromSector(lnk);
+		l->inSector.init();
+		if(l->getFrame()){
+			Sphere sph;
+			sph.center = l->getFrame()->getLTM()->pos;
+			sph.radius = l->radius;
+			sectorAddLight(findSector(this, &sph), l);
+		}else
+			sectorAddLight(this->rootSector, l);
+	}
+	this->dirtyLights.init();
+}
+
+// Render all atomics in the current camera's frustum
+static void
+renderBatch(Atomic **atomics, int32 n, Camera *cam, CullStats *stats)
+{
+	if(cam->occlusion){
+		n = Atomic::frustumCull(atomics, n, cam, stats);
+		for(int32 i = 0; i < n; i++)
+			cam->occlusion->addAtomic(atomics[i]);
+	}else
+		Atomic::renderCulled(atomics, n, cam, stats);
+}
+
 void
 World::render(void)
 {
-	// this is very wrong, we really want world sectors
-	FORLIST(lnk, this->clumps)
-		Clump::fromWorld(lnk)->render();
+	struct { WorldSector *s; bool32 inside; } stack[MAXSECTORDEPTH*8 + 1];
+	Atomic *batch[Atomic::CULLBATCH];
+	int32 i, n, sp, res;
+	WorldSector *s;
+	bool32 inside;
+	Camera *cam = engine->currentCamera;
+	OcclusionBuffer *occ = cam ? cam->occlusion : nil;
+
+	this->updateSectors();
+	memset(&this->cullStats, 0, sizeof(CullStats));
+	// with occlusion culling, frustum visible atomics are only
+	// collected here and rendered after the occluders are drawn
+	if(occ)
+		occ->begin(cam);
+
+	sp = 0;
+	stack[sp].s = this->rootSector;
+	stack[sp].inside = cam == nil;
+	sp++;
+	while(sp > 0){
+		sp--;
+		s = stack[sp].s;
+		inside = stack[sp].inside;
+		// root also holds what is outside the world's box
+		if(!inside && s != this->rootSector){
+			res = cam->frustumTestBBox(&s->looseBox);
+			this->cullStats.sectorsTested++;
+			if(res == Camera::BOXOUTSIDE){
+				this->cullStats.sectorsCulled++;
+				continue;
+			}
+			inside = res == Camera::BOXINSIDE;
+		}
+		if(inside){
+			FORLIST(lnk, s->atomics){
+				Atomic *a = Atomic::fromSector(lnk);
+				if(a->object.object.flags & Atomic::RENDER){
+					if(occ)
+						occ->addAtomic(a);
+					else
+						a->render();
+				}
+			}
+		}else{
+			n = 0;
+			FORLIST(lnk, s->atomics){
+				batch[n++] = Atomic::fromSector(lnk);
+				if(n == Atomic::CULLBATCH){
+					renderBatch(batch, n, cam, &this->cullStats);
+					n = 0;
+				}
+			}
+			if(n)
+				renderBatch(batch, n, cam, &this->cullStats);
+		}
+		for(i = 0; i < 8; i++)
+			if(s->children[i] && s->children[i]->numAtomics){
+				stack[sp].s = s->children[i];
+				stack[sp].inside = inside;
+				sp++;
+			}
+	}
+	if(occ)
+		occ->end(&this->cullStats);
+}
+
+//
+// Light clusters
+//
+
+static int32
+depthSlice(LightClusters *lc, float32 z)
+{
+	if(z <= lc->nearPlane)
+		return 0;
+	return (int32)(logf(z/lc->nearPlane)*lc->sliceScale);
+}
+
+// Conservative cluster range of a sphere as x0,x1, y0,y1, z0,z1.
+// The bounding box corners are projected, the projection
+// of a box with positive depth is bounded by its corners.
+// Returns 0 if the sphere touches no cluster, clipped is set
+// if part of it is outside the clusters.
+static bool32
+clusterRange(LightClusters *lc, const Sphere *sph, int32 *r, bool32 *clipped)
+{
+	V3d corners[8], v[8];
+	float32 minu, maxu, minv, maxv, minz, maxz, u, w;
+	int32 i;
+
+	for(i = 0; i < 8; i++){
+		corners[i].x = sph->center.x + (i & 1 ? sph->radius : -sph->radius);
+		corners[i].y = sph->center.y + (i & 2 ? sph->radius : -sph->radius);
+		corners[i].z = sph->center.z + (i & 4 ? sph->radius : -sph->radius);
+	}
+	V3d::transformPoints(v, corners, 8, &lc->viewMatrix);
+	minz = maxz = v[0].z;
+	for(i = 1; i < 8; i++){
+		if(v[i].z < minz) minz = v[i].z;
+		if(v[i].z > maxz) maxz = v[i].z;
+	}
+	if(maxz < lc->nearPlane)
+		return 0;
+	r[4] = depthSlice(lc, minz);
+	r[5] = depthSlice(lc, maxz);
+	if(r[4] >= LightClusters::SLICES)
+		return 0;
+	*clipped = minz < lc->nearPlane;
+	if(r[5] >= LightClusters::SLICES){
+		r[5] = LightClusters::SLICES-1;
+		*clipped = 1;
+	}
+
+	if(lc->perspective && minz <= 0.0f){
+		// around the camera, covers the whole screen
+		r[0] = 0;
+		r[1] = LightClusters::TILESX-1;
+		r[2] = 0;
+		r[3] = LightClusters::TILESY-1;
+		*clipped = 1;
+		return 1;
+	}
+	minu = minv = 1.0e30f;
+	maxu = maxv = -1.0e30f;
+	for(i = 0; i < 8; i++){
+		w = lc->perspective ? 1.0f/v[i].z : 1.0f;
+		u = v[i].x*w;
+		if(u < minu) minu = u;
+		if(u > maxu) maxu = u;
+		u = v[i].y*w;
+		if(u < minv) minv = u;
+		if(u > maxv) maxv = u;
+	}
+	if(maxu < 0.0f || minu > 1.0f || maxv < 0.0f || minv > 1.0f)
+		return 0;
+	if(minu < 0.0f || maxu >= 1.0f || minv < 0.0f || maxv >= 1.0f)
+		*clipped = 1;
+	r[0] = minu < 0.0f ? 0 : (int32)(minu*LightClusters::TILESX);
+	r[1] = maxu >= 1.0f ? LightClusters::TILESX-1 : (int32)(maxu*LightClusters::TILESX);
+	r[2] = minv < 0.0f ? 0 : (int32)(minv*LightClusters::TILESY);
+	r[3] = maxv >= 1.0f ? LightClusters::TILESY-1 : (int32)(maxv*LightClusters::TILESY);
+	return 1;
+}
+
+#define CLUSTER(x, y, z) (((z)*LightClusters::TILESY + (y))*LightClusters::TILESX + (x))
+
+// Bin all local lights for this camera, called when it begins its update.
+void
+World::clusterLights(Camera *cam)
+{
+	LightClusters *lc = this->lightClusters;
+	int32 cursor[LightClusters::NUMCLUSTERS];
+	int32 i, n, x, y, z, c, *r;
+	bool32 clipped;
+	Sphere sph;
+
+	if(lc == nil){
+		lc = rwNewT(LightClusters, 1, MEMDUR_EVENT | ID_WORLD);
+		lc->lights = nil;
+		lc->numLights = 0;
+		lc->maxLights = 0;
+		lc->indices = nil;
+		lc->maxIndices = 0;
+		lc->ranges = nil;
+		lc->stamps = nil;
+		lc->found = nil;
+		lc->spheres = nil;
+		this->lightClusters = lc;
+	}
+	lc->camera = cam;
+	lc->viewMatrix = cam->viewMatrix;
+	lc->perspective = cam->projection == Camera::PERSPECTIVE;
+	lc->nearPlane = cam->nearPlane;
+	lc->sliceScale = LightClusters::SLICES/logf(cam->farPlane/cam->nearPlane);
+
+	n = 0;
+	FORLIST(lnk, this->localLights)
+		n++;
+	if(n > lc->maxLights){
+		lc->maxLights = n;
+		lc->lights = rwResizeT(Light*, lc->lights, n, MEMDUR_EVENT | ID_WORLD);
+		lc->ranges = rwResizeT(int32, lc->ranges, n*6, MEMDUR_EVENT | ID_WORLD);
+		lc->stamps = rwResizeT(uint32, lc->stamps, n, MEMDUR_EVENT | ID_WORLD);
+		lc->found = rwResizeT(int32, lc->found, n, MEMDUR_EVENT | ID_WORLD);
+		lc->spheres = rwResizeT(Sphere, lc->spheres, n, MEMDUR_EVENT | ID_WORLD);
+	}
+
+	// count lights per cluster
+	memset(lc->offsets, 0, sizeof(lc->offsets));
+	n = 0;
+	FORLIST(lnk, this->localLights){
+		Light *l = Light::fromWorld(lnk);
+		if((l->getFlags() & Light::LIGHTATOMICS) == 0 || l->getFrame() == nil)
+			continue;
+		sph.center = l->getFrame()->getLTM()->pos;
+		sph.radius = l->radius;
+		r = &lc->ranges[n*6];
+		if(!clusterRange(lc, &sph, r, &clipped))
+			continue;
+		for(z = r[4]; z <= r[5]; z++)
+			for(y = r[2]; y <= r[3]; y++)
+				for(x = r[0]; x <= r[1]; x++)
+					lc->offsets[CLUSTER(x, y, z)+1]++;
+		lc->lights[n] = l;
+		lc->spheres[n] = sph;
+		lc->stamps[n] = 0;
+		n++;
+	}
+	lc->numLights = n;
+	lc->stamp = 0;
+
+	for(c = 0; c < LightClusters::NUMCLUSTERS; c++){
+		lc->offsets[c+1] += lc->offsets[c];
+		cursor[c] = lc->offsets[c];
+	}
+	if(lc->offsets[LightClusters::NUMCLUSTERS] > lc->maxIndices){
+		lc->maxIndices = lc->offsets[LightClusters::NUMCLUSTERS];
+		lc->indices = rwResizeT(int32, lc->indices, lc->maxIndices, MEMDUR_EVENT | ID_WORLD);
+	}
+
+	// fill in light order so every cluster's list is sorted
+	for(i = 0; i < n; i++){
+		r = &lc->ranges[i*6];
+		for(z = r[4]; z <= r[5]; z++)
+			for(y = r[2]; y <= r[3]; y++)
+				for(x = r[0]; x <= r[1]; x++)
+					lc->indices[cursor[CLUSTER(x, y, z)]++] = i;
+	}
+}
+
+static int
+cmpIndex(const void *a, const void *b)
+{
+	return *(const int32*)a - *(const int32*)b;
+}
+
+// Lights from the clusters an atomic touches, in binning order
+// which is the order of World::localLights.
+// Returns 0 if the atomic is not completely inside the clusters,
+// lights outside of them could still reach it.
+static bool32
+lookupClusterLights(LightClusters *lc, Sphere *atomsphere, WorldLights *lightData, int32 maxLocals)
+{
+	int32 r[6];
+	int32 x, y, z, c, i, j, n;
+	bool32 clipped;
+	Sphere *ls;
+	V3d dist;
+	float32 rad;
+
+	if(!clusterRange(lc, atomsphere, r, &clipped) || clipped)
+		return 0;
+
+	if(++lc->stamp == 0){
+		for(i = 0; i < lc->numLights; i++)
+			lc->stamps[i] = 0;
+		lc->stamp = 1;
+	}
+	n = 0;
+	for(z = r[4]; z <= r[5]; z++)
+		for(y = r[2]; y <= r[3]; y++)
+			for(x = r[0]; x <= r[1]; x++){
+				c = CLUSTER(x, y, z);
+				for(j = lc->offsets[c]; j < lc->offsets[c+1]; j++){
+					i = lc->indices[j];
+					if(lc->stamps[i] == lc->stamp)
+						continue;
+					lc->stamps[i] = lc->stamp;
+					// check if spheres are intersecting
+					ls = &lc->spheres[i];
+					dist = sub(ls->center, atomsphere->center);
+					rad = atomsphere->radius + ls->radius;
+					if(dot(dist, dist) < rad*rad)
+						lc->found[n++] = i;
+				}
+			}
+	if(n > 1)
+		qsort(lc->found, n, sizeof(int32), cmpIndex);
+	for(i = 0; i < n && lightData->numLocals < maxLocals; i++)
+		lightData->locals[lightData->numLocals++] = lc->lights[lc->found[i]];
+	return 1;
+}
+
+#undef CLUSTER
+
+// Sectors are not visited in world order, keep the
+// maxLocals first lights of World::localLights like the clusters do.
+static void
+addLocalLight(WorldLights *lightData, Light *l, int32 maxLocals)
+{
+	int32 i;
+	Light **locals = lightData->locals;
+
+	i = lightData->numLocals;
+	if(i < maxLocals)
+		lightData->numLocals++;
+	else if(maxLocals == 0 || l->worldSerial > locals[i-1]->worldSerial)
+		return;
+	else
+		i--;	// drop the last one
+	for(; i > 0 && locals[i-1]->worldSerial > l->worldSerial; i--)
+		locals[i] = locals[i-1];
+	locals[i] = l;
 }
 
 // Find lights that illuminate an atomic
@@ -178,20 +709,38 @@ World::enumerateLights(Atomic *atomic, WorldLights *lightData)
 	if(!normals)
 		return;
 
-	// TODO: for this we would use an atomic's world sectors, but we don't have those yet
-	FORLIST(lnk, this->localLights){
-		if(lightData->numLocals >= maxLocals)
-			return;
+	Sphere *atomsphere = atomic->getWorldBoundingSphere();
 
-		Light *l = Light::fromWorld(lnk);
-		if((l->getFlags() & Light::LIGHTATOMICS) == 0)
+	// clusters of the current camera if we have them
+	LightClusters *lc = this->lightClusters;
+	if(lc && lc->camera && lc->camera == engine->currentCamera &&
+	   lookupClusterLights(lc, atomsphere, lightData, maxLocals))
+		return;
+
+	// only look at sectors whose loose bounds touch the atomic
+	this->updateSectors();
+	WorldSector *stack[MAXSECTORDEPTH*8 + 1];
+	int32 i, sp;
+	WorldSector *s;
+	sp = 0;
+	stack[sp++] = this->rootSector;
+	while(sp > 0){
+		s = stack[--sp];
+		if(s != this->rootSector && !sphereIntersectsBox(atomsphere, &s->looseBox))
 			continue;
+		FORLIST(lnk, s->lights){
+			Light *l = Light::fromSector(lnk);
+			if((l->getFlags() & Light::LIGHTATOMICS) == 0 || l->getFrame() == nil)
+				continue;
 
-		// check if spheres are intersecting
-		Sphere *atomsphere = atomic->getWorldBoundingSphere();
-		V3d dist = sub(l->getFrame()->getLTM()->pos, atomsphere->center);
-		if(length(dist) < atomsphere->radius + l->radius)
-			lightData->locals[lightData->numLocals++] = l;
+			// check if spheres are intersecting
+			V3d dist = sub(l->getFrame()->getLTM()->pos, atomsphere->center);
+			if(length(dist) < atomsphere->radius + l->radius)
+				addLocalLight(lightData, l, maxLocals);
+		}
+		for(i = 0; i < 8; i++)
+			if(s->children[i] && s->children[i]->numLights)
+				stack[sp++] = s->children[i];
 	}
 }
 
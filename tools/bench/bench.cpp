@@ -0,0 +1,741 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <chrono>
+
+#include <rw.h>
+
+using namespace std;
+using namespace rw;
+
+// Benchmarks for the hot paths that don't need a GPU.
+// All assets are generated, nothing is read from disk.
+
+struct Bench
+{
+	const char *name;
+	const char *unit;	// what work is counted in
+	int32 platform;		// for the platform specific ones
+	void (*setup)(void);
+	// does one iteration, returns the work done in units
+	double (*run)(void);
+	void (*cleanup)(void);
+};
+
+struct Result
+{
+	const char *name;
+	const char *unit;
+	int iterations;
+	double seconds;
+	double work;
+};
+
+static double minTime = 0.5;
+static int32 benchPlatform;
+
+static double
+now(void)
+{
+	using namespace std::chrono;
+	return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+//
+// Asset generators
+//
+
+enum {
+	GRIDSIZE = 48,		// quads per side
+	NUMATOMICS = 16,
+	NUMMATERIALS = 4,
+	NUMTEXTURES = 16,
+	TEXSIZE = 128,
+	NUMHIERNODES = 64,
+	NUMFRAMES = 4096
+};
+
+static Image*
+makeImage(int w, int h, int seed)
+{
+	Image *img = Image::create(w, h, 32);
+	img->allocate();
+	for(int y = 0; y < h; y++){
+		uint8 *p = img->pixels + y*img->stride;
+		for(int x = 0; x < w; x++){
+			p[0] = (x*4 + seed*16) & 0xFF;
+			p[1] = (y*4 + seed*32) & 0xFF;
+			p[2] = ((x^y) + seed*64) & 0xFF;
+			p[3] = ((x/8 + y/8) & 1) ? 0xFF : 0x80;
+			p += 4;
+		}
+	}
+	return img;
+}
+
+// Xbox rasters can't be made from images, copy the pixels in directly
+static Raster*
+makeRaster(Image *img, int32 platform)
+{
+	if(platform != PLATFORM_XBOX)
+		return Raster::createFromImage(img, platform);
+	Raster *ras = Raster::create(img->width, img->height, 32,
+		Raster::TEXTURE | Raster::C8888, PLATFORM_XBOX);
+	if(ras == nil)
+		return nil;
+	uint8 *pixels = ras->lock(0, Raster::LOCKWRITE|Raster::LOCKNOFETCH);
+	memcpy(pixels, img->pixels, img->width*img->height*4);
+	ras->unlock(0);
+	return ras;
+}
+
+static void
+texName(char *name, int i)
+{
+	sprintf(name, "benchtex%d", i);
+}
+
+static TexDictionary*
+makeTexDict(int32 platform)
+{
+	char name[32];
+	TexDictionary *txd = TexDictionary::create();
+	for(int i = 0; i < NUMTEXTURES; i++){
+		Image *img = makeImage(TEXSIZE, TEXSIZE, i);
+		Raster *ras = makeRaster(img, platform);
+		img->destroy();
+		if(ras == nil){
+			fprintf(stderr, "can't create raster for platform %d\n", platform);
+			exit(1);
+		}
+		Texture *tex = Texture::create(ras);
+		texName(name, i);
+		strncpy(tex->name, name, 32);
+		tex->setFilter(Texture::LINEAR);
+		txd->add(tex);
+	}
+	return txd;
+}
+
+// Grid with a bit of height so normals and bounds aren't trivial
+static Geometry*
+makeGeometry(int n, int seed, uint32 flags)
+{
+	char name[32];
+	int32 numVerts = (n+1)*(n+1);
+	int32 numTris = n*n*2;
+	Geometry *geo = Geometry::create(numVerts, numTris,
+		flags | Geometry::POSITIONS | Geometry::NORMALS | Geometry::TEXTURED |
+		Geometry::PRELIT | Geometry::LIGHT | Geometry::MODULATE);
+	MorphTarget *mt = &geo->morphTargets[0];
+	int32 i = 0;
+	for(int y = 0; y <= n; y++)
+		for(int x = 0; x <= n; x++){
+			float32 h = sinf(x*0.3f + seed)*cosf(y*0.2f);
+			mt->vertices[i].x = x - n/2.0f;
+			mt->vertices[i].y = y - n/2.0f;
+			mt->vertices[i].z = h;
+			mt->normals[i].x = 0.0f;
+			mt->normals[i].y = 0.0f;
+			mt->normals[i].z = 1.0f;
+			geo->texCoords[0][i].u = x/(float32)n;
+			geo->texCoords[0][i].v = y/(float32)n;
+			geo->colors[i].red = x*255/n;
+			geo->colors[i].green = y*255/n;
+			geo->colors[i].blue = 128;
+			geo->colors[i].alpha = 255;
+			i++;
+		}
+	for(i = 0; i < NUMMATERIALS; i++){
+		Material *mat = Material::create();
+		texName(name, (seed*NUMMATERIALS + i) % NUMTEXTURES);
+		// only found while a dictionary is current
+		Texture *tex = Texture::read(name, nil);
+		if(tex){
+			mat->setTexture(tex);
+			tex->destroy();
+		}
+		geo->matList.appendMaterial(mat);
+		mat->destroy();
+	}
+	Triangle *t = geo->triangles;
+	for(int y = 0; y < n; y++)
+		for(int x = 0; x < n; x++){
+			uint16 v = y*(n+1) + x;
+			uint16 m = (x*NUMMATERIALS/n) % NUMMATERIALS;
+			t->v[0] = v; t->v[1] = v+1; t->v[2] = v+n+1; t->matId = m; t++;
+			t->v[0] = v+1; t->v[1] = v+n+2; t->v[2] = v+n+1; t->matId = m; t++;
+		}
+	geo->calculateBoundingSphere();
+	geo->buildMeshes();
+	return geo;
+}
+
+static Clump*
+makeClump(void)
+{
+	Clump *clump = Clump::create();
+	Frame *root = Frame::create();
+	clump->setFrame(root);
+	for(int i = 0; i < NUMATOMICS; i++){
+		Frame *f = Frame::create();
+		V3d t = { (float32)i*GRIDSIZE, 0.0f, 0.0f };
+		f->translate(&t);
+		root->addChild(f);
+		Geometry *geo = makeGeometry(GRIDSIZE, i, (i & 1) ? Geometry::TRISTRIP : 0);
+		Atomic *a = Atomic::create();
+		a->setGeometry(geo, 0);
+		geo->destroy();
+		a->setFrame(f);
+		clump->addAtomic(a);
+	}
+	return clump;
+}
+
+struct MemFile
+{
+	uint8 *data;
+	uint32 size;
+};
+
+static void
+writeClump(MemFile *mf, Clump *clump)
+{
+	StreamMemory stream;
+	mf->size = clump->streamGetSize() + 12;
+	mf->data = rwNewT(uint8, mf->size, MEMDUR_GLOBAL);
+	stream.open(mf->data, 0, mf->size);
+	clump->streamWrite(&stream);
+	mf->size = stream.getLength();
+	stream.close();
+}
+
+static void
+writeTexDict(MemFile *mf, TexDictionary *txd)
+{
+	StreamMemory stream;
+	mf->size = txd->streamGetSize() + 12;
+	mf->data = rwNewT(uint8, mf->size, MEMDUR_GLOBAL);
+	stream.open(mf->data, 0, mf->size);
+	txd->streamWrite(&stream);
+	mf->size = stream.getLength();
+	stream.close();
+}
+
+//
+// Parsing
+//
+
+static TexDictionary *benchTxd;
+static MemFile clumpFile;
+static MemFile txdFile;
+
+static void
+setupClumpRead(void)
+{
+	benchTxd = makeTexDict(PLATFORM_D3D8);
+	TexDictionary::setCurrent(benchTxd);
+	Clump *clump = makeClump();
+	writeClump(&clumpFile, clump);
+	clump->destroy();
+}
+
+static double
+runClumpRead(void)
+{
+	StreamMemory stream;
+	stream.open(clumpFile.data, clumpFile.size);
+	if(!findChunk(&stream, ID_CLUMP, nil, nil)){
+		fprintf(stderr, "no clump\n");
+		exit(1);
+	}
+	Clump *clump = Clump::streamRead(&stream);
+	stream.close();
+	clump->destroy();
+	return clumpFile.size;
+}
+
+static void
+cleanupClumpRead(void)
+{
+	rwFree(clumpFile.data);
+	TexDictionary::setCurrent(nil);
+	benchTxd->destroy();
+}
+
+static void
+setupTxdRead(void)
+{
+	TexDictionary *txd = makeTexDict(benchPlatform);
+	writeTexDict(&txdFile, txd);
+	txd->destroy();
+}
+
+static double
+runTxdRead(void)
+{
+	StreamMemory stream;
+	stream.open(txdFile.data, txdFile.size);
+	if(!findChunk(&stream, ID_TEXDICTIONARY, nil, nil)){
+		fprintf(stderr, "no texture dictionary\n");
+		exit(1);
+	}
+	TexDictionary *txd = TexDictionary::streamRead(&stream);
+	stream.close();
+	txd->destroy();
+	return txdFile.size;
+}
+
+static void
+cleanupTxdRead(void)
+{
+	rwFree(txdFile.data);
+}
+
+//
+// Raster conversion
+//
+
+static Image *convImage;
+
+static void
+setupConvert(void)
+{
+	convImage = makeImage(256, 256, 1);
+}
+
+static double
+runConvert(void)
+{
+	Raster *ras = makeRaster(convImage, benchPlatform);
+	Image *img = ras->toImage();
+	img->destroy();
+	ras->destroy();
+	return convImage->width*convImage->height;
+}
+
+static void
+cleanupConvert(void)
+{
+	convImage->destroy();
+}
+
+//
+// Frame sync
+//
+
+static Clump *frameClump;
+static Frame *frames[NUMFRAMES];
+
+static void
+setupSync(void)
+{
+	frameClump = Clump::create();
+	frames[0] = Frame::create();
+	frameClump->setFrame(frames[0]);
+	// wide and fairly deep, every node has up to 4 children
+	for(int i = 1; i < NUMFRAMES; i++){
+		V3d t = { 1.0f, 0.5f, 0.25f };
+		frames[i] = Frame::create();
+		frames[i]->translate(&t);
+		frames[(i-1)/4]->addChild(frames[i]);
+	}
+	Frame::syncDirty();
+}
+
+static double
+runSync(void)
+{
+	static const V3d axis = { 0.0f, 0.0f, 1.0f };
+	// touch every 16th frame, whole subtrees have to be updated
+	for(int i = 1; i < NUMFRAMES; i += 16)
+		frames[i]->rotate(&axis, 1.0f);
+	Frame::syncDirty();
+	return NUMFRAMES;
+}
+
+static void
+cleanupSync(void)
+{
+	frameClump->destroy();
+}
+
+//
+// HAnim
+//
+
+static HAnimHierarchy *hier;
+static Animation *hierAnim;
+
+static void
+setupHAnim(void)
+{
+	int32 flags[NUMHIERNODES];
+	int32 ids[NUMHIERNODES];
+	int i, j;
+
+	// chains of 8 nodes branching off the root
+	for(i = 0; i < NUMHIERNODES; i++){
+		ids[i] = i;
+		flags[i] = 0;
+		if(i > 0 && i%8 == 0)
+			flags[i-1] |= HAnimHierarchy::POP;
+		if(i%8 == 0 && i+8 < NUMHIERNODES)
+			flags[i] |= HAnimHierarchy::PUSH;
+	}
+	flags[NUMHIERNODES-1] |= HAnimHierarchy::POP;
+	hier = HAnimHierarchy::create(NUMHIERNODES, flags, ids, HAnimHierarchy::LOCALSPACEMATRICES, 36);
+
+	// 4 keys per node
+	AnimInterpolatorInfo *info = AnimInterpolatorInfo::find(1);
+	hierAnim = Animation::create(info, NUMHIERNODES*4, 0, 3.0f);
+	HAnimKeyFrame *kf = (HAnimKeyFrame*)hierAnim->keyframes;
+	for(j = 0; j < 4; j++)
+		for(i = 0; i < NUMHIERNODES; i++){
+			float32 a = (i + j)*0.1f;
+			kf->prev = j == 0 ? nil : kf - NUMHIERNODES;
+			kf->time = (float32)j;
+			kf->q.x = sinf(a)*0.5f;
+			kf->q.y = 0.0f;
+			kf->q.z = 0.0f;
+			kf->q.w = cosf(a)*0.5f;
+			kf->q = normalize(kf->q);
+			kf->t.x = 0.0f;
+			kf->t.y = 1.0f;
+			kf->t.z = 0.0f;
+			kf++;
+		}
+	hier->interpolator->setCurrentAnim(hierAnim);
+}
+
+static double
+runHAnim(void)
+{
+	hier->interpolator->addTime(1/60.0f);
+	hier->updateMatrices();
+	return NUMHIERNODES;
+}
+
+static void
+cleanupHAnim(void)
+{
+	hier->destroy();
+	hierAnim->destroy();
+}
+
+//
+// Tristrips
+//
+
+static Geometry *stripGeo;
+
+static void
+setupTristrip(void)
+{
+	stripGeo = makeGeometry(GRIDSIZE, 0, Geometry::TRISTRIP);
+}
+
+static double
+runTristrip(void)
+{
+	stripGeo->buildMeshes();
+	return stripGeo->numTriangles;
+}
+
+static void
+cleanupTristrip(void)
+{
+	stripGeo->destroy();
+}
+
+//
+// Instancing
+//
+
+static Atomic *instAtomic;
+static int32 savedPlatform;
+
+static void
+setupInstance(void)
+{
+	Geometry *geo = makeGeometry(GRIDSIZE, 0, 0);
+	instAtomic = Atomic::create();
+	instAtomic->setGeometry(geo, 0);
+	instAtomic->setFrame(Frame::create());
+	geo->destroy();
+	savedPlatform = rw::platform;
+	rw::platform = benchPlatform;
+}
+
+static double
+runInstance(void)
+{
+	instAtomic->instance();
+	instAtomic->uninstance();
+	return instAtomic->geometry->numVertices;
+}
+
+static void
+cleanupInstance(void)
+{
+	Frame *f = instAtomic->getFrame();
+	instAtomic->destroy();
+	f->destroy();
+	rw::platform = savedPlatform;
+}
+
+#ifdef RW_SOFT
+//
+// Software rendering
+//
+
+enum {
+	RENDERWIDTH = 1920,
+	RENDERHEIGHT = 1080
+};
+
+static TexDictionary *renderTxd;
+static Clump *renderClump;
+static World *renderWorld;
+static Camera *renderCam;
+static Light *renderLights[2];
+
+// Close enough that the grid fills the screen with mid-sized triangles
+static void
+setupRender(void)
+{
+	renderTxd = makeTexDict(PLATFORM_SOFT);
+	TexDictionary::setCurrent(renderTxd);
+	renderClump = makeClump();
+	TexDictionary::setCurrent(nil);
+
+	renderWorld = World::create();
+	renderLights[0] = Light::create(Light::AMBIENT);
+	renderLights[0]->setColor(0.3f, 0.3f, 0.3f);
+	renderWorld->addLight(renderLights[0]);
+	renderLights[1] = Light::create(Light::DIRECTIONAL);
+	renderLights[1]->setFrame(Frame::create());
+	renderWorld->addLight(renderLights[1]);
+
+	renderCam = Camera::create();
+	renderCam->frameBuffer = Raster::create(RENDERWIDTH, RENDERHEIGHT, 0, Raster::CAMERA);
+	renderCam->zBuffer = Raster::create(RENDERWIDTH, RENDERHEIGHT, 0, Raster::ZBUFFER);
+	renderCam->setFrame(Frame::create());
+	V3d pos = { 0.0f, 0.0f, -40.0f };
+	renderCam->getFrame()->translate(&pos);
+	V2d vw = { 0.5f, 0.5f*RENDERHEIGHT/RENDERWIDTH };
+	renderCam->setViewWindow(&vw);
+	renderCam->setNearPlane(0.5f);
+	renderCam->setFarPlane(200.0f);
+	renderWorld->addCamera(renderCam);
+}
+
+static double
+runRender(void)
+{
+	static RGBA clearColor = { 64, 64, 64, 255 };
+	renderCam->clear(&clearColor, Camera::CLEARIMAGE|Camera::CLEARZ);
+	renderCam->beginUpdate();
+	renderClump->render();
+	renderCam->endUpdate();
+	return RENDERWIDTH*RENDERHEIGHT;
+}
+
+static void
+cleanupRender(void)
+{
+	Frame *f;
+	renderWorld->removeCamera(renderCam);
+	renderCam->frameBuffer->destroy();
+	renderCam->zBuffer->destroy();
+	f = renderCam->getFrame();
+	renderCam->destroy();
+	f->destroy();
+	renderWorld->removeLight(renderLights[0]);
+	renderWorld->removeLight(renderLights[1]);
+	f = renderLights[1]->getFrame();
+	renderLights[0]->destroy();
+	renderLights[1]->destroy();
+	f->destroy();
+	renderWorld->destroy();
+	renderClump->destroy();
+	renderTxd->destroy();
+}
+#endif
+
+static Bench benches[] = {
+	{ "clump_read", "bytes", PLATFORM_NULL, setupClumpRead, runClumpRead, cleanupClumpRead },
+	{ "txd_read_ps2", "bytes", PLATFORM_PS2, setupTxdRead, runTxdRead, cleanupTxdRead },
+	{ "txd_read_xbox", "bytes", PLATFORM_XBOX, setupTxdRead, runTxdRead, cleanupTxdRead },
+	{ "txd_read_d3d8", "bytes", PLATFORM_D3D8, setupTxdRead, runTxdRead, cleanupTxdRead },
+	{ "txd_read_d3d9", "bytes", PLATFORM_D3D9, setupTxdRead, runTxdRead, cleanupTxdRead },
+	{ "convert_ps2", "pixels", PLATFORM_PS2, setupConvert, runConvert, cleanupConvert },
+	{ "convert_xbox", "pixels", PLATFORM_XBOX, setupConvert, runConvert, cleanupConvert },
+	{ "convert_d3d8", "pixels", PLATFORM_D3D8, setupConvert, runConvert, cleanupConvert },
+	{ "convert_d3d9", "pixels", PLATFORM_D3D9, setupConvert, runConvert, cleanupConvert },
+	{ "frame_sync", "frames", PLATFORM_NULL, setupSync, runSync, cleanupSync },
+	{ "hanim_update", "nodes", PLATFORM_NULL, setupHAnim, runHAnim, cleanupHAnim },
+	{ "tristrip", "triangles", PLATFORM_NULL, setupTristrip, runTristrip, cleanupTristrip },
+	{ "instance_ps2", "vertices", PLATFORM_PS2, setupInstance, runInstance, cleanupInstance },
+	{ "instance_xbox", "vertices", PLATFORM_XBOX, setupInstance, runInstance, cleanupInstance },
+	{ "instance_d3d8", "vertices", PLATFORM_D3D8, setupInstance, runInstance, cleanupInstance },
+	{ "instance_d3d9", "vertices", PLATFORM_D3D9, setupInstance, runInstance, cleanupInstance },
+	{ "instance_wdgl", "vertices", PLATFORM_WDGL, setupInstance, runInstance, cleanupInstance },
+#ifdef RW_SOFT
+	{ "render_soft", "pixels", PLATFORM_SOFT, setupRender, runRender, cleanupRender },
+#endif
+};
+#define NUMBENCHES (int)(sizeof(benches)/sizeof(benches[0]))
+
+static void
+runBench(Bench *b, Result *r)
+{
+	double start, t;
+
+	benchPlatform = b->platform;
+	b->setup();
+	// one warm up
+	b->run();
+	r->name = b->name;
+	r->unit = b->unit;
+	r->iterations = 0;
+	r->work = 0.0;
+	start = now();
+	do{
+		r->work += b->run();
+		r->iterations++;
+		t = now() - start;
+	}while(t < minTime);
+	r->seconds = t;
+	b->cleanup();
+}
+
+static void
+writeJson(FILE *f, Result *results, int n)
+{
+	fprintf(f, "{\n\t\"benchmarks\": [\n");
+	for(int i = 0; i < n; i++){
+		Result *r = &results[i];
+		fprintf(f, "\t\t{ \"name\": \"%s\", \"iterations\": %d, \"seconds\": %g, "
+			"\"us_per_iteration\": %g, \"unit\": \"%s\", \"per_second\": %g }%s\n",
+			r->name, r->iterations, r->seconds,
+			r->seconds*1e6/r->iterations, r->unit, r->work/r->seconds,
+			i == n-1 ? "" : ",");
+	}
+	fprintf(f, "\t]\n}\n");
+}
+
+// The plugins the platform pipelines need
+static void
+pluginattach(void)
+{
+	rw::registerMeshPlugin();
+	rw::registerNativeDataPlugin();
+	rw::xbox::registerVertexFormatPlugin();
+	rw::registerSkinPlugin();
+	rw::registerHAnimPlugin();
+	rw::registerMatFXPlugin();
+	rw::ps2::registerADCPlugin();
+}
+
+static void
+usage(void)
+{
+#ifdef RW_SOFT
+	fprintf(stderr, "usage: librw_bench [-t seconds] [-o out.json] [-j threads] [-l] [name...]\n");
+#else
+	fprintf(stderr, "usage: librw_bench [-t seconds] [-o out.json] [-l] [name...]\n");
+#endif
+	fprintf(stderr, "\t-t: minimum time per benchmark, default 0.5\n");
+	fprintf(stderr, "\t-o: write results as json, - for stdout\n");
+#ifdef RW_SOFT
+	fprintf(stderr, "\t-j: rasteriser worker threads, default one per core\n");
+#endif
+	fprintf(stderr, "\t-l: list benchmarks\n");
+	fprintf(stderr, "\tnames select benchmarks whose name starts with them\n");
+	exit(1);
+}
+
+static bool
+selected(Bench *b, char **names, int numNames)
+{
+	if(numNames == 0)
+		return true;
+	for(int i = 0; i < numNames; i++)
+		if(strncmp(b->name, names[i], strlen(names[i])) == 0)
+			return true;
+	return false;
+}
+
+int
+main(int argc, char *argv[])
+{
+	const char *jsonPath = nil;
+	Result results[NUMBENCHES];
+	int numResults;
+	int i;
+#ifdef RW_SOFT
+	EngineOpenParams openParams;
+	openParams.numThreads = -1;
+#endif
+
+	for(i = 1; i < argc && argv[i][0] == '-' && argv[i][1]; i++){
+		if(strcmp(argv[i], "-t") == 0 && i+1 < argc)
+			minTime = atof(argv[++i]);
+		else if(strcmp(argv[i], "-o") == 0 && i+1 < argc)
+			jsonPath = argv[++i];
+#ifdef RW_SOFT
+		else if(strcmp(argv[i], "-j") == 0 && i+1 < argc)
+			openParams.numThreads = atoi(argv[++i]);
+#endif
+		else if(strcmp(argv[i], "-l") == 0){
+			for(int j = 0; j < NUMBENCHES; j++)
+				printf("%s\n", benches[j].name);
+			return 0;
+		}else
+			usage();
+	}
+
+	rw::Engine::init();
+	pluginattach();
+#ifdef RW_SOFT
+	rw::Engine::open(&openParams);
+#else
+	rw::Engine::open(nil);
+#endif
+	rw::Engine::start();
+	rw::Texture::setLoadTextures(false);
+
+	numResults = 0;
+	for(int j = 0; j < NUMBENCHES; j++){
+		Bench *b = &benches[j];
+		if(!selected(b, &argv[i], argc-i))
+			continue;
+		Result *r = &results[numResults++];
+		runBench(b, r);
+		printf("%-16s %10d iterations %12.2f us %14.0f %s/s\n",
+			r->name, r->iterations, r->seconds*1e6/r->iterations,
+			r->work/r->seconds, r->unit);
+		fflush(stdout);
+	}
+
+	if(jsonPath){
+		if(strcmp(jsonPath, "-") == 0)
+			writeJson(stdout, results, numResults);
+		else{
+			FILE *f = fopen(jsonPath, "w");
+			if(f == nil){
+				fprintf(stderr, "can't open %s\n", jsonPath);
+				return 1;
+			}
+			writeJson(f, results, numResults);
+			fclose(f);
+		}
+	}
+
+	rw::Engine::stop();
+	rw::Engine::close();
+	rw::Engine::term();
+	return 0;
+}